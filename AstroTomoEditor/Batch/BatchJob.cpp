@@ -0,0 +1,266 @@
+﻿#include "BatchJob.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+
+#include <vtkImageData.h>
+#include <vtkPolyData.h>
+#include <vtkSmartPointer.h>
+
+#include <Services/DicomSniffer.h>
+#include <Services/Save3DR.h>
+#include <Services/SeriesVolume.h>
+#include <Window/Render/ProgressiveMesh.h>
+#include <Window/Render/SparseLabelVolume.h>
+#include <Window/Render/VolumeStlExporter.h>
+
+#include <algorithm>
+
+namespace {
+    constexpr double kMB = 1024.0 * 1024.0;
+
+    QString resolveAgainst(const QString& base, const QString& path)
+    {
+        return QFileInfo(path).isAbsolute() ? path : QDir(base).absoluteFilePath(path);
+    }
+}
+
+bool BatchJob::load(const QString& path, BatchJob& out, QString* error)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) {
+        if (error) *error = QString("Cannot open job: %1").arg(path);
+        return false;
+    }
+
+    QJsonParseError pe{};
+    const QJsonDocument doc = QJsonDocument::fromJson(f.readAll(), &pe);
+    if (pe.error != QJsonParseError::NoError || !doc.isObject()) {
+        if (error) *error = QString("Job parse error: %1").arg(pe.errorString());
+        return false;
+    }
+    const QJsonObject root = doc.object();
+
+    BatchJob j;
+    const QJsonObject thr = root.value("threshold").toObject();
+    j.thresholdLo = std::clamp(thr.value("lo").toInt(j.thresholdLo), 0, 255);
+    j.thresholdHi = std::clamp(thr.value("hi").toInt(j.thresholdHi), 0, 255);
+
+    for (const auto& v : root.value("templates").toArray()) {
+        const QJsonObject o = v.toObject();
+        BatchTemplate t;
+        t.path = o.value("path").toString();
+        t.erase = o.value("mode").toString("erase") != "paint";
+        if (!t.path.isEmpty())
+            j.templates.push_back(t);
+    }
+
+    const QJsonObject stl = root.value("stl").toObject();
+    j.writeStl = stl.value("enabled").toBool(j.writeStl);
+    j.smoothIterations = std::max(0, stl.value("smoothIterations").toInt(j.smoothIterations));
+    j.smoothPassBand = std::clamp(stl.value("smoothPassBand").toDouble(j.smoothPassBand), 0.0, 1.0);
+    j.targetStlMB = std::max(0.0, stl.value("targetMB").toDouble(j.targetStlMB));
+
+    j.write3dr = root.value("write3dr").toBool(j.write3dr);
+    j.outputDir = root.value("outputDir").toString();
+    if (!j.outputDir.isEmpty())
+        j.outputDir = resolveAgainst(QFileInfo(path).absolutePath(), j.outputDir);
+
+    out = j;
+    return true;
+}
+
+QJsonObject StudyReport::toJson() const
+{
+    QJsonObject o;
+    o["input"] = input;
+    o["ok"] = ok;
+    if (!error.isEmpty()) o["error"] = error;
+    if (!output3dr.isEmpty()) o["output3dr"] = output3dr;
+    if (!outputStl.isEmpty()) o["outputStl"] = outputStl;
+    o["dims"] = QJsonArray{ dims[0], dims[1], dims[2] };
+    o["estimateMB"] = double(estimateBytes) / kMB;
+    o["triangles"] = double(triangles);
+    o["stlBytes"] = double(stlBytes);
+
+    QJsonObject ms;
+    ms["load"] = double(loadMs);
+    ms["templates"] = double(templatesMs);
+    ms["save3dr"] = double(save3drMs);
+    ms["mesh"] = double(meshMs);
+    ms["simplify"] = double(simplifyMs);
+    ms["saveStl"] = double(saveStlMs);
+    ms["total"] = double(totalMs);
+    o["ms"] = ms;
+    return o;
+}
+
+QVector<QString> Batch::CollectInputFiles(const QString& study)
+{
+    QVector<QString> files;
+    const QFileInfo fi(study);
+
+    if (fi.isFile()) {
+        if (fi.suffix().compare("3dr", Qt::CaseInsensitive) == 0 || DicomSniffer::looksLikeDicomFile(fi.absoluteFilePath()))
+            files.push_back(fi.absoluteFilePath());
+        return files;
+    }
+    if (!fi.isDir())
+        return files;
+
+    // порядок срезов восстанавливает vtkDICOMReader по IPP, здесь только отбор
+    const auto entries = QDir(study).entryInfoList(QDir::Files | QDir::NoDotAndDotDot, QDir::Name);
+    for (const QFileInfo& e : entries) {
+        if (DicomSniffer::isDicomdirName(e.fileName()))
+            continue;
+        if (DicomSniffer::looksLikeDicomFile(e.absoluteFilePath()))
+            files.push_back(e.absoluteFilePath());
+    }
+    return files;
+}
+
+qint64 Batch::EstimatePeakBytes(const QVector<QString>& files)
+{
+    qint64 input = 0;
+    for (const QString& f : files)
+        input += QFileInfo(f).size();
+
+    // 16-бит исходник (~размер файлов) + float-копия (x2) + U8-объём и маска (x0.5 + x0.5)
+    return input * 4;
+}
+
+StudyReport Batch::RunStudy(const QString& study, const BatchJob& job)
+{
+    StudyReport r;
+    r.input = study;
+
+    QElapsedTimer total; total.start();
+    QElapsedTimer t; t.start();
+    auto finish = [&](const QString& err) {
+        r.error = err;
+        r.ok = err.isEmpty();
+        r.totalMs = total.elapsed();
+        return r;
+        };
+
+    const QVector<QString> files = CollectInputFiles(study);
+    if (files.isEmpty())
+        return finish("No DICOM or 3DR input");
+    r.estimateBytes = EstimatePeakBytes(files);
+
+    // 1) серия -> U8
+    SeriesVolume::Result vol;
+    QString err;
+    if (!SeriesVolume::Load(files, vol, &err))
+        return finish(err);
+    vtkImageData* img = vol.volume;
+    img->GetDimensions(r.dims);
+    r.loadMs = t.restart();
+
+    const QFileInfo studyInfo(study);
+    const QString studyDir = studyInfo.isDir() ? studyInfo.absoluteFilePath() : studyInfo.absolutePath();
+    const QString baseName = studyInfo.isDir() ? QDir(studyDir).dirName() : studyInfo.completeBaseName();
+
+    // 2) шаблоны — как applyTemplateLayer в RenderView
+    for (const BatchTemplate& tpl : job.templates)
+    {
+        auto mask = vtkSmartPointer<vtkImageData>::New();
+        mask->CopyStructure(img);
+        mask->AllocateScalars(VTK_UNSIGNED_CHAR, 1);
+        if (!Save3DR::readmini3dr_into(resolveAgainst(studyDir, tpl.path), mask, &err))
+            return finish(QString("Template %1: %2").arg(tpl.path, err));
+
+        SparseLabelVolume layer;
+        if (!layer.encode(mask))
+            return finish(QString("Template %1: encode failed").arg(tpl.path));
+        mask = nullptr;
+
+        if (tpl.erase)
+            layer.eraseFrom(img);
+        else
+            layer.paintInto(img);
+    }
+    img->Modified();
+    r.templatesMs = t.restart();
+
+    // геометрия для STL — как в RenderView::setVolume
+    DicomInfo& di = vol.dicom;
+    double origin[3]; img->GetOrigin(origin);
+    double vb[6]; img->GetBounds(vb);
+    di.VolumeOriginX = origin[0];
+    di.VolumeOriginY = origin[1];
+    di.VolumeOriginZ = origin[2];
+    di.VolumeCenterX = (vb[1] - vb[0]) / 2;
+    di.VolumeCenterY = (vb[3] - vb[2]) / 2;
+    di.VolumeCenterZ = (vb[5] - vb[4]) / 2;
+
+    const QString outDir = job.outputDir.isEmpty() ? studyDir : job.outputDir;
+    if (!QDir().mkpath(outDir))
+        return finish(QString("Cannot create output folder: %1").arg(outDir));
+
+    // в общей папке одноимённые серии разных пациентов не должны перезаписать друг друга:
+    // к имени добавляется хеш полного пути входа (стабилен между прогонами)
+    QString outName = baseName;
+    if (!job.outputDir.isEmpty())
+        outName += "-" + QString::fromLatin1(QCryptographicHash::hash(
+            studyInfo.absoluteFilePath().toUtf8(), QCryptographicHash::Sha1).toHex().left(8));
+
+    // 3) .3dr
+    if (job.write3dr)
+    {
+        r.output3dr = QDir(outDir).filePath(outName + "_batch.3dr");
+        if (!Save3DR::write(r.output3dr, img, &di, &err))
+            return finish(QString("3DR: %1").arg(err));
+        r.save3drMs = t.restart();
+    }
+
+    // 4) STL по порогу
+    if (job.writeStl)
+    {
+        vtkSmartPointer<vtkPolyData> mesh;
+        {
+            auto mask = vtkSmartPointer<vtkImageData>::New();
+            if (!VolumeStlExporter::BuildBinaryMask(img, job.thresholdLo, job.thresholdHi, mask))
+                return finish("STL: mask failed");
+            mesh = VolumeStlExporter::BuildFromBinaryVoxelsNew(mask, VisibleExportOptions{});
+        }
+        if (!mesh || mesh->GetNumberOfCells() == 0)
+            return finish("STL: empty surface for the threshold");
+        r.meshMs = t.restart();
+
+        const auto targetBytes = static_cast<std::int64_t>(job.targetStlMB * kMB);
+        if (targetBytes > 0 &&
+            static_cast<std::int64_t>(VolumeStlExporter::estimateBinaryStlBytesFast(mesh)) > targetBytes)
+        {
+            auto pm = VolumeStlExporter::BuildProgressiveMesh(mesh, job.smoothIterations, job.smoothPassBand);
+            auto simplified = pm ? VolumeStlExporter::SimplifyToTargetBytes(*pm, targetBytes, job.smoothIterations, job.smoothPassBand)
+                                 : nullptr;
+            if (!simplified || simplified->GetNumberOfCells() == 0)
+                return finish("STL: simplify failed");
+            mesh = simplified;
+            r.simplifyMs = t.restart();
+        }
+        else if (job.smoothIterations > 0)
+        {
+            // без упрощения сглаживание иначе нигде не применится: тот же проход, что у экспорта из редактора
+            mesh = VolumeStlExporter::SmoothSurface(mesh, job.smoothIterations, job.smoothPassBand);
+            r.meshMs += t.restart();
+        }
+
+        r.outputStl = QDir(outDir).filePath(outName + "_batch.stl");
+        if (!VolumeStlExporter::SaveStlMyBinary_NoCenter(mesh, r.outputStl,
+            di.VolumeOriginX, di.VolumeOriginY, di.VolumeOriginZ,
+            di.VolumeCenterX, di.VolumeCenterY, di.VolumeCenterZ, true))
+            return finish("STL: save failed");
+        r.saveStlMs = t.restart();
+        r.triangles = mesh->GetNumberOfCells();
+        r.stlBytes = QFileInfo(r.outputStl).size();
+    }
+
+    return finish(QString());
+}
@@ -0,0 +1,65 @@
+﻿#pragma once
+#include <QJsonObject>
+#include <QString>
+#include <QVector>
+
+// Пакетное задание (JSON) и прогон одного исследования без GUI:
+// серия -> U8-объём -> шаблоны -> .3dr и/или STL по порогу.
+struct BatchTemplate
+{
+    QString path;        // mini3dr-маска; относительный путь — от папки исследования
+    bool erase = true;   // true — стереть помеченные воксели, false — дорисовать
+};
+
+struct BatchJob
+{
+    // видимый диапазон в шкале U8, как маска гистограммы в RenderView
+    int thresholdLo = 0;
+    int thresholdHi = 255;
+    QVector<BatchTemplate> templates;
+
+    int smoothIterations = 16;
+    double smoothPassBand = 0.12;
+    double targetStlMB = 0.0;    // 0 — без упрощения
+
+    bool write3dr = true;
+    bool writeStl = true;
+    QString outputDir;           // пусто — рядом с исследованием
+
+    static bool load(const QString& path, BatchJob& out, QString* error = nullptr);
+};
+
+struct StudyReport
+{
+    QString input;
+    QString output3dr;
+    QString outputStl;
+    bool ok = false;
+    QString error;
+
+    qint64 estimateBytes = 0;
+    int dims[3]{};
+    qint64 triangles = 0;
+    qint64 stlBytes = 0;
+
+    // этапы, мс
+    qint64 loadMs = 0;
+    qint64 templatesMs = 0;
+    qint64 save3drMs = 0;
+    qint64 meshMs = 0;
+    qint64 simplifyMs = 0;
+    qint64 saveStlMs = 0;
+    qint64 totalMs = 0;
+
+    QJsonObject toJson() const;
+};
+
+namespace Batch
+{
+    // Один .3dr или DICOM-файлы папки (одна серия на папку).
+    QVector<QString> CollectInputFiles(const QString& study);
+    // Пик памяти прогона по размеру входа: исходник + float-копия + U8 + маска.
+    qint64 EstimatePeakBytes(const QVector<QString>& files);
+
+    StudyReport RunStudy(const QString& study, const BatchJob& job);
+}
@@ -0,0 +1,102 @@
+﻿#include "BatchRunner.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFuture>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+#include <condition_variable>
+#include <mutex>
+#include <algorithm>
+#include <cstdio>
+
+BatchRunner::BatchRunner(const BatchJob& job, int maxParallel, qint64 memoryCapBytes)
+    : mJob(job)
+    , mMaxParallel(std::max(1, maxParallel))
+    , mMemoryCap(std::max<qint64>(0, memoryCapBytes))
+{
+}
+
+QVector<StudyReport> BatchRunner::run(const QStringList& studies)
+{
+    QVector<StudyReport> reports(studies.size());
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(mMaxParallel);
+
+    std::mutex m;
+    std::condition_variable cv;
+    qint64 reserved = 0;
+    int running = 0;
+
+    QVector<QFuture<void>> futures;
+    futures.reserve(studies.size());
+
+    for (int i = 0; i < studies.size(); ++i)
+    {
+        const QString study = studies[i];
+        const qint64 need = Batch::EstimatePeakBytes(Batch::CollectInputFiles(study));
+
+        {
+            // ждём слот и память; при пустом конвейере берём даже то, что больше лимита
+            std::unique_lock<std::mutex> lk(m);
+            cv.wait(lk, [&] {
+                if (running >= mMaxParallel) return false;
+                return running == 0 || mMemoryCap <= 0 || reserved + need <= mMemoryCap;
+                });
+            reserved += need;
+            ++running;
+        }
+
+        std::fprintf(stdout, "[%d/%d] start %s\n", i + 1, int(studies.size()), qPrintable(study));
+        std::fflush(stdout);
+
+        futures.push_back(QtConcurrent::run(&pool, [&, i, study, need] {
+            reports[i] = Batch::RunStudy(study, mJob);
+
+            const StudyReport& r = reports[i];
+            {
+                std::lock_guard<std::mutex> lk(m);
+                if (r.ok)
+                    std::fprintf(stdout, "[%d] done  %s  %.1f s\n", i + 1, qPrintable(study), r.totalMs / 1000.0);
+                else
+                    std::fprintf(stdout, "[%d] FAIL  %s: %s\n", i + 1, qPrintable(study), qPrintable(r.error));
+                std::fflush(stdout);
+
+                reserved -= need;
+                --running;
+            }
+            cv.notify_all();
+            }));
+    }
+
+    for (auto& f : futures)
+        f.waitForFinished();
+    return reports;
+}
+
+bool BatchRunner::writeReport(const QString& path, const QVector<StudyReport>& reports, qint64 wallMs, QString* error)
+{
+    QJsonArray arr;
+    int failed = 0;
+    for (const StudyReport& r : reports) {
+        arr.push_back(r.toJson());
+        if (!r.ok) ++failed;
+    }
+
+    QJsonObject root;
+    root["studies"] = arr;
+    root["failed"] = failed;
+    root["wallMs"] = double(wallMs);
+
+    QFile f(path);
+    if (!f.open(QIODevice::WriteOnly)) {
+        if (error) *error = QString("Cannot open report: %1").arg(path);
+        return false;
+    }
+    f.write(QJsonDocument(root).toJson(QJsonDocument::Indented));
+    return true;
+}
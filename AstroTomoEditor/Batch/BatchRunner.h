@@ -0,0 +1,23 @@
+﻿#pragma once
+#include "BatchJob.h"
+
+#include <QStringList>
+
+// Параллельный прогон исследований под общим лимитом памяти.
+// Исследование стартует, только если его оценка (Batch::EstimatePeakBytes) влезает
+// в остаток лимита; не влезающее даже в пустой лимит идёт в одиночку.
+class BatchRunner
+{
+public:
+    BatchRunner(const BatchJob& job, int maxParallel, qint64 memoryCapBytes);
+
+    // Отчёты в порядке studies.
+    QVector<StudyReport> run(const QStringList& studies);
+
+    static bool writeReport(const QString& path, const QVector<StudyReport>& reports, qint64 wallMs, QString* error = nullptr);
+
+private:
+    BatchJob mJob;
+    int      mMaxParallel = 1;
+    qint64   mMemoryCap = 0;
+};
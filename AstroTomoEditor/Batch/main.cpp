@@ -0,0 +1,75 @@
+﻿#include "BatchJob.h"
+#include "BatchRunner.h"
+
+#include <Services/Trace.h>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QThread>
+
+#include <vtkOutputWindow.h>
+
+#include <algorithm>
+#include <cstdio>
+
+// AstroTomoBatch: пакетный прогон без виджетов и OpenGL.
+//   AstroTomoBatch --job job.json [--jobs N] [--mem-mb M] [--report report.json] [--trace trace.json] <study>...
+// study — папка одной DICOM-серии или файл .3dr.
+int main(int argc, char* argv[])
+{
+    QCoreApplication::setOrganizationName("Astrocard");
+    QCoreApplication::setApplicationName("AstroTomoBatch");
+    vtkOutputWindow::SetGlobalWarningDisplay(false);
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser p;
+    p.setApplicationDescription("Series -> 3DR/STL without GUI");
+    p.addHelpOption();
+    QCommandLineOption optJob("job", "Job description (JSON).", "file");
+    QCommandLineOption optJobs("jobs", "Studies processed in parallel.", "n",
+        QString::number(std::max(1, QThread::idealThreadCount() / 4)));
+    QCommandLineOption optMem("mem-mb", "Memory cap for concurrently running studies, MB (0 = no cap).", "mb", "0");
+    QCommandLineOption optReport("report", "Timing report (JSON).", "file", "batch-report.json");
+    QCommandLineOption optTrace("trace", "Chrome trace of hot paths (JSON).", "file");
+    p.addOption(optJob);
+    p.addOption(optJobs);
+    p.addOption(optMem);
+    p.addOption(optReport);
+    p.addOption(optTrace);
+    p.addPositionalArgument("studies", "Series folders or .3dr files.", "<study>...");
+    p.process(app);
+
+    const QStringList studies = p.positionalArguments();
+    if (!p.isSet(optJob) || studies.isEmpty()) {
+        std::fprintf(stderr, "%s\n", qPrintable(p.helpText()));
+        return 2;
+    }
+
+    BatchJob job;
+    QString err;
+    if (!BatchJob::load(p.value(optJob), job, &err)) {
+        std::fprintf(stderr, "%s\n", qPrintable(err));
+        return 2;
+    }
+
+    const qint64 capBytes = p.value(optMem).toLongLong() * 1024 * 1024;
+    BatchRunner runner(job, p.value(optJobs).toInt(), capBytes);
+
+    QElapsedTimer wall; wall.start();
+    const QVector<StudyReport> reports = runner.run(studies);
+    const qint64 wallMs = wall.elapsed();
+
+    if (!BatchRunner::writeReport(p.value(optReport), reports, wallMs, &err))
+        std::fprintf(stderr, "%s\n", qPrintable(err));
+
+    if (p.isSet(optTrace) && !Trace::WriteChromeJson(p.value(optTrace), &err))
+        std::fprintf(stderr, "%s\n", qPrintable(err));
+
+    int failed = 0;
+    for (const StudyReport& r : reports)
+        if (!r.ok) ++failed;
+
+    std::fprintf(stdout, "%d studies, %d failed, %.1f s\n", int(reports.size()), failed, wallMs / 1000.0);
+    return failed ? 1 : 0;
+}
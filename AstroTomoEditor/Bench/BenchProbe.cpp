@@ -0,0 +1,85 @@
+﻿#include "BenchProbe.h"
+
+#include <vtkImageData.h>
+
+#include <chrono>
+#include <cstdio>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <unistd.h>
+#endif
+
+size_t BenchProbe::CurrentRss()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc{};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return size_t(pmc.WorkingSetSize);
+    return 0;
+#else
+    long pages = 0, resident = 0;
+    FILE* f = std::fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    const int got = std::fscanf(f, "%ld %ld", &pages, &resident);
+    std::fclose(f);
+    return got == 2 ? size_t(resident) * size_t(sysconf(_SC_PAGESIZE)) : 0;
+#endif
+}
+
+uint64_t BenchProbe::Checksum(vtkImageData* img)
+{
+    uint64_t h = 14695981039346656037ULL;
+    if (!img || img->GetScalarType() != VTK_UNSIGNED_CHAR) return h;
+
+    int dims[3]{ 0,0,0 };
+    img->GetDimensions(dims);
+    const size_t n = size_t(dims[0]) * dims[1] * dims[2];
+    const auto* p = static_cast<const uint8_t*>(img->GetScalarPointer());
+    if (!p) return h;
+
+    for (size_t i = 0; i < n; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+BenchProbe::PeakRss::PeakRss()
+{
+    mBase = CurrentRss();
+    mPeak.store(mBase, std::memory_order_relaxed);
+    mThread = std::thread([this]
+        {
+            while (!mStop.load(std::memory_order_relaxed)) {
+                sample();
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            }
+        });
+}
+
+BenchProbe::PeakRss::~PeakRss()
+{
+    stop();
+}
+
+size_t BenchProbe::PeakRss::stop()
+{
+    mStop.store(true, std::memory_order_relaxed);
+    if (mThread.joinable()) {
+        mThread.join();
+        sample();
+    }
+    return peak();
+}
+
+void BenchProbe::PeakRss::sample()
+{
+    const size_t cur = CurrentRss();
+    size_t prev = mPeak.load(std::memory_order_relaxed);
+    while (cur > prev && !mPeak.compare_exchange_weak(prev, cur, std::memory_order_relaxed)) {}
+}
@@ -0,0 +1,39 @@
+﻿#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+class vtkImageData;
+
+namespace BenchProbe
+{
+    // Текущий рабочий набор процесса, байт (0 — если платформа не даёт).
+    size_t CurrentRss();
+
+    // FNV-1a 64 по скалярам U8: сверка результатов между прогонами/сборками.
+    uint64_t Checksum(vtkImageData* img);
+
+    // Пиковый RSS за время жизни: фоновый опрос раз в несколько мс.
+    class PeakRss
+    {
+    public:
+        PeakRss();
+        ~PeakRss();
+        PeakRss(const PeakRss&) = delete;
+        PeakRss& operator=(const PeakRss&) = delete;
+
+        // останавливает опрос (с последним замером) и возвращает пик
+        size_t stop();
+        size_t peak() const { return mPeak.load(std::memory_order_relaxed); }
+        size_t base() const { return mBase; }
+
+    private:
+        void sample();
+
+        size_t mBase = 0;
+        std::atomic<size_t> mPeak{ 0 };
+        std::atomic<bool> mStop{ false };
+        std::thread mThread;
+    };
+}
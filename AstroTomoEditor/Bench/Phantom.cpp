@@ -0,0 +1,187 @@
+﻿#include "Phantom.h"
+
+#include <vtkImageData.h>
+#include <vtkSMPTools.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+    // Целочисленный хеш вместо <random>: распределения std не побайтно переносимы.
+    inline uint32_t hash32(uint32_t x)
+    {
+        x ^= x >> 16; x *= 0x7feb352dU;
+        x ^= x >> 15; x *= 0x846ca68bU;
+        x ^= x >> 16;
+        return x;
+    }
+
+    inline double unit(uint32_t seed, uint32_t i)   // [0..1)
+    {
+        return double(hash32(seed * 0x9E3779B9U + i) >> 8) / double(1u << 24);
+    }
+
+    struct Vec3 { double x, y, z; };
+
+    // Растеризация фигуры в её bbox (нормированные координаты [-1..1]).
+    class Raster
+    {
+    public:
+        Raster(uint8_t* data, int n) : mData(data), mN(n) {}
+
+        template <class Inside>
+        void paint(Vec3 lo, Vec3 hi, uint8_t value, Inside&& inside)
+        {
+            int a[3], b[3];
+            toIndex(lo, a, false);
+            toIndex(hi, b, true);
+            if (a[0] > b[0] || a[1] > b[1] || a[2] > b[2]) return;
+
+            const size_t n = size_t(mN);
+            vtkSMPTools::For(a[2], b[2] + 1, [&](int k0, int k1)
+                {
+                    for (int k = k0; k < k1; ++k)
+                        for (int j = a[1]; j <= b[1]; ++j)
+                        {
+                            uint8_t* row = mData + (size_t(k) * n + size_t(j)) * n;
+                            for (int i = a[0]; i <= b[0]; ++i)
+                                if (inside(Vec3{ coord(i), coord(j), coord(k) }))
+                                    row[i] = value;
+                        }
+                });
+        }
+
+        double coord(int i) const { return (i + 0.5) * 2.0 / mN - 1.0; }
+        // радиус не тоньше вокселя, иначе на малых n фигура пропадает
+        double atLeastVoxel(double r) const { return std::max(r, 1.0 / mN); }
+
+    private:
+        void toIndex(Vec3 p, int out[3], bool up) const
+        {
+            const double c[3]{ p.x, p.y, p.z };
+            for (int d = 0; d < 3; ++d) {
+                const double f = (c[d] + 1.0) * 0.5 * mN - 0.5;
+                out[d] = std::clamp(int(up ? std::ceil(f) : std::floor(f)), 0, mN - 1);
+            }
+        }
+
+        uint8_t* mData;
+        int mN;
+    };
+
+    void ellipsoid(Raster& R, Vec3 c, Vec3 r, uint8_t value)
+    {
+        R.paint({ c.x - r.x, c.y - r.y, c.z - r.z }, { c.x + r.x, c.y + r.y, c.z + r.z }, value,
+            [&](Vec3 p) {
+                const double dx = (p.x - c.x) / r.x, dy = (p.y - c.y) / r.y, dz = (p.z - c.z) / r.z;
+                return dx * dx + dy * dy + dz * dz <= 1.0;
+            });
+    }
+
+    void sphere(Raster& R, Vec3 c, double r, uint8_t value)
+    {
+        r = R.atLeastVoxel(r);
+        ellipsoid(R, c, { r, r, r }, value);
+    }
+
+    void capsule(Raster& R, Vec3 a, Vec3 b, double r, uint8_t value)
+    {
+        r = R.atLeastVoxel(r);
+        const Vec3 ab{ b.x - a.x, b.y - a.y, b.z - a.z };
+        const double len2 = std::max(1e-12, ab.x * ab.x + ab.y * ab.y + ab.z * ab.z);
+        R.paint({ std::min(a.x, b.x) - r, std::min(a.y, b.y) - r, std::min(a.z, b.z) - r },
+                { std::max(a.x, b.x) + r, std::max(a.y, b.y) + r, std::max(a.z, b.z) + r }, value,
+            [&](Vec3 p) {
+                const double t = std::clamp(((p.x - a.x) * ab.x + (p.y - a.y) * ab.y + (p.z - a.z) * ab.z) / len2, 0.0, 1.0);
+                const double dx = p.x - (a.x + t * ab.x), dy = p.y - (a.y + t * ab.y), dz = p.z - (a.z + t * ab.z);
+                return dx * dx + dy * dy + dz * dz <= r * r;
+            });
+    }
+
+    // Камера: стенка (внешний эллипсоид) и кровь внутри
+    void chamber(Raster& R, Vec3 c, Vec3 r, double wall)
+    {
+        ellipsoid(R, c, r, Phantom::kWall);
+        wall = R.atLeastVoxel(wall);
+        ellipsoid(R, c, { r.x - wall, r.y - wall, r.z - wall }, Phantom::kBlood);
+    }
+
+    const Vec3 kLvCenter{ 0.15, -0.05, 0.0 };
+}
+
+void Phantom::LeftVentricleSeed(int n, int ijk[3])
+{
+    const double c[3]{ kLvCenter.x, kLvCenter.y, kLvCenter.z };
+    for (int d = 0; d < 3; ++d)
+        ijk[d] = std::clamp(int(std::floor((c[d] + 1.0) * 0.5 * n)), 0, n - 1);
+}
+
+vtkSmartPointer<vtkImageData> Phantom::MakeCardiac(int n, uint32_t seed)
+{
+    if (n < 16) return nullptr;
+
+    auto img = vtkSmartPointer<vtkImageData>::New();
+    img->SetDimensions(n, n, n);
+    img->SetSpacing(1.0, 1.0, 1.0);
+    img->SetOrigin(0.0, 0.0, 0.0);
+    img->AllocateScalars(VTK_UNSIGNED_CHAR, 1);
+
+    auto* data = static_cast<uint8_t*>(img->GetScalarPointer());
+    const size_t total = size_t(n) * n * n;
+    std::memset(data, 0, total);
+
+    Raster R(data, n);
+
+    // тело и позвоночник
+    ellipsoid(R, { 0, 0, 0 }, { 0.9, 0.7, 0.95 }, kBody);
+    capsule(R, { 0.0, 0.5, -0.9 }, { 0.0, 0.5, 0.9 }, 0.08, kBone);
+
+    // камеры: ЛЖ, ПЖ, ЛП, ПП
+    chamber(R, kLvCenter, { 0.22, 0.18, 0.30 }, 0.05);
+    chamber(R, { -0.15, 0.00, 0.05 }, { 0.20, 0.16, 0.26 }, 0.03);
+    chamber(R, { 0.12, 0.12, 0.30 }, { 0.14, 0.12, 0.12 }, 0.025);
+    chamber(R, { -0.14, 0.10, 0.28 }, { 0.14, 0.12, 0.13 }, 0.025);
+
+    // аорта: дуга из ЛЖ вверх и назад к позвоночнику, с лёгким «дрожанием» по seed
+    {
+        constexpr int K = 24;
+        Vec3 prev{ 0.08, -0.02, 0.22 };
+        for (int s = 1; s <= K; ++s) {
+            const double t = double(s) / K;
+            const double a = t * 3.14159265358979;
+            const double jitter = 0.01 * (unit(seed, 1000 + s) - 0.5);
+            const Vec3 cur{ 0.08 - 0.12 * t + jitter, -0.02 + 0.42 * std::sin(a * 0.5), 0.22 + 0.35 * std::sin(a) - 0.6 * t * t };
+            capsule(R, prev, cur, 0.045 - 0.015 * t, kBlood);
+            prev = cur;
+        }
+    }
+
+    // электрод: цепочка бусин из ПП в ПЖ
+    for (int b = 0; b < 12; ++b) {
+        const double t = b / 11.0;
+        sphere(R, { -0.14 + 0.02 * t, 0.10 - 0.12 * t, 0.40 - 0.45 * t }, 0.012, kMetal);
+    }
+
+    // «островки» — оторванные видимые кусочки внутри тела
+    for (uint32_t s = 0; s < 48; ++s) {
+        const Vec3 c{ 1.4 * (unit(seed, 3 * s) - 0.5), 1.0 * (unit(seed, 3 * s + 1) - 0.5), 1.6 * (unit(seed, 3 * s + 2) - 0.5) };
+        sphere(R, c, 0.008 + 0.012 * unit(seed, 500 + s), kIsland);
+    }
+
+    // шум ±8 на всём, кроме пустоты и металла
+    vtkSMPTools::For(vtkIdType(0), vtkIdType(total), [&](vtkIdType first, vtkIdType last)
+        {
+            for (vtkIdType id = first; id < last; ++id) {
+                const uint8_t v = data[id];
+                if (v == 0 || v == kMetal) continue;
+                const int noisy = int(v) + int(hash32(uint32_t(id) ^ (seed * 0x85EBCA6BU)) % 17u) - 8;
+                data[id] = uint8_t(std::clamp(noisy, 1, int(kMetal) - 1));
+            }
+        });
+
+    img->Modified();
+    return img;
+}
@@ -0,0 +1,26 @@
+﻿#pragma once
+#include <cstdint>
+#include <vtkSmartPointer.h>
+
+class vtkImageData;
+
+// Детерминированный синтетический «кардио» объём U8 n^3 (spacing 1, origin 0):
+// тело, позвоночник, четыре камеры (стенка + кровь), изогнутая аорта, цепочка
+// металлических бусин-электродов, оторванные «островки» и шум. Один и тот же
+// (n, seed) даёт побайтно один и тот же объём на любой платформе.
+namespace Phantom
+{
+    // Значения в шкале гистограммы: тело ниже порога видимости, остальное выше.
+    constexpr uint8_t kBody = 45;
+    constexpr uint8_t kWall = 110;
+    constexpr uint8_t kIsland = 120;
+    constexpr uint8_t kBlood = 160;
+    constexpr uint8_t kBone = 200;
+    constexpr uint8_t kMetal = 254;
+    constexpr uint8_t kVisibleLo = 60;
+
+    vtkSmartPointer<vtkImageData> MakeCardiac(int n, uint32_t seed);
+
+    // Воксель внутри кровяного пула ЛЖ — «клик» для инструментов.
+    void LeftVentricleSeed(int n, int ijk[3]);
+}
@@ -0,0 +1,261 @@
+﻿#include "BenchProbe.h"
+#include "Phantom.h"
+
+#include <Window/Render/Tools.h>
+#include <Window/Render/ToolsRemoveConnected.h>
+#include <Window/Render/TransferFunction.h>
+#include <Window/Render/VolumeRenderBackend.h>
+
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QWidget>
+
+#include <vtkAutoInit.h>
+#include <vtkImageData.h>
+#include <vtkOutputWindow.h>
+#include <vtkVolumeProperty.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <utility>
+#include <vector>
+
+VTK_MODULE_INIT(vtkRenderingOpenGL2);
+VTK_MODULE_INIT(vtkRenderingVolumeOpenGL2);
+
+// AstroTomoBench: время, пиковая память и контрольная сумма каждой операции
+// ToolsRemoveConnected на синтетических кардио-фантомах; с --render — ещё и
+// время кадра объёмного рендера выбранными бэкендами (offscreen).
+//   AstroTomoBench [--sizes 128,256,512] [--ops RemoveConnected,...] [--repeat N]
+//                  [--seed S] [--json out.json] [--baseline prev.json]
+//                  [--render gpu,cpu] [--frames N]
+// С --baseline расхождение контрольных сумм — код возврата 1.
+namespace {
+
+    const std::vector<std::pair<const char*, Action>>& allOps()
+    {
+        static const std::vector<std::pair<const char*, Action>> ops{
+            { "RemoveUnconnected", Action::RemoveUnconnected },
+            { "RemoveConnected",   Action::RemoveConnected },
+            { "SmartDeleting",     Action::SmartDeleting },
+            { "RemoveSelected",    Action::RemoveSelected },
+            { "VoxelEraser",       Action::VoxelEraser },
+            { "VoxelRecovery",     Action::VoxelRecovery },
+            { "AddBase",           Action::AddBase },
+            { "FillEmpty",         Action::FillEmpty },
+            { "TotalSmoothing",    Action::TotalSmoothing },
+            { "SurfaceMapping",    Action::SurfaceMapping },
+            { "PeelRecovery",      Action::PeelRecovery },
+            { "Plus",              Action::Plus },
+            { "Minus",             Action::Minus },
+        };
+        return ops;
+    }
+
+    // Видимость фантома: всё от kVisibleLo и выше непрозрачно, тело — нет.
+    TF::RgbaLut visibilityLut()
+    {
+        TF::RgbaLut lut{};
+        for (int v = HistMin; v <= HistMax; ++v)
+            lut[v] = { 1.f, 1.f, 1.f, v >= Phantom::kVisibleLo ? 1.f : 0.f };
+        return lut;
+    }
+
+    const std::vector<std::pair<const char*, VolumeRenderBackend::Kind>>& allBackends()
+    {
+        static const std::vector<std::pair<const char*, VolumeRenderBackend::Kind>> kinds{
+            { "gpu",  VolumeRenderBackend::Kind::Gpu },
+            { "cpu",  VolumeRenderBackend::Kind::Cpu },
+            { "auto", VolumeRenderBackend::Kind::Auto },
+        };
+        return kinds;
+    }
+
+    QString hex(uint64_t v) { return QString("%1").arg(v, 16, 16, QChar('0')); }
+
+    // ключ «размер/операция» -> checksum из прошлого отчёта
+    QHash<QString, QString> loadBaseline(const QString& path)
+    {
+        QHash<QString, QString> out;
+        QFile f(path);
+        if (!f.open(QIODevice::ReadOnly)) return out;
+        const QJsonArray runs = QJsonDocument::fromJson(f.readAll()).object().value("results").toArray();
+        for (const QJsonValue& v : runs) {
+            const QJsonObject o = v.toObject();
+            out.insert(QString("%1/%2").arg(o.value("size").toInt()).arg(o.value("op").toString()),
+                o.value("checksum").toString());
+        }
+        return out;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+#ifndef _WIN32
+    // инструменту нужен QWidget-хост, но не экран
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+#endif
+    QCoreApplication::setOrganizationName("Astrocard");
+    QCoreApplication::setApplicationName("AstroTomoBench");
+    vtkOutputWindow::SetGlobalWarningDisplay(false);
+    QApplication app(argc, argv);
+
+    QCommandLineParser p;
+    p.setApplicationDescription("ToolsRemoveConnected benchmark on synthetic phantoms");
+    p.addHelpOption();
+    QCommandLineOption optSizes("sizes", "Phantom edge sizes, voxels.", "list", "128,256");
+    QCommandLineOption optOps("ops", "Operations to run (default: all).", "list");
+    QCommandLineOption optRepeat("repeat", "Runs per operation.", "n", "3");
+    QCommandLineOption optSeed("seed", "Phantom seed.", "n", "1");
+    QCommandLineOption optJson("json", "Write results (JSON).", "file");
+    QCommandLineOption optBase("baseline", "Compare checksums with a previous --json.", "file");
+    p.addOption(optSizes);
+    p.addOption(optOps);
+    p.addOption(optRepeat);
+    p.addOption(optSeed);
+    p.addOption(optJson);
+    QCommandLineOption optRender("render", "Also time volume rendering: gpu, cpu, auto.", "list");
+    QCommandLineOption optFrames("frames", "Frames per render benchmark.", "n", "20");
+    p.addOption(optBase);
+    p.addOption(optRender);
+    p.addOption(optFrames);
+    p.process(app);
+
+    std::vector<int> sizes;
+    for (const QString& s : p.value(optSizes).split(',', Qt::SkipEmptyParts)) {
+        const int n = s.trimmed().toInt();
+        if (n >= 16 && n <= 1024) sizes.push_back(n);
+    }
+    std::vector<std::pair<const char*, Action>> ops;
+    const QStringList wanted = p.value(optOps).split(',', Qt::SkipEmptyParts);
+    for (const auto& op : allOps())
+        if (wanted.isEmpty() || wanted.contains(QString::fromLatin1(op.first), Qt::CaseInsensitive))
+            ops.push_back(op);
+    std::vector<std::pair<const char*, VolumeRenderBackend::Kind>> backends;
+    const QStringList wantedBackends = p.value(optRender).split(',', Qt::SkipEmptyParts);
+    for (const auto& b : allBackends())
+        if (wantedBackends.contains(QString::fromLatin1(b.first), Qt::CaseInsensitive))
+            backends.push_back(b);
+    if (sizes.empty() || ops.empty() || (p.isSet(optRender) && backends.empty())) {
+        std::fprintf(stderr, "%s\n", qPrintable(p.helpText()));
+        return 2;
+    }
+
+    const int repeat = std::max(1, p.value(optRepeat).toInt());
+    const uint32_t seed = p.value(optSeed).toUInt();
+    const QHash<QString, QString> baseline = p.isSet(optBase) ? loadBaseline(p.value(optBase)) : QHash<QString, QString>{};
+    const TF::RgbaLut lut = visibilityLut();
+
+    const int frames = std::max(1, p.value(optFrames).toInt());
+
+    QWidget host;
+    QJsonArray results;
+    QJsonArray renders;
+    int mismatches = 0;
+
+    std::fprintf(stdout, "%6s %-18s %10s %10s %10s  %s\n", "size", "op", "best ms", "peak MB", "Mvox/s", "checksum");
+    for (int n : sizes)
+    {
+        const vtkSmartPointer<vtkImageData> phantom = Phantom::MakeCardiac(n, seed);
+        int seedIjk[3];
+        Phantom::LeftVentricleSeed(n, seedIjk);
+        const double mvox = double(n) * n * n / 1e6;
+
+        for (const auto& [name, action] : ops)
+        {
+            qint64 bestNs = -1;
+            size_t peakBytes = 0;
+            uint64_t sum = 0;
+            bool stable = true;
+
+            for (int r = 0; r < repeat; ++r)
+            {
+                // свежий инструмент на каждый прогон: снимок оригинала и кэши не переживают замер
+                ToolsRemoveConnected tool(&host);
+                tool.EnsureOriginalSnapshot(phantom);
+
+                BenchProbe::PeakRss rss;
+                QElapsedTimer t; t.start();
+                const vtkSmartPointer<vtkImageData> out = tool.runOffscreen(action, phantom, seedIjk, lut,
+                    double(Phantom::kVisibleLo), double(HistMax));
+                const qint64 ns = t.nsecsElapsed();
+                const size_t peak = rss.stop();
+
+                const uint64_t cs = out ? BenchProbe::Checksum(out) : 0;
+                if (r == 0) sum = cs;
+                else if (cs != sum) stable = false;
+
+                if (bestNs < 0 || ns < bestNs) bestNs = ns;
+                if (peak > rss.base()) peakBytes = std::max(peakBytes, peak - rss.base());
+            }
+
+            const double ms = bestNs / 1e6;
+            const double peakMb = peakBytes / (1024.0 * 1024.0);
+            const QString key = QString("%1/%2").arg(n).arg(QString::fromLatin1(name));
+            const bool mismatch = baseline.contains(key) && baseline.value(key) != hex(sum);
+            if (mismatch) ++mismatches;
+
+            std::fprintf(stdout, "%6d %-18s %10.2f %10.1f %10.1f  %s%s%s\n", n, name, ms, peakMb,
+                ms > 0 ? mvox / (ms / 1000.0) : 0.0, qPrintable(hex(sum)),
+                stable ? "" : "  NONDETERMINISTIC", mismatch ? "  MISMATCH" : "");
+
+            QJsonObject o;
+            o["size"] = n;
+            o["op"] = QString::fromLatin1(name);
+            o["bestMs"] = ms;
+            o["peakMb"] = peakMb;
+            o["checksum"] = hex(sum);
+            o["deterministic"] = stable;
+            results.append(o);
+        }
+    }
+
+    if (!backends.empty())
+    {
+        std::fprintf(stdout, "\n%6s %-18s %10s\n", "size", "backend", "ms/frame");
+        for (int n : sizes)
+        {
+            const vtkSmartPointer<vtkImageData> phantom = Phantom::MakeCardiac(n, seed);
+            auto prop = vtkSmartPointer<vtkVolumeProperty>::New();
+            prop->SetInterpolationTypeToLinear();
+            prop->ShadeOff();
+            TF::ApplyPreset(prop, TFPreset::Bone);
+
+            for (const auto& [name, kind] : backends)
+            {
+                const double ms = VolumeRenderBackend::benchmark(kind, phantom, prop, frames);
+                std::fprintf(stdout, "%6d %-18s %10.2f\n", n, name, ms);
+
+                QJsonObject o;
+                o["size"] = n;
+                o["backend"] = QString::fromLatin1(name);
+                o["frames"] = frames;
+                o["msPerFrame"] = ms;
+                renders.append(o);
+            }
+        }
+    }
+
+    if (p.isSet(optJson)) {
+        QJsonObject root;
+        root["seed"] = int(seed);
+        root["repeat"] = repeat;
+        root["results"] = results;
+        if (!renders.isEmpty())
+            root["render"] = renders;
+        QFile f(p.value(optJson));
+        if (f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            f.write(QJsonDocument(root).toJson(QJsonDocument::Indented));
+        else
+            std::fprintf(stderr, "Cannot write %s\n", qPrintable(p.value(optJson)));
+    }
+
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,298 @@
+﻿#include "MemoryRegistry.h"
+
+#include <QDebug>
+#include <QPair>
+#include <QSettings>
+#include <QStringList>
+
+#include <algorithm>
+#include <cstdlib>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+    constexpr int kPollMs = 2000;
+    constexpr qint64 kMB = qint64(1024) * 1024;
+    constexpr qint64 kLogStep = 256 * kMB;       // в лог — когда итог сдвинулся на столько
+    constexpr double kMinFreePhysical = 0.10;   // меньше свободной физпамяти — уже своп
+
+    constexpr const char* kTotalBudgetKey = "memory/budgetMb";
+    QString budgetKey(const QString& key) { return QStringLiteral("memory/budget/%1Mb").arg(key); }
+
+    QString mb(qint64 bytes) { return QString::number(double(bytes) / kMB, 'f', 0); }
+
+    // Charge живут отдельно от синглтона: их создают и рабочие потоки,
+    // а сам реестр (с таймером) должен родиться в GUI-потоке.
+    std::mutex gChargeMutex;
+    QVector<QPair<const char*, qint64>> gCharges;
+}
+
+MemoryRegistry& MemoryRegistry::instance()
+{
+    // не разрушается: таймер не должен пережить QCoreApplication в статических деструкторах
+    static MemoryRegistry* r = new MemoryRegistry;
+    return *r;
+}
+
+MemoryRegistry::MemoryRegistry()
+{
+    QSettings s;
+    mTotalBudget = s.value(kTotalBudgetKey, defaultTotalBudget() / kMB).toLongLong() * kMB;
+
+    mTimer.setInterval(kPollMs);
+    connect(&mTimer, &QTimer::timeout, this, &MemoryRegistry::poll);
+    mTimer.start();
+}
+
+qint64 MemoryRegistry::PhysicalBytes()
+{
+#ifdef _WIN32
+    MEMORYSTATUSEX st{};
+    st.dwLength = sizeof(st);
+    return GlobalMemoryStatusEx(&st) ? qint64(st.ullTotalPhys) : 0;
+#else
+    return qint64(sysconf(_SC_PHYS_PAGES)) * qint64(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+qint64 MemoryRegistry::AvailablePhysicalBytes()
+{
+#ifdef _WIN32
+    MEMORYSTATUSEX st{};
+    st.dwLength = sizeof(st);
+    return GlobalMemoryStatusEx(&st) ? qint64(st.ullAvailPhys) : 0;
+#else
+    return qint64(sysconf(_SC_AVPHYS_PAGES)) * qint64(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+qint64 MemoryRegistry::defaultTotalBudget()
+{
+    // половина физической памяти: остальное — VTK/GPU-драйвер, Qt и ОС
+    const qint64 phys = PhysicalBytes();
+    return phys > 0 ? phys / 2 : 4096 * kMB;
+}
+
+int MemoryRegistry::addSource(const QString& key, const QString& title, BytesFn bytes,
+    EvictFn evict, int evictOrder)
+{
+    std::lock_guard<std::mutex> lk(mMutex);
+    Source s;
+    s.id = mNextId++;
+    s.key = key;
+    s.title = title;
+    s.bytes = std::move(bytes);
+    s.evict = std::move(evict);
+    s.order = evictOrder;
+    mSources.push_back(std::move(s));
+
+    if (!mBudgets.contains(key))
+        mBudgets.insert(key, QSettings().value(budgetKey(key), 0).toLongLong() * kMB);
+    return mSources.back().id;
+}
+
+void MemoryRegistry::removeSource(int id)
+{
+    std::lock_guard<std::mutex> lk(mMutex);
+    mSources.erase(std::remove_if(mSources.begin(), mSources.end(),
+        [id](const Source& s) { return s.id == id; }), mSources.end());
+}
+
+MemoryRegistry::Charge::Charge(const char* key, qint64 bytes)
+    : mKey(key), mBytes(bytes)
+{
+    std::lock_guard<std::mutex> lk(gChargeMutex);
+    gCharges.push_back({ mKey, mBytes });
+}
+
+MemoryRegistry::Charge::~Charge()
+{
+    std::lock_guard<std::mutex> lk(gChargeMutex);
+    for (int i = 0; i < gCharges.size(); ++i)
+        if (gCharges[i].first == mKey && gCharges[i].second == mBytes) {
+            gCharges.remove(i);
+            break;
+        }
+}
+
+void MemoryRegistry::setTotalBudget(qint64 bytes)
+{
+    mTotalBudget = std::max<qint64>(0, bytes);
+    QSettings().setValue(kTotalBudgetKey, mTotalBudget / kMB);
+    mWarned = false;
+}
+
+qint64 MemoryRegistry::budget(const QString& key) const
+{
+    return mBudgets.value(key, 0);
+}
+
+void MemoryRegistry::setBudget(const QString& key, qint64 bytes)
+{
+    bytes = std::max<qint64>(0, bytes);
+    mBudgets.insert(key, bytes);
+    QSettings().setValue(budgetKey(key), bytes / kMB);
+}
+
+QVector<MemoryRegistry::Entry> MemoryRegistry::snapshot()
+{
+    QVector<Source> sources;
+    QVector<QPair<const char*, qint64>> charges;
+    {
+        std::lock_guard<std::mutex> lk(mMutex);
+        sources = mSources;
+    }
+    {
+        std::lock_guard<std::mutex> lk(gChargeMutex);
+        charges = gCharges;
+    }
+
+    QVector<Entry> out;
+    out.reserve(sources.size() + charges.size());
+    for (const Source& s : sources)
+    {
+        Entry e;
+        e.key = s.key;
+        e.title = s.title;
+        e.bytes = s.bytes ? std::max<qint64>(0, s.bytes()) : 0;
+        e.budget = budget(s.key);
+        e.evictable = bool(s.evict);
+        out.push_back(e);
+    }
+    for (const auto& c : charges)
+    {
+        const QString key = QString::fromLatin1(c.first);
+        auto it = std::find_if(out.begin(), out.end(), [&](const Entry& e) { return e.key == key; });
+        if (it == out.end()) {
+            Entry e;
+            e.key = key;
+            e.title = key;
+            out.push_back(e);
+            it = out.end() - 1;
+        }
+        it->bytes += c.second;
+    }
+    return out;
+}
+
+qint64 MemoryRegistry::totalBytes()
+{
+    qint64 total = 0;
+    for (const Entry& e : snapshot())
+        total += e.bytes;
+    return total;
+}
+
+qint64 MemoryRegistry::evict(QVector<Entry>& entries, qint64 want, const QVector<Source>& sources)
+{
+    QVector<const Source*> order;
+    for (const Source& s : sources)
+        if (s.evict)
+            order.push_back(&s);
+    std::stable_sort(order.begin(), order.end(),
+        [](const Source* a, const Source* b) { return a->order < b->order; });
+
+    qint64 freed = 0;
+    for (const Source* s : order)
+    {
+        if (freed >= want)
+            break;
+        const qint64 got = std::max<qint64>(0, s->evict(want - freed));
+        if (got > 0)
+            qInfo().noquote() << "[Memory] evicted" << mb(got) << "MB from" << s->key;
+        freed += got;
+    }
+
+    if (freed > 0)
+        entries = snapshot();
+    return freed;
+}
+
+void MemoryRegistry::poll()
+{
+    QVector<Source> sources;
+    {
+        std::lock_guard<std::mutex> lk(mMutex);
+        sources = mSources;
+    }
+
+    QVector<Entry> entries = snapshot();
+
+    // 1) бюджеты источников
+    bool trimmed = false;
+    for (const Source& s : sources)
+    {
+        const qint64 b = budget(s.key);
+        if (!s.evict || b <= 0 || !s.bytes)
+            continue;
+        const qint64 cur = s.bytes();
+        if (cur > b && s.evict(cur - b) > 0) {
+            qInfo().noquote() << "[Memory]" << s.key << "trimmed to budget" << mb(b) << "MB";
+            trimmed = true;
+        }
+    }
+    if (trimmed)
+        entries = snapshot();
+
+    qint64 total = 0;
+    for (const Entry& e : entries)
+        total += e.bytes;
+
+    // 2) общий бюджет и нехватка физической памяти (до свопа)
+    qint64 want = (mTotalBudget > 0) ? total - mTotalBudget : 0;
+    const qint64 phys = PhysicalBytes();
+    const qint64 avail = AvailablePhysicalBytes();
+    const qint64 floorFree = qint64(double(phys) * kMinFreePhysical);
+    if (phys > 0 && avail > 0 && avail < floorFree)
+        want = std::max(want, floorFree - avail);
+
+    if (want > 0)
+    {
+        logSnapshot(entries, total, "over budget");
+        const qint64 freed = evict(entries, want, sources);
+
+        total = 0;
+        for (const Entry& e : entries)
+            total += e.bytes;
+
+        // фоновое выселение ещё не видно в байтах — не предупреждаем, если запрошенное набрано
+        const bool stillOver = freed < want && ((mTotalBudget > 0 && total > mTotalBudget)
+            || (phys > 0 && AvailablePhysicalBytes() < floorFree));
+        if (stillOver && !mWarned)
+        {
+            mWarned = true;
+            qWarning().noquote() << "[Memory] still over budget:" << mb(total) << "MB of" << mb(mTotalBudget)
+                << "MB, free physical" << mb(AvailablePhysicalBytes()) << "MB";
+            emit overBudget(total, mTotalBudget);
+        }
+        if (!stillOver)
+            mWarned = false;
+    }
+    else
+    {
+        mWarned = false;
+    }
+
+    if (std::abs(total - mLastLoggedTotal) >= kLogStep)
+        logSnapshot(entries, total, "changed");
+
+    emit updated();
+}
+
+void MemoryRegistry::logSnapshot(const QVector<Entry>& entries, qint64 total, const char* why)
+{
+    mLastLoggedTotal = total;
+
+    QStringList parts;
+    for (const Entry& e : entries)
+        if (e.bytes >= kMB)
+            parts << QStringLiteral("%1=%2").arg(e.key, mb(e.bytes));
+
+    qInfo().noquote() << "[Memory]" << why << "total" << mb(total) << "MB (budget" << mb(mTotalBudget)
+        << "MB):" << parts.join(' ');
+}
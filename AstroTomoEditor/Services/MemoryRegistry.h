@@ -0,0 +1,100 @@
+﻿#pragma once
+#include <QHash>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <QVector>
+#include <functional>
+#include <mutex>
+
+// Учёт живой памяти по подсистемам: каждая регистрирует функцию «сколько байт сейчас»
+// и, если умеет, «освободи столько-то» (обрезка истории, ужатие кеша срезов).
+// Раз в пару секунд реестр опрашивает источники, пишет заметные изменения в лог
+// и выселяет, если превышен общий бюджет, бюджет источника или кончается физическая память.
+// Все вызовы источников — в GUI-потоке; Charge можно создавать из любого потока.
+class MemoryRegistry : public QObject
+{
+    Q_OBJECT
+public:
+    static MemoryRegistry& instance();
+
+    using BytesFn = std::function<qint64()>;
+    // want — сколько надо освободить; вернуть, сколько освобождено
+    // (или уже поставлено в фоновое освобождение — как выгрузка сессии на диск)
+    using EvictFn = std::function<qint64(qint64 want)>;
+
+    struct Entry
+    {
+        QString key;        // стабильный ключ (настройки, лог)
+        QString title;      // для панели
+        qint64 bytes = 0;
+        qint64 budget = 0;  // 0 — без своего бюджета
+        bool evictable = false;
+    };
+
+    // evictOrder: меньше — выселяется раньше (сначала кеши без потерь, потом история правок)
+    int addSource(const QString& key, const QString& title, BytesFn bytes,
+        EvictFn evict = {}, int evictOrder = 100);
+    void removeSource(int id);
+
+    // Крупный временный буфер на время жизни объекта (каст float в buildCache и т.п.)
+    class Charge
+    {
+    public:
+        Charge(const char* key, qint64 bytes);
+        ~Charge();
+        Charge(const Charge&) = delete;
+        Charge& operator=(const Charge&) = delete;
+    private:
+        const char* mKey;
+        qint64 mBytes;
+    };
+
+    QVector<Entry> snapshot();
+    qint64 totalBytes();
+
+    // Бюджеты в байтах, 0 — без ограничения; хранятся в QSettings (memory/...)
+    qint64 totalBudget() const { return mTotalBudget; }
+    void setTotalBudget(qint64 bytes);
+    qint64 budget(const QString& key) const;
+    void setBudget(const QString& key, qint64 bytes);
+    static qint64 defaultTotalBudget();
+
+    static qint64 PhysicalBytes();
+    static qint64 AvailablePhysicalBytes();
+
+    // Опрос + выселение сейчас (обычно по таймеру)
+    void poll();
+
+signals:
+    void updated();
+    // выселять больше нечего, а бюджет/физпамять всё ещё превышены
+    void overBudget(qint64 total, qint64 budget);
+
+private:
+    MemoryRegistry();
+
+    struct Source
+    {
+        int id = 0;
+        QString key;
+        QString title;
+        BytesFn bytes;
+        EvictFn evict;
+        int order = 100;
+    };
+
+    qint64 evict(QVector<Entry>& entries, qint64 want, const QVector<Source>& sources);
+    void logSnapshot(const QVector<Entry>& entries, qint64 total, const char* why);
+
+    std::mutex mMutex;          // mSources
+    QVector<Source> mSources;
+    int mNextId = 1;
+
+    qint64 mTotalBudget = 0;
+    QHash<QString, qint64> mBudgets;
+
+    qint64 mLastLoggedTotal = 0;
+    bool mWarned = false;
+    QTimer mTimer;
+};
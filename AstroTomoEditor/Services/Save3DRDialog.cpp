@@ -0,0 +1,66 @@
+﻿#include "Save3DR.h"
+
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QSettings>
+#include <QStandardPaths>
+
+#include <Window/ServiceWindow/CustomMessageBox.h>
+#include <Window/ServiceWindow/ShellFileDialog.h>
+
+// Диалоговая часть Save3DR отдельно: Save3DR.cpp собирается и без виджетов (AstroTomoBatch).
+bool Save3DR::saveWithDialog(QWidget* parent, vtkImageData* img, const DicomInfo* dicom, QString& savepath)
+{
+    if (!img)
+    {
+        CustomMessageBox::warning(parent, QObject::tr("Save 3DR"),
+            QObject::tr("No loaded volume"), ServiceWindow);
+        return false;
+    }
+
+    QSettings s;
+    const QString defDir = s.value(
+        "Paths/Last3drDir",
+        QStandardPaths::writableLocation(QStandardPaths::DocumentsLocation)
+    ).toString();
+
+    ShellFileDialog shell(parent,
+        QObject::tr("Save 3DR"),
+        ServiceWindow,
+        QDir(defDir).filePath("volume.3dr"),
+        QObject::tr("Astro 3DR (*.3dr)")
+    );
+
+    auto* dlg = shell.fileDialog();
+    dlg->setAcceptMode(QFileDialog::AcceptSave);
+    dlg->setFileMode(QFileDialog::AnyFile);
+    dlg->setOption(QFileDialog::ShowDirsOnly, true);
+    dlg->setFilter(QDir::AllDirs | QDir::Drives | QDir::NoDotAndDotDot);
+    dlg->setDefaultSuffix("3dr");
+    dlg->setOption(QFileDialog::DontConfirmOverwrite, true);
+
+    if (shell.exec() != QDialog::Accepted)
+        return false;
+
+    QString path = dlg->selectedFiles().isEmpty() ? QString() : dlg->selectedFiles().first();
+    if (path.isEmpty())
+        return false;
+
+    while (path.endsWith('.')) path.chop(1);
+    if (!path.endsWith(".3dr", Qt::CaseInsensitive))
+        path += ".3dr";
+
+    s.setValue("Paths/Last3drDir", QFileInfo(path).absolutePath());
+
+
+    QString err;
+    if (!Save3DR::write(path, img, dicom, &err))
+    {
+        CustomMessageBox::critical(parent, QObject::tr("Save 3DR"),
+            QObject::tr("Failed to save file:\n%1").arg(err), ServiceWindow);
+        return false;
+    }
+
+    savepath = path;
+    return true;
+}
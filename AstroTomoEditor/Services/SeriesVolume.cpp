@@ -0,0 +1,535 @@
+﻿#include "SeriesVolume.h"
+#include "VolumeFix3DR.h"
+#include "Trace.h"
+
+#include <QCoreApplication>
+#include <vtkDICOMMetaData.h>
+#include <vtkDICOMParser.h>
+#include <vtkDICOMReader.h>
+#include <vtkDICOMTag.h>
+#include <vtkGDCMImageReader.h>
+#include <vtkImageCast.h>
+#include <vtkImageData.h>
+#include <vtkImageShrink3D.h>
+#include <vtkMatrix3x3.h>
+#include <vtkNew.h>
+#include <vtkSMPTools.h>
+#include <vtkStringArray.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+    // --- Сглаживание и поиск первого значимого пика справа от threshold ---
+    // mH        — входная гистограмма (256 значений)
+    // threshold — индекс, откуда начинаем поиск
+    // outPeak   — возвращает индекс найденного пика
+    // minFrac   — минимальная доля от глобального максимума (0..1)
+    // Первый осмысленный пик справа от threshold (берём самый первый, а не "лучший")
+    bool detectFirstPeakAfter(const QVector<uint32_t>& mH,
+        int threshold,
+        int& outPeak,
+        double minFrac = 0.05)
+    {
+        const int N = mH.size();
+        if (N < 3 || threshold >= N - 2) return false;
+
+        // 1) Сглаживание (box 9)
+        const int win = 9, R = win / 2;
+        QVector<double> h(N);
+        auto at = [&](int i) {
+            if (i < 0) i = -i;
+            if (i >= N) i = 2 * (N - 1) - i;
+            return double(mH[i]);
+            };
+        for (int i = 0; i < N; ++i) {
+            double s = 0; for (int k = -R; k <= R; ++k) s += at(i + k);
+            h[i] = s / win;
+        }
+
+        // 2) Порог по амплитуде
+        const double maxVal = *std::max_element(h.begin(), h.end());
+        if (maxVal <= 0.0) return false;
+        const double minPeakHeight = maxVal * std::clamp(minFrac, 0.0, 1.0);
+
+        auto deriv = [&](int i) { return h[i + 1] - h[i]; };
+        auto fwhm = [&](int p)->int {
+            const double half = h[p] * 0.5;
+            int L = p, Rr = p;
+            while (L > 0 && h[L] > half) --L;
+            while (Rr<N - 1 && h[Rr]>half) ++Rr;
+            return Rr - L;
+            };
+
+        // 3) Поиск ПЕРВОГО пика с поддержкой плато
+        const double epsFlat = maxVal * 1e-4;
+        const int    maxFlat = 12;
+
+        bool inRise = false; int riseStart = -1;
+
+        for (int i = std::max(threshold + 1, 1); i < N - 2; ++i)
+        {
+            const double d0 = deriv(i - 1);
+            const double d1 = deriv(i);
+
+            if (!inRise && d0 > 0) { inRise = true; riseStart = i - 1; }
+
+            if (inRise)
+            {
+                // плато
+                int j = i, flat = 0;
+                while (j < N - 2 && std::abs(deriv(j)) <= epsFlat && flat < maxFlat) { ++j; ++flat; }
+
+                // начался спуск либо уже спускаемся
+                if ((j < N - 2 && (deriv(j) < -epsFlat || h[j + 1] < h[j])) || d1 < 0)
+                {
+                    // максимум на вершине ростового сегмента
+                    int L = std::max(riseStart, 0);
+                    int Rr = std::min(j + 1, N - 1);
+                    int p = L;
+                    for (int k = L + 1; k <= Rr; ++k) if (h[k] > h[p]) p = k;
+
+                    // ВАЖНО: проверяем только высоту
+                    if (h[p] >= minPeakHeight) {
+                        if (fwhm(p) < 5) {  // слишком узкий — флуктуация
+                            inRise = false;
+                            riseStart = -1;
+                            continue;       // ищем дальше
+                        }
+                        outPeak = p;
+                        return true;
+                    }
+
+                    // иначе ищем дальше
+                    inRise = false; riseStart = -1;
+                    i = std::max(p, i);
+                }
+            }
+        }
+        return false;
+    }
+
+    vtkSmartPointer<vtkImageData> shrinkAlongAxis(vtkImageData* src, int axis, int factor)
+    {
+        if (!src || factor <= 1)
+            return src;
+
+        auto shrink = vtkSmartPointer<vtkImageShrink3D>::New();
+        shrink->SetInputData(src);
+
+        int fx = 1, fy = 1, fz = 1;
+        if (axis == 0) fx = factor;
+        if (axis == 1) fy = factor;
+        if (axis == 2) fz = factor;
+
+        shrink->SetShrinkFactors(fx, fy, fz);
+        shrink->AveragingOn();      // усредняем, а не просто выбрасываем
+
+        shrink->Update();
+
+        auto out = vtkSmartPointer<vtkImageData>::New();
+        out->DeepCopy(shrink->GetOutput());  // отцепиться от pipeline
+        return out;
+    }
+
+    bool fail(QString* error, const QString& text)
+    {
+        if (error) *error = text;
+        return false;
+    }
+}
+
+void SeriesVolume::ReadOrientation(vtkDICOMMetaData* md, double dir[9], double org[3])
+{
+    double iop[6]{ 1,0,0, 0,1,0 };
+    if (md && md->Has(DC::ImageOrientationPatient)) {
+        const auto v = md->Get(DC::ImageOrientationPatient);
+        for (int i = 0; i < 6 && i < v.GetNumberOfValues(); ++i) iop[i] = v.GetDouble(i);
+    }
+    const double* R = iop;
+    const double* C = iop + 3;
+    const double N[3]{
+        R[1] * C[2] - R[2] * C[1],
+        R[2] * C[0] - R[0] * C[2],
+        R[0] * C[1] - R[1] * C[0] };
+
+    // столбцы: R, C, N
+    for (int r = 0; r < 3; ++r) {
+        dir[r * 3 + 0] = R[r];
+        dir[r * 3 + 1] = C[r];
+        dir[r * 3 + 2] = N[r];
+    }
+
+    org[0] = org[1] = org[2] = 0.0;
+    if (md && md->Has(DC::ImagePositionPatient)) {
+        const auto ipp = md->Get(DC::ImagePositionPatient);
+        org[0] = ipp.GetDouble(0); org[1] = ipp.GetDouble(1); org[2] = ipp.GetDouble(2);
+    }
+}
+
+double SeriesVolume::MedianSliceStep(vtkStringArray* names, const double normal[3])
+{
+    if (!names) return -1.0;
+
+    // Собираем скаляр s = dot(IPP, N) по всем файлам и берём медианный шаг
+    std::vector<double> s; s.reserve(size_t(names->GetNumberOfValues()));
+    for (vtkIdType i = 0; i < names->GetNumberOfValues(); ++i) {
+        const std::string fname = names->GetValue(i);
+        vtkNew<vtkDICOMParser>    parser;
+        vtkNew<vtkDICOMMetaData>  meta;
+        parser->SetMetaData(meta);
+        parser->SetFileName(fname.c_str());
+        parser->Update(); // быстро: читает только теги
+        if (meta->Has(DC::ImagePositionPatient)) {
+            const auto ipp = meta->Get(DC::ImagePositionPatient);
+            s.push_back(ipp.GetDouble(0) * normal[0] + ipp.GetDouble(1) * normal[1] + ipp.GetDouble(2) * normal[2]);
+        }
+    }
+    std::sort(s.begin(), s.end());
+
+    std::vector<double> step; step.reserve(s.size());
+    for (size_t i = 1; i < s.size(); ++i) {
+        const double d = std::abs(s[i] - s[i - 1]);
+        if (d > 1e-9) step.push_back(d);
+    }
+    if (step.empty()) return -1.0;
+
+    auto mid = step.begin() + step.size() / 2;
+    std::nth_element(step.begin(), mid, step.end());
+    return std::max(1e-6, *mid);
+}
+
+bool SeriesVolume::ApplyModality(vtkDICOMMetaData* md, DicomInfo& di)
+{
+    bool invertMono1 = false;
+    QString modalityStr;
+    if (md) {
+        if (md->Has(DC::PhotometricInterpretation)) {
+            const QString phot = QString::fromStdString(md->Get(DC::PhotometricInterpretation).AsString()).toUpper();
+            invertMono1 = (phot == "MONOCHROME1");
+        }
+        if (md->Has(DC::Modality))
+            modalityStr = QString::fromStdString(md->Get(DC::Modality).AsString()).toUpper();
+    }
+
+    // Подписи остаются в контексте PlanarView: переводы уже есть в .ts
+    auto tr = [](const char* s) { return QCoreApplication::translate("PlanarView", s); };
+
+    if (modalityStr == "CT") {
+        di.TypeOfRecord = CT;
+        if (di.intercept < -1000)
+        {
+            di.physicalMin = 0;
+            di.physicalMax = 2048;
+        }
+        else
+        {
+            di.physicalMin = -1024;
+            di.physicalMax = 1024;
+        }
+        di.RealMin = -1000;
+        di.RealMax = 1000;
+        di.XTitle = tr("Hounsfield Units");
+        di.YTitle = tr("Voxel count");
+        di.XLable = tr("HU");
+        di.YLable = tr("N");
+    }
+    else if (modalityStr == "MR" || modalityStr == "MRI")
+    {
+        di.TypeOfRecord = MRI;
+        di.physicalMin = -500; di.physicalMax = 1500;
+        di.RealMin = 0; di.RealMax = 255;
+        di.XTitle = tr("MRI intensity");
+        di.YTitle = tr("Voxel count");
+        di.XLable = tr("AU");
+        di.YLable = tr("N");
+    }
+    return invertMono1;
+}
+
+void SeriesVolume::Apply3drDefaults(bool isMRI, DicomInfo& di)
+{
+    if (isMRI) {
+        di.TypeOfRecord = MRI3DR;
+        di.physicalMin = 0;    di.physicalMax = 255;
+        di.RealMin = 0;    di.RealMax = 255;
+    }
+    else {
+        di.TypeOfRecord = CT3DR;
+        di.physicalMin = 0;    di.physicalMax = 2000;
+        di.RealMin = -1000; di.RealMax = 1000;
+    }
+    di.slope = 1.0; di.intercept = 0.0;
+}
+
+void SeriesVolume::RefineCtWindow(vtkImageData* img, DicomInfo& di)
+{
+    if (!img || di.TypeOfRecord != CT || img->GetScalarType() != VTK_FLOAT)
+        return;
+
+    int ext[6]; img->GetExtent(ext);
+    const int x0 = ext[0], y0 = ext[2], z0 = ext[4], z1 = ext[5];
+    const int w = ext[1] - x0 + 1;
+    const int h = ext[3] - y0 + 1;
+    const int total = z1 - z0 + 1;
+    if (w <= 0 || h <= 0 || total <= 0) return;
+
+    // быстрый пик по подвыборке, без полного прохода по объему
+    const int maxZSlices = 64;
+    const int zStep = std::max(1, total / maxZSlices);
+    const int xyStep = 3;
+
+    QVector<uint32_t> hist(HistScale, 0u);
+
+    const float minPhys = float(di.physicalMin);
+    const float maxPhys = float(di.physicalMax);
+    const float window = std::max(1.0f, maxPhys - minPhys);
+
+    const float slopeF = float(di.slope);
+    const float interF = float(di.intercept);
+
+    const float scaleF = float(HistScale) / window;   // (vHU - minPhys) * scale
+    const float bias = -minPhys * scaleF;
+
+    auto fastFloorToInt = [](float x) -> int {
+        int i = int(x);
+        return (x < float(i)) ? (i - 1) : i;
+        };
+
+    vtkIdType incX, incY, incZ;
+    img->GetIncrements(incX, incY, incZ);
+
+    for (int z = z1; z >= z0; z -= zStep)
+    {
+        const float* p00 = static_cast<const float*>(img->GetScalarPointer(x0, y0, z));
+        if (!p00) continue;
+
+        for (int yy = 0; yy < h; yy += xyStep)
+        {
+            const float* row = p00 + incY * yy;
+            for (int xx = 0; xx < w; xx += xyStep)
+            {
+                const float vHU = row[incX * xx] * slopeF - interF;
+
+                int bin = fastFloorToInt(vHU * scaleF + bias);
+                if (bin < HistMin + 1) bin = HistMin;
+                else if (bin > HistMax) bin = HistMax;
+
+                hist[bin] += 1u;
+            }
+        }
+    }
+
+    hist[0] = 0;
+
+    int peakHU = 0;
+    if (detectFirstPeakAfter(hist, HistScale / 4, peakHU))
+    {
+        peakHU -= 2;
+        const float vHU = window * (0.5f - float(peakHU) / float(HistScale));
+        di.physicalMax -= (2 * fastFloorToInt(vHU));
+    }
+}
+
+vtkSmartPointer<vtkImageData> SeriesVolume::ThickenThinSlices(vtkImageData* vol)
+{
+    if (!vol) return nullptr;
+
+    int dims[3]{};
+    vol->GetDimensions(dims);
+    double sp[3]{};
+    vol->GetSpacing(sp);
+
+    const double minSliceThickness = std::min(sp[0], sp[1]); // мм
+    const int d = dims[2];
+
+    if (sp[2] > 0.0 && sp[2] < minSliceThickness && d > 1) {
+        // во сколько раз нужно утолщить, чтобы >= minSliceThickness мм
+        int factor = static_cast<int>(std::ceil(minSliceThickness / sp[2]));
+        if (factor < 2) factor = 2;          // смысл есть только при factor >= 2
+
+        // не даём фактору убить объём до 1 среза
+        const int maxFactor = std::max(2, d / 2);  // оставим хотя бы половину срезов
+        factor = std::min(factor, maxFactor);
+
+        if (factor > 1)
+            return shrinkAlongAxis(vol, /*axis=*/2, factor);
+    }
+    return vol;
+}
+
+bool SeriesVolume::Load(const QVector<QString>& files, Result& out, QString* error, const Progress& progress)
+{
+    TRACE_SCOPE("load", "SeriesVolume::Load");
+    auto step = [&](int p, const char* stage) {
+        if (progress) progress(p, QString::fromLatin1(stage));
+        };
+
+    out = Result{};
+    if (files.isEmpty())
+        return fail(error, "No input files");
+
+    DicomInfo& di = out.dicom;
+    vtkSmartPointer<vtkImageData> volume;
+    double dir[9]{ 1,0,0, 0,1,0, 0,0,1 };
+    double org[3]{ 0,0,0 };
+
+    const bool is3dr = (files.size() == 1 && files.front().endsWith(".3dr", Qt::CaseInsensitive));
+    if (is3dr)
+    {
+        step(0, "Loading 3DR");
+        bool isMRI = false;
+        volume = Load3DR_Normalized(files.front(), isMRI);
+        if (!volume)
+            return fail(error, QString("3DR load failed: %1").arg(files.front()));
+        Apply3drDefaults(isMRI, di);
+    }
+    else
+    {
+        step(0, "Reading DICOM metadata");
+        auto names = vtkSmartPointer<vtkStringArray>::New();
+        names->SetNumberOfValues(files.size());
+        for (vtkIdType i = 0; i < static_cast<vtkIdType>(files.size()); ++i)
+            names->SetValue(i, files[int(i)].toUtf8().constData());
+
+        auto mdReader = vtkSmartPointer<vtkDICOMReader>::New();
+        auto errMd = vtkSmartPointer<ErrorCatcher>::New();
+        mdReader->AddObserver(vtkCommand::ErrorEvent, errMd);
+        mdReader->SetFileNames(names);
+        mdReader->UpdateInformation();
+
+        vtkDICOMMetaData* md = mdReader->GetMetaData();
+        if (errMd->hasError || !md)
+            return fail(error, QString("DICOM metadata read failed: %1").arg(QString::fromStdString(errMd->message)));
+
+        bool isCompressed = false;
+        if (md->Has(DC::TransferSyntaxUID)) {
+            const std::string ts = md->Get(DC::TransferSyntaxUID).AsString();
+            isCompressed = ts.rfind("1.2.840.10008.1.2.4.", 0) == 0 || ts == "1.2.840.10008.1.2.5";
+        }
+
+        step(20, "Decoding pixels");
+        ReadOrientation(md, dir, org);
+
+        if (!isCompressed)
+        {
+            auto pixReader = vtkSmartPointer<vtkDICOMReader>::New();
+            auto errPix = vtkSmartPointer<ErrorCatcher>::New();
+            pixReader->AddObserver(vtkCommand::ErrorEvent, errPix);
+            pixReader->SetFileNames(names);
+            pixReader->Update();
+            if (errPix->hasError || !pixReader->GetOutput())
+                return fail(error, QString("DICOM read failed: %1").arg(QString::fromStdString(errPix->message)));
+
+            volume = pixReader->GetOutput();
+            di = GetDicomRangesVTK(pixReader);
+        }
+        else
+        {
+            auto gdcm = vtkSmartPointer<vtkGDCMImageReader>::New();
+            auto errPix = vtkSmartPointer<ErrorCatcher>::New();
+            gdcm->AddObserver(vtkCommand::ErrorEvent, errPix);
+            gdcm->SetFileNames(names);
+            gdcm->Update();
+            if (errPix->hasError || !gdcm->GetOutput())
+                return fail(error, QString("GDCM decode failed: %1").arg(QString::fromStdString(errPix->message)));
+
+            volume = gdcm->GetOutput();
+            di = GetDicomRangesVTK(mdReader);
+
+            if (!di.SpCreated)
+            {
+                // X/Y из volume, Z — при «затычке» ридера считаем по IPP
+                double sp[3]{ 1,1,1 };
+                volume->GetSpacing(sp);
+                di.OriginSpZ = sp[2];
+                if (!(sp[2] > 0.0) || sp[2] == 1.0) {
+                    const double normal[3]{ dir[2], dir[5], dir[8] };
+                    const double z = MedianSliceStep(names, normal);
+                    if (z > 0.0) sp[2] = z;
+                }
+                di.SpCreated = true;
+                di.mSpX = sp[0] > 0 ? sp[0] : 1.0;
+                di.mSpY = sp[1] > 0 ? sp[1] : 1.0;
+                di.mSpZ = sp[2] > 0 ? sp[2] : 1.0;
+            }
+        }
+
+        out.invertMono1 = ApplyModality(md, di);
+    }
+
+    if (!di.SpCreated) {
+        di.SpCreated = true;
+        double sp[3]{ 1,1,1 }; volume->GetSpacing(sp);
+        di.mSpX = sp[0] > 0 ? sp[0] : 1.0;
+        di.mSpY = sp[1] > 0 ? sp[1] : 1.0;
+        di.mSpZ = sp[2] > 0 ? sp[2] : 1.0;
+    }
+
+    // --- в 8 бит: float-вход, те же флипы, что у PlanarView::buildCache (Y и порядок Z) ---
+    step(60, "Normalizing");
+    vtkSmartPointer<vtkImageData> img = volume;
+    if (volume->GetScalarType() != VTK_FLOAT) {
+        auto castF = vtkSmartPointer<vtkImageCast>::New();
+        castF->SetInputData(volume);
+        castF->SetOutputScalarTypeToFloat();
+        castF->Update();
+        img = castF->GetOutput();
+    }
+    volume = nullptr; // исходный тип больше не нужен — освобождаем до выделения U8
+
+    int ext[6]; img->GetExtent(ext);
+    const int w = ext[1] - ext[0] + 1;
+    const int h = ext[3] - ext[2] + 1;
+    const int d = ext[5] - ext[4] + 1;
+    if (w <= 0 || h <= 0 || d <= 0)
+        return fail(error, "Empty volume");
+
+    // окно уточняется только для перевода в 8 бит, в DicomInfo остаётся исходное
+    DicomInfo win = di;
+    RefineCtWindow(img, win);
+
+    auto vol = vtkSmartPointer<vtkImageData>::New();
+    vol->SetDimensions(w, h, d);
+    vol->AllocateScalars(VTK_UNSIGNED_CHAR, 1);
+    vol->SetSpacing(di.mSpX, di.mSpY, di.mSpZ);
+
+    vtkNew<vtkMatrix3x3> m;
+    m->DeepCopy(dir);
+    vol->SetDirectionMatrix(m);
+    vol->SetOrigin(org);
+
+    vtkIdType incX, incY, incZ;
+    img->GetIncrements(incX, incY, incZ);
+    const float* src = static_cast<const float*>(img->GetScalarPointer(ext[0], ext[2], ext[4]));
+    auto* dst = static_cast<unsigned char*>(vol->GetScalarPointer());
+    const bool inv = out.invertMono1;
+
+    vtkSMPTools::For(0, d, [&](int first, int last)
+        {
+            for (int idx = first; idx < last; ++idx)
+            {
+                const float* slice = src + incZ * vtkIdType(d - 1 - idx);
+                for (int yy = 0; yy < h; ++yy)
+                {
+                    const float* row = slice + incY * yy;
+                    unsigned char* o = dst + (size_t(idx) * h + size_t(h - 1 - yy)) * size_t(w);
+                    for (int xx = 0; xx < w; ++xx)
+                    {
+                        const double vHU = double(row[incX * xx]) * win.slope - win.intercept;
+                        o[xx] = MapTo8(vHU, win.physicalMin, win.physicalMax, win.TypeOfRecord, inv);
+                    }
+                }
+            }
+        });
+    vol->Modified();
+    img = nullptr;
+
+    step(90, "Finalizing");
+    out.volume = ThickenThinSlices(vol);
+    step(100, "Loaded");
+    return true;
+}
@@ -0,0 +1,82 @@
+﻿#pragma once
+#include <QString>
+#include <QVector>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <cmath>
+#include <vtkCommand.h>
+#include <vtkSmartPointer.h>
+#include "DicomRange.h"
+
+class vtkImageData;
+class vtkDICOMMetaData;
+class vtkStringArray;
+
+// Серия -> нормализованный U8-объём без виджетов и цикла событий.
+// PlanarView берёт отсюда те же шаги (геометрия, modality, окно CT, перевод в 8 бит),
+// пакетный режим — целиком Load().
+namespace SeriesVolume
+{
+    // Ловит ErrorEvent ридеров VTK вместо вывода в окно ошибок.
+    class ErrorCatcher : public vtkCommand {
+    public:
+        static ErrorCatcher* New() { return new ErrorCatcher; }
+        void Execute(vtkObject*, unsigned long, void* callData) override {
+            hasError = true;
+            if (callData) message = static_cast<const char*>(callData);
+        }
+        bool hasError = false;
+        std::string message;
+    };
+
+    using Progress = std::function<void(int percent, const QString& stage)>;
+
+    struct Result
+    {
+        vtkSmartPointer<vtkImageData> volume;   // U8x1, spacing/direction/origin выставлены
+        DicomInfo dicom{};
+        bool invertMono1 = false;
+    };
+
+    // Направляющие (столбцы R, C, N; row-major 3x3) и начало из IOP/IPP.
+    void ReadOrientation(vtkDICOMMetaData* md, double dir[9], double org[3]);
+    // Медианный шаг между срезами по проекции IPP на нормаль; <= 0 — не удалось.
+    double MedianSliceStep(vtkStringArray* names, const double normal[3]);
+    // Поля DicomInfo по Modality; возвращает true для MONOCHROME1.
+    bool ApplyModality(vtkDICOMMetaData* md, DicomInfo& di);
+    void Apply3drDefaults(bool isMRI, DicomInfo& di);
+    // CT: уточняет physicalMax по первому пику гистограммы подвыборки (img — float).
+    void RefineCtWindow(vtkImageData* img, DicomInfo& di);
+    // Утолщает слишком тонкие срезы усреднением по Z (или возвращает vol как есть).
+    vtkSmartPointer<vtkImageData> ThickenThinSlices(vtkImageData* vol);
+
+    // Значение после rescale -> бин [HistMin..HistMax-1] в окне [min..max].
+    inline unsigned char MapTo8(double v, double min, double max, Mode typeOfRecord, bool invMono1)
+    {
+        const double window = std::max(1.0, max - min);
+
+        if (typeOfRecord == CT)
+        {
+            if (v > max + window / 20)
+                v = max + window / 20;
+            else if (v > max - window / 15)
+                v = max - window / 15;
+        }
+
+        int bin = static_cast<int>(std::floor((v - min) * scale / window));
+        if (bin < static_cast<int>(HistMin))
+            bin = static_cast<int>(HistMin);
+        if (bin >= static_cast<int>(HistMax))
+            bin = static_cast<int>(HistMax - 1);
+
+        // инверсия для MONOCHROME1 в той же шкале
+        if (invMono1)
+            bin = static_cast<int>(HistMin + (HistMax - bin));
+
+        return static_cast<unsigned char>(bin);
+    }
+
+    // Файлы серии (или один .3dr) -> U8-объём той же ориентации, что собирает PlanarView.
+    bool Load(const QVector<QString>& files, Result& out, QString* error = nullptr, const Progress& progress = {});
+}
@@ -0,0 +1,283 @@
+﻿#include "Trace.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QThread>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+    struct Event
+    {
+        const char* cat;
+        const char* name;
+        int64_t startNs;
+        int64_t endNs;
+    };
+
+    // Поля атомарны (relaxed — обычные store/load): читатель может застать слот
+    // в момент перезаписи, но не получит «разорванный» указатель.
+    struct Slot
+    {
+        std::atomic<const char*> cat{ nullptr };
+        std::atomic<const char*> name{ nullptr };
+        std::atomic<int64_t> startNs{ 0 };
+        std::atomic<int64_t> endNs{ 0 };
+    };
+
+    constexpr int64_t kChunkEvents = 4096;
+    constexpr int kMaxChunks = 128;
+    constexpr int64_t kCapacity = kChunkEvents * kMaxChunks;   // 512K событий (16 МБ) на поток
+
+    struct Chunk { Slot ev[kChunkEvents]; };
+
+    // Кольцо: пишет только поток-владелец, событие n лежит в слоте n % kCapacity.
+    // Читатель копирует [begin, count) и отбрасывает то, что могло быть перезаписано
+    // за время копирования (как в seqlock).
+    struct ThreadBuffer
+    {
+        int tid = 0;
+        QString name;
+        std::atomic<int64_t> count{ 0 };
+        std::atomic<int64_t> begin{ 0 };
+        std::array<std::atomic<Chunk*>, kMaxChunks> chunks{};
+
+        ~ThreadBuffer()
+        {
+            for (auto& c : chunks)
+                delete c.load();
+        }
+    };
+
+    struct Registry
+    {
+        std::mutex m;
+        std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+        std::vector<ThreadBuffer*> idle;   // буферы завершившихся потоков
+    };
+
+    // не разрушается: пулы потоков могут писать и после выхода из main
+    Registry& registry()
+    {
+        static Registry* r = new Registry;
+        return *r;
+    }
+
+    std::atomic<bool> gEnabled{ true };
+    const std::chrono::steady_clock::time_point gOrigin = std::chrono::steady_clock::now();
+
+    // Пулы (QtConcurrent, VTK SMP) гасят и заводят потоки заново: при выходе потока
+    // его буфер уходит в idle и достаётся следующему новому, память не растёт с их числом.
+    struct LocalBuffer
+    {
+        ThreadBuffer* buffer = nullptr;
+
+        ~LocalBuffer()
+        {
+            if (!buffer)
+                return;
+            Registry& r = registry();
+            std::lock_guard<std::mutex> lk(r.m);
+            r.idle.push_back(buffer);
+        }
+    };
+
+    thread_local LocalBuffer tlsBuffer;
+
+    ThreadBuffer* localBuffer()
+    {
+        if (tlsBuffer.buffer)
+            return tlsBuffer.buffer;
+
+        QString name;
+        QThread* th = QThread::currentThread();
+        if (QCoreApplication::instance() && th == QCoreApplication::instance()->thread())
+            name = QStringLiteral("main");
+        else if (th && !th->objectName().isEmpty())
+            name = th->objectName();
+
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lk(r.m);
+        ThreadBuffer* b = nullptr;
+        if (!r.idle.empty())
+        {
+            // события прежнего владельца новому потоку не приписываем
+            b = r.idle.back();
+            r.idle.pop_back();
+            b->begin.store(b->count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        else
+        {
+            r.buffers.push_back(std::make_unique<ThreadBuffer>());
+            b = r.buffers.back().get();
+            b->tid = int(r.buffers.size());
+        }
+        b->name = name.isEmpty() ? QStringLiteral("worker %1").arg(b->tid) : name;
+        tlsBuffer.buffer = b;
+        return b;
+    }
+
+    // Снимок последних событий потока; начало — не раньше begin и живой части кольца
+    std::vector<Event> snapshot(const ThreadBuffer& b)
+    {
+        const int64_t end = b.count.load(std::memory_order_acquire);
+        const int64_t first = std::max(b.begin.load(std::memory_order_relaxed), end - kCapacity);
+
+        std::vector<Event> out;
+        out.reserve(size_t(std::max<int64_t>(0, end - first)));
+        for (int64_t i = first; i < end; ++i)
+        {
+            const int64_t s = i % kCapacity;
+            const Chunk* c = b.chunks[size_t(s / kChunkEvents)].load(std::memory_order_acquire);
+            const Slot& e = c->ev[s % kChunkEvents];
+            out.push_back(Event{
+                e.cat.load(std::memory_order_relaxed),
+                e.name.load(std::memory_order_relaxed),
+                e.startNs.load(std::memory_order_relaxed),
+                e.endNs.load(std::memory_order_relaxed) });
+        }
+
+        // писатель мог уйти вперёд: событие i затирается записью i + kCapacity,
+        // а запись с номером after может идти прямо сейчас
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const int64_t after = b.count.load(std::memory_order_relaxed);
+        const int64_t stale = std::max<int64_t>(0, after - kCapacity + 1 - first);
+        out.erase(out.begin(), out.begin() + size_t(std::min<int64_t>(stale, int64_t(out.size()))));
+        return out;
+    }
+
+    void appendEscaped(QByteArray& out, const char* s)
+    {
+        for (; s && *s; ++s) {
+            if (*s == '"' || *s == '\\') out += '\\';
+            out += *s;
+        }
+    }
+}
+
+bool Trace::Enabled()
+{
+    return gEnabled.load(std::memory_order_relaxed);
+}
+
+void Trace::SetEnabled(bool on)
+{
+    gEnabled.store(on, std::memory_order_relaxed);
+}
+
+int64_t Trace::NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - gOrigin).count();
+}
+
+void Trace::Record(const char* cat, const char* name, int64_t startNs, int64_t endNs)
+{
+    ThreadBuffer* b = localBuffer();
+    const int64_t n = b->count.load(std::memory_order_relaxed);
+    const int64_t s = n % kCapacity;
+
+    std::atomic<Chunk*>& chunk = b->chunks[size_t(s / kChunkEvents)];
+    Chunk* c = chunk.load(std::memory_order_relaxed);
+    if (!c) {
+        c = new Chunk;
+        chunk.store(c, std::memory_order_release);
+    }
+
+    Slot& e = c->ev[s % kChunkEvents];
+    e.cat.store(cat, std::memory_order_relaxed);
+    e.name.store(name, std::memory_order_relaxed);
+    e.startNs.store(startNs, std::memory_order_relaxed);
+    e.endNs.store(endNs, std::memory_order_relaxed);
+    b->count.store(n + 1, std::memory_order_release);
+}
+
+int64_t Trace::EventCount()
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lk(r.m);
+    int64_t total = 0;
+    for (const auto& b : r.buffers)
+        total += std::min(kCapacity, b->count.load(std::memory_order_acquire) - b->begin.load(std::memory_order_relaxed));
+    return total;
+}
+
+int64_t Trace::DroppedCount()
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lk(r.m);
+    int64_t total = 0;
+    for (const auto& b : r.buffers)
+        total += std::max<int64_t>(0, b->count.load(std::memory_order_acquire) - b->begin.load(std::memory_order_relaxed) - kCapacity);
+    return total;
+}
+
+void Trace::Clear()
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lk(r.m);
+    for (const auto& b : r.buffers)
+        b->begin.store(b->count.load(std::memory_order_acquire), std::memory_order_relaxed);
+}
+
+bool Trace::WriteChromeJson(const QString& path, QString* error)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        if (error) *error = f.errorString();
+        return false;
+    }
+
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lk(r.m);
+
+    // Chrome trace: "X" — полное событие, ts/dur в микросекундах
+    QByteArray out;
+    out.reserve(1 << 20);
+    out += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    auto flush = [&]() {
+        if (out.size() > (1 << 20)) { f.write(out); out.clear(); }
+    };
+
+    for (const auto& b : r.buffers)
+    {
+        if (!first) out += ",\n";
+        first = false;
+        out += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":";
+        out += QByteArray::number(b->tid);
+        out += ",\"args\":{\"name\":\"";
+        appendEscaped(out, b->name.toUtf8().constData());
+        out += "\"}}";
+
+        for (const Event& e : snapshot(*b))
+        {
+            out += ",\n{\"name\":\"";
+            appendEscaped(out, e.name);
+            out += "\",\"cat\":\"";
+            appendEscaped(out, e.cat);
+            out += "\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+            out += QByteArray::number(b->tid);
+            out += ",\"ts\":";
+            out += QByteArray::number(e.startNs / 1000.0, 'f', 3);
+            out += ",\"dur\":";
+            out += QByteArray::number((e.endNs - e.startNs) / 1000.0, 'f', 3);
+            out += '}';
+            flush();
+        }
+    }
+    out += "\n]}\n";
+
+    if (f.write(out) < 0 || !f.flush()) {
+        if (error) *error = f.errorString();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,55 @@
+﻿#pragma once
+#include <QString>
+#include <cstdint>
+
+// Лёгкая трассировка горячих участков: TRACE_SCOPE("stl", "EDT outside") в начале блока
+// пишет событие длительности в кольцевой буфер своего потока (без блокировок, хранятся
+// последние 512K событий потока) — Trace::WriteChromeJson сбрасывает их в формат
+// chrome://tracing / Perfetto. Буфер завершившегося потока переходит к следующему
+// новому; до этого его события остаются в выгрузке.
+// Имена и категории — только строковые литералы (хранится указатель).
+// ASTRO_NO_TRACE в PreprocessorDefinitions убирает макросы из сборки целиком.
+namespace Trace
+{
+    bool Enabled();
+    void SetEnabled(bool on);
+
+    int64_t NowNs();
+    void Record(const char* cat, const char* name, int64_t startNs, int64_t endNs);
+
+    // Сколько событий в буферах и сколько старых уже перезаписано кольцом
+    int64_t EventCount();
+    int64_t DroppedCount();
+
+    // Забыть накопленное (освобождения памяти нет — буферы переиспользуются)
+    void Clear();
+
+    bool WriteChromeJson(const QString& path, QString* error = nullptr);
+
+    class Scope
+    {
+    public:
+        Scope(const char* cat, const char* name)
+            : mCat(cat), mName(name), mStart(Enabled() ? NowNs() : -1) {}
+        ~Scope()
+        {
+            if (mStart >= 0)
+                Record(mCat, mName, mStart, NowNs());
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        const char* mCat;
+        const char* mName;
+        int64_t mStart;
+    };
+}
+
+#ifndef ASTRO_NO_TRACE
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(cat, name) ::Trace::Scope TRACE_CONCAT(traceScope_, __LINE__)(cat, name)
+#else
+#define TRACE_SCOPE(cat, name) ((void)0)
+#endif
@@ -17,7 +17,8 @@ enum WindowType
     TranferFunction = 5,
     Template = 6,
     ServiceWindow = 7,
-    DicomSave = 8
+    DicomSave = 8,
+    Memory = 9
 };
 
 class DialogShell : public QDialog
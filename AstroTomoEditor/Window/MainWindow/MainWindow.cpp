@@ -7,6 +7,8 @@
 #include <QScopedValueRollback>
 #include <Services/Save3DR.h>
 #include <Services/AppConfig.h>
+#include <Services/Trace.h>
+#include <Services/MemoryRegistry.h>
 #include <QApplication>
 #include <QEvent>
 #include <QWindow>
@@ -20,6 +22,7 @@
 #include <QFileInfo>
 #include <QFileDialog>
 #include <QFile>
+#include <QDateTime>
 #include <QDir>
 #include <QHash>
 #include <QSet>
@@ -119,6 +122,8 @@ void MainWindow::buildUi()
     mPlanar->setObjectName("PlanarView");
     mViewerStack->addWidget(mPlanar);
 
+    mSession = new StudySession(this);
+
     // 3D/VTK создаём после ExplorerDialog вместе с главным окном,
     // чтобы первый переход в 3D не пересоздавал OpenGL-контекст на глазах.
     ensureRenderView();
@@ -326,6 +331,38 @@ void MainWindow::buildUi()
                 : RenderView::VolumeInterpolation::Nearest);
         });
 
+    connect(mSettingsDlg, &SettingsDialog::volumeBackendChanged,
+        this, [this](int backend)
+        {
+            if (!mRenderView) return;
+            mRenderView->setVolumeBackend(VolumeRenderBackend::fromInt(backend));
+        });
+
+    connect(mSettingsDlg, &SettingsDialog::frameTimeTargetChanged,
+        this, [this](int ms)
+        {
+            if (!mRenderView) return;
+            mRenderView->setFrameTimeTarget(ms);
+        });
+
+    connect(mSettingsDlg, &SettingsDialog::maxFpsChanged,
+        this, [this](int fps)
+        {
+            if (!mRenderView) return;
+            mRenderView->setMaxFps(fps);
+        });
+
+    mSettingsDlg->setRenderStatsSource([this]() -> QString
+        {
+            if (!mRenderView || !mRenderView->isVisible())
+                return {};
+            const RenderScheduler::Stats st = mRenderView->renderStats();
+            return tr("%1 fps, %2 ms avg, %3 ms max")
+                .arg(QString::number(st.fps, 'f', 1),
+                    QString::number(st.avgMs, 'f', 1),
+                    QString::number(st.maxMs, 'f', 1));
+        });
+
     connect(mSettingsDlg, &SettingsDialog::samplingFactorChanged,
         this, [this](double f)
         {
@@ -333,6 +370,16 @@ void MainWindow::buildUi()
             mRenderView->setSamplingFactor(f);
         });
 
+    connect(mSettingsDlg, &SettingsDialog::saveTraceRequested, this, &MainWindow::onSaveTrace);
+    connect(mSettingsDlg, &SettingsDialog::memoryPanelRequested, this, &MainWindow::showMemoryPanel);
+
+    // выселять больше нечего — предупреждаем в статусе, без модального окна посреди правки
+    connect(&MemoryRegistry::instance(), &MemoryRegistry::overBudget, this, [this](qint64 total, qint64 budget)
+        {
+            showInfo(tr("Memory is running low: %1 MB in use (budget %2 MB). Close other series or lower the history depth.")
+                .arg(total / (1024 * 1024)).arg(budget / (1024 * 1024)));
+        });
+
     retranslateUi(true);
     connect(&LanguageManager::instance(), &LanguageManager::languageChanged,
         this, [this] { retranslateUi(false); });
@@ -537,25 +584,42 @@ void MainWindow::wireSignals()
     connect(mSeries, &SeriesListPanel::patientInfoChanged,
         this, &MainWindow::onSeriesPatientInfoChanged);
 
-    // при активации серии: переключить вид и обновить статус
+    // при активации серии: переключить вид, отложить текущую в сессию и открыть новую
     connect(mSeries, &SeriesListPanel::seriesActivated,
         this, &MainWindow::onSeriesActivated);
 
-    // напрямую прокинем файлы в PlanarView (если у него есть соответствующий слот — оставим через лямбду)
-    connect(mSeries, &SeriesListPanel::seriesActivated,
-        this, [this](const QString&, const QVector<QString>& files) 
+    // выгруженная серия дочитана с диска
+    connect(mSession, &StudySession::studyRestored, this, [this](const QString& uid)
         {
-            if (mPlanar && !files.isEmpty())
-                if (!mPlanar->IsLoading())
-                {
-                    StartLoading();
-                    mPlanar->StartLoading();
-                    mPlanar->loadSeriesFiles(files);
-                }
+            if (uid != mRestoringSeriesUid)
+                return;
+            mRestoringSeriesUid.clear();
+            mPlanar->StopLoading();
+            restoreSeriesFromSession(uid);
+        });
+
+    connect(mSession, &StudySession::studyRestoreFailed, this,
+        [this](const QString& uid, const QVector<QString>& files, const QString&)
+        {
+            if (uid != mRestoringSeriesUid)
+                return;
+            mRestoringSeriesUid.clear();
+            mPlanar->loadSeriesFiles(files);
         });
 
     connect(mSeries, &SeriesListPanel::scanStarted, this,
         [this](int total) {
+            // новое сканирование — прежние серии сессии больше не в списке
+            mSession->clear();
+            mCurrentSeriesUid.clear();
+            mCurrentSeriesFiles.clear();
+            mPendingEdits = {};
+            // дочитка из сессии больше не придёт: studyRestored для очищенной серии не шлётся
+            if (!mRestoringSeriesUid.isEmpty())
+            {
+                mRestoringSeriesUid.clear();
+                mPlanar->StopLoading();
+            }
             mStatusText->setText(tr("DICOM files detection 0%"));
             StartLoading();
             mProgBox->setVisible(true);
@@ -683,6 +747,12 @@ void MainWindow::wireSignals()
     connect(actSave2, &QAction::triggered, this, &MainWindow::onSaveDicom);
     addAction(actSave2);
 
+    // Горячая клавиша Ctrl+Shift+T: трасса для отчёта о медленной работе
+    auto* actTrace = new QAction(tr("Save performance trace"), this);
+    actTrace->setShortcut(QKeySequence(Qt::CTRL | Qt::SHIFT | Qt::Key_T));
+    connect(actTrace, &QAction::triggered, this, &MainWindow::onSaveTrace);
+    addAction(actTrace);
+
     auto sc2 = new QShortcut(QKeySequence(Qt::Key_2), this);
     connect(sc2, &QShortcut::activated, this, [this]
         {
@@ -830,6 +900,50 @@ void MainWindow::onSave3DR()
         mRenderView->saveTemplates(filename);
 }
 
+void MainWindow::onSaveTrace()
+{
+    QSettings s;
+    const QString defDir = s.value(
+        "Paths/LastTraceDir",
+        QStandardPaths::writableLocation(QStandardPaths::DocumentsLocation)
+    ).toString();
+
+    ShellFileDialog shell(this,
+        tr("Save performance trace"),
+        ServiceWindow,
+        QDir(defDir).filePath(QString("astrotomo-trace-%1.json")
+            .arg(QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss"))),
+        tr("Chrome trace (*.json)"));
+
+    auto* dlg = shell.fileDialog();
+    dlg->setAcceptMode(QFileDialog::AcceptSave);
+    dlg->setFileMode(QFileDialog::AnyFile);
+    dlg->setDefaultSuffix("json");
+
+    if (shell.exec() != QDialog::Accepted)
+        return;
+
+    QString path = dlg->selectedFiles().isEmpty() ? QString() : dlg->selectedFiles().first();
+    if (path.isEmpty())
+        return;
+    if (!path.endsWith(".json", Qt::CaseInsensitive))
+        path += ".json";
+
+    s.setValue("Paths/LastTraceDir", QFileInfo(path).absolutePath());
+
+    QString err;
+    if (!Trace::WriteChromeJson(path, &err))
+    {
+        CustomMessageBox::warning(this, tr("Save performance trace"),
+            tr("Failed to write trace: %1").arg(err), ServiceWindow);
+        return;
+    }
+
+    CustomMessageBox::information(this, tr("Save performance trace"),
+        tr("Trace saved (%1 events). Open it in chrome://tracing or ui.perfetto.dev.")
+            .arg(Trace::EventCount()), ServiceWindow);
+}
+
 void MainWindow::onSaveDicom()
 {
     if (!mSeries)
@@ -1166,7 +1280,7 @@ void MainWindow::onSeriesPatientInfoChanged(const PatientInfo& info)
     if (mPatientDlg) mPatientDlg->setInfo(mCurrentPatient);
 }
 
-void MainWindow::onSeriesActivated(const QString& /*seriesUID*/, const QVector<QString>& files)
+void MainWindow::onSeriesActivated(const QString& seriesUID, const QVector<QString>& files)
 {
     StartLoading();
 
@@ -1176,6 +1290,16 @@ void MainWindow::onSeriesActivated(const QString& /*seriesUID*/, const QVector<Q
     if (mPlanar->IsLoading())
         return;
 
+    // электроды, контуры и несохранённые шаблоны в сессию не паркуются
+    if (seriesUID != mCurrentSeriesUid && mRenderView)
+    {
+        const QStringList work = mRenderView->unsavedSeriesWork();
+        if (!work.isEmpty() && !CustomMessageBox::questionYesNo(this, tr("Switch series"),
+            tr("This work on the current series is not kept when switching:\n%1\n\nSwitch anyway?")
+            .arg(work.join("\n"))))
+            return;
+    }
+
     mPlanar->sethidescroll();
 
     if (mRenderView)
@@ -1185,24 +1309,91 @@ void MainWindow::onSeriesActivated(const QString& /*seriesUID*/, const QVector<Q
 
     mViewerStack->setCurrentWidget(mPlanar);
     mStatusText->setText(tr("Series loading…"));
+
+    // повторный клик по той же серии, как и раньше, перечитывает её с диска
+    if (seriesUID != mCurrentSeriesUid)
+        parkCurrentSeries();
+    mPendingEdits = {};
+    mCurrentSeriesUid = seriesUID;
+    mCurrentSeriesFiles = files;
+
+    if (restoreSeriesFromSession(seriesUID))
+        return;
+
+    StartLoading();
+    mPlanar->StartLoading();
+    mPlanar->loadSeriesFiles(files);
 }
 
-void MainWindow::onShowVolume3D()
+void MainWindow::parkCurrentSeries()
 {
-    if (!mPlanar) return;
-
-    auto vtkVol = mPlanar->makeVtkVolume();
-    if (!vtkVol) {
-        mStatusText->setText(tr("Warning"));
+    if (mCurrentSeriesUid.isEmpty() || !mPlanar)
         return;
+
+    // правки, ещё не показанные в 3D, или том с историей из RenderView
+    RenderView::EditState edits = std::exchange(mPendingEdits, {});
+    if (edits.isEmpty() && mRenderView)
+        edits = mRenderView->takeEditState();
+
+    PlanarView::Snapshot planar = mPlanar->takeSnapshot();
+    if (!planar.isEmpty())
+        mSession->park(mCurrentSeriesUid, mCurrentSeriesFiles, std::move(planar), std::move(edits));
+}
+
+bool MainWindow::restoreSeriesFromSession(const QString& seriesUID)
+{
+    PlanarView::Snapshot planar;
+    RenderView::EditState edits;
+    switch (mSession->take(seriesUID, planar, edits))
+    {
+    case StudySession::Take::Missing:
+        return false;
+
+    case StudySession::Take::Restoring:
+        // как обычная загрузка: другие серии не активируются, пока не дочитаем
+        mRestoringSeriesUid = seriesUID;
+        mPlanar->StartLoading();
+        mStatusText->setText(tr("Restoring series from cache…"));
+        mProgBox->setVisible(true);
+        if (mProgress) {
+            mProgress->setVisible(true);
+            mProgress->startLoading();
+        }
+        return true;
+
+    case StudySession::Take::Ready:
+        break;
     }
 
+    mPendingEdits = std::move(edits);
+    mPlanar->restoreSnapshot(std::move(planar));
+    return true;
+}
+
+void MainWindow::onShowVolume3D()
+{
+    if (!mPlanar) return;
+
     auto* renderView = ensureRenderView();
     if (!renderView)
         return;
 
     mCurrentPatient.DicomDirPath = mDicomPath;
-    renderView->setVolume(vtkVol, mPlanar->GetDicomInfo(), mCurrentPatient);
+
+    // серия вернулась из сессии с правками — продолжаем с того же тома и истории
+    if (!mPendingEdits.isEmpty())
+    {
+        renderView->restoreEditState(std::exchange(mPendingEdits, {}), mPlanar->GetDicomInfo(), mCurrentPatient);
+    }
+    else
+    {
+        auto vtkVol = mPlanar->makeVtkVolume();
+        if (!vtkVol) {
+            mStatusText->setText(tr("Warning"));
+            return;
+        }
+        renderView->setVolume(vtkVol, mPlanar->GetDicomInfo(), mCurrentPatient);
+    }
     mViewerStack->setCurrentWidget(renderView);
 
     if (mTitle) { mTitle->set3DChecked(true); mTitle->set2DChecked(false); }
@@ -1251,6 +1442,20 @@ void MainWindow::showPatientDetails()
     mPatientDlg->move(r.center() - QPoint(s.width() / 2, s.height() / 2 + 40));
 }
 
+void MainWindow::showMemoryPanel()
+{
+    if (!mMemoryDlg)
+        mMemoryDlg = new MemoryDialog(this);
+
+    mMemoryDlg->show();
+    mMemoryDlg->raise();
+    mMemoryDlg->activateWindow();
+
+    const QRect r = geometry();
+    const QSize s = mMemoryDlg->size();
+    mMemoryDlg->move(r.center() - QPoint(s.width() / 2, s.height() / 2 + 40));
+}
+
 void MainWindow::showSettings()
 {
     if (!mSettingsDlg)
@@ -12,6 +12,8 @@
 #include "AsyncProgressBar.h"
 #include "SettingsDialog.h"
 #include "DicomSeriesSaveDialog.h"
+#include "MemoryDialog.h"
+#include "StudySession.h"
 
 class QSplitter;
 class QStackedWidget;
@@ -61,6 +63,8 @@ private slots:
     void showSettings();
     void onSave3DR();
     void onSaveDicom();
+    void onSaveTrace();
+    void showMemoryPanel();
 protected:
     void changeEvent(QEvent* e) override;
     void resizeEvent(QResizeEvent* e) override;
@@ -83,6 +87,9 @@ private:
     bool isWindowExpanded(MyWindowState ws) const;
     bool copySelectedDicomSeries(const QString& targetRoot, const QVector<SeriesExportEntry>& selected, bool replaceExistingCt = false);
     QString hdBasePath() const;
+    // сессия исследований: текущая серия уходит в mSession, возвращается без чтения DICOM
+    void parkCurrentSeries();
+    bool restoreSeriesFromSession(const QString& seriesUID);
 
 private:
     // --- данные контекста ---
@@ -104,6 +111,14 @@ private:
     PatientDialog* mPatientDlg{ nullptr };
     SettingsDialog* mSettingsDlg{ nullptr };
     DicomSeriesSaveDialog* mDicomSeriesSaveDlg{ nullptr };
+    MemoryDialog* mMemoryDlg{ nullptr };
+
+    // --- сессия исследований ---
+    StudySession* mSession{ nullptr };
+    QString mCurrentSeriesUid;
+    QVector<QString> mCurrentSeriesFiles;
+    QString mRestoringSeriesUid;         // ждём фонового чтения выгруженной серии
+    RenderView::EditState mPendingEdits; // правки серии, применятся при переходе в 3D
 
     // --- нижняя панель / статус ---
     QWidget* mFooter{ nullptr };
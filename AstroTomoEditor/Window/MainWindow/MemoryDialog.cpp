@@ -0,0 +1,192 @@
+﻿#include "MemoryDialog.h"
+
+#include <QFormLayout>
+#include <QGridLayout>
+#include <QLabel>
+#include <QSpinBox>
+#include <QVBoxLayout>
+#include <Services/MemoryRegistry.h>
+#include <algorithm>
+
+namespace {
+    constexpr qint64 kMB = qint64(1024) * 1024;
+
+    QString mbText(qint64 bytes)
+    {
+        return QObject::tr("%1 MB").arg(QString::number(double(bytes) / kMB, 'f', 0));
+    }
+}
+
+MemoryDialog::MemoryDialog(QWidget* parent)
+    : DialogShell(parent, QObject::tr("Memory"), WindowType::Memory)
+{
+    setWindowFlag(Qt::Tool);
+    setFixedSize(460, 420);
+
+    QWidget* content = contentWidget();
+    content->setObjectName("MemoryDialogContent");
+
+    auto* v = new QVBoxLayout(content);
+    v->setContentsMargins(16, 12, 16, 16);
+    v->setSpacing(10);
+
+    auto* form = new QFormLayout();
+    form->setContentsMargins(0, 0, 0, 0);
+    form->setHorizontalSpacing(20);
+    form->setVerticalSpacing(8);
+    form->setLabelAlignment(Qt::AlignLeft | Qt::AlignVCenter);
+
+    lblTotal = new QLabel(content);
+    lblTotal->setProperty("role", "label");
+    mTotal = new QLabel(content);
+    form->addRow(lblTotal, mTotal);
+
+    // общий бюджет: при превышении выселяются кеши, потом старая история правок
+    lblBudget = new QLabel(content);
+    lblBudget->setProperty("role", "label");
+    mBudget = new QSpinBox(content);
+    mBudget->setRange(0, int(std::max<qint64>(MemoryRegistry::PhysicalBytes() / kMB, 1024)));
+    mBudget->setSingleStep(256);
+    mBudget->setSuffix(tr(" MB"));
+    mBudget->setSpecialValueText(tr("Unlimited"));
+    mBudget->setValue(int(MemoryRegistry::instance().totalBudget() / kMB));
+    form->addRow(lblBudget, mBudget);
+
+    connect(mBudget, qOverload<int>(&QSpinBox::valueChanged), this, [](int mb)
+        {
+            MemoryRegistry::instance().setTotalBudget(qint64(mb) * kMB);
+        });
+
+    lblPhysical = new QLabel(content);
+    lblPhysical->setProperty("role", "label");
+    mPhysical = new QLabel(content);
+    form->addRow(lblPhysical, mPhysical);
+
+    v->addLayout(form);
+
+    mGrid = new QGridLayout();
+    mGrid->setContentsMargins(0, 8, 0, 0);
+    mGrid->setHorizontalSpacing(12);
+    mGrid->setVerticalSpacing(6);
+
+    hdrSubsystem = new QLabel(content);
+    hdrSize = new QLabel(content);
+    hdrBudget = new QLabel(content);
+    for (QLabel* h : { hdrSubsystem, hdrSize, hdrBudget })
+        h->setProperty("role", "label");
+    mGrid->addWidget(hdrSubsystem, 0, 0);
+    mGrid->addWidget(hdrSize, 0, 1, Qt::AlignRight);
+    mGrid->addWidget(hdrBudget, 0, 2);
+    mGrid->setColumnStretch(0, 1);
+
+    v->addLayout(mGrid);
+    v->addStretch(1);
+
+    content->setStyleSheet(
+        "#MemoryDialogContent { background: transparent; }"
+        "QLabel { color:#e6e6e6; }"
+        "QLabel[role=\"label\"] { color:rgba(255,255,255,0.70); }"
+    );
+
+    connect(&MemoryRegistry::instance(), &MemoryRegistry::updated, this, [this]
+        {
+            if (isVisible())
+                refresh();
+        });
+
+    retranslateUi();
+    refresh();
+}
+
+void MemoryDialog::rebuildRows(const QStringList& keys)
+{
+    for (const Row& r : mRows)
+    {
+        delete r.title;
+        delete r.bytes;
+        delete r.budget;
+    }
+    mRows.clear();
+    mKeys = keys;
+
+    QWidget* content = contentWidget();
+    auto& reg = MemoryRegistry::instance();
+    const auto entries = reg.snapshot();
+
+    int row = 1;
+    for (const auto& e : entries)
+    {
+        Row r;
+        r.title = new QLabel(e.title, content);
+        r.bytes = new QLabel(content);
+        mGrid->addWidget(r.title, row, 0);
+        mGrid->addWidget(r.bytes, row, 1, Qt::AlignRight);
+
+        // свой бюджет имеет смысл только там, где есть что выселять
+        if (e.evictable)
+        {
+            r.budget = new QSpinBox(content);
+            r.budget->setRange(0, mBudget->maximum());
+            r.budget->setSingleStep(128);
+            r.budget->setSuffix(tr(" MB"));
+            r.budget->setSpecialValueText(tr("Shared"));
+            r.budget->setValue(int(e.budget / kMB));
+            mGrid->addWidget(r.budget, row, 2);
+
+            const QString key = e.key;
+            connect(r.budget, qOverload<int>(&QSpinBox::valueChanged), this, [key](int mb)
+                {
+                    MemoryRegistry::instance().setBudget(key, qint64(mb) * kMB);
+                });
+        }
+        mRows.insert(e.key, r);
+        ++row;
+    }
+}
+
+void MemoryDialog::refresh()
+{
+    auto& reg = MemoryRegistry::instance();
+    const auto entries = reg.snapshot();
+
+    QStringList keys;
+    for (const auto& e : entries)
+        keys << e.key;
+    if (keys != mKeys)
+        rebuildRows(keys);
+
+    qint64 total = 0;
+    for (const auto& e : entries)
+    {
+        total += e.bytes;
+        const auto it = mRows.constFind(e.key);
+        if (it != mRows.cend())
+            it->bytes->setText(mbText(e.bytes));
+    }
+
+    const qint64 budget = reg.totalBudget();
+    mTotal->setText(mbText(total));
+    mTotal->setStyleSheet(budget > 0 && total > budget ? "color:#ff8a80;" : QString());
+
+    mPhysical->setText(tr("%1 free of %2")
+        .arg(mbText(MemoryRegistry::AvailablePhysicalBytes()), mbText(MemoryRegistry::PhysicalBytes())));
+}
+
+void MemoryDialog::retranslateUi()
+{
+    DialogShell::retranslateUi();
+
+    const QString title = tr("Memory");
+    setWindowTitle(title);
+    if (titleBar())
+        titleBar()->setTitle(title);
+
+    lblTotal->setText(tr("Tracked:"));
+    lblBudget->setText(tr("Budget:"));
+    lblPhysical->setText(tr("Physical RAM:"));
+    hdrSubsystem->setText(tr("Subsystem"));
+    hdrSize->setText(tr("Size"));
+    hdrBudget->setText(tr("Own budget"));
+    mBudget->setSuffix(tr(" MB"));
+    mBudget->setSpecialValueText(tr("Unlimited"));
+}
@@ -0,0 +1,51 @@
+﻿#pragma once
+
+#include "DialogShell.h"
+#include <QEvent>
+#include <QHash>
+#include <QStringList>
+
+class QGridLayout;
+class QLabel;
+class QSpinBox;
+
+// Панель «Память»: живые байты по подсистемам из MemoryRegistry и их бюджеты.
+class MemoryDialog : public DialogShell
+{
+    Q_OBJECT
+public:
+    explicit MemoryDialog(QWidget* parent = nullptr);
+    void retranslateUi();
+    void changeEvent(QEvent* e) override
+    {
+        QDialog::changeEvent(e);
+        if (e->type() == QEvent::LanguageChange)
+            retranslateUi();
+    }
+
+private:
+    void refresh();
+    void rebuildRows(const QStringList& keys);
+
+    struct Row
+    {
+        QLabel* title = nullptr;
+        QLabel* bytes = nullptr;
+        QSpinBox* budget = nullptr; // только у выселяемых
+    };
+
+    QLabel* lblTotal = nullptr;
+    QLabel* mTotal = nullptr;
+    QLabel* lblBudget = nullptr;
+    QSpinBox* mBudget = nullptr;
+    QLabel* lblPhysical = nullptr;
+    QLabel* mPhysical = nullptr;
+
+    QLabel* hdrSubsystem = nullptr;
+    QLabel* hdrSize = nullptr;
+    QLabel* hdrBudget = nullptr;
+
+    QGridLayout* mGrid = nullptr;
+    QStringList mKeys;
+    QHash<QString, Row> mRows;
+};
@@ -2,8 +2,11 @@
 #include "PlanarView.h"
 #include <Services/VolumeFix3DR.h>
 #include <Services/DicomRange.h>
+#include <Services/MemoryRegistry.h>
+#include <Services/SeriesVolume.h>
+#include <Services/Trace.h>
 #include <vtkDICOMApplyRescale.h>
-#include <vtk-9.5/vtkGDCMImageReader.h>
+#include <vtkGDCMImageReader.h>
 #include <vtkImageCast.h>
 
 #include <algorithm>
@@ -12,19 +15,6 @@
 #include <numeric>
 #include <vector>
 
-namespace {
-    class VtkErrorCatcher : public vtkCommand {
-    public:
-        static VtkErrorCatcher* New() { return new VtkErrorCatcher; }
-        void Execute(vtkObject*, unsigned long, void* callData) override {
-            hasError = true;
-            if (callData) message = static_cast<const char*>(callData);
-        }
-        bool hasError = false;
-        std::string message;
-    };
-}
-
 
 static std::vector<int> buildSampleIndices(int first, int last, int step)
 {
@@ -39,104 +29,145 @@ static std::vector<int> buildSampleIndices(int first, int last, int step)
     return out;
 }
 
-// --- Сглаживание и поиск первого значимого пика справа от threshold ---
-// mH        — входная гистограмма (256 значений)
-// threshold — индекс, откуда начинаем поиск
-// outPeak   — возвращает индекс найденного пика
-// minFrac   — минимальная доля от глобального максимума (0..1)
-// minWidth  — минимальная ширина пика (в бинах) по FWHM
-// minPromFrac — минимальная проминентность как доля от глобального максимума
-// Первый осмысленный пик справа от threshold (берём самый первый, а не "лучший")
-static bool detectFirstPeakAfter(const QVector<uint32_t>& mH,
-    int threshold,
-    int& outPeak,
-    double minFrac = 0.05,
-    int    minWidthSoft = 3) // 0 = не требовать ширину
+PlanarView::PlanarView(QWidget* parent) : QWidget(parent)
 {
-    const int N = mH.size();
-    if (N < 3 || threshold >= N - 2) return false;
-
-    // 1) Сглаживание (box 9)
-    const int win = 9, R = win / 2;
-    QVector<double> h(N);
-    auto at = [&](int i) {
-        if (i < 0) i = -i;
-        if (i >= N) i = 2 * (N - 1) - i;
-        return double(mH[i]);
-        };
-    for (int i = 0; i < N; ++i) {
-        double s = 0; for (int k = -R; k <= R; ++k) s += at(i + k);
-        h[i] = s / win;
-    }
+    initUi();
+    connect(mScroll, &QSlider::valueChanged, this, &PlanarView::setSlice);
+    retranslateUi();
 
-    // 2) Порог по амплитуде
-    const double maxVal = *std::max_element(h.begin(), h.end());
-    if (maxVal <= 0.0) return false;
-    const double minPeakHeight = maxVal * std::clamp(minFrac, 0.0, 1.0);
-
-    // Вспомогалки
-    auto deriv = [&](int i) { return h[i + 1] - h[i]; };
-    auto fwhm = [&](int p)->int {
-        const double half = h[p] * 0.5;
-        int L = p, Rr = p;
-        while (L > 0 && h[L] > half) --L;
-        while (Rr<N - 1 && h[Rr]>half) ++Rr;
-        return Rr - L;
-        };
+    // срезы ужимаются раньше истории правок: это без потерь
+    mMemorySource = MemoryRegistry::instance().addSource("planar.slices", tr("2D slice cache"),
+        [this] { return sliceCacheBytes(); },
+        [this](qint64 want) { return packSlices(want); }, 20);
+}
 
-    // 3) Поиск ПЕРВОГО пика с поддержкой плато
-    const double epsFlat = maxVal * 1e-4;
-    const int    maxFlat = 12;
+PlanarView::~PlanarView()
+{
+    MemoryRegistry::instance().removeSource(mMemorySource);
+}
 
-    bool inRise = false; int riseStart = -1;
+QImage PlanarView::sliceAt(int i) const
+{
+    if (i < 0 || i >= mSlices.size())
+        return {};
+    if (!mSlices[i].isNull() || i >= mPacked.size() || mPacked[i].isEmpty())
+        return mSlices[i];
 
-    for (int i = std::max(threshold + 1, 1); i < N - 2; ++i)
-    {
-        const double d0 = deriv(i - 1);
-        const double d1 = deriv(i);
+    return UnpackSlice(mPacked[i], X, Y);
+}
 
-        if (!inRise && d0 > 0) { inRise = true; riseStart = i - 1; }
+QByteArray PlanarView::PackSlice(const QImage& slice)
+{
+    return qCompress(slice.constBits(), slice.sizeInBytes(), 1);
+}
 
-        if (inRise)
-        {
-            // плато
-            int j = i, flat = 0;
-            while (j < N - 2 && std::abs(deriv(j)) <= epsFlat && flat < maxFlat) { ++j; ++flat; }
+QImage PlanarView::UnpackSlice(const QByteArray& packed, int w, int h)
+{
+    QImage img(w, h, QImage::Format_Grayscale8);
+    const QByteArray raw = qUncompress(packed);
+    if (raw.size() != img.sizeInBytes())
+        return {};
+    memcpy(img.bits(), raw.constData(), size_t(raw.size()));
+    return img;
+}
 
-            // начался спуск либо уже спускаемся
-            if ((j < N - 2 && (deriv(j) < -epsFlat || h[j + 1] < h[j])) || d1 < 0)
-            {
-                // максимум на вершине ростового сегмента
-                int L = std::max(riseStart, 0);
-                int Rr = std::min(j + 1, N - 1);
-                int p = L;
-                for (int k = L + 1; k <= Rr; ++k) if (h[k] > h[p]) p = k;
-
-                // ВАЖНО: проверяем только высоту (и необязательную мягкую ширину)
-                if (h[p] >= minPeakHeight) {
-                    if (fwhm(p) < 5) {  // слишком узкий — флуктуация
-                        inRise = false;
-                        riseStart = -1;
-                        continue;       // ищем дальше
-                    }
-                    outPeak = p;
-                    return true;
-                }
+qint64 PlanarView::Snapshot::bytes() const
+{
+    qint64 total = 0;
+    for (const QImage& s : slices)
+        total += s.sizeInBytes();
+    for (const QByteArray& p : packed)
+        total += p.size();
+    return total;
+}
 
-                // иначе ищем дальше
-                inRise = false; riseStart = -1;
-                i = std::max(p, i);
-            }
-        }
-    }
-    return false;
+qint64 PlanarView::sliceCacheBytes() const
+{
+    qint64 total = 0;
+    for (const QImage& s : mSlices)
+        total += s.sizeInBytes();
+    for (const QByteArray& p : mPacked)
+        total += p.size();
+    return total;
 }
 
-PlanarView::PlanarView(QWidget* parent) : QWidget(parent)
+PlanarView::Snapshot PlanarView::takeSnapshot()
 {
-    initUi();
-    connect(mScroll, &QSlider::valueChanged, this, &PlanarView::setSlice);
-    retranslateUi();
+    Snapshot s;
+    if (loading || mSlices.isEmpty())
+        return s;
+
+    s.slices = std::move(mSlices);
+    s.packed = std::move(mPacked);
+    s.dicom = Dicom;
+    s.x = X; s.y = Y; s.z = Z;
+    s.sp[0] = mSpX; s.sp[1] = mSpY; s.sp[2] = mSpZ;
+    s.originSpZ = OriginSpZ;
+    s.flip[0] = flipX; s.flip[1] = flipY; s.flip[2] = flipZ;
+    s.reconstructable = avalibletoreconstruction;
+    s.dir = mDir;
+    std::copy(mOrg, mOrg + 3, s.org);
+    s.index = mIndex;
+
+    resetScene();
+    return s;
+}
+
+void PlanarView::restoreSnapshot(Snapshot s)
+{
+    TRACE_SCOPE("load", "restoreSnapshot");
+    resetScene();
+
+    mSlices = std::move(s.slices);
+    mPacked = std::move(s.packed);
+    Dicom = s.dicom;
+    X = s.x; Y = s.y; Z = s.z;
+    mSpX = s.sp[0]; mSpY = s.sp[1]; mSpZ = s.sp[2];
+    OriginSpZ = s.originSpZ;
+    flipX = s.flip[0]; flipY = s.flip[1]; flipZ = s.flip[2];
+    avalibletoreconstruction = s.reconstructable;
+    mDir = s.dir;
+    std::copy(s.org, s.org + 3, mOrg);
+
+    finishLoad();
+    if (!mSlices.isEmpty())
+        mScroll->setValue(std::clamp(s.index, 0, int(mSlices.size() - 1)));
+}
+
+void PlanarView::resetScene()
+{
+    clearSlices();
+    mIndex = 0;
+    mScene->clear();
+    avalibletoreconstruction = false;
+    mImageItem = mScene->addPixmap(QPixmap());
+}
+
+qint64 PlanarView::packSlices(qint64 want)
+{
+    if (mSlices.isEmpty() || loading)
+        return 0;
+    mPacked.resize(mSlices.size());
+
+    // от дальних к ближним; окно вокруг текущего среза остаётся распакованным для листания
+    constexpr int kKeepNear = 8;
+    const int n = int(mSlices.size());
+    qint64 freed = 0;
+    for (int dist = n; dist > kKeepNear && freed < want; --dist)
+    {
+        for (int i : { mIndex - dist, mIndex + dist })
+        {
+            if (i < 0 || i >= n || mSlices[i].isNull())
+                continue;
+            const QImage& s = mSlices[i];
+            if (s.format() != QImage::Format_Grayscale8 || s.width() != X || s.height() != Y)
+                continue;
+            mPacked[i] = PackSlice(s);
+            freed += s.sizeInBytes() - mPacked[i].size();
+            mSlices[i] = QImage();
+        }
+    }
+    return std::max<qint64>(0, freed);
 }
 
 void PlanarView::initUi()
@@ -236,31 +267,9 @@ void PlanarView::initUi()
 #include <cmath> 
 #include <algorithm> 
 
-vtkSmartPointer<vtkImageData> shrinkAlongAxis(vtkImageData* src, int axis, int factor)
-{
-    if (!src || factor <= 1)
-        return src;
-
-    auto shrink = vtkSmartPointer<vtkImageShrink3D>::New();
-    shrink->SetInputData(src);
-
-    int fx = 1, fy = 1, fz = 1;
-    if (axis == 0) fx = factor;
-    if (axis == 1) fy = factor;
-    if (axis == 2) fz = factor;
-
-    shrink->SetShrinkFactors(fx, fy, fz);
-    shrink->AveragingOn();      // усредняем, а не просто выбрасываем
-
-    shrink->Update();
-
-    auto out = vtkSmartPointer<vtkImageData>::New();
-    out->DeepCopy(shrink->GetOutput());  // отцепиться от pipeline
-    return out;
-}
-
 vtkSmartPointer<vtkImageData> PlanarView::makeVtkVolume() const
 {
+    TRACE_SCOPE("load", "makeVtkVolume");
     if (mSlices.isEmpty()) return nullptr;
 
     const int w = X;
@@ -268,18 +277,9 @@ vtkSmartPointer<vtkImageData> PlanarView::makeVtkVolume() const
     const int d = Z;
 
     for (const QImage& im : mSlices)
-        if (im.width() != w || im.height() != h)
+        if (!im.isNull() && (im.width() != w || im.height() != h))
             return nullptr;
 
-    QVector<QImage> gray;
-    gray.reserve(d);
-    for (const QImage& s : mSlices) {
-        gray.push_back(
-            s.format() == QImage::Format_Grayscale8
-            ? s
-            : s.convertToFormat(QImage::Format_Grayscale8));
-    }
-
     auto vol = vtkSmartPointer<vtkImageData>::New();
     vol->SetDimensions(w, h, d);
     vol->AllocateScalars(VTK_UNSIGNED_CHAR, 1);
@@ -293,9 +293,15 @@ vtkSmartPointer<vtkImageData> PlanarView::makeVtkVolume() const
     vol->SetDirectionMatrix(dir);
     vol->SetOrigin(mOrg);
 
+    // ужатые срезы распаковываются по одному, без второй копии всего стека
     for (int z = 0; z < d; ++z) {
-        const uchar* src = gray[z].constBits();
-        const int stride = gray[z].bytesPerLine();
+        QImage gray = sliceAt(z);
+        if (gray.isNull())
+            return nullptr;
+        if (gray.format() != QImage::Format_Grayscale8)
+            gray = gray.convertToFormat(QImage::Format_Grayscale8);
+        const uchar* src = gray.constBits();
+        const int stride = gray.bytesPerLine();
         for (int y = 0; y < h; ++y) {
             auto* dst = static_cast<uchar*>(vol->GetScalarPointer(0, y, z));
             memcpy(dst, src + y * stride, w);
@@ -303,29 +309,8 @@ vtkSmartPointer<vtkImageData> PlanarView::makeVtkVolume() const
     }
     vol->Modified();
 
-    // --- shrink по Z, если слайсы слишком тонкие ---
-    double sp[3]{};
-    vol->GetSpacing(sp);
-
-    const double minSliceThickness = std::min(sp[0], sp[1]); // мм
-
-    if (sp[2] > 0.0 && sp[2] < minSliceThickness && d > 1) {
-        // во сколько раз нужно утолщить, чтобы >= minSliceThickness мм
-        int factor = static_cast<int>(std::ceil(minSliceThickness / sp[2]));
-        if (factor < 2) factor = 2;          // смысл есть только при factor >= 2
-
-        // не даём фактору убить объём до 1 среза
-        int maxFactor = std::max(2, d / 2);  // оставим хотя бы половину срезов
-        factor = std::min(factor, maxFactor);
-
-        if (factor > 1) 
-        {
-            return shrinkAlongAxis(vol, /*axis=*/2, factor);
-        }
-    }
-
-    
-    return vol;
+    // слишком тонкие срезы утолщаем усреднением по Z
+    return SeriesVolume::ThickenThinSlices(vol);
 }
 
 bool PlanarView::eventFilter(QObject* obj, QEvent* ev)
@@ -525,6 +510,7 @@ static bool canReconstructVolume(const QVector<QString>& files)
 
 void PlanarView::loadSeriesFiles(const QVector<QString>& files)
 {
+    TRACE_SCOPE("load", "loadSeriesFiles");
     emit loadStarted(0);
     emit showInfo(tr("Preparing…"));
     qApp->processEvents(QEventLoop::ExcludeUserInputEvents);
@@ -552,12 +538,16 @@ void PlanarView::loadSeriesFiles(const QVector<QString>& files)
         emit loadProgress(100, 100);
         pump();
         };
+    auto readGeometry = [this](vtkDICOMMetaData* m) {
+        double dir[9], org[3];
+        SeriesVolume::ReadOrientation(m, dir, org);
+        for (int r = 0; r < 3; ++r)
+            for (int c = 0; c < 3; ++c)
+                mDir(r, c) = float(dir[r * 3 + c]);
+        mOrg[0] = org[0]; mOrg[1] = org[1]; mOrg[2] = org[2];
+        };
 
-    mSlices.clear();
-    mIndex = 0;
-    mScene->clear();
-    avalibletoreconstruction = false;
-    mImageItem = mScene->addPixmap(QPixmap());
+    resetScene();
 
     if (files.isEmpty()) {
         mScroll->setRange(0, 0);
@@ -578,7 +568,10 @@ void PlanarView::loadSeriesFiles(const QVector<QString>& files)
         QString err; bool isMRI = false;
 
         // если Load3DR_Normalized внутри долго читает файл — дай пользователю жизнь
-        volume = Load3DR_Normalized(files.front(), isMRI);
+        {
+            TRACE_SCOPE("load", "Load3DR_Normalized");
+            volume = Load3DR_Normalized(files.front(), isMRI);
+        }
         phaseStep(50, tr("3DR: normalizing…"));   // «фиктивный» шаг посередине
         pump();
 
@@ -590,17 +583,7 @@ void PlanarView::loadSeriesFiles(const QVector<QString>& files)
         }
 
         // DICOM-поля для .3dr
-        if (isMRI) {
-            Dicom.TypeOfRecord = MRI3DR;
-            Dicom.physicalMin = 0;    Dicom.physicalMax = 255;
-            Dicom.RealMin = 0;    Dicom.RealMax = 255;
-        }
-        else {
-            Dicom.TypeOfRecord = CT3DR;
-            Dicom.physicalMin = 0;    Dicom.physicalMax = 2000;
-            Dicom.RealMin = -1000; Dicom.RealMax = 1000;
-        }
-        Dicom.slope = 1.0; Dicom.intercept = 0.0;
+        SeriesVolume::Apply3drDefaults(isMRI, Dicom);
 
         // Ориентация по умолчанию
         mDir = QMatrix3x3(); mDir(0, 0) = mDir(1, 1) = mDir(2, 2) = 1.0f;
@@ -625,10 +608,13 @@ void PlanarView::loadSeriesFiles(const QVector<QString>& files)
         // 1) метаданные/сортировка
         phaseStart(tr("Reading DICOM metadata…"));
         vtkSmartPointer<vtkDICOMReader> mdReader = vtkSmartPointer<vtkDICOMReader>::New();
-        auto errObs1 = vtkSmartPointer<VtkErrorCatcher>::New();
+        auto errObs1 = vtkSmartPointer<SeriesVolume::ErrorCatcher>::New();
         mdReader->AddObserver(vtkCommand::ErrorEvent, errObs1);
         mdReader->SetFileNames(names);
-        mdReader->UpdateInformation();
+        {
+            TRACE_SCOPE("load", "DICOM metadata");
+            mdReader->UpdateInformation();
+        }
 
 
 
@@ -658,13 +644,16 @@ void PlanarView::loadSeriesFiles(const QVector<QString>& files)
         if (!isCompressed) {
             phaseStart(tr("Decoding pixels… (uncompressed)"));
             auto pixReader = vtkSmartPointer<vtkDICOMReader>::New();
-            auto errObs2 = vtkSmartPointer<VtkErrorCatcher>::New();
+            auto errObs2 = vtkSmartPointer<SeriesVolume::ErrorCatcher>::New();
             pixReader->AddObserver(vtkCommand::ErrorEvent, errObs2);
             pixReader->SetFileNames(names);
             pixReader->UpdateInformation();
             phaseStep(40, tr("Allocating image…"));
             pump();
-            pixReader->Update();
+            {
+                TRACE_SCOPE("load", "decode pixels");
+                pixReader->Update();
+            }
             phaseStep(90, tr("Preparing geometry…"));
             pump();
 
@@ -676,27 +665,8 @@ void PlanarView::loadSeriesFiles(const QVector<QString>& files)
             }
             volume = pixReader->GetOutput();
             srcPort = pixReader->GetOutputPort();
-            {
-                // Геометрия LPS
-                double iop[6]{ 1,0,0, 0,1,0 };
-                if (md->Has(DC::ImageOrientationPatient)) {
-                    const auto v = md->Get(DC::ImageOrientationPatient);
-                    for (int i = 0; i < 6 && i < v.GetNumberOfValues(); ++i) iop[i] = v.GetDouble(i);
-                }
-                const QVector3D RR(iop[0], iop[1], iop[2]);
-                const QVector3D CC(iop[3], iop[4], iop[5]);
-
-                const QVector3D NN = QVector3D::crossProduct(RR, CC);
-                mDir = QMatrix3x3();
-                mDir(0, 0) = RR.x(); mDir(1, 0) = RR.y(); mDir(2, 0) = RR.z();
-                mDir(0, 1) = CC.x(); mDir(1, 1) = CC.y(); mDir(2, 1) = CC.z();
-                mDir(0, 2) = NN.x(); mDir(1, 2) = NN.y(); mDir(2, 2) = NN.z();
-                if (md->Has(DC::ImagePositionPatient)) 
-                {
-                    const auto ipp = md->Get(DC::ImagePositionPatient);
-                    mOrg[0] = ipp.GetDouble(0); mOrg[1] = ipp.GetDouble(1); mOrg[2] = ipp.GetDouble(2);
-                }
-            }
+            // Геометрия LPS
+            readGeometry(md);
             // DICOM-диапазоны/VOI
             phaseDone();
             {
@@ -708,15 +678,21 @@ void PlanarView::loadSeriesFiles(const QVector<QString>& files)
         else {
             phaseStart(tr("Decoding pixels… (compressed via GDCM)"));
             vtkSmartPointer<vtkGDCMImageReader> gdcm = vtkSmartPointer<vtkGDCMImageReader>::New();
-            auto errObs2 = vtkSmartPointer<VtkErrorCatcher>::New();
+            auto errObs2 = vtkSmartPointer<SeriesVolume::ErrorCatcher>::New();
             gdcm->AddObserver(vtkCommand::ErrorEvent, errObs2);
             gdcm->SetFileNames(names);
 
-            gdcm->UpdateInformation();               // долгая точка №1
+            {
+                TRACE_SCOPE("load", "GDCM information");
+                gdcm->UpdateInformation();           // долгая точка №1
+            }
             phaseStep(35, tr("Preparing decoder…"));
             pump();
 
-            gdcm->Update();                          // долгая точка №2
+            {
+                TRACE_SCOPE("load", "GDCM decode");
+                gdcm->Update();                      // долгая точка №2
+            }
             phaseStep(85, tr("Preparing geometry…"));
             pump();
 
@@ -731,22 +707,7 @@ void PlanarView::loadSeriesFiles(const QVector<QString>& files)
 
 
             // Геометрия LPS — по метаданным mdReader (единое место истины)
-            double iop[6]{ 1,0,0, 0,1,0 };
-            if (md->Has(DC::ImageOrientationPatient)) {
-                const auto v = md->Get(DC::ImageOrientationPatient);
-                for (int i = 0; i < 6 && i < v.GetNumberOfValues(); ++i) iop[i] = v.GetDouble(i);
-            }
-            const QVector3D RR(iop[0], iop[1], iop[2]);
-            const QVector3D CC(iop[3], iop[4], iop[5]);
-            const QVector3D NN = QVector3D::crossProduct(RR, CC);
-            mDir = QMatrix3x3();
-            mDir(0, 0) = RR.x(); mDir(1, 0) = RR.y(); mDir(2, 0) = RR.z();
-            mDir(0, 1) = CC.x(); mDir(1, 1) = CC.y(); mDir(2, 1) = CC.z();
-            mDir(0, 2) = NN.x(); mDir(1, 2) = NN.y(); mDir(2, 2) = NN.z();
-            if (md->Has(DC::ImagePositionPatient)) {
-                const auto ipp = md->Get(DC::ImagePositionPatient);
-                mOrg[0] = ipp.GetDouble(0); mOrg[1] = ipp.GetDouble(1); mOrg[2] = ipp.GetDouble(2);
-            }
+            readGeometry(md);
 
             phaseStep(90, tr("Estimating spacing…"));
             pump();
@@ -758,32 +719,11 @@ void PlanarView::loadSeriesFiles(const QVector<QString>& files)
                 OriginSpZ = sp[2];
                 const bool zLooksWrong = !(sp[2] > 0.0) || sp[2] == 1.0; // частая «затычка» по умолчанию
                 if (zLooksWrong) {
-                    // Собираем скаляр s = dot(IPP, N) по всем файлам и берём медианный шаг
-                    QVector<double> s; s.reserve(names->GetNumberOfValues());
-                    for (vtkIdType i = 0; i < names->GetNumberOfValues(); ++i) {
-                        const std::string fname = names->GetValue(i);
-                        vtkNew<vtkDICOMParser>    parser;
-                        vtkNew<vtkDICOMMetaData>  meta;
-                        parser->SetMetaData(meta);
-                        parser->SetFileName(fname.c_str());
-                        parser->Update(); // быстро: читает только теги
-                        if (meta->Has(DC::ImagePositionPatient)) {
-                            const auto ipp = meta->Get(DC::ImagePositionPatient);
-                            const QVector3D P(ipp.GetDouble(0), ipp.GetDouble(1), ipp.GetDouble(2));
-                            s.push_back(QVector3D::dotProduct(P, NN));
-                        }
-                    }
-                    std::sort(s.begin(), s.end());
-                    QVector<double> step; step.reserve(std::max(0, (int)s.size() - 1));
-                    for (int i = 1; i < s.size(); ++i) {
-                        const double d = std::abs(s[i] - s[i - 1]);
-                        if (d > 1e-9) step.push_back(d);
-                    }
-                    if (!step.isEmpty()) {
-                        auto mid = step.begin() + step.size() / 2;
-                        std::nth_element(step.begin(), mid, step.end());
-                        sp[2] = std::max(1e-6, *mid);
-                    }
+                    // медианный шаг по проекции IPP на нормаль
+                    const double normal[3]{ mDir(0, 2), mDir(1, 2), mDir(2, 2) };
+                    const double step = SeriesVolume::MedianSliceStep(names, normal);
+                    if (step > 0.0)
+                        sp[2] = step;
                 }
 
                 // сохраняем в поля класса (volume менять не обязательно)
@@ -811,47 +751,7 @@ void PlanarView::loadSeriesFiles(const QVector<QString>& files)
 
         // Доп. интерпретация modality / VOI
         phaseStart(tr("Interpreting modality…"));
-        vtkDICOMMetaData* md2 = mdReader->GetMetaData();
-        QString modalityStr;
-        if (md2) {
-            if (md2->Has(DC::PhotometricInterpretation)) {
-                const QString phot = QString::fromStdString(md2->Get(DC::PhotometricInterpretation).AsString()).toUpper();
-                invertMono1 = (phot == "MONOCHROME1");
-            }
-            if (md2->Has(DC::Modality))
-                modalityStr = QString::fromStdString(md2->Get(DC::Modality).AsString()).toUpper();
-        }
-
-        // Заодно сохраним «инверсию» сразу в Dicom.TypeOfRecord и передадим в buildCache (ниже).
-        if (modalityStr == "CT") {
-            Dicom.TypeOfRecord = CT;
-            if (Dicom.intercept < -1000)
-            {
-                Dicom.physicalMin = 0;
-                Dicom.physicalMax = 2048;
-            }
-            else
-            {
-                Dicom.physicalMin = -1024;
-                Dicom.physicalMax = 1024;
-            }
-            Dicom.RealMin = -1000;
-            Dicom.RealMax = 1000;
-            Dicom.XTitle = tr("Hounsfield Units");
-            Dicom.YTitle = tr("Voxel count");
-            Dicom.XLable = tr("HU");
-            Dicom.YLable = tr("N");
-        }
-        else if (modalityStr == "MR" || modalityStr == "MRI")
-        {
-            Dicom.TypeOfRecord = MRI;
-            Dicom.physicalMin = -500; Dicom.physicalMax = 1500;
-            Dicom.RealMin = 0; Dicom.RealMax = 255;
-            Dicom.XTitle = tr("MRI intensity");
-            Dicom.YTitle = tr("Voxel count");
-            Dicom.XLable = tr("AU");
-            Dicom.YLable = tr("N");
-        }
+        invertMono1 = SeriesVolume::ApplyModality(mdReader->GetMetaData(), Dicom);
         phaseDone();
     }
 
@@ -877,6 +777,11 @@ void PlanarView::loadSeriesFiles(const QVector<QString>& files)
     buildCache(volume, srcPort, invertMono1, Dicom);
     avalibletoreconstruction = (Z > 1) && !mSlices.isEmpty();
 
+    finishLoad();
+}
+
+void PlanarView::finishLoad()
+{
     // --- UI финализация ---
     if (mSlices.isEmpty()) {
         mScroll->setRange(0, 0);
@@ -901,54 +806,14 @@ void PlanarView::loadSeriesFiles(const QVector<QString>& files)
 
 // ===== cache / display ======================================================
 
-static inline uchar wl8(double v, double min, double max, Mode TypeOfRecord, bool invMono1)
-{
-    double window = std::max(1.0, max - min);
-
-
-    if (TypeOfRecord == CT)
-    {
-        if (v > max + window / 20)
-            v = max + window / 20;
-        else if (v > max - window / 15)
-            v = max - window / 15;
-    }
-
-    // проекция значения в шкалу [HistMin..HistMax]
-    double xf = (v - min) * scale / window;
-    int y = static_cast<int>(std::floor(xf));
-
-    //электроды в видимую область
-    //// зажимаем в допустимый диапазон
-    if (y < static_cast<int>(HistMin))
-        y = static_cast<int>(HistMin);
-    if (y >= static_cast<int>(HistMax))
-        y = static_cast<int>(HistMax-1);
-
-    // зажимаем в допустимый диапазон
-    //if (y < static_cast<int>(HistMin + 8))
-    //    y = 0;
-    //if (y > static_cast<int>(HistMax))
-    //    y = 0;
-
-
-    int bin = y;
-
-    // инверсия для MONOCHROME1 в той же шкале
-    if (invMono1)
-        bin = static_cast<int>(HistMin + (HistMax - bin));
-
-    // тут bin гарантированно в [0..255], так что каст безопасен
-    return static_cast<uchar>(bin);
-}
-
 void PlanarView::buildCache(vtkImageData* volume,
     vtkAlgorithmOutput* /*srcPort*/,
     bool invertMono1,
     DicomInfo Dicom)
 {
+    TRACE_SCOPE("load", "buildCache");
     if (!volume) {
-        mSlices.clear();
+        clearSlices();
         emit loadProgress(0, 0);
         return;
     }
@@ -963,7 +828,7 @@ void PlanarView::buildCache(vtkImageData* volume,
     const int total = z1 - z0 + 1;
 
     if (w <= 0 || h <= 0 || total <= 0) {
-        mSlices.clear();
+        clearSlices();
         emit loadProgress(0, 0);
         return;
     }
@@ -971,6 +836,8 @@ void PlanarView::buildCache(vtkImageData* volume,
     // --- 1) ЕДИНСТВЕННЫЙ унифицированный вход: float (быстрее и достаточно) ---
     vtkImageData* img = volume;
     vtkSmartPointer<vtkImageCast> castF;
+    const MemoryRegistry::Charge castCharge("planar.castFloat",
+        volume->GetScalarType() != VTK_FLOAT ? qint64(w) * h * total * qint64(sizeof(float)) : 0);
 
     if (volume->GetScalarType() != VTK_FLOAT) {
         castF = vtkSmartPointer<vtkImageCast>::New();
@@ -978,104 +845,24 @@ void PlanarView::buildCache(vtkImageData* volume,
         castF->SetOutputScalarTypeToFloat();
         {
             // каст может быть заметным, но это ОДИН раз
+            TRACE_SCOPE("load", "cast to float");
             castF->Update();
         }
         img = castF->GetOutput();
         if (!img) {
-            mSlices.clear();
+            clearSlices();
             emit loadProgress(0, 0);
             return;
         }
     }
 
-    mSlices.clear();
+    clearSlices();
     mSlices.reserve(total);
 
-    // --- 2) CT: быстрый пик по подвыборке, без полного прохода по объему ---
-    if (Dicom.TypeOfRecord == CT)
+    // --- 2) CT: окно уточняется по первому пику гистограммы подвыборки ---
     {
-
-        const int maxZSlices = 64;
-        const int zStep = std::max(1, total / maxZSlices);
-        const int xyStep = 3;
-
-        QVector<uint32_t> hist(HistScale, 0u);
-        QVector<uint32_t> hist2000(2000, 0u);
-
-        const float minPhys = float(Dicom.physicalMin);
-        const float maxPhys = float(Dicom.physicalMax);
-        const float window = std::max(1.0f, maxPhys - minPhys);
-
-        const float slopeF = float(Dicom.slope);
-        const float interF = float(Dicom.intercept);
-
-        const float scale = float(HistScale) / window;   // (vHU - minPhys) * scale
-        const float bias = -minPhys * scale;
-
-        auto fastFloorToInt = [](float x) -> int {
-            int i = int(x);
-            return (x < float(i)) ? (i - 1) : i;
-            };
-
-        for (int z = z1; z >= z0; z -= zStep)
-        {
-            char* p00 = static_cast<char*>(img->GetScalarPointer(x0, y0, z));
-            if (!p00) continue;
-
-            // шаг по X: либо через p10-p00 (если w>1), либо sizeof(float)
-            ptrdiff_t stepXb = ptrdiff_t(sizeof(float));
-            if (w > 1) {
-                char* p10 = static_cast<char*>(img->GetScalarPointer(x0 + 1, y0, z));
-                if (p10) stepXb = (p10 - p00);
-            }
-
-            // шаг по Y: через p01-p00 (если h>1)
-            ptrdiff_t stepYb = ptrdiff_t(w) * stepXb;
-            if (h > 1) {
-                char* p01 = static_cast<char*>(img->GetScalarPointer(x0, y0 + 1, z));
-                if (p01) stepYb = (p01 - p00);
-            }
-
-            for (int yy = 0; yy < h; yy += xyStep)
-            {
-                char* row0 = p00 + stepYb * yy;
-
-                for (int xx = 0; xx < w; xx += xyStep)
-                {
-                    const float raw = *reinterpret_cast<const float*>(row0 + stepXb * xx);
-                    const float vHU = raw * slopeF - interF;
-
-                    int bin = fastFloorToInt(vHU * scale + bias);
-                    if (bin < HistMin + 1) bin = HistMin;
-                    else if (bin > HistMax) bin = HistMax;
-
-                    int vHU2000 = (int)vHU;
-                    if (vHU2000 < 2000)
-                    hist2000[vHU2000]++;
-
-                    hist[bin] += 1u;
-                }
-            }
-        }
-
-        hist[0] = 0;
-
-        /*for (int i = 0; i < 2000; i++)
-            qDebug() << i << "  " << hist2000[i];*/
-
-        int peakHU = 0;
-        if (detectFirstPeakAfter(hist, HistScale / 4, peakHU))
-        {
-            peakHU -= 2;
-            const float vHU = window * (0.5f - float(peakHU) / float(HistScale));
-            const int y = fastFloorToInt(vHU);
-            Dicom.physicalMax -= (2 * y);
-
-            /*qDebug() << "peakHU" << "  " << peakHU;
-            qDebug() << "vHU" << "  " << vHU;
-            qDebug() << "y" << "  " << y;
-            qDebug() << "physicalMax" << "  " << Dicom.physicalMax;*/
-        }
+        TRACE_SCOPE("load", "RefineCtWindow");
+        SeriesVolume::RefineCtWindow(img, Dicom);
     }
 
     flipZ = false;
@@ -1141,7 +928,7 @@ void PlanarView::buildCache(vtkImageData* volume,
                     {
                         const float raw = *reinterpret_cast<const float*>(row0 + stepXb * xx);
                         const double vHU = (double(raw) * slope) - inter;
-                        dst[xx] = wl8(vHU, Dicom.physicalMin, Dicom.physicalMax, Dicom.TypeOfRecord, invertMono1);
+                        dst[xx] = SeriesVolume::MapTo8(vHU, Dicom.physicalMin, Dicom.physicalMax, Dicom.TypeOfRecord, invertMono1);
                     }
                 }
                 else
@@ -1151,7 +938,7 @@ void PlanarView::buildCache(vtkImageData* volume,
                     {
                         const float raw = *reinterpret_cast<const float*>(row0 + stepXb * xx);
                         const double vHU = (double(raw) * slope) - inter;
-                        dst[w - 1 - xx] = wl8(vHU, Dicom.physicalMin, Dicom.physicalMax, Dicom.TypeOfRecord, invertMono1);
+                        dst[w - 1 - xx] = SeriesVolume::MapTo8(vHU, Dicom.physicalMin, Dicom.physicalMax, Dicom.TypeOfRecord, invertMono1);
                     }
                 }
             }       
@@ -1176,7 +963,7 @@ void PlanarView::setSlice(int i)
     mIndex = i;
 
     // гарантированный валидный формат
-    const QImage img = mSlices[i].convertToFormat(QImage::Format_ARGB32);
+    const QImage img = sliceAt(i).convertToFormat(QImage::Format_ARGB32);
     mImageItem->setPixmap(QPixmap::fromImage(img));
 
     // обновить границы сцены и вписать в вид
@@ -1254,7 +1041,7 @@ void PlanarView::retranslateUi()
 bool PlanarView::readPixelKeyQuick(const QString& file, DicomPixelKey& out, QString* errMsg)
 {
     vtkNew<vtkDICOMReader> r;
-    auto err = vtkSmartPointer<VtkErrorCatcher>::New();
+    auto err = vtkSmartPointer<SeriesVolume::ErrorCatcher>::New();
     r->AddObserver(vtkCommand::ErrorEvent, err);
     r->SetFileName(file.toUtf8().constData());
 
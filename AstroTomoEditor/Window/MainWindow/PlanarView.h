@@ -29,6 +29,7 @@ class PlanarView : public QWidget
     Q_OBJECT
 public:
     explicit PlanarView(QWidget* parent = nullptr);
+    ~PlanarView() override;
 
     // API
     void loadSeriesFiles(const QVector<QString>& files);
@@ -59,6 +60,32 @@ public:
     static ValidationReport filterSeriesByConsistency(const QVector<QString>& files);
     static ValidationReport filterSeriesByConsistency(const QVector<SeriesScanResult::QuickDicomFile>& entries);
 
+    // Состояние вида одной серии для сессии исследований: кеш срезов и геометрия.
+    struct Snapshot
+    {
+        QVector<QImage> slices;     // пустой QImage — срез ужат в packed
+        QVector<QByteArray> packed;
+        DicomInfo dicom;
+        int x = 1, y = 1, z = 1;
+        double sp[3]{ 1.0, 1.0, 1.0 };
+        double originSpZ = 1.0;
+        bool flip[3]{ false, false, false };
+        bool reconstructable = false;
+        QMatrix3x3 dir;
+        double org[3]{ 0.0, 0.0, 0.0 };
+        int index = 0;
+
+        bool isEmpty() const { return slices.isEmpty(); }
+        qint64 bytes() const;
+    };
+    // забрать загруженную серию (вид остаётся пустым) / вернуть её без чтения с диска
+    Snapshot takeSnapshot();
+    void restoreSnapshot(Snapshot s);
+
+    // срез Grayscale8 <-> qCompress его байтов (кеш срезов, выгрузка сессии)
+    static QByteArray PackSlice(const QImage& slice);
+    static QImage UnpackSlice(const QByteArray& packed, int w, int h);
+
 signals:
     void loadStarted(int total);
     void loadProgress(int processed, int total);
@@ -85,6 +112,15 @@ private:
     // Кэширование QImage из vtkImageData
     void buildCache(vtkImageData* volume, vtkAlgorithmOutput* srcPort, bool invertMono1, DicomInfo Dicom);
 
+    // Кэш срезов под давлением памяти: далёкие от текущего срезы ужимаются qCompress,
+    // sliceAt распаковывает на лету.
+    QImage sliceAt(int i) const;
+    qint64 sliceCacheBytes() const;
+    qint64 packSlices(qint64 want);
+    void clearSlices() { mSlices.clear(); mPacked.clear(); }
+    void resetScene();
+    void finishLoad();
+
     // Валидация/фильтрация серии
     struct DicomPixelKey {
         int rows = 0, cols = 0, bitsAllocated = 0, samplesPerPixel = 0, pixelRepresentation = 0;
@@ -110,7 +146,9 @@ private:
 
 
     // данные
-    QVector<QImage> mSlices;
+    QVector<QImage> mSlices;     // пустой QImage — срез ужат в mPacked
+    QVector<QByteArray> mPacked;
+    int             mMemorySource{ 0 };
     int             mIndex{ 0 };
     double          mWL{ 0.0 };
     double          mWW{ 0.0 };
@@ -2,6 +2,7 @@
 #include "..\..\Services\DicomParcer.h"
 #include "..\..\Services\PatientInfo.h"
 #include <Services/FastDicomHeaderReader.h>
+#include <Services/Trace.h>
 #include <Services/VolumeFix3DR.h>
 
 #include <QtConcurrent/QtConcurrentRun>
@@ -37,7 +38,7 @@
 #include <vtkImageData.h>
 #include <vtkImageShiftScale.h>
 #include <vtkSmartPointer.h>
-#include <vtk-9.5/vtkGDCMImageReader.h>
+#include <vtkGDCMImageReader.h>
 
 #include <QElapsedTimer>
 #include <QAtomicInt>
@@ -867,6 +868,7 @@ static void trashFileCache()
 
 SeriesScanResult SeriesScanWorker::runScan(const QStringList& rootPaths)
 {
+    TRACE_SCOPE("scan", "runScan");
     SeriesScanResult result;
 
     if (rootPaths.isEmpty()) {
@@ -879,6 +881,7 @@ SeriesScanResult SeriesScanWorker::runScan(const QStringList& rootPaths)
     candidates.reserve(1 << 15);
 
     {
+        TRACE_SCOPE("scan", "pass 1: collect files");
         QElapsedTimer tick;
         tick.start();
 
@@ -1112,26 +1115,29 @@ SeriesScanResult SeriesScanWorker::runScan(const QStringList& rootPaths)
      };
 
     SeriesScanResult acc;
-    for (const QString& candidate : candidates)
     {
-        if (shouldCancel()) {
-            result.canceled = true;
-            return result;
-        }
+        TRACE_SCOPE("scan", "pass 2: headers");
+        for (const QString& candidate : candidates)
+        {
+            if (shouldCancel()) {
+                result.canceled = true;
+                return result;
+            }
 
-        const MapOut m = mapFn(candidate);
-        if (shouldCancel()) {
-            result.canceled = true;
-            return result;
-        }
+            const MapOut m = mapFn(candidate);
+            if (shouldCancel()) {
+                result.canceled = true;
+                return result;
+            }
 
-        if (!m.ok)
-            continue;
+            if (!m.ok)
+                continue;
 
-        acc.entriesBySeries[m.seriesKey].push_back(m.meta);
-        if (!acc.patientInfoValid && m.pinfoValid) {
-            acc.patientInfo = m.pinfo;
-            acc.patientInfoValid = true;
+            acc.entriesBySeries[m.seriesKey].push_back(m.meta);
+            if (!acc.patientInfoValid && m.pinfoValid) {
+                acc.patientInfo = m.pinfo;
+                acc.patientInfoValid = true;
+            }
         }
     }
 
@@ -1157,6 +1163,7 @@ SeriesScanResult SeriesScanWorker::runScan(const QStringList& rootPaths)
     items.reserve(keys.size());
 
     {
+        TRACE_SCOPE("scan", "pass 3: group series");
         for (const QString& seriesKey : keys)
         {
             if (shouldCancel()) { result.canceled = true; break; }
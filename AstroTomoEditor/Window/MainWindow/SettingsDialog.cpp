@@ -7,13 +7,20 @@
 #include <QSettings>
 #include <Services/AppConfig.h>
 #include <QCheckBox>
+#include <QSpinBox>
+#include <QPushButton>
+#include <QTimer>
 #include <Services/TooltipsFilter.h>
 #include <algorithm>
 #include <cmath>
+#include <utility>
 
 static constexpr const char* kLangKey = "ui/language"; // "ru" / "en"
 static constexpr const char* kGradOpacityKey = "render/gradientOpacity";
 static constexpr const char* kInterpKey = "render/volumeInterpolation"; // 0 nearest, 1 linear
+static constexpr const char* kVolumeBackendKey = "render/volumeBackend"; // 0 auto, 1 gpu, 2 cpu
+static constexpr const char* kFrameTargetKey = "render/frameTimeTargetMs"; // 0 — без LOD
+static constexpr const char* kMaxFpsKey = "render/maxFps"; // 0 — по частоте экрана
 static constexpr const char* kSamplingKey = "render/samplingFactor";
 
 SettingsDialog::SettingsDialog(QWidget* parent, bool mainstate)
@@ -98,6 +105,23 @@ SettingsDialog::SettingsDialog(QWidget* parent, bool mainstate)
                 emit volumeInterpolationChanged(mode);
             });
 
+        lblVolumeBackend = new QLabel(QObject::tr("Volume renderer:"), content);
+        lblVolumeBackend->setProperty("role", "label");
+
+        mVolumeBackendCombo = new FixedDownComboBox(content);
+        mVolumeBackendCombo->addItem(tr("Auto"), 0);
+        mVolumeBackendCombo->addItem(tr("GPU"), 1);
+        mVolumeBackendCombo->addItem(tr("CPU (no GPU)"), 2);
+
+        mForm->addRow(lblVolumeBackend, mVolumeBackendCombo);
+
+        connect(mVolumeBackendCombo, &FixedDownComboBox::currentIndexChanged, this, [this](int idx)
+            {
+                const int backend = mVolumeBackendCombo->itemData(idx).toInt();
+                saveVolumeBackend(backend);
+                emit volumeBackendChanged(backend);
+            });
+
         connect(mGradientOpacity, &QCheckBox::toggled, this, [this](bool on)
             {
                 enableGradientOpacity(on);
@@ -137,8 +161,84 @@ SettingsDialog::SettingsDialog(QWidget* parent, bool mainstate)
                 emit samplingFactorChanged(f);
             });
 
+        // --- Render: цель по времени кадра при вращении (упрощённый объём, если не успеваем)
+        lblFrameTarget = new QLabel(QObject::tr("Frame time target:"), content);
+        lblFrameTarget->setProperty("role", "label");
+
+        mFrameTarget = new QSpinBox(content);
+        mFrameTarget->setRange(0, 500);
+        mFrameTarget->setSingleStep(5);
+        mFrameTarget->setSuffix(tr(" ms"));
+        mFrameTarget->setSpecialValueText(tr("Off"));
+
+        mForm->addRow(lblFrameTarget, mFrameTarget);
+
+        connect(mFrameTarget, qOverload<int>(&QSpinBox::valueChanged), this, [this](int ms)
+            {
+                saveFrameTimeTarget(ms);
+                emit frameTimeTargetChanged(ms);
+            });
+
+        // --- Render: предел частоты кадров по запросам мыши (на слабых машинах — меньше нагрев и шум)
+        lblMaxFps = new QLabel(QObject::tr("Max frame rate:"), content);
+        lblMaxFps->setProperty("role", "label");
+
+        mMaxFps = new QSpinBox(content);
+        mMaxFps->setRange(0, 240);
+        mMaxFps->setSingleStep(10);
+        mMaxFps->setSuffix(tr(" fps"));
+        mMaxFps->setSpecialValueText(tr("Display"));
+
+        mForm->addRow(lblMaxFps, mMaxFps);
+
+        connect(mMaxFps, qOverload<int>(&QSpinBox::valueChanged), this, [this](int fps)
+            {
+                saveMaxFps(fps);
+                emit maxFpsChanged(fps);
+            });
+
+        // --- Render: что реально выходит при текущих настройках
+        lblRenderStats = new QLabel(QObject::tr("Rendering:"), content);
+        lblRenderStats->setProperty("role", "label");
+
+        mRenderStats = new QLabel(content);
+        mForm->addRow(lblRenderStats, mRenderStats);
+
+        mRenderTick = new QTimer(this);
+        mRenderTick->setInterval(1000);
+        connect(mRenderTick, &QTimer::timeout, this, [this]
+            {
+                if (isVisible())
+                    refreshRenderStats();
+            });
+        mRenderTick->start();
+        refreshRenderStats();
+
+        // --- Диагностика: трасса горячих участков для отчёта «тормозит»
+        lblDiagnostics = new QLabel(QObject::tr("Diagnostics:"), content);
+        lblDiagnostics->setProperty("role", "label");
+
+        mSaveTrace = new QPushButton(tr("Save performance trace..."), content);
+        mSaveTrace->setCursor(Qt::PointingHandCursor);
+
+        // и панель учёта памяти: [trace][memory]
+        mShowMemory = new QPushButton(tr("Memory..."), content);
+        mShowMemory->setCursor(Qt::PointingHandCursor);
+
+        auto* diagRow = new QWidget(content);
+        auto* diagLay = new QHBoxLayout(diagRow);
+        diagLay->setContentsMargins(0, 0, 0, 0);
+        diagLay->setSpacing(10);
+        diagLay->addWidget(mSaveTrace, 1);
+        diagLay->addWidget(mShowMemory, 0);
+
+        mForm->addRow(lblDiagnostics, diagRow);
+
+        connect(mSaveTrace, &QPushButton::clicked, this, &SettingsDialog::saveTraceRequested);
+        connect(mShowMemory, &QPushButton::clicked, this, &SettingsDialog::memoryPanelRequested);
+
         QSize targetSize = mSize;
-        targetSize.setHeight(targetSize.height() + 90);
+        targetSize.setHeight(targetSize.height() + 300);
         targetSize.setWidth(targetSize.width() + 90);
         setMinimumSize(targetSize);
         setMaximumSize(targetSize);
@@ -187,6 +287,9 @@ SettingsDialog::SettingsDialog(QWidget* parent, bool mainstate)
         "QSlider::handle:horizontal:hover {"
         "  background:rgba(255,255,255,0.85);"
         "}"
+        "QPushButton { color:#e6e6e6; background:#2b2d31; border:1px solid rgba(255,255,255,0.15); "
+        "border-radius:6px; padding:4px 10px; }"
+        "QPushButton:hover { background:rgba(255,255,255,0.10); }"
     );
 
     loadSettings();
@@ -222,8 +325,28 @@ void SettingsDialog::loadSettings()
             mInterpolationCombo->setCurrentIndex(ii);
     }
 
+    if (mVolumeBackendCombo)
+    {
+        QSignalBlocker b(mVolumeBackendCombo);
+        const int bi = mVolumeBackendCombo->findData(s.value(kVolumeBackendKey, 0).toInt());
+        if (bi >= 0)
+            mVolumeBackendCombo->setCurrentIndex(bi);
+    }
+
     const double sampling = s.value(kSamplingKey, 0.35).toDouble();
     syncSamplingFactorUi(sampling);
+
+    if (mFrameTarget)
+    {
+        QSignalBlocker b(mFrameTarget);
+        mFrameTarget->setValue(s.value(kFrameTargetKey, 40).toInt());
+    }
+
+    if (mMaxFps)
+    {
+        QSignalBlocker b(mMaxFps);
+        mMaxFps->setValue(std::clamp(s.value(kMaxFpsKey, 0).toInt(), 0, 240));
+    }
 }
 
 void SettingsDialog::saveSamplingFactor(double f)
@@ -284,6 +407,38 @@ void SettingsDialog::saveVolumeInterpolation(int mode)
     s.setValue(kInterpKey, mode);
 }
 
+void SettingsDialog::saveFrameTimeTarget(int ms)
+{
+    QSettings s;
+    s.setValue(kFrameTargetKey, ms);
+}
+
+void SettingsDialog::saveMaxFps(int fps)
+{
+    QSettings s;
+    s.setValue(kMaxFpsKey, fps);
+}
+
+void SettingsDialog::setRenderStatsSource(std::function<QString()> fn)
+{
+    mRenderStatsSource = std::move(fn);
+    refreshRenderStats();
+}
+
+void SettingsDialog::refreshRenderStats()
+{
+    if (!mRenderStats)
+        return;
+    const QString text = mRenderStatsSource ? mRenderStatsSource() : QString();
+    mRenderStats->setText(text.isEmpty() ? tr("No 3D view") : text);
+}
+
+void SettingsDialog::saveVolumeBackend(int backend)
+{
+    QSettings s;
+    s.setValue(kVolumeBackendKey, backend);
+}
+
 void SettingsDialog::syncGradientOpacityUi(bool on)
 {
     if (!mGradientOpacity) return;
@@ -307,6 +462,38 @@ void SettingsDialog::retranslateUi()
     if (lblSampling)
         lblSampling->setText(tr("Quality/Speed:"));
 
+    if (lblFrameTarget)
+        lblFrameTarget->setText(tr("Frame time target:"));
+
+    if (lblMaxFps)
+        lblMaxFps->setText(tr("Max frame rate:"));
+
+    if (lblRenderStats)
+        lblRenderStats->setText(tr("Rendering:"));
+
+    refreshRenderStats();
+
+    if (lblDiagnostics)
+        lblDiagnostics->setText(tr("Diagnostics:"));
+
+    if (mSaveTrace)
+        mSaveTrace->setText(tr("Save performance trace..."));
+
+    if (mShowMemory)
+        mShowMemory->setText(tr("Memory..."));
+
+    if (mFrameTarget)
+    {
+        mFrameTarget->setSuffix(tr(" ms"));
+        mFrameTarget->setSpecialValueText(tr("Off"));
+    }
+
+    if (mMaxFps)
+    {
+        mMaxFps->setSuffix(tr(" fps"));
+        mMaxFps->setSpecialValueText(tr("Display"));
+    }
+
     if (mLangCombo)
     {
         const QString currentCode = mLangCombo->currentData().toString();
@@ -340,6 +527,23 @@ void SettingsDialog::retranslateUi()
     if (mGradientOpacity)
         mGradientOpacity->setText(tr("Enable gradient opacity"));
 
+    if (lblVolumeBackend)
+        lblVolumeBackend->setText(tr("Volume renderer:"));
+
+    if (mVolumeBackendCombo)
+    {
+        for (int i = 0; i < mVolumeBackendCombo->count(); ++i)
+        {
+            const int backend = mVolumeBackendCombo->itemData(i).toInt();
+            if (backend == 0)
+                mVolumeBackendCombo->setItemText(i, tr("Auto"));
+            else if (backend == 1)
+                mVolumeBackendCombo->setItemText(i, tr("GPU"));
+            else if (backend == 2)
+                mVolumeBackendCombo->setItemText(i, tr("CPU (no GPU)"));
+        }
+    }
+
     if (mInterpolationCombo)
     {
         const int currentMode = mInterpolationCombo->currentData().toInt();
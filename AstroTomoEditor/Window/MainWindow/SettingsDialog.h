@@ -6,6 +6,11 @@
 #include "TitleBar.h"
 #include <qmessagebox.h>
 #include <QSlider>
+#include <functional>
+
+class QSpinBox;
+class QPushButton;
+class QTimer;
 
 class QLabel;
 class QFormLayout;
@@ -24,12 +29,19 @@ public:
             retranslateUi();
     }
     void syncGradientOpacityUi(bool on);
+    // Строка статистики кадров 3D-вида (раз в секунду, пока окно открыто); пусто — вида нет.
+    void setRenderStatsSource(std::function<QString()> fn);
 
 signals:
     void languageChanged(const QString& code);
     void gradientOpacityChanged(bool on);
     void volumeInterpolationChanged(int mode); // 0 nearest, 1 linear
+    void volumeBackendChanged(int backend);    // 0 auto, 1 gpu, 2 cpu
     void samplingFactorChanged(double f);
+    void frameTimeTargetChanged(int ms);       // 0 — без LOD
+    void maxFpsChanged(int fps);               // 0 — по частоте экрана
+    void saveTraceRequested();
+    void memoryPanelRequested();
 
 private:
     void saveLanguage(const QString& code);
@@ -38,9 +50,13 @@ private:
     void loadSettings();
     void saveGradientOpacity(bool on);
     void saveVolumeInterpolation(int mode);
+    void saveVolumeBackend(int backend);
     void saveSamplingFactor(double f);
     void syncSamplingFactorUi(double f);
     void updateSamplingFactorLabel(double f);
+    void saveFrameTimeTarget(int ms);
+    void saveMaxFps(int fps);
+    void refreshRenderStats();
 
 private:
 
@@ -58,9 +74,27 @@ private:
     QLabel* lblInterpolation = nullptr;
     FixedDownComboBox* mInterpolationCombo = nullptr;
 
+    QLabel* lblVolumeBackend = nullptr;
+    FixedDownComboBox* mVolumeBackendCombo = nullptr;
+
     QLabel* lblSampling = nullptr;
     QSlider* mSampling = nullptr;
     QLabel* mSamplingVal = nullptr;
 
+    QLabel* lblFrameTarget = nullptr;
+    QSpinBox* mFrameTarget = nullptr;
+
+    QLabel* lblMaxFps = nullptr;
+    QSpinBox* mMaxFps = nullptr;
+
+    QLabel* lblRenderStats = nullptr;
+    QLabel* mRenderStats = nullptr;
+    QTimer* mRenderTick = nullptr;
+    std::function<QString()> mRenderStatsSource;
+
+    QLabel* lblDiagnostics = nullptr;
+    QPushButton* mSaveTrace = nullptr;
+    QPushButton* mShowMemory = nullptr;
+
     const QSize mSize{ 420, 180 };
 };
\ No newline at end of file
@@ -0,0 +1,491 @@
+﻿#include "StudySession.h"
+
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QPair>
+#include <QSaveFile>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <Services/MemoryRegistry.h>
+#include <Services/Trace.h>
+
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
+#include <vtkPointData.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    constexpr quint32 kMagic = 0x41545353; // "ATSS"
+    constexpr qint32 kVersion = 1;
+    constexpr qsizetype kChunk = 16 * 1024 * 1024; // тома жмутся кусками параллельно
+    constexpr qint64 kMB = qint64(1024) * 1024;
+    constexpr const char* kMaxStudiesKey = "session/maxStudies";
+
+    struct Blob
+    {
+        const uchar* data = nullptr;
+        qsizetype size = 0;
+    };
+
+    vtkDataArray* scalarsOf(vtkImageData* im)
+    {
+        return (im && im->GetPointData()) ? im->GetPointData()->GetScalars() : nullptr;
+    }
+
+    qsizetype scalarBytes(vtkDataArray* a)
+    {
+        return a ? qsizetype(a->GetDataSize()) * a->GetDataTypeSize() : 0;
+    }
+}
+
+qint64 StudySession::Study::residentBytes() const
+{
+    return planar.bytes() + edits.bytes();
+}
+
+StudySession::StudySession(QObject* parent)
+    : QObject(parent)
+{
+    mMaxStudies = std::max(1, QSettings().value(kMaxStudiesKey, 6).toInt());
+
+    // хвосты упавших сессий
+    const QDateTime stale = QDateTime::currentDateTime().addDays(-1);
+    QDir dir(spillDir());
+    for (const QFileInfo& fi : dir.entryInfoList({ "*.spill" }, QDir::Files))
+        if (fi.lastModified() < stale)
+            QFile::remove(fi.absoluteFilePath());
+
+    // отложенные серии выселяются раньше истории правок открытой серии
+    mMemorySource = MemoryRegistry::instance().addSource("session.studies", tr("Parked series"),
+        [this] {
+            qint64 total = 0;
+            for (const Study& s : mStudies)
+                total += s.residentBytes();
+            return total;
+        },
+        [this](qint64 want) { return spillLru(want); }, 25);
+}
+
+StudySession::~StudySession()
+{
+    MemoryRegistry::instance().removeSource(mMemorySource);
+    clear();
+}
+
+QString StudySession::spillDir() const
+{
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("studies");
+}
+
+void StudySession::park(const QString& uid, const QVector<QString>& files,
+    PlanarView::Snapshot planar, RenderView::EditState edits)
+{
+    if (uid.isEmpty() || planar.isEmpty())
+        return;
+
+    auto old = mStudies.find(uid);
+    if (old != mStudies.end() && !old->spillPath.isEmpty())
+        QFile::remove(old->spillPath);
+
+    Study s;
+    s.files = files;
+    s.planar = std::move(planar);
+    s.edits = std::move(edits);
+    s.lastUsed = ++mTick;
+    mStudies.insert(uid, std::move(s));
+
+    dropOldest();
+
+    // уложиться в бюджет сразу, не дожидаясь таймера реестра
+    MemoryRegistry::instance().poll();
+}
+
+StudySession::Take StudySession::take(const QString& uid,
+    PlanarView::Snapshot& planar, RenderView::EditState& edits)
+{
+    auto it = mStudies.find(uid);
+    if (it == mStudies.end())
+        return Take::Missing;
+
+    switch (it->state)
+    {
+    case State::Restoring:
+        return Take::Restoring;
+    case State::Spilled:
+        startRestore(uid, *it);
+        return Take::Restoring;
+    case State::Spilling:
+        // фоновая запись ещё читает срезы и тома — отдадим их в finishSpill, файл выбросим
+        it->wanted = true;
+        return Take::Restoring;
+    case State::Resident:
+        break;
+    }
+
+    planar = std::move(it->planar);
+    edits = std::move(it->edits);
+    mStudies.erase(it);
+    return Take::Ready;
+}
+
+void StudySession::clear()
+{
+    for (const Study& s : mStudies)
+        if (!s.spillPath.isEmpty())
+            QFile::remove(s.spillPath);
+    mStudies.clear();
+}
+
+void StudySession::dropOldest()
+{
+    // сверх лимита выбрасываются самые старые серии без правок — их срезы перечитаются
+    // из DICOM. Правленые не теряются: остаются в сессии, но уходят на диск
+    qsizetype excess = mStudies.size() - mMaxStudies;
+    if (excess <= 0)
+        return;
+
+    QVector<QPair<quint64, QString>> order;
+    for (auto it = mStudies.cbegin(); it != mStudies.cend(); ++it)
+        if (it->state != State::Restoring && !it->wanted)
+            order.push_back({ it->lastUsed, it.key() });
+    std::sort(order.begin(), order.end());
+
+    for (const auto& [tick, uid] : order)
+    {
+        if (excess <= 0)
+            break;
+        auto it = mStudies.find(uid);
+        if (it->hasEdits())
+        {
+            if (it->state == State::Resident && !it->spillFailed)
+                spill(uid, *it);
+            continue;
+        }
+
+        qInfo().noquote() << "[Session] dropped" << uid;
+        if (!it->spillPath.isEmpty())
+            QFile::remove(it->spillPath);
+        mStudies.erase(it);
+        --excess;
+    }
+}
+
+qint64 StudySession::spillLru(qint64 want)
+{
+    // то, что уже пишется, освободится и так — засчитываем
+    qint64 freed = 0;
+    QVector<QPair<quint64, QString>> order;
+    for (auto it = mStudies.cbegin(); it != mStudies.cend(); ++it)
+    {
+        if (it->state == State::Spilling && !it->wanted)
+            freed += it->residentBytes();
+        else if (it->state == State::Resident && !it->spillFailed)
+            order.push_back({ it->lastUsed, it.key() });
+    }
+    std::sort(order.begin(), order.end());
+
+    for (const auto& [tick, uid] : order)
+    {
+        if (freed >= want)
+            break;
+        auto it = mStudies.find(uid);
+        if (it != mStudies.end())
+            freed += spill(uid, *it);
+    }
+    return freed;
+}
+
+qint64 StudySession::spill(const QString& uid, Study& s)
+{
+    if (s.state != State::Resident)
+        return 0;
+    const qint64 before = s.residentBytes();
+    if (before <= 0)
+        return 0;
+
+    QVector<vtkSmartPointer<vtkImageData>> images;
+    if (s.edits.image)
+        images << s.edits.image << s.edits.undo << s.edits.redo;
+    for (const auto& im : images)
+        if (!scalarsOf(im))
+            return 0;
+
+    QDir().mkpath(spillDir());
+    const int ticket = ++mSpillSerial;
+    const QString path = QDir(spillDir()).filePath(QString("%1-%2.spill")
+        .arg(QCoreApplication::applicationPid()).arg(ticket));
+
+    s.state = State::Spilling;
+    s.spillTicket = ticket;
+
+    // задача держит свои ссылки на срезы (неявно разделяемые) и тома; если серию откроют
+    // раньше, чем запись закончится, файл выбрасывается в finishSpill
+    auto* watcher = new QFutureWatcher<QString>(this);
+    connect(watcher, &QFutureWatcher<QString>::finished, this, [this, watcher, uid, ticket, path]()
+        {
+            const QString error = watcher->result();
+            watcher->deleteLater();
+            finishSpill(uid, ticket, path, error);
+        });
+    watcher->setFuture(QtConcurrent::run(&StudySession::WriteSpill,
+        path, s.planar.slices, s.planar.packed, images));
+    return before;
+}
+
+void StudySession::finishSpill(const QString& uid, int ticket, const QString& path, const QString& error)
+{
+    auto it = mStudies.find(uid);
+    if (it == mStudies.end() || it->state != State::Spilling || it->spillTicket != ticket)
+    {
+        // серию заменили или сессию очистили, пока писали
+        QFile::remove(path);
+        return;
+    }
+
+    if (it->wanted)
+    {
+        // серию открыли, пока писали: данные всё ещё в памяти
+        QFile::remove(path);
+        it->wanted = false;
+        it->state = State::Resident;
+        it->lastUsed = ++mTick;
+        emit studyRestored(uid);
+        return;
+    }
+
+    if (!error.isEmpty())
+    {
+        qWarning().noquote() << "[Session] spill failed" << uid << error;
+        QFile::remove(path);
+        it->state = State::Resident;
+        it->spillFailed = true;
+        return;
+    }
+
+    Study& s = *it;
+    const qint64 before = s.residentBytes();
+
+    // в памяти остаются геометрия и DicomInfo
+    QVector<vtkSmartPointer<vtkImageData>> images;
+    if (s.edits.image)
+        images << s.edits.image << s.edits.undo << s.edits.redo;
+    s.shells.clear();
+    for (const auto& im : images)
+    {
+        ImageShell sh;
+        sh.geometry = vtkSmartPointer<vtkImageData>::New();
+        sh.geometry->CopyStructure(im);
+        sh.scalarType = im->GetScalarType();
+        sh.components = im->GetNumberOfScalarComponents();
+        s.shells.push_back(sh);
+    }
+    s.sliceCount = int(s.planar.slices.size());
+    s.undoCount = int(s.edits.undo.size());
+    s.redoCount = int(s.edits.redo.size());
+    s.planar.slices = QVector<QImage>();
+    s.planar.packed = QVector<QByteArray>();
+    s.edits = RenderView::EditState{};
+    s.spillPath = path;
+    s.state = State::Spilled;
+
+    qInfo().noquote() << "[Session] spilled" << uid << before / kMB << "MB ->"
+        << QFileInfo(path).size() / kMB << "MB on disk";
+    // панель увидит освобождённое, а бюджет проверится уже по факту
+    MemoryRegistry::instance().poll();
+}
+
+QString StudySession::WriteSpill(const QString& path, const QVector<QImage>& slices,
+    const QVector<QByteArray>& packed, const QVector<vtkSmartPointer<vtkImageData>>& images)
+{
+    TRACE_SCOPE("session", "spill");
+
+    // ужатые срезы уже в формате PackSlice — пишутся как есть, остальное жмётся параллельно
+    const int n = int(slices.size());
+    QVector<Blob> jobs;
+    QVector<int> sliceJob(n, -1);
+    for (int i = 0; i < n; ++i)
+    {
+        if (i < packed.size() && !packed[i].isEmpty())
+            continue;
+        const QImage& q = slices[i];
+        sliceJob[i] = int(jobs.size());
+        jobs.push_back({ q.constBits(), q.sizeInBytes() });
+    }
+
+    QVector<QVector<int>> imageJobs;
+    for (const auto& im : images)
+    {
+        vtkDataArray* a = scalarsOf(im);
+        const auto* p = static_cast<const uchar*>(a->GetVoidPointer(0));
+        const qsizetype total = scalarBytes(a);
+        QVector<int> chunks;
+        for (qsizetype off = 0; off < total; off += kChunk)
+        {
+            chunks.push_back(int(jobs.size()));
+            jobs.push_back({ p + off, std::min(kChunk, total - off) });
+        }
+        imageJobs.push_back(chunks);
+    }
+
+    const QVector<QByteArray> blobs = QtConcurrent::blockingMapped<QVector<QByteArray>>(jobs,
+        [](const Blob& b) { return qCompress(b.data, b.size, 1); });
+
+    QSaveFile f(path);
+    if (!f.open(QIODevice::WriteOnly))
+        return QString("Cannot write %1").arg(path);
+
+    QDataStream ds(&f);
+    ds.setVersion(QDataStream::Qt_6_0);
+    ds << kMagic << kVersion << qint32(n);
+    for (int i = 0; i < n; ++i)
+        ds << (sliceJob[i] >= 0 ? blobs[sliceJob[i]] : packed[i]);
+    ds << qint32(images.size());
+    for (const QVector<int>& chunks : imageJobs)
+    {
+        ds << qint32(chunks.size());
+        for (int j : chunks)
+            ds << blobs[j];
+    }
+
+    if (ds.status() != QDataStream::Ok || !f.commit())
+        return QString("Write error %1").arg(path);
+    return {};
+}
+
+void StudySession::startRestore(const QString& uid, Study& s)
+{
+    s.state = State::Restoring;
+
+    auto* watcher = new QFutureWatcher<Restored>(this);
+    connect(watcher, &QFutureWatcher<Restored>::finished, this, [this, watcher, uid]()
+        {
+            Restored r = watcher->result();
+            watcher->deleteLater();
+
+            auto it = mStudies.find(uid);
+            if (it == mStudies.end())
+                return; // сессию очистили, пока читали
+
+            QFile::remove(it->spillPath);
+            it->spillPath.clear();
+
+            if (!r.error.isEmpty())
+            {
+                const QVector<QString> files = it->files;
+                mStudies.erase(it);
+                qWarning().noquote() << "[Session] restore failed" << uid << r.error;
+                emit studyRestoreFailed(uid, files, r.error);
+                return;
+            }
+
+            it->planar.slices = std::move(r.slices);
+            if (!r.images.isEmpty())
+            {
+                it->edits.image = r.images[0];
+                it->edits.undo = r.images.mid(1, it->undoCount);
+                it->edits.redo = r.images.mid(1 + it->undoCount, it->redoCount);
+            }
+            it->shells.clear();
+            it->state = State::Resident;
+            it->lastUsed = ++mTick;
+            emit studyRestored(uid);
+        });
+
+    watcher->setFuture(QtConcurrent::run(&StudySession::ReadSpill,
+        s.spillPath, s.sliceCount, s.planar.x, s.planar.y, s.shells));
+}
+
+StudySession::Restored StudySession::ReadSpill(const QString& path, int sliceCount, int w, int h,
+    const QVector<ImageShell>& shells)
+{
+    TRACE_SCOPE("session", "restore");
+    Restored r;
+
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly))
+    {
+        r.error = QString("Cannot open %1").arg(path);
+        return r;
+    }
+
+    QDataStream ds(&f);
+    ds.setVersion(QDataStream::Qt_6_0);
+    quint32 magic = 0;
+    qint32 version = 0, n = 0;
+    ds >> magic >> version >> n;
+    if (magic != kMagic || version != kVersion || n != sliceCount)
+    {
+        r.error = "Bad spill header";
+        return r;
+    }
+
+    r.slices.reserve(n);
+    for (int i = 0; i < n; ++i)
+    {
+        QByteArray blob;
+        ds >> blob;
+        QImage q = PlanarView::UnpackSlice(blob, w, h);
+        if (q.isNull())
+        {
+            r.error = QString("Bad slice %1").arg(i);
+            return r;
+        }
+        r.slices.push_back(std::move(q));
+    }
+
+    qint32 imageCount = 0;
+    ds >> imageCount;
+    if (imageCount != shells.size())
+    {
+        r.error = "Image count mismatch";
+        return r;
+    }
+
+    for (const ImageShell& sh : shells)
+    {
+        auto im = vtkSmartPointer<vtkImageData>::New();
+        im->CopyStructure(sh.geometry);
+        im->AllocateScalars(sh.scalarType, sh.components);
+        vtkDataArray* a = scalarsOf(im);
+        auto* dst = a ? static_cast<uchar*>(a->GetVoidPointer(0)) : nullptr;
+        const qsizetype total = scalarBytes(a);
+
+        qint32 chunks = 0;
+        ds >> chunks;
+        qsizetype off = 0;
+        for (int c = 0; c < chunks; ++c)
+        {
+            QByteArray blob;
+            ds >> blob;
+            const QByteArray raw = qUncompress(blob);
+            if (!dst || off + raw.size() > total)
+            {
+                r.error = "Image data overflow";
+                return r;
+            }
+            memcpy(dst + off, raw.constData(), size_t(raw.size()));
+            off += raw.size();
+        }
+        if (off != total)
+        {
+            r.error = "Image data truncated";
+            return r;
+        }
+        r.images.push_back(im);
+    }
+
+    if (ds.status() != QDataStream::Ok)
+        r.error = "Read error";
+    return r;
+}
@@ -0,0 +1,96 @@
+﻿#pragma once
+
+#include "PlanarView.h"
+#include <Window/Render/RenderView.h>
+#include <QHash>
+#include <QObject>
+#include <QVector>
+
+// Сессия исследований: отложенные серии (кеш срезов, правленый том с историей undo/redo)
+// живут под общим бюджетом MemoryRegistry. Давно не открывавшиеся выгружаются на диск
+// (qCompress, без потерь) и при возврате дочитываются; и запись, и чтение идут в фоне.
+// Производное от тома (STL и его история, контуры, электроды, несохранённые шаблоны)
+// не паркуется: после возврата оно строится заново, а ручную работу MainWindow
+// перед уходом серии подтверждает у пользователя (RenderView::unsavedSeriesWork).
+class StudySession : public QObject
+{
+    Q_OBJECT
+public:
+    explicit StudySession(QObject* parent = nullptr);
+    ~StudySession() override;
+
+    enum class Take { Missing, Ready, Restoring };
+
+    // серия уходит из вида и становится самой свежей в сессии
+    void park(const QString& uid, const QVector<QString>& files,
+        PlanarView::Snapshot planar, RenderView::EditState edits);
+    // Ready — данные отданы и серия ушла из сессии; Restoring — идёт фоновое чтение
+    // или дописывается выгрузка, ждать studyRestored
+    Take take(const QString& uid, PlanarView::Snapshot& planar, RenderView::EditState& edits);
+    bool contains(const QString& uid) const { return mStudies.contains(uid); }
+    void clear();
+
+signals:
+    void studyRestored(const QString& uid);
+    // файл выгрузки пропал/битый — серия из сессии убрана, читать заново из files
+    void studyRestoreFailed(const QString& uid, const QVector<QString>& files, const QString& error);
+
+private:
+    // Spilling — пишется в фоне, данные ещё в памяти; снимаются только после успешной записи
+    enum class State { Resident, Spilling, Spilled, Restoring };
+
+    // геометрия выгруженного тома: скаляры на диске
+    struct ImageShell
+    {
+        vtkSmartPointer<vtkImageData> geometry;
+        int scalarType = 0;
+        int components = 1;
+    };
+
+    struct Study
+    {
+        QVector<QString> files;
+        PlanarView::Snapshot planar;   // при выгрузке срезы пустые, геометрия и DicomInfo остаются
+        RenderView::EditState edits;   // при выгрузке тома сброшены, см. shells
+        QVector<ImageShell> shells;    // image, undo..., redo...
+        int sliceCount = 0;
+        int undoCount = 0;
+        int redoCount = 0;
+        QString spillPath;
+        State state = State::Resident;
+        quint64 lastUsed = 0;
+        int spillTicket = 0;           // какая запись идёт сейчас (серия могла уйти и вернуться)
+        bool spillFailed = false;      // не пробовать снова, пока серия не откроется
+        bool wanted = false;           // take пришёл во время записи: отдать, когда она кончится
+
+        qint64 residentBytes() const;
+        // правленый том с историей: из DICOM его не перечитать
+        bool hasEdits() const { return !edits.isEmpty() || !shells.isEmpty(); }
+    };
+
+    struct Restored
+    {
+        QVector<QImage> slices;
+        QVector<vtkSmartPointer<vtkImageData>> images;
+        QString error;
+    };
+
+    qint64 spillLru(qint64 want);
+    // ставит запись в фон; вернёт байты, которые освободятся после неё
+    qint64 spill(const QString& uid, Study& s);
+    void finishSpill(const QString& uid, int ticket, const QString& path, const QString& error);
+    void startRestore(const QString& uid, Study& s);
+    void dropOldest();
+    QString spillDir() const;
+
+    static QString WriteSpill(const QString& path, const QVector<QImage>& slices,
+        const QVector<QByteArray>& packed, const QVector<vtkSmartPointer<vtkImageData>>& images);
+    static Restored ReadSpill(const QString& path, int sliceCount, int w, int h,
+        const QVector<ImageShell>& shells);
+
+    QHash<QString, Study> mStudies;
+    quint64 mTick = 0;
+    int mSpillSerial = 0;
+    int mMaxStudies = 6;
+    int mMemorySource = 0;
+};
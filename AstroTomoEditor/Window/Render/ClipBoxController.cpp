@@ -1,11 +1,13 @@
 ﻿#include "ClipBoxController.h"
+#include "VolumeRenderBackend.h"
+#include "RenderScheduler.h"
 
 #include <vtkCallbackCommand.h>
 #include <vtkRenderer.h>
 #include <vtkRenderWindow.h>
 #include <vtkRenderWindowInteractor.h>
 #include <vtkVolume.h>
-#include <vtkGPUVolumeRayCastMapper.h>
+#include <vtkVolumeMapper.h>
 #include <vtkImageData.h>
 #include <vtkMatrix4x4.h>
 #include <vtkPolyData.h>
@@ -225,14 +227,11 @@ void ClipBoxController::attachToVolume(vtkVolume* vol)
         mRep->PlaceBox(vb);
     }
 
-    if (auto* mapper = mVolume->GetMapper())
-    {
-        if (auto* gm = vtkGPUVolumeRayCastMapper::SafeDownCast(mapper))
-            gm->SetCropping(0);
-    }
+    if (auto* vm = vtkVolumeMapper::SafeDownCast(mVolume->GetMapper()))
+        vm->SetCropping(0);
 
     if (mRenderer) mRenderer->ResetCameraClippingRange();
-    if (auto* rw = mRenderer ? mRenderer->GetRenderWindow() : nullptr) rw->Render();
+    if (mRenderer) RenderScheduler::request(mRenderer->GetRenderWindow());
 }
 
 void ClipBoxController::attachToSTL(vtkActor* actor)
@@ -264,7 +263,7 @@ void ClipBoxController::attachToSTL(vtkActor* actor)
     }
 
     if (mRenderer) mRenderer->ResetCameraClippingRange();
-    if (auto* rw = mRenderer ? mRenderer->GetRenderWindow() : nullptr) rw->Render();
+    if (mRenderer) RenderScheduler::request(mRenderer->GetRenderWindow());
 }
 
 void ClipBoxController::setEnabled(bool on)
@@ -283,11 +282,11 @@ void ClipBoxController::setEnabled(bool on)
         applyClippingFromBox();
 
         // 3. теперь безопасно выключаем клип
-        if (auto* gm = vtkGPUVolumeRayCastMapper::SafeDownCast(
+        if (auto* vm = vtkVolumeMapper::SafeDownCast(
             mVolume ? mVolume->GetMapper() : nullptr))
         {
-            gm->SetCropping(false);
-            gm->Modified();
+            vm->SetCropping(false);
+            vm->Modified();
         }
 
         if (auto* pm = vtkPolyDataMapper::SafeDownCast(
@@ -316,8 +315,8 @@ void ClipBoxController::setEnabled(bool on)
     if (mRenderer)
         mRenderer->ResetCameraClippingRange();
 
-    if (auto* rw = mRenderer ? mRenderer->GetRenderWindow() : nullptr)
-        rw->Render();
+    if (mRenderer)
+        RenderScheduler::request(mRenderer->GetRenderWindow());
 }
 
 void ClipBoxController::resetToBounds()
@@ -341,8 +340,8 @@ void ClipBoxController::applyNow()
     applyClippingFromBox();
 
     if (mRenderer) mRenderer->ResetCameraClippingRange();
-    if (auto* rw = mRenderer ? mRenderer->GetRenderWindow() : nullptr)
-        rw->Render();
+    if (mRenderer)
+        RenderScheduler::request(mRenderer->GetRenderWindow());
 }
 
 vtkSmartPointer<vtkPlaneCollection> ClipBoxController::currentClippingPlanes() const
@@ -352,8 +351,6 @@ vtkSmartPointer<vtkPlaneCollection> ClipBoxController::currentClippingPlanes() c
     return mRep->MakeClippingPlanes();
 }
 
-#include <vtkVolumeMapper.h> 
-
 void ClipBoxController::applyClippingFromBox()
 {
     if (!mEnabled) return;
@@ -363,20 +360,13 @@ void ClipBoxController::applyClippingFromBox()
     if (mVolume)
     {
         auto* mapper = mVolume->GetMapper();
-        auto* gm = vtkGPUVolumeRayCastMapper::SafeDownCast(mapper);
-        if (!gm) return;
-
-        // важно: если раньше включали cropping, он будет мешать и создавать ощущение "не режется"
-        gm->SetCropping(false);
-
-        // сбросим старые плоскости
-        gm->RemoveAllClippingPlanes();
+        if (!mapper) return;
 
+        // GPU и CPU мапперы режутся одинаково; cropping выключается внутри,
+        // иначе он мешает и создаёт ощущение "не режется".
         // плоскости берем из репрезентации (OBB)
         auto planes = mRep->MakeClippingPlanes();     // <-- метод в FaceOnlyBoxRepresentation
-        gm->SetClippingPlanes(planes);
-
-        gm->Modified();
+        VolumeRenderBackend::setClippingPlanes(mapper, planes);
     }
 
     // --- surface: тоже лучше резать теми же плоскостями, а не AABB ---
@@ -392,8 +382,9 @@ void ClipBoxController::applyClippingFromBox()
 
     emit clippingChanged();
 
-    if (mRenderer && mRenderer->GetRenderWindow())
-        mRenderer->GetRenderWindow()->Render();
+    // во время перетаскивания виджет и сам рисует — запрос закроется его кадром
+    if (mRenderer)
+        RenderScheduler::request(mRenderer->GetRenderWindow());
 }
 
 void ClipBoxController::onInteraction(vtkObject*, unsigned long evId, void* cd, void*)
@@ -407,8 +398,8 @@ void ClipBoxController::onInteraction(vtkObject*, unsigned long evId, void* cd,
     {
         if (self->mRenderer) self->mRenderer->ResetCameraClippingRange();
         if (self->mInteractor && self->mInteractor->GetRenderWindow())
-            self->mInteractor->GetRenderWindow()->Render();
-        else if (self->mRenderer && self->mRenderer->GetRenderWindow())
-            self->mRenderer->GetRenderWindow()->Render();
+            RenderScheduler::request(self->mInteractor->GetRenderWindow());
+        else if (self->mRenderer)
+            RenderScheduler::request(self->mRenderer->GetRenderWindow());
     }
 }
@@ -18,7 +18,6 @@ class vtkBoxRepresentation;
 class vtkCallbackCommand;
 class vtkImageData;
 class vtkVolume;
-class vtkGPUVolumeRayCastMapper;
 class vtkActor;
 class vtkPlanes;
 class vtkPolyDataMapper;
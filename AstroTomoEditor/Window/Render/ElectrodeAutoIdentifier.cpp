@@ -5,137 +5,11 @@
 #include <vtkPropCollection.h>
 #include <vtkRenderer.h>
 #include <vtkCamera.h>
-#include <vtkLineSource.h>
-#include <vtkPolyDataMapper.h>
-#include <vtkActor.h>
-#include <vtkProperty.h>
-#include <vtkTextActor.h>
-#include <vtkTextProperty.h>
-#include <vtkCoordinate.h>
 #include <vtkRenderWindow.h>
-#include <vtkRendererCollection.h>
-#include <vtkNamedColors.h>
-#include <vtkInformation.h>
-#include <vtkInformationStringKey.h>
-#include <vtkObjectFactory.h>
-#include <vtkPoints.h>
-#include <vtkCellArray.h>
-#include <vtkPolyData.h>
-#include <vtkPolyDataMapper2D.h>
-#include <vtkActor2D.h>
-#include <vtkProperty2D.h>
 #include <algorithm>
 #include <cmath>
 #include <limits>
 
-namespace
-{
-    static std::vector<vtkSmartPointer<vtkProp>> gSectorDebugProps;
-
-    void ClearDebugProps(vtkRenderer* ren)
-    {
-        if (!ren)
-            return;
-
-        for (auto& p : gSectorDebugProps)
-        {
-            if (p)
-                ren->RemoveViewProp(p);
-        }
-        gSectorDebugProps.clear();
-    }
-
-    void AddDebugProp(vtkRenderer* ren, vtkProp* prop)
-    {
-        if (!ren || !prop)
-            return;
-
-        ren->AddViewProp(prop);
-        gSectorDebugProps.push_back(prop);
-    }
-
-    vtkSmartPointer<vtkActor> MakeLineActor(
-        const std::array<double, 3>& p0,
-        const std::array<double, 3>& p1,
-        double r, double g, double b,
-        double lineWidth = 3.0)
-    {
-        vtkNew<vtkLineSource> line;
-        line->SetPoint1(p0[0], p0[1], p0[2]);
-        line->SetPoint2(p1[0], p1[1], p1[2]);
-        line->Update();
-
-        vtkNew<vtkPolyDataMapper> mapper;
-        mapper->SetInputConnection(line->GetOutputPort());
-
-        vtkSmartPointer<vtkActor> actor = vtkSmartPointer<vtkActor>::New();
-        actor->SetMapper(mapper);
-        actor->GetProperty()->SetColor(r, g, b);
-        actor->GetProperty()->SetLineWidth(lineWidth);
-        actor->PickableOff();
-
-        return actor;
-    }
-
-
-
-    vtkSmartPointer<vtkTextActor> MakeScreenLabel(
-        vtkRenderer* ren,
-        const std::array<double, 3>& worldPos,
-        const QString& text,
-        double r, double g, double b)
-    {
-        if (!ren)
-            return nullptr;
-
-        double dx = 0.0, dy = 0.0;
-        if (!ElectrodeAutoIdentifier::WorldToDisplay(ren, worldPos, dx, dy))
-            return nullptr;
-
-        vtkSmartPointer<vtkTextActor> txt = vtkSmartPointer<vtkTextActor>::New();
-        txt->SetInput(text.toUtf8().constData());
-        txt->SetPosition(dx + 8.0, dy + 8.0);
-        txt->GetTextProperty()->SetFontSize(16);
-        txt->GetTextProperty()->SetColor(r, g, b);
-        txt->GetTextProperty()->SetBold(1);
-
-        return txt;
-    }
-
-
-
-    static vtkSmartPointer<vtkActor2D> MakeScreenLineActor(
-        double x0, double y0,
-        double x1, double y1,
-        double r, double g, double b,
-        double lineWidth = 3.0)
-    {
-        vtkNew<vtkPoints> pts;
-        pts->InsertNextPoint(x0, y0, 0.0);
-        pts->InsertNextPoint(x1, y1, 0.0);
-
-        vtkNew<vtkCellArray> lines;
-        vtkIdType ids[2] = { 0, 1 };
-        lines->InsertNextCell(2, ids);
-
-        vtkNew<vtkPolyData> poly;
-        poly->SetPoints(pts);
-        poly->SetLines(lines);
-
-        vtkNew<vtkPolyDataMapper2D> mapper;
-        mapper->SetInputData(poly);
-
-        vtkSmartPointer<vtkActor2D> actor = vtkSmartPointer<vtkActor2D>::New();
-        actor->SetMapper(mapper);
-        actor->GetProperty()->SetColor(r, g, b);
-        actor->GetProperty()->SetLineWidth(lineWidth);
-
-        return actor;
-    }
-}
-
-
-
 namespace
 {
     enum class Quadrant
@@ -563,137 +437,327 @@ static double Dist(const std::array<double, 3>& a,
     return std::sqrt(dx * dx + dy * dy + dz * dz);
 }
 
-static void DrawSectorDebug2D(
-    vtkRenderer* ren,
-    double ax, double ay,
-    double h0, double h1,
-    double rayLen = 140.0)
+namespace
 {
-    if (!ren)
+    constexpr double kConsumeSphereRadiusMm = 25.0;
+
+    inline std::array<double, 3> Cross3(const std::array<double, 3>& a, const std::array<double, 3>& b)
+    {
+        return { a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0] };
+    }
+
+    inline bool Normalize3(std::array<double, 3>& v)
+    {
+        const double n = Norm3(v);
+        if (n < 1e-12)
+            return false;
+        v = { v[0] / n, v[1] / n, v[2] / n };
+        return true;
+    }
+
+    // То же, что vtkCamera::Azimuth + OrthogonalizeViewUp: позиция вращается
+    // вокруг view-up через фокус
+    void AzimuthCamera(ElectrodeAutoIdentifier::CameraState& cam, double deg)
+    {
+        std::array<double, 3> axis{ cam.viewUp[0], cam.viewUp[1], cam.viewUp[2] };
+        if (!Normalize3(axis))
+            return;
+
+        const std::array<double, 3> rel{
+            cam.pos[0] - cam.focal[0],
+            cam.pos[1] - cam.focal[1],
+            cam.pos[2] - cam.focal[2] };
+
+        const double a = deg * M_PI / 180.0;
+        const double c = std::cos(a);
+        const double s = std::sin(a);
+        const auto kxr = Cross3(axis, rel);
+        const double kdr = Dot3(axis, rel) * (1.0 - c);
+
+        for (int k = 0; k < 3; ++k)
+            cam.pos[k] = cam.focal[k] + rel[k] * c + kxr[k] * s + axis[k] * kdr;
+
+        std::array<double, 3> dir{
+            cam.focal[0] - cam.pos[0],
+            cam.focal[1] - cam.pos[1],
+            cam.focal[2] - cam.pos[2] };
+        if (!Normalize3(dir))
+            return;
+
+        const double ud = Dot3(axis, dir);
+        std::array<double, 3> up{ axis[0] - dir[0] * ud, axis[1] - dir[1] * ud, axis[2] - dir[2] * ud };
+        if (Normalize3(up))
+        {
+            cam.viewUp[0] = up[0];
+            cam.viewUp[1] = up[1];
+            cam.viewUp[2] = up[2];
+        }
+    }
+
+    // Экранные координаты как у WorldToDisplay, без сдвига на центр вьюпорта
+    bool ProjectCamera(const ElectrodeAutoIdentifier::CameraState& cam, double pixelScale,
+        const std::array<double, 3>& w, double& outX, double& outY)
+    {
+        std::array<double, 3> vpn{
+            cam.pos[0] - cam.focal[0],
+            cam.pos[1] - cam.focal[1],
+            cam.pos[2] - cam.focal[2] };
+        if (!Normalize3(vpn))
+            return false;
+
+        std::array<double, 3> side = Cross3({ cam.viewUp[0], cam.viewUp[1], cam.viewUp[2] }, vpn);
+        if (!Normalize3(side))
+            return false;
+        const auto up = Cross3(vpn, side);
+
+        const std::array<double, 3> rel{ w[0] - cam.pos[0], w[1] - cam.pos[1], w[2] - cam.pos[2] };
+        const double vx = Dot3(rel, side);
+        const double vy = Dot3(rel, up);
+
+        if (cam.parallelProjection)
+        {
+            outX = vx * pixelScale;
+            outY = vy * pixelScale;
+        }
+        else
+        {
+            const double depth = -Dot3(rel, vpn);
+            if (std::abs(depth) < 1e-12)
+                return false;
+            outX = vx / depth * pixelScale;
+            outY = vy / depth * pixelScale;
+        }
+
+        return std::isfinite(outX) && std::isfinite(outY);
+    }
+}
+
+ElectrodeAutoIdentifier::Labeler::Labeler(std::vector<std::array<double, 3>> sphereCenters,
+    const std::array<double, 3>& volumeCenterW,
+    const CameraState& apCamera,
+    int viewportHeightPx)
+    : mSpheres(std::move(sphereCenters))
+    , mVolumeCenter(volumeCenterW)
+    , mAp(apCamera)
+    , mCam(apCamera)
+{
+    mAlive.assign(mSpheres.size(), 1);
+
+    mKd.resize(mSpheres.size());
+    for (int i = 0; i < static_cast<int>(mKd.size()); ++i)
+        mKd[i].index = i;
+    buildKd(0, static_cast<int>(mKd.size()));
+
+    const double halfH = 0.5 * std::max(1, viewportHeightPx);
+    if (mAp.parallelProjection)
+        mPixelScale = halfH / std::max(1e-9, mAp.parallelScale);
+    else
+        mPixelScale = halfH / std::tan(0.5 * std::clamp(mAp.viewAngle, 1e-3, 179.0) * M_PI / 180.0);
+}
+
+void ElectrodeAutoIdentifier::Labeler::buildKd(int lo, int hi)
+{
+    if (hi - lo <= 1)
         return;
 
-    ClearDebugProps(ren);
+    double mn[3]{ std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max() };
+    double mx[3]{ std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest() };
+    for (int i = lo; i < hi; ++i)
+    {
+        const auto& p = mSpheres[mKd[i].index];
+        for (int k = 0; k < 3; ++k)
+        {
+            mn[k] = std::min(mn[k], p[k]);
+            mx[k] = std::max(mx[k], p[k]);
+        }
+    }
+
+    int axis = 0;
+    for (int k = 1; k < 3; ++k)
+        if (mx[k] - mn[k] > mx[axis] - mn[axis])
+            axis = k;
 
-    const double t0 = norm0_2pi(hourToTheta(h0));
-    const double t1 = norm0_2pi(hourToTheta(h1));
+    const int mid = (lo + hi) / 2;
+    std::nth_element(mKd.begin() + lo, mKd.begin() + mid, mKd.begin() + hi,
+        [&](const KdNode& a, const KdNode& b) { return mSpheres[a.index][axis] < mSpheres[b.index][axis]; });
+    mKd[mid].axis = axis;
 
-    // Важно:
-    // у тебя theta = atan2(dx, dy)
-    // значит:
-    // dx = sin(theta) * L
-    // dy = cos(theta) * L
-    const double x0 = ax + std::sin(t0) * rayLen;
-    const double y0 = ay + std::cos(t0) * rayLen;
+    buildKd(lo, mid);
+    buildKd(mid + 1, hi);
+}
 
-    const double x1 = ax + std::sin(t1) * rayLen;
-    const double y1 = ay + std::cos(t1) * rayLen;
+void ElectrodeAutoIdentifier::Labeler::nearestKd(int lo, int hi, const std::array<double, 3>& p, int& best, double& bestD2) const
+{
+    if (lo >= hi)
+        return;
+
+    const int mid = (lo + hi) / 2;
+    const KdNode& n = mKd[mid];
+    const auto& c = mSpheres[n.index];
+
+    if (mAlive[n.index])
+    {
+        const double dx = c[0] - p[0];
+        const double dy = c[1] - p[1];
+        const double dz = c[2] - p[2];
+        const double d2 = dx * dx + dy * dy + dz * dz;
+        // при равенстве побеждает больший индекс, как в ElectrodeSurfaceDetector::removeSphereNearWorld
+        if (d2 < bestD2 || (d2 == bestD2 && n.index > best))
+        {
+            bestD2 = d2;
+            best = n.index;
+        }
+    }
 
-    // центральный луч сектора
-    double tm = t0;
-    if (t0 <= t1)
-        tm = 0.5 * (t0 + t1);
+    const double diff = p[n.axis] - c[n.axis];
+    if (diff < 0.0)
+    {
+        nearestKd(lo, mid, p, best, bestD2);
+        if (diff * diff <= bestD2)
+            nearestKd(mid + 1, hi, p, best, bestD2);
+    }
     else
     {
-        double a = t0;
-        double b = t1 + 2.0 * M_PI;
-        tm = 0.5 * (a + b);
-        tm = norm0_2pi(tm);
+        nearestKd(mid + 1, hi, p, best, bestD2);
+        if (diff * diff <= bestD2)
+            nearestKd(lo, mid, p, best, bestD2);
     }
+}
+
+void ElectrodeAutoIdentifier::Labeler::withinKd(int lo, int hi, const std::array<double, 3>& p, double r2, std::vector<int>& out) const
+{
+    if (lo >= hi)
+        return;
 
-    const double xm = ax + std::sin(tm) * (rayLen * 0.9);
-    const double ym = ay + std::cos(tm) * (rayLen * 0.9);
-
-    // границы сектора
-    auto l0 = MakeScreenLineActor(ax, ay, x0, y0, 0.0, 1.0, 1.0, 4.0);
-    auto l1 = MakeScreenLineActor(ax, ay, x1, y1, 1.0, 0.5, 0.0, 4.0);
-    auto lm = MakeScreenLineActor(ax, ay, xm, ym, 0.2, 1.0, 0.2, 3.0);
-
-    AddDebugProp(ren, l0);
-    AddDebugProp(ren, l1);
-    AddDebugProp(ren, lm);
-
-    // подписи
-    std::array<double, 3> p0w{ 0.0, 0.0, 0.0 };
-    std::array<double, 3> p1w{ 0.0, 0.0, 0.0 };
-    std::array<double, 3> pmw{ 0.0, 0.0, 0.0 };
-
-    auto txtAnchor = vtkSmartPointer<vtkTextActor>::New();
-    txtAnchor->SetInput("ANCHOR");
-    txtAnchor->SetPosition(ax + 8.0, ay + 8.0);
-    txtAnchor->GetTextProperty()->SetFontSize(16);
-    txtAnchor->GetTextProperty()->SetColor(0.2, 1.0, 0.2);
-    txtAnchor->GetTextProperty()->SetBold(1);
-    AddDebugProp(ren, txtAnchor);
-
-    auto txt0 = vtkSmartPointer<vtkTextActor>::New();
-    txt0->SetInput(QString("h=%1").arg(h0, 0, 'f', 1).toUtf8().constData());
-    txt0->SetPosition(x0 + 6.0, y0 + 6.0);
-    txt0->GetTextProperty()->SetFontSize(16);
-    txt0->GetTextProperty()->SetColor(0.0, 1.0, 1.0);
-    txt0->GetTextProperty()->SetBold(1);
-    AddDebugProp(ren, txt0);
-
-    auto txt1 = vtkSmartPointer<vtkTextActor>::New();
-    txt1->SetInput(QString("h=%1").arg(h1, 0, 'f', 1).toUtf8().constData());
-    txt1->SetPosition(x1 + 6.0, y1 + 6.0);
-    txt1->GetTextProperty()->SetFontSize(16);
-    txt1->GetTextProperty()->SetColor(1.0, 0.5, 0.0);
-    txt1->GetTextProperty()->SetBold(1);
-    AddDebugProp(ren, txt1);
-
-    if (auto* rw = ren->GetRenderWindow())
-        rw->Render();
+    const int mid = (lo + hi) / 2;
+    const KdNode& n = mKd[mid];
+    const auto& c = mSpheres[n.index];
+
+    const double dx = c[0] - p[0];
+    const double dy = c[1] - p[1];
+    const double dz = c[2] - p[2];
+    if (mAlive[n.index] && dx * dx + dy * dy + dz * dz <= r2)
+        out.push_back(n.index);
+
+    const double diff = p[n.axis] - c[n.axis];
+    if (diff <= 0.0 || diff * diff <= r2)
+        withinKd(lo, mid, p, r2, out);
+    if (diff >= 0.0 || diff * diff <= r2)
+        withinKd(mid + 1, hi, p, r2, out);
 }
 
+void ElectrodeAutoIdentifier::Labeler::setVolumeBoundsCenter(const std::array<double, 3>& c)
+{
+    mBoundsCenter = c;
+    mHasBounds = true;
+}
 
-struct SectorSearchParams
+void ElectrodeAutoIdentifier::Labeler::setSeed(const std::array<double, 3>& w)
 {
-    double h0 = 0.0;
-    double h1 = 0.0;
-    double minRadialTolerance = 8.0;
-    double radialToleranceFactor = 0.18;
-    bool useAnchorHemisphere = true;
-};
-
-static ElectrodeAutoIdentifier::Anchor CommitByWorld(ElectrodePanel* panel,
-    vtkRenderer* ren,
-    ElectrodeSurfaceDetector& det,
-    ElectrodePanel::ElectrodeId id,
-    const std::array<double, 3>& w)
+    mSeed = w;
+    mHasSeed = true;
+}
+
+void ElectrodeAutoIdentifier::Labeler::setKnown(Id id, const std::array<double, 3>& w)
 {
-    ElectrodeAutoIdentifier::Anchor a;
-    if (!panel->commitElectrodeFromWorld(id, w, false))
+    const int i = static_cast<int>(id);
+    if (i < 0 || i >= kIdCount)
+        return;
+    mKnown[i] = w;
+    mHas[i] = true;
+}
+
+bool ElectrodeAutoIdentifier::Labeler::has(Id id) const
+{
+    const int i = static_cast<int>(id);
+    return i >= 0 && i < kIdCount && mHas[i];
+}
+
+bool ElectrodeAutoIdentifier::Labeler::project(const std::array<double, 3>& w, double& x, double& y) const
+{
+    return ProjectCamera(mCam, mPixelScale, w, x, y);
+}
+
+bool ElectrodeAutoIdentifier::Labeler::projectBoundsCenter(double& x, double& y) const
+{
+    return mHasBounds && project(mBoundsCenter, x, y);
+}
+
+std::vector<int> ElectrodeAutoIdentifier::Labeler::aliveIds() const
+{
+    std::vector<int> ids;
+    ids.reserve(mSpheres.size());
+    for (int i = 0; i < static_cast<int>(mSpheres.size()); ++i)
+        if (mAlive[i])
+            ids.push_back(i);
+    return ids;
+}
+
+std::vector<ElectrodeAutoIdentifier::Cand2D> ElectrodeAutoIdentifier::Labeler::collect(
+    const std::vector<int>& ids,
+    const std::array<double, 3>& coneCenter,
+    bool useCone) const
+{
+    const std::array<double, 3> camPosW{ mCam.pos[0], mCam.pos[1], mCam.pos[2] };
+
+    std::vector<Cand2D> out;
+    out.reserve(ids.size());
+    for (const int i : ids)
+    {
+        if (!mAlive[i])
+            continue;
+        if (useCone && !IsWorldWithinCameraCone(coneCenter, mSpheres[i], camPosW, kAutoDetectConeAngleDeg))
+            continue;
+
+        Cand2D c;
+        c.w = mSpheres[i];
+        if (project(c.w, c.x, c.y))
+            out.push_back(c);
+    }
+    return out;
+}
+
+ElectrodeAutoIdentifier::Anchor ElectrodeAutoIdentifier::Labeler::anchor(Id id) const
+{
+    Anchor a;
+    if (!has(id))
+        return a;
+    a.w = mKnown[static_cast<int>(id)];
+    a.valid = project(a.w, a.x, a.y);
+    return a;
+}
+
+ElectrodeAutoIdentifier::Anchor ElectrodeAutoIdentifier::Labeler::commitWorld(Id id, const std::array<double, 3>& w)
+{
+    Anchor a;
+    if (mCommit && !mCommit(id, w))
         return a;
 
+    setKnown(id, w);
     a.w = w;
-    a.valid = ElectrodeAutoIdentifier::WorldToDisplay(ren, w, a.x, a.y);
-    det.removeSphereNearWorld(ren, w, 25.0);
+    a.valid = project(w, a.x, a.y);
+
+    int best = -1;
+    double bestD2 = kConsumeSphereRadiusMm * kConsumeSphereRadiusMm;
+    nearestKd(0, static_cast<int>(mKd.size()), w, best, bestD2);
+    if (best >= 0)
+        mAlive[best] = 0;
+
     return a;
 }
 
-static ElectrodeAutoIdentifier::Anchor CommitFromSector(
-    ElectrodePanel* panel,
-    vtkRenderer* ren,
-    ElectrodeSurfaceDetector& det,
-    ElectrodePanel::ElectrodeId id,
-    const std::array<double, 3>& volumeCenterW,
+ElectrodeAutoIdentifier::Anchor ElectrodeAutoIdentifier::Labeler::commitFromSector(
+    Id id,
     const std::array<double, 3>& anchorW,
     double ax,
     double ay,
     const SectorSearchParams& params)
 {
-    ElectrodeAutoIdentifier::Anchor a;
-
-
-    const auto centersNow = det.currentSphereCenters();
-    if (centersNow.empty())
-        return a;
-
-    const auto cands = ElectrodeAutoIdentifier::CollectDisplayCandidates(ren, centersNow);
-    if (cands.empty())
+    Anchor a;
+    if (std::find(mAlive.begin(), mAlive.end(), char(1)) == mAlive.end())
         return a;
 
-    const double rAnchor = Dist(volumeCenterW, anchorW);
+    const double rAnchor = Dist(mVolumeCenter, anchorW);
     double minR = 0.0;
     double maxR = std::numeric_limits<double>::infinity();
     bool useAnchorHemisphere = false;
@@ -706,107 +770,328 @@ static ElectrodeAutoIdentifier::Anchor CommitFromSector(
         useAnchorHemisphere = params.useAnchorHemisphere;
     }
 
+    // радиальное окно снимается с дерева, сектор и полусфера проверяются уже на кандидатах
+    std::vector<int> ids;
+    if (std::isfinite(maxR))
+    {
+        withinKd(0, static_cast<int>(mKd.size()), mVolumeCenter, maxR * maxR, ids);
+        std::sort(ids.begin(), ids.end());
+    }
+    else
+    {
+        ids = aliveIds();
+    }
 
-    DrawSectorDebug2D(ren, ax, ay, params.h0, params.h1);
+    const auto cands = collect(ids, mBoundsCenter, mHasBounds);
 
-    int idx = ElectrodeAutoIdentifier::PickClosestInSectorFrom(
+    const int idx = PickClosestInSectorFrom(
         cands,
         ax, ay, params.h0, params.h1,
-        volumeCenterW, minR, maxR,
+        mVolumeCenter, minR, maxR,
         anchorW, useAnchorHemisphere);
 
-
     if (idx < 0 && useAnchorHemisphere)
     {
         const SectorSearchParams fallback{ params.h0, params.h1, params.minRadialTolerance + 7.0, std::max(0.35, params.radialToleranceFactor), false };
-        return CommitFromSector(panel, ren, det, id, volumeCenterW, anchorW, ax, ay, fallback);
+        return commitFromSector(id, anchorW, ax, ay, fallback);
     }
 
     if (idx < 0 || idx >= static_cast<int>(cands.size()))
         return a;
 
-    return CommitByWorld(panel, ren, det, id, cands[idx].w);
+    return commitWorld(id, cands[idx].w);
 }
 
-static void RotateAzimuthToCenterX(ElectrodePanel* panel,
-    vtkRenderer* ren,
-    ElectrodePanel::ElectrodeId id,
-    int iters = 2)
+void ElectrodeAutoIdentifier::Labeler::centerOn(Id id, int iters)
 {
-    auto* cam = ren->GetActiveCamera();
-    if (!cam) return;
-
-    auto* rw = ren->GetRenderWindow();
-    if (!rw) return;
-
     for (int it = 0; it < iters; ++it)
     {
-        ElectrodeAutoIdentifier::Anchor a0 = ElectrodeAutoIdentifier::AnchorFromPanel(panel, ren, id);
-        if (!a0.valid) return;
+        const Anchor a0 = anchor(id);
+        if (!a0.valid)
+            return;
 
         double cxD = 0.0, cyD = 0.0;
-        if (!ElectrodeAutoIdentifier::ComputeVolumeDisplayCenter(ren, cxD, cyD))
+        if (!projectBoundsCenter(cxD, cyD))
             return;
 
         const double err = (a0.x - cxD);
         if (std::abs(err) < 1.0)
             return;
 
+        // производная по азимуту - пробным поворотом копии камеры
         constexpr double testDeg = 1.0;
-        cam->Azimuth(+testDeg);
-        cam->OrthogonalizeViewUp();
-        ren->ResetCameraClippingRange();
-        rw->Render();
-
-        const ElectrodeAutoIdentifier::Anchor a1 = ElectrodeAutoIdentifier::AnchorFromPanel(panel, ren, id);
-
-        cam->Azimuth(-testDeg);
-        cam->OrthogonalizeViewUp();
-        ren->ResetCameraClippingRange();
-        rw->Render();
+        CameraState probe = mCam;
+        AzimuthCamera(probe, +testDeg);
 
-        if (!a1.valid) return;
+        double x1 = 0.0, y1 = 0.0;
+        if (!ProjectCamera(probe, mPixelScale, a0.w, x1, y1))
+            return;
 
-        const double dxPerDeg = (a1.x - a0.x) / testDeg;
+        const double dxPerDeg = (x1 - a0.x) / testDeg;
         if (std::abs(dxPerDeg) < 1e-6)
             return;
 
         double deltaAz = -err / dxPerDeg;
         deltaAz = std::clamp(deltaAz, -25.0, +25.0);
 
-        cam->Azimuth(deltaAz);
-        cam->OrthogonalizeViewUp();
-        ren->ResetCameraClippingRange();
-        rw->Render();
+        AzimuthCamera(mCam, deltaAz);
     }
 }
 
-static ElectrodeAutoIdentifier::Anchor PlaceSequential(
-    ElectrodePanel* panel,
-    vtkRenderer* ren,
-    ElectrodeSurfaceDetector& det,
-    ElectrodePanel::ElectrodeId id,
-    ElectrodeAutoIdentifier::Anchor prevAnchor,
-    const std::array<double, 3>& volumeCenterW,
+ElectrodeAutoIdentifier::Anchor ElectrodeAutoIdentifier::Labeler::placeSequential(
+    Id id,
+    const Anchor& prev,
     const SectorSearchParams& params)
 {
+    Anchor a = anchor(id);
+
+    if (!a.valid && !has(id) && prev.valid)
+        a = commitFromSector(id, prev.w, prev.x, prev.y, params);
 
-    auto a = ElectrodeAutoIdentifier::AnchorFromPanel(panel, ren, id);
+    centerOn(id);
+    return anchor(id);
+}
 
+ElectrodeAutoIdentifier::Result ElectrodeAutoIdentifier::Labeler::searchRLFN()
+{
+    Result r;
+    mCam = mAp;
 
-    if (!a.valid && !panel->hasCoord(id) && prevAnchor.valid)
+    // Берем только кандидатов на полусфере, обращенной к камере
+    const auto cands = collect(aliveIds(), mVolumeCenter, true);
+    if (cands.empty())
+        return r;
+
+    double minX = std::numeric_limits<double>::max();
+    double maxX = std::numeric_limits<double>::lowest();
+
+    for (const auto& c : cands)
     {
-        a = CommitFromSector(panel, ren, det, id,
-            volumeCenterW,
-            prevAnchor.w, prevAnchor.x, prevAnchor.y,
-            params);
+        minX = std::min(minX, c.x);
+        maxX = std::max(maxX, c.x);
     }
 
-    RotateAzimuthToCenterX(panel, ren, id);
+    const double midX = 0.5 * (minX + maxX);
+    std::vector<bool> used(cands.size(), false);
 
-    a = ElectrodeAutoIdentifier::AnchorFromPanel(panel, ren, id);
+    const auto tryCommitIndex =
+        [&](Id id, int idx, bool& outPlaced, std::array<double, 3>& outWorld)
+        {
+            if (has(id))
+                return;
 
-    return a;
+            if (idx < 0 || idx >= static_cast<int>(cands.size()))
+                return;
+
+            commitWorld(id, cands[idx].w);
+            if (has(id))
+            {
+                used[idx] = true;
+                outPlaced = true;
+                outWorld = cands[idx].w;
+            }
+        };
+
+    // AP:
+    // R = левый верх
+    // L = правый верх
+    // F = правый низ
+    // N = левый низ
+
+    tryCommitIndex(Id::R, PickTopMostSide(cands, used, true, midX), r.placedR, r.wR);
+    tryCommitIndex(Id::L, PickTopMostSide(cands, used, false, midX), r.placedL, r.wL);
+    tryCommitIndex(Id::F, PickBottomMostSide(cands, used, false, midX), r.placedF, r.wF);
+    tryCommitIndex(Id::N, PickBottomMostSide(cands, used, true, midX), r.placedN, r.wN);
+
+    return r;
+}
+
+void ElectrodeAutoIdentifier::Labeler::searchV1V6()
+{
+    mCam = mAp;
+
+    double cx = 0.0;
+    double cy = 0.0;
+    bool hasSeed = mHasSeed && project(mSeed, cx, cy);
+    if (!hasSeed && !projectBoundsCenter(cx, cy))
+        return;
+
+    const std::array<double, 3> seedWorld = hasSeed ? mSeed : mVolumeCenter;
+
+    Anchor aV1 = anchor(Id::V1);
+    if (!aV1.valid && !has(Id::V1))
+        aV1 = commitFromSector(Id::V1, seedWorld, cx, cy, SectorSearchParams{ 10.5, 12.0, 20.0, 0.30, true });
+
+    Anchor aV2 = anchor(Id::V2);
+    if (!aV2.valid && !has(Id::V2))
+        aV2 = commitFromSector(Id::V2, seedWorld, cx, cy, SectorSearchParams{ 12.0, 1.5, 20.0, 0.30, true });
+
+    centerOn(Id::V2);
+    aV2 = anchor(Id::V2);
+
+    const Anchor aV3 = placeSequential(Id::V3, aV2, SectorSearchParams{ 3.0, 6.0, 20.0, 0.30, true });
+    const Anchor aV4 = placeSequential(Id::V4, aV3, SectorSearchParams{ 2.0, 6.0, 20.0, 0.30, true });
+    const Anchor aV5 = placeSequential(Id::V5, aV4, SectorSearchParams{ 1.0, 5.0, 20.0, 0.30, true });
+    (void)placeSequential(Id::V6, aV5, SectorSearchParams{ 2.0, 4.0, 20.0, 0.30, true });
+}
+
+void ElectrodeAutoIdentifier::Labeler::searchV7V12()
+{
+    mCam = mAp;
+    AzimuthCamera(mCam, 90.0); // правый бок
+
+    const Anchor aV6 = anchor(Id::V6);
+    const Anchor aV7 = placeSequential(Id::V7, aV6, SectorSearchParams{ 0.5, 5.0, 20.0, 0.30, true });
+    const Anchor aV8 = placeSequential(Id::V8, aV7, SectorSearchParams{ 0.0, 4.0, 20.0, 0.30, true });
+    const Anchor aV9 = placeSequential(Id::V9, aV8, SectorSearchParams{ 1.5, 4.5, 20.0, 0.30, true });
+    const Anchor aV10 = placeSequential(Id::V10, aV9, SectorSearchParams{ 1.0, 5.0, 20.0, 0.30, true });
+    const Anchor aV11 = placeSequential(Id::V11, aV10, SectorSearchParams{ 1.0, 5.0, 20.0, 0.30, true });
+    (void)placeSequential(Id::V12, aV11, SectorSearchParams{ 2.0, 6.0, 20.0, 0.30, true });
+}
+
+void ElectrodeAutoIdentifier::Labeler::searchV13V19()
+{
+    mCam = mAp;
+
+    centerOn(Id::V1);
+    Anchor aV1 = anchor(Id::V1);
+
+    const Anchor aV15 = placeSequential(Id::V15, aV1, SectorSearchParams{ 6.0, 9.0, 20.0, 0.30, true });
+    const Anchor aV14 = placeSequential(Id::V14, aV15, SectorSearchParams{ 6.0, 9.0, 20.0, 0.30, true });
+    const Anchor aV13 = placeSequential(Id::V13, aV14, SectorSearchParams{ 7.5, 10.5, 20.0, 0.30, true });
+    (void)placeSequential(Id::V19, aV13, SectorSearchParams{ 4.5, 7.5, 20.0, 0.30, true });
+
+    centerOn(Id::V1);
+    aV1 = anchor(Id::V1);
+
+    const Anchor aV16 = placeSequential(Id::V16, aV1, SectorSearchParams{ 0.0, 3.0, 20.0, 0.30, true });
+    const Anchor aV17 = placeSequential(Id::V17, aV16, SectorSearchParams{ 1.5, 4.5, 20.0, 0.30, true });
+    (void)placeSequential(Id::V18, aV17, SectorSearchParams{ 1.5, 4.5, 20.0, 0.30, true });
+}
+
+void ElectrodeAutoIdentifier::Labeler::searchV20V25()
+{
+    mCam = mAp;
+
+    centerOn(Id::V1);
+    const Anchor aV1 = anchor(Id::V1);
+
+    const Anchor aV25 = placeSequential(Id::V25, aV1, SectorSearchParams{ 9.0, 0.0, 20.0, 0.30, true });
+    (void)placeSequential(Id::V24, aV25, SectorSearchParams{ 6.0, 10.5, 20.0, 0.30, true });
+
+    mCam = mAp;                 // вернулись в AP
+    AzimuthCamera(mCam, 180.0); // повернули на PA
+
+    Anchor aV20;
+    if (!has(Id::V20))
+    {
+        const auto cands = collect(aliveIds(), mBoundsCenter, mHasBounds);
+        const int idx = PickLeft(cands);
+        if (idx >= 0)
+            aV20 = commitWorld(Id::V20, cands[idx].w);
+    }
+    else
+    {
+        aV20 = anchor(Id::V20);
+    }
+
+    const Anchor aV21 = placeSequential(Id::V21, aV20, SectorSearchParams{ 1.0, 4.5, 20.0, 0.30, true });
+    const Anchor aV22 = placeSequential(Id::V22, aV21, SectorSearchParams{ 1.5, 4.5, 20.0, 0.30, true });
+    (void)placeSequential(Id::V23, aV22, SectorSearchParams{ 1.5, 4.5, 20.0, 0.30, true });
+}
+
+void ElectrodeAutoIdentifier::Labeler::searchV26V30()
+{
+    mCam = mAp;
+
+    centerOn(Id::V1);
+    const Anchor aV1 = anchor(Id::V1);
+
+    // экранная позиция V26 остается от повернутого вида, как и при живой камере
+    const Anchor aV26 = placeSequential(Id::V26, aV1, SectorSearchParams{ 4.5, 6.0, 20.0, 0.30, true });
+    mCam = mAp;
+    (void)placeSequential(Id::V27, aV26, SectorSearchParams{ 3.0, 6.0, 20.0, 0.30, true });
+
+    centerOn(Id::V6);
+    const Anchor aV6 = anchor(Id::V6);
+
+    (void)placeSequential(Id::V28, aV6, SectorSearchParams{ 4.0, 8.0, 20.0, 0.30, true });
+
+    mCam = mAp;                 // вернулись в AP
+    AzimuthCamera(mCam, 180.0); // повернули на PA
+
+    Anchor aV29;
+    if (!has(Id::V29))
+    {
+        const auto cands = collect(aliveIds(), mBoundsCenter, mHasBounds);
+        const int idx = PickLeftBottom(cands);
+        if (idx >= 0)
+            aV29 = commitWorld(Id::V29, cands[idx].w);
+    }
+    else
+    {
+        aV29 = anchor(Id::V29);
+    }
+
+    (void)placeSequential(Id::V30, aV29, SectorSearchParams{ 1.5, 4.5, 8.0, 0.18, true });
+}
+
+ElectrodeAutoIdentifier::Result ElectrodeAutoIdentifier::Labeler::searchAll()
+{
+    // порядок групп повторяет зависимости кнопок поиска
+    const Result r = searchRLFN();
+    searchV1V6();
+    searchV26V30();
+    searchV7V12();
+    searchV13V19();
+    searchV20V25();
+    return r;
+}
+
+namespace
+{
+    std::array<double, 3> DicomVolumeCenter(const DicomInfo& DI)
+    {
+        return { DI.VolumeOriginX + DI.VolumeCenterX, DI.VolumeOriginY + DI.VolumeCenterY, DI.VolumeOriginZ + DI.VolumeCenterZ };
+    }
+
+    // Камера рендерера только читается; сферы снимаются с детектора вместе с фиксацией электрода
+    ElectrodeAutoIdentifier::Labeler MakeLabeler(ElectrodePanel* panel, vtkRenderer* ren, const DicomInfo& DI)
+    {
+        auto& det = ElectrodeSurfaceDetector::instance();
+
+        int viewportH = 0;
+        if (const int* sz = ren->GetSize())
+            viewportH = sz[1];
+
+        ElectrodeAutoIdentifier::Labeler labeler(det.currentSphereCenters(), DicomVolumeCenter(DI),
+            ElectrodeAutoIdentifier::SaveCamera(ren), viewportH);
+
+        std::array<double, 3> boundsCenter{};
+        if (ElectrodeAutoIdentifier::ComputeVolumeWorldCenter(ren, boundsCenter))
+            labeler.setVolumeBoundsCenter(boundsCenter);
+
+        for (const auto& c : panel->coordsWorld())
+            labeler.setKnown(c.id, c.world);
+
+        labeler.setCommit([panel, ren, &det](ElectrodePanel::ElectrodeId id, const std::array<double, 3>& w)
+            {
+                if (!panel->commitElectrodeFromWorld(id, w, false))
+                    return false;
+                det.removeSphereNearWorld(ren, w, kConsumeSphereRadiusMm);
+                return true;
+            });
+
+        return labeler;
+    }
+
+    void SetSeedFromViewportCenter(ElectrodeAutoIdentifier::Labeler& labeler, const ElectrodePanel* panel)
+    {
+        std::array<int, 3> ijk{};
+        std::array<double, 3> w{};
+        if (panel->pickAtViewportCenter(ijk, w))
+            labeler.setSeed(w);
+    }
 }
 
 int ElectrodeAutoIdentifier::PickClosestInSectorFrom(
@@ -937,79 +1222,11 @@ ElectrodeAutoIdentifier::Anchor ElectrodeAutoIdentifier::AnchorFromPanel(const E
 
 ElectrodeAutoIdentifier::Result ElectrodeAutoIdentifier::SearchRLFN(ElectrodePanel* panel, vtkRenderer* ren, DicomInfo DI)
 {
-    Result r;
     if (!panel || !ren)
-        return r;
-
-    auto& det = ElectrodeSurfaceDetector::instance();
-    const auto centers = det.currentSphereCenters();
-    if (centers.empty())
-        return r;
-
-    const std::array<double, 3> volCenterW{
-        DI.VolumeOriginX + DI.VolumeCenterX,
-        DI.VolumeOriginY + DI.VolumeCenterY,
-        DI.VolumeOriginZ + DI.VolumeCenterZ
-    };
-
-    // Берем только кандидатов на полусфере, обращенной к камере
-    const auto cands = CollectRLFNCandidatesFiltered(ren, centers, volCenterW);
-    if (cands.empty())
-        return r;
-
-    double minX = std::numeric_limits<double>::max();
-    double maxX = std::numeric_limits<double>::lowest();
-
-    for (const auto& c : cands)
-    {
-        minX = std::min(minX, c.x);
-        maxX = std::max(maxX, c.x);
-    }
-
-    const double midX = 0.5 * (minX + maxX);
-    std::vector<bool> used(cands.size(), false);
-
-    const auto tryCommitIndex =
-        [&](ElectrodePanel::ElectrodeId id, int idx, bool& outPlaced, std::array<double, 3>& outWorld)
-        {
-            if (panel->hasCoord(id))
-                return;
-
-            if (idx < 0 || idx >= static_cast<int>(cands.size()))
-                return;
-
-            if (panel->commitElectrodeFromWorld(id, cands[idx].w, false))
-            {
-                used[idx] = true;
-                outPlaced = true;
-                outWorld = cands[idx].w;
-                det.removeSphereNearWorld(ren, cands[idx].w, 25.0);
-            }
-        };
-
-    // AP:
-    // R = левый верх
-    // L = правый верх
-    // F = правый низ
-    // N = левый низ
-
-    tryCommitIndex(ElectrodePanel::ElectrodeId::R,
-        PickTopMostSide(cands, used, true, midX),
-        r.placedR, r.wR);
-
-    tryCommitIndex(ElectrodePanel::ElectrodeId::L,
-        PickTopMostSide(cands, used, false, midX),
-        r.placedL, r.wL);
-
-    tryCommitIndex(ElectrodePanel::ElectrodeId::F,
-        PickBottomMostSide(cands, used, false, midX),
-        r.placedF, r.wF);
-
-    tryCommitIndex(ElectrodePanel::ElectrodeId::N,
-        PickBottomMostSide(cands, used, true, midX),
-        r.placedN, r.wN);
+        return {};
 
-    return r;
+    auto labeler = MakeLabeler(panel, ren, DI);
+    return labeler.searchRLFN();
 }
 
 ElectrodeAutoIdentifier::CameraState ElectrodeAutoIdentifier::SaveCamera(vtkRenderer* ren)
@@ -1024,6 +1241,7 @@ ElectrodeAutoIdentifier::CameraState ElectrodeAutoIdentifier::SaveCamera(vtkRend
     cam->GetViewUp(s.viewUp);
     s.parallelProjection = cam->GetParallelProjection() != 0;
     s.parallelScale = cam->GetParallelScale();
+    s.viewAngle = cam->GetViewAngle();
     return s;
 }
 
@@ -1038,6 +1256,7 @@ void ElectrodeAutoIdentifier::RestoreCamera(vtkRenderer* ren, const CameraState&
     cam->SetViewUp(s.viewUp);
     cam->SetParallelProjection(s.parallelProjection ? 1 : 0);
     cam->SetParallelScale(s.parallelScale);
+    cam->SetViewAngle(s.viewAngle);
     cam->OrthogonalizeViewUp();
     ren->ResetCameraClippingRange();
 
@@ -1217,78 +1436,10 @@ void ElectrodeAutoIdentifier::SearchV1V6(ElectrodePanel* panel, vtkRenderer* ren
     if (!panel || !ren)
         return;
 
-    auto& det = ElectrodeSurfaceDetector::instance();
-
-    std::array<double, 3> volCenterW{ DI.VolumeOriginX + DI.VolumeCenterX, DI.VolumeOriginY + DI.VolumeCenterY, DI.VolumeOriginZ + DI.VolumeCenterZ };
-    std::array<int, 3> centerIJK{};
-    std::array<double, 3> centerFirstNonZeroW{};
-    bool hasCenterFirstNonZero = panel->pickAtViewportCenter(centerIJK, centerFirstNonZeroW);
-
-    double cx = 0.0;
-    double cy = 0.0;
-    if (hasCenterFirstNonZero)
-    {
-        if (!WorldToDisplay(ren, centerFirstNonZeroW, cx, cy))
-            hasCenterFirstNonZero = false;
-    }
-    if (!hasCenterFirstNonZero && !ComputeVolumeDisplayCenter(ren, cx, cy))
-    {
-        return;
-    }
-
-    const std::array<double, 3>& seedWorld = hasCenterFirstNonZero ? centerFirstNonZeroW : volCenterW;
-
-    Anchor aV1 = AnchorFromPanel(panel, ren, ElectrodePanel::ElectrodeId::V1);
-    if (!aV1.valid && !panel->hasCoord(ElectrodePanel::ElectrodeId::V1))
-        aV1 = CommitFromSector(panel, ren, det, ElectrodePanel::ElectrodeId::V1,
-            volCenterW,
-            seedWorld, cx, cy,
-            SectorSearchParams{ 10.5, 12.0, 20.0, 0.30, true });
-
-    Anchor aV2 = AnchorFromPanel(panel, ren, ElectrodePanel::ElectrodeId::V2);
-    if (!aV2.valid && !panel->hasCoord(ElectrodePanel::ElectrodeId::V2))
-        aV2 = CommitFromSector(panel, ren, det, ElectrodePanel::ElectrodeId::V2,
-            volCenterW,
-            seedWorld, cx, cy,
-            SectorSearchParams{ 12.0, 1.5, 20.0, 0.30, true });
-
-
-    RotateAzimuthToCenterX(panel, ren, ElectrodePanel::ElectrodeId::V2);
-    aV2 = AnchorFromPanel(panel, ren, ElectrodePanel::ElectrodeId::V2);
-
-    Anchor aV3 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V3, aV2, volCenterW, SectorSearchParams{ 3.0, 6.0, 20.0, 0.30, true });
-    Anchor aV4 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V4, aV3, volCenterW, SectorSearchParams{ 2.0, 6.0, 20.0, 0.30, true });
-    Anchor aV5 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V5, aV4, volCenterW, SectorSearchParams{ 1.0, 5.0, 20.0, 0.30, true });
-    (void)PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V6, aV5, volCenterW, SectorSearchParams{ 2.0, 4.0, 20.0, 0.30, true });
-    ClearDebugProps(ren);
-}
-
-static void TurnPA(vtkRenderer* ren)
-{
-    if (!ren) return;
-    auto* cam = ren->GetActiveCamera();
-    if (!cam) return;
-
-    cam->Azimuth(180.0);
-    cam->OrthogonalizeViewUp();
-    ren->ResetCameraClippingRange();
-
-    if (auto* rw = ren->GetRenderWindow())
-        rw->Render();
-}
-
-static void TurnR(vtkRenderer* ren)
-{
-    if (!ren) return;
-    auto* cam = ren->GetActiveCamera();
-    if (!cam) return;
-
-    cam->Azimuth(90.0);
-    cam->OrthogonalizeViewUp();
-    ren->ResetCameraClippingRange();
-
-    if (auto* rw = ren->GetRenderWindow())
-        rw->Render();
+    auto labeler = MakeLabeler(panel, ren, DI);
+    SetSeedFromViewportCenter(labeler, panel);
+    labeler.searchV1V6();
+    RestoreCamera(ren, labeler.camera(), false);
 }
 
 void ElectrodeAutoIdentifier::SearchV7V12(ElectrodePanel* panel, vtkRenderer* ren, DicomInfo DI)
@@ -1296,65 +1447,9 @@ void ElectrodeAutoIdentifier::SearchV7V12(ElectrodePanel* panel, vtkRenderer* re
     if (!panel || !ren)
         return;
 
-
-    auto camSaved = SaveCamera(ren);
-    ClearDebugProps(ren);
-    auto& det = ElectrodeSurfaceDetector::instance();
-
-    std::array<double, 3> volCenterW{ DI.VolumeOriginX + DI.VolumeCenterX, DI.VolumeOriginY + DI.VolumeCenterY, DI.VolumeOriginZ + DI.VolumeCenterZ };
-
-    TurnR(ren);
-    Anchor aV6 = AnchorFromPanel(panel, ren, ElectrodePanel::ElectrodeId::V6);
-    Anchor aV7 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V7, aV6, volCenterW, SectorSearchParams{ 0.5, 5, 20.0, 0.30, true });
-    Anchor aV8 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V8, aV7, volCenterW, SectorSearchParams{ 0.0, 4.0, 20.0, 0.30, true });
-    Anchor aV9 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V9, aV8, volCenterW, SectorSearchParams{ 1.5, 4.5, 20.0, 0.30, true });
-    Anchor aV10 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V10, aV9, volCenterW, SectorSearchParams{ 1.0, 5.0, 20.0, 0.30, true });
-    Anchor aV11 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V11, aV10, volCenterW, SectorSearchParams{ 1.0, 5.0, 20.0, 0.30, true });
-    Anchor aV12 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V12, aV11, volCenterW, SectorSearchParams{ 2.0, 6.0, 20.0, 0.30, true });
-    ClearDebugProps(ren);
-}
-
-static int pickLeftBottomPA(const std::vector<ElectrodeAutoIdentifier::Cand2D>& cands)
-{
-    if (cands.empty())
-        return -1;
-
-    double minX = std::numeric_limits<double>::max();
-    double maxX = std::numeric_limits<double>::lowest();
-    double minY = std::numeric_limits<double>::max();
-    double maxY = std::numeric_limits<double>::lowest();
-
-    for (const auto& c : cands)
-    {
-        minX = std::min(minX, c.x);
-        maxX = std::max(maxX, c.x);
-        minY = std::min(minY, c.y);
-        maxY = std::max(maxY, c.y);
-    }
-
-    const double rangeX = std::max(1.0, maxX - minX);
-    const double rangeY = std::max(1.0, maxY - minY);
-
-    int best = -1;
-    double bestScore = std::numeric_limits<double>::max();
-
-    for (int i = 0; i < (int)cands.size(); ++i)
-    {
-        // нормируем в [0..1]
-        const double nx = (cands[i].x - minX) / rangeX; // 0 = самый левый
-        const double ny = (cands[i].y - minY) / rangeY; // 0 = самый нижний
-
-        // “левый-низ” => минимизируем nx + ny
-        const double score = nx + ny;
-
-        if (score < bestScore)
-        {
-            bestScore = score;
-            best = i;
-        }
-    }
-
-    return best;
+    auto labeler = MakeLabeler(panel, ren, DI);
+    labeler.searchV7V12();
+    RestoreCamera(ren, labeler.camera(), false);
 }
 
 void ElectrodeAutoIdentifier::SearchV13V19(ElectrodePanel* panel, vtkRenderer* ren, DicomInfo DI)
@@ -1362,29 +1457,9 @@ void ElectrodeAutoIdentifier::SearchV13V19(ElectrodePanel* panel, vtkRenderer* r
     if (!panel || !ren)
         return;
 
-
-    auto camSaved = SaveCamera(ren);
-    ClearDebugProps(ren);
-    auto& det = ElectrodeSurfaceDetector::instance();
-
-    std::array<double, 3> volCenterW{ DI.VolumeOriginX + DI.VolumeCenterX, DI.VolumeOriginY + DI.VolumeCenterY, DI.VolumeOriginZ + DI.VolumeCenterZ };
-
-    RotateAzimuthToCenterX(panel, ren, ElectrodePanel::ElectrodeId::V1);
-    Anchor aV1 = AnchorFromPanel(panel, ren, ElectrodePanel::ElectrodeId::V1);
-
-
-    Anchor aV15 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V15, aV1, volCenterW, SectorSearchParams{ 6.0, 9.0, 20.0, 0.30, true });
-    Anchor aV14 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V14, aV15, volCenterW, SectorSearchParams{ 6.0, 9.0, 20.0, 0.30, true });
-    Anchor aV13 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V13, aV14, volCenterW, SectorSearchParams{ 7.5, 10.5, 20.0, 0.30, true });
-    Anchor aV19 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V19, aV13, volCenterW, SectorSearchParams{ 4.5, 7.5, 20.0, 0.30, true });
-
-    RotateAzimuthToCenterX(panel, ren, ElectrodePanel::ElectrodeId::V1);
-    aV1 = AnchorFromPanel(panel, ren, ElectrodePanel::ElectrodeId::V1);
-
-    Anchor aV16 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V16, aV1, volCenterW, SectorSearchParams{ 0.0, 3.0, 20.0, 0.30, true });
-    Anchor aV17 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V17, aV16, volCenterW, SectorSearchParams{ 1.5, 4.5, 20.0, 0.30, true });
-    Anchor aV18 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V18, aV17, volCenterW, SectorSearchParams{ 1.5, 4.5, 20.0, 0.30, true });
-    ClearDebugProps(ren);
+    auto labeler = MakeLabeler(panel, ren, DI);
+    labeler.searchV13V19();
+    RestoreCamera(ren, labeler.camera(), false);
 }
 
 void ElectrodeAutoIdentifier::SearchV20V25(ElectrodePanel* panel, vtkRenderer* ren, DicomInfo DI)
@@ -1392,49 +1467,9 @@ void ElectrodeAutoIdentifier::SearchV20V25(ElectrodePanel* panel, vtkRenderer* r
     if (!panel || !ren)
         return;
 
-
-    auto camSaved = SaveCamera(ren);
-    ClearDebugProps(ren);
-    auto& det = ElectrodeSurfaceDetector::instance();
-
-    std::array<double, 3> volCenterW{ DI.VolumeOriginX + DI.VolumeCenterX, DI.VolumeOriginY + DI.VolumeCenterY, DI.VolumeOriginZ + DI.VolumeCenterZ };
-
-
-    RotateAzimuthToCenterX(panel, ren, ElectrodePanel::ElectrodeId::V1);
-    Anchor aV1 = AnchorFromPanel(panel, ren, ElectrodePanel::ElectrodeId::V1);
-
-
-    Anchor aV25 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V25, aV1, volCenterW, SectorSearchParams{ 9.0, 0.0, 20.0, 0.30, true });
-    Anchor aV24 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V24, aV25, volCenterW, SectorSearchParams{ 6.0, 10.5, 20.0, 0.30, true });
-
-    RestoreCamera(ren, camSaved); // вернулись в AP
-    TurnPA(ren);                  // повернули на PA
-
-    bool placedV20 = false;
-    std::array<double, 3> wV20{};
-    Anchor aV20;
-
-    if (!panel->hasCoord(ElectrodePanel::ElectrodeId::V20))
-    {
-        const auto centers = det.currentSphereCenters();
-        const auto cands = CollectDisplayCandidates(ren, centers);
-
-        const int idx = PickLeft(cands);
-
-        aV20 = CommitByIndex(panel, ren, det,
-            ElectrodePanel::ElectrodeId::V20,
-            cands, idx,
-            placedV20, wV20);
-    }
-    else
-    {
-        aV20 = AnchorFromPanel(panel, ren, ElectrodePanel::ElectrodeId::V20);
-    }
-
-    Anchor aV21 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V21, aV20, volCenterW, SectorSearchParams{ 1.0, 4.5, 20.0, 0.30, true });
-    Anchor aV22 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V22, aV21, volCenterW, SectorSearchParams{ 1.5, 4.5, 20.0, 0.30, true });
-    Anchor aV23 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V23, aV22, volCenterW, SectorSearchParams{ 1.5, 4.5, 20.0, 0.30, true });
-    ClearDebugProps(ren);
+    auto labeler = MakeLabeler(panel, ren, DI);
+    labeler.searchV20V25();
+    RestoreCamera(ren, labeler.camera(), false);
 }
 
 void ElectrodeAutoIdentifier::SearchV26V30(ElectrodePanel* panel, vtkRenderer* ren, DicomInfo DI)
@@ -1442,50 +1477,20 @@ void ElectrodeAutoIdentifier::SearchV26V30(ElectrodePanel* panel, vtkRenderer* r
     if (!panel || !ren)
         return;
 
-    auto camSaved = SaveCamera(ren);
-
-    auto& det = ElectrodeSurfaceDetector::instance();
-
-    std::array<double, 3> volCenterW{ DI.VolumeOriginX + DI.VolumeCenterX, DI.VolumeOriginY + DI.VolumeCenterY, DI.VolumeOriginZ + DI.VolumeCenterZ };
-
-    RotateAzimuthToCenterX(panel, ren, ElectrodePanel::ElectrodeId::V1);
-    Anchor aV1 = AnchorFromPanel(panel, ren, ElectrodePanel::ElectrodeId::V1);
-
-    Anchor aV26 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V26, aV1, volCenterW, SectorSearchParams{ 4.5, 6, 20.0, 0.30, true });
-    RestoreCamera(ren, camSaved);
-    Anchor aV27 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V27, aV26, volCenterW, SectorSearchParams{3.0, 6.0, 20.0, 0.30, true});
-
-    RotateAzimuthToCenterX(panel, ren, ElectrodePanel::ElectrodeId::V6);
-    Anchor aV6 = AnchorFromPanel(panel, ren, ElectrodePanel::ElectrodeId::V6);
-
-    Anchor aV28 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V28, aV6, volCenterW, SectorSearchParams{ 4.0, 8.0, 20.0, 0.30, true });
-    
-    RestoreCamera(ren, camSaved); // вернулись в AP
-    TurnPA(ren);                  // повернули на PA
-
-    bool placedV29 = false;
-    std::array<double, 3> wV29{};
-    Anchor aV29;
-
-    if (!panel->hasCoord(ElectrodePanel::ElectrodeId::V29))
-    {
-        const auto centers = det.currentSphereCenters();
-        const auto cands = CollectDisplayCandidates(ren, centers);
-
-        const int idx = PickLeftBottom(cands);
+    auto labeler = MakeLabeler(panel, ren, DI);
+    labeler.searchV26V30();
+    RestoreCamera(ren, labeler.camera(), false);
+}
 
-        aV29 = CommitByIndex(panel, ren, det,
-            ElectrodePanel::ElectrodeId::V29,
-            cands, idx,
-            placedV29, wV29);
-    }
-    else
-    {
-        aV29 = AnchorFromPanel(panel, ren, ElectrodePanel::ElectrodeId::V29);
-    }
+void ElectrodeAutoIdentifier::SearchAll(ElectrodePanel* panel, vtkRenderer* ren, DicomInfo DI)
+{
+    if (!panel || !ren)
+        return;
 
-    Anchor aV30 = PlaceSequential(panel, ren, det, ElectrodePanel::ElectrodeId::V30, aV29, volCenterW, SectorSearchParams{ 1.5, 4.5, 8.0, 0.18, true });
-    ClearDebugProps(ren);
+    auto labeler = MakeLabeler(panel, ren, DI);
+    SetSeedFromViewportCenter(labeler, panel);
+    (void)labeler.searchAll();
+    RestoreCamera(ren, labeler.camera(), false);
 }
 
 
@@ -1686,4 +1691,19 @@ bool ElectrodeAutoIdentifier::ShouldShowSearchV26V30(const ElectrodePanel* panel
 
     const int availableSpheres = ElectrodeSurfaceDetector::instance().sphereCount();
     return availableSpheres >= missing;
-}
\ No newline at end of file
+}
+
+bool ElectrodeAutoIdentifier::ShouldShowSearchAll(const ElectrodePanel* panel)
+{
+    if (!panel)
+        return false;
+
+    int missing = 0;
+    for (int i = 0; i < static_cast<int>(ElectrodePanel::ElectrodeId::Count); ++i)
+        if (!panel->hasCoord(static_cast<ElectrodePanel::ElectrodeId>(i))) ++missing;
+
+    if (missing <= 0)
+        return false;
+
+    return ElectrodeSurfaceDetector::instance().sphereCount() > 0;
+}
@@ -2,6 +2,7 @@
 #include "ElectrodePanel.h"
 
 #include <array>
+#include <functional>
 #include <vector>
 
 class vtkRenderer;
@@ -38,6 +39,96 @@ public:
         std::array<double, 3> wN{};
     };
 
+    struct SectorSearchParams
+    {
+        double h0 = 0.0;
+        double h1 = 0.0;
+        double minRadialTolerance = 8.0;
+        double radialToleranceFactor = 0.18;
+        bool useAnchorHemisphere = true;
+    };
+
+    struct CameraState
+    {
+        double pos[3]{};
+        double focal[3]{};
+        double viewUp[3]{};
+        double parallelScale = 1.0;
+        double viewAngle = 30.0;
+        bool parallelProjection = false;
+    };
+
+    // Разметка в мировых координатах без рендера: повороты камеры считаются
+    // аналитически от исходного AP-вида, сферы детектора лежат в k-d дереве
+    class Labeler
+    {
+    public:
+        using Id = ElectrodePanel::ElectrodeId;
+        using CommitFn = std::function<bool(Id, const std::array<double, 3>&)>;
+
+        Labeler(std::vector<std::array<double, 3>> sphereCenters,
+            const std::array<double, 3>& volumeCenterW,
+            const CameraState& apCamera,
+            int viewportHeightPx);
+
+        void setVolumeBoundsCenter(const std::array<double, 3>& c);
+        void setSeed(const std::array<double, 3>& w);      // первая непустая точка в центре AP-вида
+        void setKnown(Id id, const std::array<double, 3>& w);
+        void setCommit(CommitFn fn) { mCommit = std::move(fn); }
+        bool has(Id id) const;
+
+        Result searchRLFN();
+        void searchV1V6();
+        void searchV7V12();
+        void searchV13V19();
+        void searchV20V25();
+        void searchV26V30();
+        Result searchAll();
+
+        // поза виртуальной камеры после последнего поиска
+        const CameraState& camera() const { return mCam; }
+
+    private:
+        bool project(const std::array<double, 3>& w, double& x, double& y) const;
+        bool projectBoundsCenter(double& x, double& y) const;
+        std::vector<Cand2D> collect(const std::vector<int>& ids, const std::array<double, 3>& coneCenter, bool useCone) const;
+        std::vector<int> aliveIds() const;
+        Anchor anchor(Id id) const;
+        Anchor commitWorld(Id id, const std::array<double, 3>& w);
+        Anchor commitFromSector(Id id, const std::array<double, 3>& anchorW, double ax, double ay, const SectorSearchParams& params);
+        Anchor placeSequential(Id id, const Anchor& prev, const SectorSearchParams& params);
+        void centerOn(Id id, int iters = 2);
+
+        struct KdNode
+        {
+            int index = -1;
+            int axis = 0;
+        };
+
+        void buildKd(int lo, int hi);
+        void nearestKd(int lo, int hi, const std::array<double, 3>& p, int& best, double& bestD2) const;
+        void withinKd(int lo, int hi, const std::array<double, 3>& p, double r2, std::vector<int>& out) const;
+
+        std::vector<std::array<double, 3>> mSpheres;
+        std::vector<char> mAlive;
+        std::vector<KdNode> mKd;
+
+        std::array<double, 3> mVolumeCenter{};
+        std::array<double, 3> mBoundsCenter{};
+        bool mHasBounds = false;
+        std::array<double, 3> mSeed{};
+        bool mHasSeed = false;
+
+        static constexpr int kIdCount = static_cast<int>(Id::Count);
+        std::array<std::array<double, 3>, kIdCount> mKnown{};
+        std::array<bool, kIdCount> mHas{};
+
+        CameraState mAp;
+        CameraState mCam;
+        double mPixelScale = 1.0;
+        CommitFn mCommit;
+    };
+
     static Result SearchRLFN(ElectrodePanel* panel, vtkRenderer* ren, DicomInfo DI);
     static bool ShouldShowSearchRLFN(const ElectrodePanel* panel);
 
@@ -51,6 +142,8 @@ public:
     static bool ShouldShowSearchV20V25(const ElectrodePanel* panel);
     static void SearchV26V30(ElectrodePanel* panel, vtkRenderer* ren, DicomInfo DI);
     static bool ShouldShowSearchV26V30(const ElectrodePanel* panel);
+    static void SearchAll(ElectrodePanel* panel, vtkRenderer* ren, DicomInfo DI);
+    static bool ShouldShowSearchAll(const ElectrodePanel* panel);
     static bool WorldToDisplay(vtkRenderer* ren, const std::array<double, 3>& w, double& outX, double& outY);
     static bool FindPanelCoord(const ElectrodePanel* panel, ElectrodePanel::ElectrodeId id, std::array<double, 3>& outWorld);
     static bool ComputeVolumeDisplayCenter(vtkRenderer* ren, double& cx, double& cy);
@@ -67,15 +160,6 @@ public:
         bool useAnchorHemisphere);
     static Anchor AnchorFromPanel(const ElectrodePanel* panel, vtkRenderer* ren, ElectrodePanel::ElectrodeId id);
 
-    struct CameraState
-    {
-        double pos[3]{};
-        double focal[3]{};
-        double viewUp[3]{};
-        double parallelScale = 1.0;
-        bool parallelProjection = false;
-    };
-
     static CameraState SaveCamera(vtkRenderer* ren);
     static void RestoreCamera(vtkRenderer* ren, const CameraState& s, bool render = true);
 
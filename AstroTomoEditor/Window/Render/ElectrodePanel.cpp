@@ -1,6 +1,7 @@
 #include "ElectrodePanel.h"
 #include "ElectrodeSurfaceDetector.h"
 #include "ElectrodeAutoIdentifier.h"
+#include "RenderScheduler.h"
 
 #include <QToolButton>
 #include <QPushButton>
@@ -20,6 +21,8 @@
 #include <vtkProp3D.h>
 #include <cmath>
 
+static constexpr double kMaxClickableAngleDeg = 85.0; // маркеры на дальней стороне тела не кликаются
+
 static const char* kElectrodeBtnQss =
 "QToolButton{ color:#fff; background:rgba(40,40,40,110);"
 " border:1px solid rgba(255,255,255,30); border-radius:6px; padding:0 8px; }"
@@ -452,12 +455,32 @@ void ElectrodePanel::buildUi()
             refreshSearchButtons();
         });
 
+    // Search all: RLFN и V1-V30 за один проход
+    mBtnSearchAll = new QPushButton(tr("Search all"), this);
+    mBtnSearchAll->setCursor(Qt::PointingHandCursor);
+    mBtnSearchAll->setFixedHeight(26);
+    mBtnSearchAll->setStyleSheet(
+        "QPushButton{"
+        "   background:rgba(60,60,60,140);"
+        "   border:1px solid rgba(255,255,255,60);"
+        "   border-radius:6px; padding:0 8px; text-align:center; color:#fff;}"
+        "QPushButton:hover{ background:rgba(90,90,90,170); }"
+        "QPushButton:pressed{ background:rgba(120,120,120,190); }"
+    );
+
+    connect(mBtnSearchAll, &QPushButton::clicked, this, [this]
+        {
+            emit searchAllRequested();
+            refreshSearchButtons();
+        });
+
     retain(mBtnSearchRLFN);
     retain(mBtnSearchV1V6);
     retain(mBtnSearchV7V12);
     retain(mBtnSearchV13V19);
     retain(mBtnSearchV20V25);
     retain(mBtnSearchV26V30);
+    retain(mBtnSearchAll);
 
     buttonsRow->addWidget(mBtnAuto, 1);
     buttonsRow->addWidget(mBtnSave, 1);
@@ -474,6 +497,8 @@ void ElectrodePanel::buildUi()
     grid->setRowMinimumHeight(row + 2, mBtnSearchV20V25->sizeHint().height());
     grid->addWidget(mBtnSearchV26V30, row + 2, 0, 1, vcolumn);
     grid->setRowMinimumHeight(row + 2, mBtnSearchV26V30->sizeHint().height());
+    grid->addWidget(mBtnSearchAll, row + 3, 0, 1, vcolumn);
+    grid->setRowMinimumHeight(row + 3, mBtnSearchAll->sizeHint().height());
 
     right->addLayout(buttonsRow);
     right->addStretch(1);
@@ -528,6 +553,11 @@ void ElectrodePanel::updateSearchRLFNButtonVisibility()
     setSearchButtonVisibility(mBtnSearchRLFN, ElectrodeAutoIdentifier::ShouldShowSearchRLFN(this));
 }
 
+void ElectrodePanel::updateSearchAllButtonVisibility()
+{
+    setSearchButtonVisibility(mBtnSearchAll, ElectrodeAutoIdentifier::ShouldShowSearchAll(this));
+}
+
 void ElectrodePanel::resizeEvent(QResizeEvent* e)
 {
     QWidget::resizeEvent(e);
@@ -594,6 +624,7 @@ void ElectrodePanel::rebuildMask()
     addBtnToMask(mBtnSearchV13V19);
     addBtnToMask(mBtnSearchV20V25);
     addBtnToMask(mBtnSearchV26V30);
+    addBtnToMask(mBtnSearchAll);
 
     setMask(reg);
 }
@@ -704,6 +735,7 @@ bool ElectrodePanel::eventFilter(QObject* obj, QEvent* ev)
                 {
                     setHoverVisible(false);
                     updateSearchRLFNButtonVisibility();
+                    updateSearchAllButtonVisibility();
                     mPick.vtkWidget->renderWindow()->Render();
                     return true;
                 }
@@ -850,149 +882,99 @@ void ElectrodePanel::clearElectrode(ElectrodeId id)
     emit electrodeClearRequested(id);
 }
 
-bool ElectrodePanel::removeElectrodeAtDisplay(const QPoint& pDevice)
+bool ElectrodePanel::deviceToDisplay(const QPoint& pDevice, double& outX, double& outY) const
 {
     if (!mPick.renderer || !mPick.vtkWidget || !mPick.vtkWidget->renderWindow())
         return false;
 
     const double dpr = mPick.vtkWidget->devicePixelRatioF();
-    const double x = double(pDevice.x()) * dpr;
     const double yQt = double(pDevice.y()) * dpr;
     const int* sz = mPick.vtkWidget->renderWindow()->GetSize();
     const double winH = double(sz ? sz[1] : int(std::lround(mPick.vtkWidget->height() * dpr)));
-    const double y = winH - 1.0 - yQt;
-
-    constexpr double kPickTolPx = 24.0;
-    const double pickTol2 = kPickTolPx * kPickTolPx;
+    outX = double(pDevice.x()) * dpr;
+    outY = winH - 1.0 - yQt;
+    return true;
+}
 
-    ElectrodeId toRemove = ElectrodeId::Count;
-    double bestD2 = std::numeric_limits<double>::max();
+void ElectrodePanel::syncElectrodeHits() const
+{
+    std::vector<ScreenMarkerIndex::Point> pts;
+    pts.reserve(size_t(mCutCenterWorld.size()));
+    mElectrodeHitIds.clear();
 
     for (auto it = mCutCenterWorld.constBegin(); it != mCutCenterWorld.constEnd(); ++it)
     {
-        const auto id = it.key();
-        if (!hasCoord(id))
+        if (!hasCoord(it.key()))
             continue;
+        pts.push_back(it.value());
+        mElectrodeHitIds.push_back(it.key());
+    }
 
-        const auto& c = it.value();
-        if (!isWorldWithinClickableAngle(c))
-            continue;
+    std::array<double, 3> center{};
+    const bool hasCenter = tryGetVolumeCenterWorld(center);
+    mElectrodeHits.sync(mPick.renderer, pts, hasCenter ? &center : nullptr, kMaxClickableAngleDeg);
+}
 
-        mPick.renderer->SetWorldPoint(c[0], c[1], c[2], 1.0);
-        mPick.renderer->WorldToDisplay();
-        double dp[3]{ 0.0, 0.0, 0.0 };
-        mPick.renderer->GetDisplayPoint(dp);
+void ElectrodePanel::syncSphereHits() const
+{
+    std::array<double, 3> center{};
+    const bool hasCenter = tryGetVolumeCenterWorld(center);
+    mSphereHits.sync(mPick.renderer, ElectrodeSurfaceDetector::instance().currentSphereCenters(),
+        hasCenter ? &center : nullptr, kMaxClickableAngleDeg);
+}
 
-        const double dx = dp[0] - x;
-        const double dy = dp[1] - y;
-        const double d2 = dx * dx + dy * dy;
-        if (d2 <= pickTol2 && d2 < bestD2)
-        {
-            bestD2 = d2;
-            toRemove = id;
-        }
-    }
+bool ElectrodePanel::removeElectrodeAtDisplay(const QPoint& pDevice)
+{
+    double x = 0.0, y = 0.0;
+    if (!deviceToDisplay(pDevice, x, y))
+        return false;
+
+    constexpr double kPickTolPx = 24.0;
 
-    if (toRemove == ElectrodeId::Count)
+    syncElectrodeHits();
+    const int hit = mElectrodeHits.nearest(x, y, kPickTolPx);
+    if (hit < 0)
         return false;
 
-    clearElectrode(toRemove);
+    clearElectrode(mElectrodeHitIds[hit]);
     requestRender();
     return true;
 }
 
-bool ElectrodePanel::closestElectrodeAtDisplay(const QPoint& pDevice, std::array<double, 3>& outWorld) const
+bool ElectrodePanel::closestElectrodeAtDisplay(const QPoint& pDevice, std::array<double, 3>& outWorld, double* outDistPx) const
 {
-    if (!mPick.renderer || !mPick.vtkWidget || !mPick.vtkWidget->renderWindow())
+    double x = 0.0, y = 0.0;
+    if (!deviceToDisplay(pDevice, x, y))
         return false;
 
-    const double dpr = mPick.vtkWidget->devicePixelRatioF();
-    const double x = double(pDevice.x()) * dpr;
-    const double yQt = double(pDevice.y()) * dpr;
-    const int* sz = mPick.vtkWidget->renderWindow()->GetSize();
-    const double winH = double(sz ? sz[1] : int(std::lround(mPick.vtkWidget->height() * dpr)));
-    const double y = winH - 1.0 - yQt;
-
     constexpr double kPickTolPx = 24.0;
-    const double pickTol2 = kPickTolPx * kPickTolPx;
-
-    bool found = false;
-    double bestD2 = std::numeric_limits<double>::max();
 
-    for (auto it = mCutCenterWorld.constBegin(); it != mCutCenterWorld.constEnd(); ++it)
-    {
-        const auto id = it.key();
-        if (!hasCoord(id))
-            continue;
-
-        const auto& c = it.value();
-        if (!isWorldWithinClickableAngle(c))
-            continue;
-
-        mPick.renderer->SetWorldPoint(c[0], c[1], c[2], 1.0);
-        mPick.renderer->WorldToDisplay();
-        double dp[3]{ 0.0, 0.0, 0.0 };
-        mPick.renderer->GetDisplayPoint(dp);
-
-        const double dx = dp[0] - x;
-        const double dy = dp[1] - y;
-        const double d2 = dx * dx + dy * dy;
-        if (d2 <= pickTol2 && d2 < bestD2)
-        {
-            bestD2 = d2;
-            outWorld = c;
-            found = true;
-        }
-    }
+    syncElectrodeHits();
+    const int hit = mElectrodeHits.nearest(x, y, kPickTolPx, outDistPx);
+    if (hit < 0)
+        return false;
 
-    return found;
+    outWorld = mElectrodeHits.points()[hit];
+    return true;
 }
 
 bool ElectrodePanel::closestDetectedSphereAtDisplay(const QPoint& pDevice,
     std::array<double, 3>& outWorld,
-    double* outRadiusMm) const
+    double* outRadiusMm,
+    double* outDistPx) const
 {
-    if (!mPick.renderer || !mPick.vtkWidget || !mPick.vtkWidget->renderWindow())
+    double x = 0.0, y = 0.0;
+    if (!deviceToDisplay(pDevice, x, y))
         return false;
 
-    const double dpr = mPick.vtkWidget->devicePixelRatioF();
-    const double x = double(pDevice.x()) * dpr;
-    const double yQt = double(pDevice.y()) * dpr;
-    const int* sz = mPick.vtkWidget->renderWindow()->GetSize();
-    const double winH = double(sz ? sz[1] : int(std::lround(mPick.vtkWidget->height() * dpr)));
-    const double y = winH - 1.0 - yQt;
-
     constexpr double kPickTolPx = 32.0;
-    const double pickTol2 = kPickTolPx * kPickTolPx;
-
-    bool found = false;
-    double bestD2 = std::numeric_limits<double>::max();
-
-    const auto centers = ElectrodeSurfaceDetector::instance().currentSphereCenters();
-    for (const auto& center : centers)
-    {
-        if (!isWorldWithinClickableAngle(center))
-            continue;
 
-        mPick.renderer->SetWorldPoint(center[0], center[1], center[2], 1.0);
-        mPick.renderer->WorldToDisplay();
-        double dp[3]{ 0.0, 0.0, 0.0 };
-        mPick.renderer->GetDisplayPoint(dp);
-
-        const double dx = dp[0] - x;
-        const double dy = dp[1] - y;
-        const double d2 = dx * dx + dy * dy;
-        if (d2 <= pickTol2 && d2 < bestD2)
-        {
-            bestD2 = d2;
-            outWorld = center;
-            found = true;
-        }
-    }
-
-    if (!found)
+    syncSphereHits();
+    const int hit = mSphereHits.nearest(x, y, kPickTolPx, outDistPx);
+    if (hit < 0)
         return false;
 
+    outWorld = mSphereHits.points()[hit];
     if (outRadiusMm)
         *outRadiusMm = ElectrodeSurfaceDetector::instance().options().sphereRadiusMm;
 
@@ -1035,23 +1017,9 @@ bool ElectrodePanel::closestAnySphereAtDisplay(const QPoint& pDevice,
 
     std::array<double, 3> worldDetected{};
     double radiusMm = 0.0;
-    if (closestDetectedSphereAtDisplay(pDevice, worldDetected, &radiusMm))
+    double distPx = 0.0;
+    if (closestDetectedSphereAtDisplay(pDevice, worldDetected, &radiusMm, &distPx))
     {
-        const double dpr = mPick.vtkWidget->devicePixelRatioF();
-        const double x = double(pDevice.x()) * dpr;
-        const double yQt = double(pDevice.y()) * dpr;
-        const int* sz = mPick.vtkWidget->renderWindow()->GetSize();
-        const double winH = double(sz ? sz[1] : int(std::lround(mPick.vtkWidget->height() * dpr)));
-        const double y = winH - 1.0 - yQt;
-
-        mPick.renderer->SetWorldPoint(worldDetected[0], worldDetected[1], worldDetected[2], 1.0);
-        mPick.renderer->WorldToDisplay();
-        double dp[3]{ 0.0, 0.0, 0.0 };
-        mPick.renderer->GetDisplayPoint(dp);
-
-        const double dx = dp[0] - x;
-        const double dy = dp[1] - y;
-        const double distPx = std::sqrt(dx * dx + dy * dy);
         if (!found || distPx < bestDistPx)
         {
             found = true;
@@ -1113,6 +1081,7 @@ void ElectrodePanel::setHasCoord(ElectrodeId id, bool has)
     updateSearchV13V19ButtonVisibility();
     updateSearchV20V25ButtonVisibility();
     updateSearchV26V30ButtonVisibility();
+    updateSearchAllButtonVisibility();
 }
 
 bool ElectrodePanel::hasCoord(ElectrodeId id) const
@@ -1165,6 +1134,11 @@ void ElectrodePanel::refreshSearchV26V30Button()
     updateSearchV26V30ButtonVisibility();
 }
 
+void ElectrodePanel::refreshSearchAllButton()
+{
+    updateSearchAllButtonVisibility();
+}
+
 void ElectrodePanel::refreshSearchButtons()
 {
     refreshSearchRLFNButton();
@@ -1173,6 +1147,7 @@ void ElectrodePanel::refreshSearchButtons()
     refreshSearchV13V19Button();
     refreshSearchV20V25Button();
     refreshSearchV26V30Button();
+    refreshSearchAllButton();
 }
 
 void ElectrodePanel::retranslateUi()
@@ -1193,6 +1168,8 @@ void ElectrodePanel::retranslateUi()
         mBtnSearchV20V25->setText(tr("Search V20-V25"));
     if (mBtnSearchV26V30)
         mBtnSearchV26V30->setText(tr("Search V26-V30"));
+    if (mBtnSearchAll)
+        mBtnSearchAll->setText(tr("Search all"));
 }
 
 QVector<ElectrodePanel::ElectrodeCoord> ElectrodePanel::coordsWorld() const
@@ -1304,8 +1281,8 @@ void ElectrodePanel::setHoverVisible(bool v)
 {
     if (!mHoverActor) return;
     mHoverActor->SetVisibility(v ? 1 : 0);
-    if (mPick.vtkWidget && mPick.vtkWidget->renderWindow())
-        mPick.vtkWidget->renderWindow()->Render();
+    if (mPick.vtkWidget)
+        RenderScheduler::request(mPick.vtkWidget->renderWindow(), RenderScheduler::Kind::Overlay);
 }
 
 void ElectrodePanel::setHoverAtWorld(const double w[3])
@@ -1400,10 +1377,25 @@ double ElectrodePanel::opacityAtIJK(int ijk[3]) const
     return of->GetValue(s);
 }
 
+void ElectrodePanel::syncPickBricks(double opThr) const
+{
+    auto* of = mPick.volProp ? mPick.volProp->GetScalarOpacity() : nullptr;
+    if (!mPick.image || !of)
+    {
+        mPickBricks.clear();
+        return;
+    }
+
+    if (mPickBricks.isStale(mPick.image))
+        mPickBricks.build(mPick.image);
+    if (!mPickBricks.isClassifiedFor(of, opThr))
+        mPickBricks.classify(of, opThr);
+}
+
 void ElectrodePanel::requestRender()
 {
-    if (mPick.vtkWidget && mPick.vtkWidget->renderWindow())
-        mPick.vtkWidget->renderWindow()->Render();
+    if (mPick.vtkWidget)
+        RenderScheduler::request(mPick.vtkWidget->renderWindow());
 }
 
 bool ElectrodePanel::tryGetVolumeCenterWorld(std::array<double, 3>& outCenter) const
@@ -1417,41 +1409,6 @@ bool ElectrodePanel::tryGetVolumeCenterWorld(std::array<double, 3>& outCenter) c
     return true;
 }
 
-bool ElectrodePanel::isWorldWithinClickableAngle(const std::array<double, 3>& world) const
-{
-    constexpr double kMaxClickableAngleDeg = 85.0;
-    constexpr double kRadToDeg = 57.29577951308232;
-
-    if (!mPick.renderer)
-        return true;
-
-    auto* cam = mPick.renderer->GetActiveCamera();
-    if (!cam)
-        return true;
-
-    std::array<double, 3> center{};
-    if (!tryGetVolumeCenterWorld(center))
-        return true;
-
-    double camPos[3]{ 0.0, 0.0, 0.0 };
-    cam->GetPosition(camPos);
-
-    const double toCamera[3]{ camPos[0] - center[0], camPos[1] - center[1], camPos[2] - center[2] };
-    const double toSphere[3]{ world[0] - center[0], world[1] - center[1], world[2] - center[2] };
-
-    const double cameraLen = std::sqrt(toCamera[0] * toCamera[0] + toCamera[1] * toCamera[1] + toCamera[2] * toCamera[2]);
-    const double sphereLen = std::sqrt(toSphere[0] * toSphere[0] + toSphere[1] * toSphere[1] + toSphere[2] * toSphere[2]);
-    if (cameraLen <= 1e-9 || sphereLen <= 1e-9)
-        return true;
-
-    double cosAngle = (toCamera[0] * toSphere[0] + toCamera[1] * toSphere[1] + toCamera[2] * toSphere[2]) / (cameraLen * sphereLen);
-    cosAngle = std::clamp(cosAngle, -1.0, 1.0);
-
-    const double angleDeg = std::acos(cosAngle) * kRadToDeg;
-    return angleDeg <= kMaxClickableAngleDeg;
-}
-
-
 bool ElectrodePanel::pickAt(const QPoint& pDevice,
     std::array<int, 3>& outIJK,
     std::array<double, 3>& outW) const
@@ -1479,24 +1436,38 @@ bool ElectrodePanel::pickAt(const QPoint& pDevice,
     // порог “ткань есть”
     const double opThr = 0.01;
 
-    for (double t = 0.0; t <= maxT; t += step)
-    {
-        double w[3] = { p0[0] + v[0] * t, p0[1] + v[1] * t, p0[2] + v[2] * t };
+    // шагаем только по кирпичам, где TF вообще что-то показывает
+    syncPickBricks(opThr);
 
-        int ijk[3];
-        if (!worldToIJK(w, ijk))
-            continue;
+    double origin[3]; mPick.image->GetOrigin(origin);
+    double a[3], b[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        a[i] = (p0[i] - origin[i]) / sp[i];
+        b[i] = (p1[i] - origin[i]) / sp[i];
+    }
 
-        const double op = opacityAtIJK(ijk);
-        if (op > opThr)
+    return mPickBricks.forEachVisibleSpan(a, b, [&](double s0, double s1) -> bool
         {
-            outIJK = { ijk[0], ijk[1], ijk[2] };
-            outW = { w[0], w[1], w[2] };
-            return true;
-        }
-    }
+            // та же сетка t, что и при сплошном проходе от 0
+            for (double t = std::ceil(s0 * maxT / step) * step; t <= s1 * maxT && t <= maxT; t += step)
+            {
+                double w[3] = { p0[0] + v[0] * t, p0[1] + v[1] * t, p0[2] + v[2] * t };
+
+                int ijk[3];
+                if (!worldToIJK(w, ijk))
+                    continue;
 
-    return false;
+                const double op = opacityAtIJK(ijk);
+                if (op > opThr)
+                {
+                    outIJK = { ijk[0], ijk[1], ijk[2] };
+                    outW = { w[0], w[1], w[2] };
+                    return true;
+                }
+            }
+            return false;
+        });
 }
 
 void ElectrodePanel::applyCut(ElectrodeId id, const std::array<int, 3>& cIJK)
@@ -1516,6 +1487,9 @@ void ElectrodePanel::applyCut(ElectrodeId id, const std::array<int, 3>& cIJK)
     const int cx = cIJK[0], cy = cIJK[1], cz = cIJK[2];
     const int R2 = R * R;
 
+    // сетка кирпичей пикинга была актуальна — обновим только задетые кирпичи
+    const bool bricksSynced = !mPickBricks.isStale(mPick.image);
+
     QVector<vtkIdType> affected;
     affected.reserve((2 * R + 1) * (2 * R + 1) * (2 * R + 1));
 
@@ -1524,6 +1498,11 @@ void ElectrodePanel::applyCut(ElectrodeId id, const std::array<int, 3>& cIJK)
             return x >= 0 && y >= 0 && z >= 0 && x < dims[0] && y < dims[1] && z < dims[2];
         };
 
+    const std::array<int, 3> regionLo{ std::max(0, cx - R), std::max(0, cy - R), std::max(0, cz - R) };
+    const std::array<int, 3> regionHi{
+        std::min(dims[0] - 1, cx + R), std::min(dims[1] - 1, cy + R), std::min(dims[2] - 1, cz + R) };
+    emit regionEditStarted(regionLo, regionHi);
+
     for (int z = cz - R; z <= cz + R; ++z)
         for (int y = cy - R; y <= cy + R; ++y)
             for (int x = cx - R; x <= cx + R; ++x)
@@ -1560,10 +1539,21 @@ void ElectrodePanel::applyCut(ElectrodeId id, const std::array<int, 3>& cIJK)
             }
 
     if (affected.isEmpty())
+    {
+        emit regionEditFinished(regionLo, regionHi);
         return;
+    }
 
     mCutByElectrode[id] = std::move(affected);
     mPick.image->Modified();
+    emit regionEditFinished(regionLo, regionHi);
+
+    if (bricksSynced)
+    {
+        const int lo[3]{ cx - R, cy - R, cz - R };
+        const int hi[3]{ cx + R, cy + R, cz + R };
+        mPickBricks.updateRegion(lo, hi);
+    }
     requestRender();
 }
 
@@ -1580,6 +1570,33 @@ void ElectrodePanel::restoreCut(ElectrodeId id)
 
     auto& affected = it.value();
 
+    const bool bricksSynced = !mPickBricks.isStale(mPick.image);
+    int dims[3];
+    mPick.image->GetDimensions(dims);
+    int lo[3]{ dims[0], dims[1], dims[2] };
+    int hi[3]{ -1, -1, -1 };
+
+    auto pidToIJK = [&](vtkIdType pid) -> std::array<int, 3>
+        {
+            return { int(pid % dims[0]),
+                int((pid / dims[0]) % dims[1]),
+                int(pid / (vtkIdType(dims[0]) * dims[1])) };
+        };
+
+    // регион для RenderView — по всем вокселям выреза, до правки
+    std::array<int, 3> regionLo{ dims[0], dims[1], dims[2] };
+    std::array<int, 3> regionHi{ -1, -1, -1 };
+    for (vtkIdType pid : affected)
+    {
+        const auto p = pidToIJK(pid);
+        for (int a = 0; a < 3; ++a)
+        {
+            regionLo[a] = std::min(regionLo[a], p[a]);
+            regionHi[a] = std::max(regionHi[a], p[a]);
+        }
+    }
+    emit regionEditStarted(regionLo, regionHi);
+
     for (vtkIdType pid : affected)
     {
         auto git = mGlobalCut.find(pid);
@@ -1597,11 +1614,26 @@ void ElectrodePanel::restoreCut(ElectrodeId id)
         {
             arr->SetComponent(pid, 0, g.original);
             mGlobalCut.erase(git);
+
+            const auto p = pidToIJK(pid);
+            for (int a = 0; a < 3; ++a)
+            {
+                lo[a] = std::min(lo[a], p[a]);
+                hi[a] = std::max(hi[a], p[a]);
+            }
         }
     }
 
     affected.clear();
     mPick.image->Modified();
+    emit regionEditFinished(regionLo, regionHi);
+
+    if (bricksSynced)
+    {
+        if (hi[0] < 0) // ничего не вернули — достаточно переотметить сетку
+            lo[0] = lo[1] = lo[2] = hi[0] = hi[1] = hi[2] = 0;
+        mPickBricks.updateRegion(lo, hi);
+    }
     requestRender();
 }
 
@@ -1868,6 +1900,7 @@ void ElectrodePanel::clearAllElectrodesState()
     mCurrent = ElectrodeId::Count;
 
     updateSearchRLFNButtonVisibility();
+    updateSearchAllButtonVisibility();
     requestRender();
 }
 
@@ -1900,33 +1933,45 @@ bool ElectrodePanel::snapToSurfaceTowardsCamera(
 
     const double opThr = 0.01;
 
-    // идем от точки клика к камере, ищем ближайший "не пустой" воксель
-    for (double t = 0.0; t <= maxDist; t += step)
-    {
-        double w[3]{ w0[0] + dir[0] * t, w0[1] + dir[1] * t, w0[2] + dir[2] * t };
+    // важно: после applyCut в вырезанной зоне скаляры уже 0
+    auto* arr = mPick.image->GetPointData()->GetScalars();
+    if (!arr) return false;
 
-        int ijk[3];
-        if (!worldToIJK(w, ijk))
-            continue;
+    syncPickBricks(opThr);
 
-        // важно: после applyCut в вырезанной зоне скаляры уже 0
-        auto* arr = mPick.image->GetPointData()->GetScalars();
-        if (!arr) return false;
+    double origin[3]; mPick.image->GetOrigin(origin);
+    double a[3], b[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        a[i] = (w0[i] - origin[i]) / sp[i];
+        b[i] = (w0[i] + dir[i] * maxDist - origin[i]) / sp[i];
+    }
 
-        const vtkIdType pid = mPick.image->ComputePointId(ijk);
-        const double s = arr->GetComponent(pid, 0);
-        if (s <= 0.0)
-            continue;
+    // идем от точки клика к камере, ищем ближайший "не пустой" воксель
+    return mPickBricks.forEachVisibleSpan(a, b, [&](double s0, double s1) -> bool
+        {
+            for (double t = std::ceil(s0 * maxDist / step) * step; t <= s1 * maxDist && t <= maxDist; t += step)
+            {
+                double w[3]{ w0[0] + dir[0] * t, w0[1] + dir[1] * t, w0[2] + dir[2] * t };
 
-        const double op = opacityAtIJK(ijk);
-        if (op <= opThr)
-            continue;
+                int ijk[3];
+                if (!worldToIJK(w, ijk))
+                    continue;
 
-        // нашли поверхность
-        inOutIJK = { ijk[0], ijk[1], ijk[2] };
-        outW = { w[0], w[1], w[2] };
-        return true;
-    }
+                const vtkIdType pid = mPick.image->ComputePointId(ijk);
+                const double s = arr->GetComponent(pid, 0);
+                if (s <= 0.0)
+                    continue;
 
-    return false;
+                const double op = opacityAtIJK(ijk);
+                if (op <= opThr)
+                    continue;
+
+                // нашли поверхность
+                inOutIJK = { ijk[0], ijk[1], ijk[2] };
+                outW = { w[0], w[1], w[2] };
+                return true;
+            }
+            return false;
+        });
 }
\ No newline at end of file
@@ -20,6 +20,8 @@
 #include <vtkPiecewiseFunction.h>
 #include <vtkBillboardTextActor3D.h>
 #include <Services/DicomRange.h>
+#include "VolumeBrickGrid.h"
+#include "ScreenMarkerIndex.h"
 
 class QVTKOpenGLNativeWidget;
 class vtkRenderer;
@@ -75,6 +77,7 @@ public:
     void refreshSearchV13V19Button();
     void refreshSearchV20V25Button();
     void refreshSearchV26V30Button();
+    void refreshSearchAllButton();
     void refreshSearchButtons();
 
     struct ElectrodeCoord
@@ -112,7 +115,12 @@ signals:
     void searchV13V19Requested();
     void searchV20V25Requested();
     void searchV26V30Requested();
+    void searchAllRequested();
     void electrodeAltRightClicked(std::array<double, 3> world);
+    // вырез/возврат вокселей под электродом правит том на месте: регион [lo..hi] в индексах,
+    // started — до изменения, finished — после Modified()
+    void regionEditStarted(std::array<int, 3> lo, std::array<int, 3> hi);
+    void regionEditFinished(std::array<int, 3> lo, std::array<int, 3> hi);
 
 public slots:
     void beginPick(ElectrodeId id);   // пользователь нажал кнопку электрода
@@ -131,11 +139,13 @@ private:
     void updateSearchV13V19ButtonVisibility();
     void updateSearchV20V25ButtonVisibility();
     void updateSearchV26V30ButtonVisibility();
+    void updateSearchAllButtonVisibility();
 
     bool pickAt(const QPoint& pDevice, std::array<int, 3>& outIJK, std::array<double, 3>& outW) const;
     bool displayRay(const QPoint& pDevice, double outP0[3], double outP1[3]) const;
     bool worldToIJK(const double w[3], int ijk[3]) const;
     double opacityAtIJK(int ijk[3]) const;
+    void syncPickBricks(double opThr) const;
 
     void ensureHoverActor();
     void setHoverVisible(bool v);
@@ -155,10 +165,12 @@ private:
     QPushButton* mBtnSearchV13V19 = nullptr;
     QPushButton* mBtnSearchV20V25 = nullptr;
     QPushButton* mBtnSearchV26V30 = nullptr;
+    QPushButton* mBtnSearchAll = nullptr;
 
     ElectrodeId mCurrent{ ElectrodeId::Count }; // none
 
     PickContext mPick;
+    mutable VolumeBrickGrid mPickBricks; // пропуск пустоты лучами пикинга
 
     DicomInfo DI;
 
@@ -210,11 +222,18 @@ private:
     bool snapToSurfaceTowardsCamera(const std::array<double, 3>& w0, std::array<int, 3>& inOutIJK, std::array<double, 3>& outW) const;
     void clearElectrode(ElectrodeId id);
     bool removeElectrodeAtDisplay(const QPoint& pDevice);
-    bool closestElectrodeAtDisplay(const QPoint& pDevice, std::array<double, 3>& outWorld) const;
-    bool closestDetectedSphereAtDisplay(const QPoint& pDevice, std::array<double, 3>& outWorld, double* outRadiusMm = nullptr) const;
+    bool closestElectrodeAtDisplay(const QPoint& pDevice, std::array<double, 3>& outWorld, double* outDistPx = nullptr) const;
+    bool closestDetectedSphereAtDisplay(const QPoint& pDevice, std::array<double, 3>& outWorld, double* outRadiusMm = nullptr, double* outDistPx = nullptr) const;
     bool closestAnySphereAtDisplay(const QPoint& pDevice,
         std::array<double, 3>& outWorld,
         double* outRadiusMm = nullptr, double* outColourR = nullptr, double* outColourG = nullptr, double* outColourB = nullptr) const;
     bool tryGetVolumeCenterWorld(std::array<double, 3>& outCenter) const;
-    bool isWorldWithinClickableAngle(const std::array<double, 3>& world) const;
+    bool deviceToDisplay(const QPoint& pDevice, double& outX, double& outY) const;
+    // экранные индексы маркеров; sync дешёвый, пока камера и набор точек не менялись
+    void syncElectrodeHits() const;
+    void syncSphereHits() const;
+
+    mutable ScreenMarkerIndex mElectrodeHits;
+    mutable QVector<ElectrodeId> mElectrodeHitIds; // id для точек mElectrodeHits
+    mutable ScreenMarkerIndex mSphereHits;
 };
@@ -1,14 +1,21 @@
 ﻿#include "ElectrodeSurfaceDetector.h"
+#include "U8Span.h"
+#include <Services/Trace.h>
 
-#include <queue>
+#include <climits>
+#include <cstdint>
 #include <vector>
 #include <array>
 #include <algorithm>
 #include <cmath>
 #include <numeric>
 
+#include <vtkImageCast.h>
 #include <vtkImageData.h>
+#include <vtkImageExtractComponents.h>
+#include <vtkNew.h>
 #include <vtkRenderer.h>
+#include <vtkSMPTools.h>
 #include <vtkSphereSource.h>
 #include <vtkPolyDataMapper.h>
 #include <vtkActor.h>
@@ -20,14 +27,31 @@
 
 namespace
 {
-    inline int idx(int x, int y, int z, int nx, int ny) noexcept
+    // 64 бита: тома больше 2^31 вокселей не переполняют индекс
+    inline int64_t linearIndex(int x, int y, int z, int nx, int ny) noexcept
     {
-        return (z * ny + y) * nx + x;
+        return (int64_t(z) * ny + y) * nx + x;
     }
 
-    inline bool inside(int x, int y, int z, int nx, int ny, int nz) noexcept
+    U8Span makeSpan(vtkImageData* im)
     {
-        return (x >= 0 && y >= 0 && z >= 0 && x < nx && y < ny && z < nz);
+        U8Span S;
+        if (!im || im->GetScalarType() != VTK_UNSIGNED_CHAR || im->GetNumberOfScalarComponents() != 1)
+            return S;
+
+        int ext[6]; im->GetExtent(ext);
+        auto* p0 = static_cast<uint8_t*>(im->GetScalarPointer(ext[0], ext[2], ext[4]));
+        if (!p0) return S;
+
+        S.valid = true;
+        for (int i = 0; i < 6; ++i) S.ext[i] = ext[i];
+        S.nx = ext[1] - ext[0] + 1;
+        S.ny = ext[3] - ext[2] + 1;
+        S.nz = ext[5] - ext[4] + 1;
+        im->GetIncrements(S.incX, S.incY, S.incZ);
+        S.p0 = p0;
+        S.p0w = p0;
+        return S;
     }
 
     struct Off3 { int dx, dy, dz; };
@@ -307,21 +331,6 @@ std::vector<std::array<double, 3>> ElectrodeSurfaceDetector::sphereCenters() con
     return centers;
 }
 
-bool ElectrodeSurfaceDetector::worldToDisplay(vtkRenderer* ren, const std::array<double, 3>& world, double outDisplay[2])
-{
-    if (!ren)
-        return false;
-
-    ren->SetWorldPoint(world[0], world[1], world[2], 1.0);
-    ren->WorldToDisplay();
-
-    double p[3]{ 0.0, 0.0, 0.0 };
-    ren->GetDisplayPoint(p);
-    outDisplay[0] = p[0];
-    outDisplay[1] = p[1];
-    return std::isfinite(outDisplay[0]) && std::isfinite(outDisplay[1]);
-}
-
 bool ElectrodeSurfaceDetector::closestSphereAtDisplay(vtkRenderer* ren,
     int x,
     int y,
@@ -333,32 +342,12 @@ bool ElectrodeSurfaceDetector::closestSphereAtDisplay(vtkRenderer* ren,
     if (!ren || actors_.empty())
         return false;
 
-    const double maxDist2 = maxDistPx * maxDistPx;
-    double bestDist2 = std::numeric_limits<double>::max();
-    const SphereMarker* best = nullptr;
-
-    for (const auto& mk : actors_)
-    {
-        double dp[2]{ 0.0, 0.0 };
-        if (!worldToDisplay(ren, mk.center, dp))
-            continue;
-
-        const double dx = dp[0] - double(x);
-        const double dy = dp[1] - double(y);
-        const double d2 = dx * dx + dy * dy;
-        if (d2 <= maxDist2 && d2 < bestDist2)
-        {
-            bestDist2 = d2;
-            best = &mk;
-        }
-    }
-
-    if (!best)
+    hitIndex_.sync(ren, currentSphereCenters());
+    const int best = hitIndex_.nearest(double(x), double(y), maxDistPx, outDistPx);
+    if (best < 0)
         return false;
 
-    outWorld = best->center;
-    if (outDistPx)
-        *outDistPx = std::sqrt(bestDist2);
+    outWorld = hitIndex_.points()[best];
     if (outRadiusMm)
         *outRadiusMm = opt_.sphereRadiusMm;
     return true;
@@ -379,181 +368,247 @@ std::vector<std::array<double, 3>> ElectrodeSurfaceDetector::detectAndShow(
     vtkRenderer* ren,
     const std::vector<std::array<double, 3>>& excludedWorld)
 {
+    TRACE_SCOPE("electrodes", "detectAndShow");
     std::vector<std::array<double, 3>> centers;
     if (!img || !ren) return centers;
 
-    int dims[3]{ 0,0,0 };
-    img->GetDimensions(dims);
-    const int nx = dims[0], ny = dims[1], nz = dims[2];
+    // сырой U8-доступ; прочие типы один раз приводятся к U8 с насыщением
+    vtkSmartPointer<vtkImageData> u8Image = img;
+    if (img->GetScalarType() != VTK_UNSIGNED_CHAR || img->GetNumberOfScalarComponents() != 1)
+    {
+        vtkNew<vtkImageExtractComponents> first;
+        first->SetInputData(img);
+        first->SetComponents(0);
+
+        vtkNew<vtkImageCast> cast;
+        cast->SetInputConnection(first->GetOutputPort());
+        cast->SetOutputScalarTypeToUnsignedChar();
+        cast->ClampOverflowOn();
+        cast->Update();
+        u8Image = cast->GetOutput();
+    }
+
+    const U8Span S = makeSpan(u8Image);
+    if (!S.valid) return centers;
+
+    const int nx = S.nx, ny = S.ny, nz = S.nz;
     if (nx <= 2 || ny <= 2 || nz <= 2) return centers;
 
     double spacing[3]{ 1,1,1 };
     double origin[3]{ 0,0,0 };
     img->GetSpacing(spacing);
     img->GetOrigin(origin);
+    // центроиды ниже — от начала экстента
+    for (int a = 0; a < 3; ++a)
+        origin[a] += S.ext[2 * a] * spacing[a];
 
-    auto vAt = [&](int x, int y, int z) -> int {
-        return int(img->GetScalarComponentAsDouble(x, y, z, 0) + 0.5);
+    auto vAt = [&S](int x, int y, int z) -> int {
+        return S.p0[x * S.incX + y * S.incY + z * S.incZ];
         };
 
-    const int nvox = nx * ny * nz;
+    const int metalMin = opt_.metalMin, metalMax = opt_.metalMax;
+    const bool useShell = opt_.restrictToSurfaceShell && opt_.shellDepthVox > 0;
+    const int shellDepth = opt_.shellDepthVox;
 
-    // 1) metal mask (254-255) внутри тела (если включено)
-    std::vector<uint8_t> metal(nvox, 0);
-    std::vector<uint8_t> visited(nvox, 0);
+    // металл у поверхности тела: вдоль ±X/±Y до воздуха не дальше shellDepth, без тела по пути
+    auto nearSurface = [&](int x, int y, int z) -> bool {
+        static constexpr int kDx[4]{ 1, -1, 0, 0 };
+        static constexpr int kDy[4]{ 0, 0, 1, -1 };
+        for (int d = 0; d < 4; ++d)
+        {
+            int xx = x, yy = y;
+            for (int step = 1; step <= shellDepth; ++step)
+            {
+                xx += kDx[d]; yy += kDy[d];
+                if (xx < 0 || xx >= nx || yy < 0 || yy >= ny) return true;
+                const int v = vAt(xx, yy, z);
+                if (isAir_0(v)) return true;
+                if (isBodyVoxel_1_253(v)) break;
+            }
+        }
+        return false;
+        };
 
-    int metalCount = 0;
-    for (int z = 1; z < nz - 1; ++z)
-        for (int y = 1; y < ny - 1; ++y)
-            for (int x = 1; x < nx - 1; ++x)
+    // 1) кандидаты металла (metalMin..metalMax) — параллельно по срезам,
+    //    линейные 64-битные индексы, по возрастанию
+    std::vector<std::vector<int64_t>> slices(size_t(nz));
+    vtkSMPTools::For(1, nz - 1, [&](vtkIdType zb, vtkIdType ze)
+        {
+            for (vtkIdType zz = zb; zz < ze; ++zz)
             {
-                const int v = vAt(x, y, z);
-                if (v < opt_.metalMin || v > opt_.metalMax) continue;
+                const int z = int(zz);
+                auto& out = slices[size_t(z)];
+                for (int y = 1; y < ny - 1; ++y)
+                {
+                    const uint8_t* row = S.p0 + z * S.incZ + y * S.incY;
+                    for (int x = 1; x < nx - 1; ++x)
+                    {
+                        const int v = row[x * S.incX];
+                        if (v < metalMin || v > metalMax) continue;
+                        if (useShell && !nearSurface(x, y, z)) continue;
+                        out.push_back(linearIndex(x, y, z, nx, ny));
+                    }
+                }
+            }
+        });
 
-                const int id = idx(x, y, z, nx, ny);
+    size_t metalCount = 0;
+    for (const auto& s : slices) metalCount += s.size();
 
-                metal[id] = 1;
-                metalCount++;
-            }
+    std::vector<int64_t> metal;
+    metal.reserve(metalCount);
+    for (auto& s : slices)
+    {
+        metal.insert(metal.end(), s.begin(), s.end());
+        std::vector<int64_t>().swap(s);
+    }
 
     if (opt_.debug)
     {
         qDebug() << "[ElectrodeDetector] dims:" << nx << ny << nz;
         qDebug() << "[ElectrodeDetector] spacing:" << spacing[0] << spacing[1] << spacing[2];
-        qDebug() << "[ElectrodeDetector] metalCount:" << metalCount;
+        qDebug() << "[ElectrodeDetector] metalCount:" << qulonglong(metalCount);
         qDebug() << "[ElectrodeDetector] sizeRangeVox=[" << opt_.minComponentVox << ".." << opt_.maxComponentVox << "]"
             << "maxAxisRatioVox=" << opt_.maxAxisRatioVox
             << "useRadiusConsistency=" << opt_.useRadiusConsistency
             << "maxRadiusStdRel=" << opt_.maxRadiusStdRel
-            << "useBodyMask=" << opt_.useBodyMask
-            << "bodyThr=" << opt_.bodyThreshold;
+            << "shell=" << useShell << shellDepth;
     }
 
-    // 2) компоненты связности на metal (26 соседей)
-    std::queue<std::array<int, 3>> q;
+    if (metal.size() > size_t(INT_MAX))
+        return centers; // это не электроды, а весь том
 
-    int compsTotal = 0;
-    int rejSize = 0, rejSphere = 0, rejRadius = 0;
+    // 2) компоненты связности (26 соседей) только по кандидатам: union-find,
+    //    сосед ищется бинарным поиском в отсортированном списке
+    const int64_t sliceSize = int64_t(nx) * ny;
+    std::vector<int> parent(metal.size());
+    std::iota(parent.begin(), parent.end(), 0);
 
-    std::vector<Cand> cands;
-    cands.reserve(512);
+    auto findRoot = [&](int i) {
+        while (parent[size_t(i)] != i)
+        {
+            parent[size_t(i)] = parent[size_t(parent[size_t(i)])];
+            i = parent[size_t(i)];
+        }
+        return i;
+        };
 
-    for (int z = 1; z < nz - 1; ++z)
+    for (size_t i = 0; i < metal.size(); ++i)
     {
-        for (int y = 1; y < ny - 1; ++y)
+        const int64_t id = metal[i];
+        // 13 «предыдущих» соседей: остальные найдут эту точку сами
+        for (const auto& o : kN26)
         {
-            for (int x = 1; x < nx - 1; ++x)
-            {
-                const int sid = idx(x, y, z, nx, ny);
-                if (!metal[sid] || visited[sid]) continue;
-
-                compsTotal++;
-                visited[sid] = 1;
-                q.push({ x,y,z });
+            const int64_t nid = id + o.dz * sliceSize + int64_t(o.dy) * nx + o.dx;
+            if (nid >= id) continue;
 
-                CompStats st;
-                std::vector<std::array<int, 3>> voxels;
-                voxels.reserve(opt_.maxComponentVox);
+            const auto it = std::lower_bound(metal.begin(), metal.begin() + i, nid);
+            if (it == metal.begin() + i || *it != nid) continue;
 
-                bool oversize = false;
-
-                while (!q.empty())
-                {
-                    auto p = q.front(); q.pop();
-                    const int cx = p[0], cy = p[1], cz = p[2];
-
-                    st.add(cx, cy, cz);
-                    voxels.push_back({ cx,cy,cz });
-
-                    if (st.count > opt_.maxComponentVox)
-                    {
-                        oversize = true;
-                        // доочищать BFS не будем: это точно не электрод
-                        // но очередь надо опустошить для этой компоненты: проще просто “продолжить”
-                        // и игнорировать добавления дальше (мы уже отметили visited)
-                    }
+            const int ra = findRoot(int(i));
+            const int rb = findRoot(int(it - metal.begin()));
+            if (ra != rb)
+                parent[size_t(std::max(ra, rb))] = std::min(ra, rb); // корень — первый воксель
+        }
+    }
 
-                    for (const auto& o : kN26)
-                    {
-                        const int xx = cx + o.dx, yy = cy + o.dy, zz = cz + o.dz;
-                        if (!inside(xx, yy, zz, nx, ny, nz)) continue;
+    std::vector<int> compOf(metal.size(), -1);
+    std::vector<CompStats> comps;
+    for (size_t i = 0; i < metal.size(); ++i)
+    {
+        const int r = findRoot(int(i));
+        if (compOf[size_t(r)] < 0)
+        {
+            compOf[size_t(r)] = int(comps.size());
+            comps.emplace_back();
+        }
+        CompStats& st = comps[size_t(compOf[size_t(r)])];
+        if (st.count > opt_.maxComponentVox)
+        {
+            ++st.count; // всё равно отбросим, моменты не нужны
+            continue;
+        }
 
-                        const int nid = idx(xx, yy, zz, nx, ny);
-                        if (!metal[nid] || visited[nid]) continue;
+        const int64_t id = metal[i];
+        const int z = int(id / sliceSize);
+        const int64_t rem = id - z * sliceSize;
+        st.add(int(rem % nx), int(rem / nx), z);
+    }
 
-                        visited[nid] = 1;
-                        q.push({ xx,yy,zz });
-                    }
-                }
+    const int compsTotal = int(comps.size());
+    int rejSize = 0, rejSphere = 0, rejRadius = 0;
 
-                if (oversize || st.count < opt_.minComponentVox || st.count > opt_.maxComponentVox)
-                {
-                    rejSize++;
-                    continue;
-                }
+    std::vector<Cand> cands;
+    cands.reserve(512);
 
-                // 3) центроид в voxel
-                const double cxv = st.sx / st.count;
-                const double cyv = st.sy / st.count;
-                const double czv = st.sz / st.count;
-
-                // 4) ковариация и axisRatio
-                const double ex = cxv, ey = cyv, ez = czv;
-
-                const double exx = st.sxx / st.count;
-                const double eyy = st.syy / st.count;
-                const double ezz = st.szz / st.count;
-                const double exy = st.sxy / st.count;
-                const double exz = st.sxz / st.count;
-                const double eyz = st.syz / st.count;
-
-                double A[3][3];
-                A[0][0] = exx - ex * ex;
-                A[1][1] = eyy - ey * ey;
-                A[2][2] = ezz - ez * ez;
-                A[0][1] = A[1][0] = exy - ex * ey;
-                A[0][2] = A[2][0] = exz - ex * ez;
-                A[1][2] = A[2][1] = eyz - ey * ez;
-
-                double* Ap[3] = { A[0], A[1], A[2] };
-                double w[3]{ 0,0,0 };
-                double V[3][3];
-                double* Vp[3] = { V[0], V[1], V[2] };
-
-                vtkMath::Jacobi(Ap, w, Vp);
-
-                std::sort(w, w + 3, [](double a, double b) { return a > b; });
-                const double lmax = std::max(1e-12, w[0]);
-                const double lmin = std::max(1e-12, w[2]);
-                const double axisRatio = std::sqrt(lmax / lmin);
-
-                if (axisRatio > opt_.maxAxisRatioVox)
-                {
-                    rejSphere++;
-                    continue;
-                }
+    for (const CompStats& st : comps)
+    {
+        if (st.count < opt_.minComponentVox || st.count > opt_.maxComponentVox)
+        {
+            rejSize++;
+            continue;
+        }
 
-                // 5) радиусная “стабильность” (std/mean)
-                double meanR = 0.0;
-                double relStd = 0.0;
-
-                Cand c;
-                c.cxv = cxv; c.cyv = cyv; c.czv = czv;
-                c.count = st.count;
-                c.axisRatio = axisRatio;
-                c.meanR = meanR;
-                c.relStdR = relStd;
-                c.world = voxelToWorld(origin, spacing, cxv, cyv, czv);
-
-                // базовый скор: маленький axisRatio и маленький relStd лучше
-                // (чисто для ранжирования, а не решающего фильтра)
-                const double s1 = std::max(0.0, opt_.maxAxisRatioVox - axisRatio);
-                const double s2 = (opt_.useRadiusConsistency) ? std::max(0.0, opt_.maxRadiusStdRel - relStd) : 0.0;
-                c.score = 1.0 + 2.0 * s1 + 2.0 * s2;
-
-                cands.push_back(c);
-            }
+        // 3) центроид в voxel
+        const double cxv = st.sx / st.count;
+        const double cyv = st.sy / st.count;
+        const double czv = st.sz / st.count;
+
+        // 4) ковариация и axisRatio
+        const double ex = cxv, ey = cyv, ez = czv;
+
+        const double exx = st.sxx / st.count;
+        const double eyy = st.syy / st.count;
+        const double ezz = st.szz / st.count;
+        const double exy = st.sxy / st.count;
+        const double exz = st.sxz / st.count;
+        const double eyz = st.syz / st.count;
+
+        double A[3][3];
+        A[0][0] = exx - ex * ex;
+        A[1][1] = eyy - ey * ey;
+        A[2][2] = ezz - ez * ez;
+        A[0][1] = A[1][0] = exy - ex * ey;
+        A[0][2] = A[2][0] = exz - ex * ez;
+        A[1][2] = A[2][1] = eyz - ey * ez;
+
+        double* Ap[3] = { A[0], A[1], A[2] };
+        double w[3]{ 0,0,0 };
+        double V[3][3];
+        double* Vp[3] = { V[0], V[1], V[2] };
+
+        vtkMath::Jacobi(Ap, w, Vp);
+
+        std::sort(w, w + 3, [](double a, double b) { return a > b; });
+        const double lmax = std::max(1e-12, w[0]);
+        const double lmin = std::max(1e-12, w[2]);
+        const double axisRatio = std::sqrt(lmax / lmin);
+
+        if (axisRatio > opt_.maxAxisRatioVox)
+        {
+            rejSphere++;
+            continue;
         }
+
+        // 5) радиусная “стабильность” (std/mean)
+        double meanR = 0.0;
+        double relStd = 0.0;
+
+        Cand c;
+        c.cxv = cxv; c.cyv = cyv; c.czv = czv;
+        c.count = st.count;
+        c.axisRatio = axisRatio;
+        c.meanR = meanR;
+        c.relStdR = relStd;
+        c.world = voxelToWorld(origin, spacing, cxv, cyv, czv);
+
+        // базовый скор: маленький axisRatio и маленький relStd лучше
+        // (чисто для ранжирования, а не решающего фильтра)
+        const double s1 = std::max(0.0, opt_.maxAxisRatioVox - axisRatio);
+        const double s2 = (opt_.useRadiusConsistency) ? std::max(0.0, opt_.maxRadiusStdRel - relStd) : 0.0;
+        c.score = 1.0 + 2.0 * s1 + 2.0 * s2;
+
+        cands.push_back(c);
     }
 
     if (cands.empty())
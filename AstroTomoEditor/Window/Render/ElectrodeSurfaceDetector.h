@@ -4,6 +4,7 @@
 #include <cstdint>
 
 #include <vtkSmartPointer.h>
+#include "ScreenMarkerIndex.h"
 
 class vtkImageData;
 class vtkRenderer;
@@ -26,6 +27,10 @@ public:
         bool useBodyMask = false;
         int bodyThreshold = 25;
 
+        // искать металл только у поверхности тела: воздух не дальше shellDepthVox по X/Y
+        bool restrictToSurfaceShell = false;
+        int shellDepthVox = 12;
+
         int minComponentVox = 25;
         int maxComponentVox = 1000;
 
@@ -74,12 +79,7 @@ private:
 
     Options opt_{};
     std::vector<SphereMarker> actors_;
-
-    static inline int idx(int x, int y, int z, int nx, int ny) noexcept
-    {
-        return (z * ny + y) * nx + x;
-    }
+    mutable ScreenMarkerIndex hitIndex_; // экранные позиции сфер, пересчёт при смене камеры
 
     void addSphere(vtkRenderer* ren, const std::array<double, 3>& world);
-    static bool worldToDisplay(vtkRenderer* ren, const std::array<double, 3>& world, double outDisplay[2]);
 };
\ No newline at end of file
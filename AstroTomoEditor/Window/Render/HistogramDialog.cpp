@@ -120,8 +120,9 @@ static QVector<double> smoothBox(const QVector<quint64>& h, int win = 9)
 
 
 
-HistogramDialog::HistogramDialog(QWidget* parent, DicomInfo DI, vtkImageData* image)
-    : DialogShell(parent, tr("Histogram"), WindowType::Histogram), mImage(image)
+HistogramDialog::HistogramDialog(QWidget* parent, DicomInfo DI, vtkImageData* image,
+    VolumeHistogram* hist)
+    : DialogShell(parent, tr("Histogram"), WindowType::Histogram), mImage(image), mHistSrc(hist)
 {
     autoleft = -1;
     autoright = -1;
@@ -229,46 +230,22 @@ void HistogramDialog::buildHistogram()
         return;
     }
 
+    // все воксели, без прореживания; после правки пересчёт только если кеш устарел
+    const VolumeHistogram::Counts& counts = histogram().counts(mImage);
+    for (int v = (int)HistMin; v <= (int)HistMax; ++v)
+        mH[v] = counts[v];
+
     if (!mAxisFixed) {
-        double range[2]{};
-        mImage->GetScalarRange(range);
-        mAxisMin = range[0];
-        mAxisMax = range[1];
+        int lo = 0, hi = 0;
+        histogram().valueRange(mImage, lo, hi);
+        mAxisMin = lo;
+        mAxisMax = hi;
         if (mAxisMin == mAxisMax) {
             mAxisMin -= 1.0;
             mAxisMax += 1.0;
         }
     }
 
-    int ext[6];
-    mImage->GetExtent(ext);
-
-    const int nx = ext[1] - ext[0] + 1;
-    const int ny = ext[3] - ext[2] + 1;
-    const int nz = ext[5] - ext[4] + 1;
-
-    vtkIdType incX, incY, incZ;  // ВНИМАНИЕ: ИНКРЕМЕНТЫ В БАЙТАХ
-    mImage->GetIncrements(incX, incY, incZ);
-
-    // стартовый адрес (xmin, ymin, zmin)
-    auto* p0 = static_cast<const uint8_t*>(
-        mImage->GetScalarPointer(ext[0], ext[2], ext[4]));
-
-
-    for (int z = 0; z < nz; z += SubStep) {
-        const uint8_t* pZ = p0 + z * incZ;
-
-        for (int y = 0; y < ny; y += SubStep) {
-            const uint8_t* pY = pZ + y * incY;
-
-            for (int x = 0; x < nx; x += SubStep) {
-                const uint8_t v = pY[x * incX];
-                if (v >= HistMin && v <= HistMax)
-                    mH[v]++;
-            }
-        }
-    }
-
     //for (int i = 0; i <= 255; i++)
     //    qDebug() << i << "  " << mH[i];
 
@@ -887,13 +864,11 @@ void HistogramDialog::paintCanvas()
     p.setPen(QPen(grid, 1));
     QFontMetrics fm(p.font());
 
-    const int mul = SubStep * SubStep * SubStep;
-
     const double stepY = niceStep(cap / 5.0);
     for (double v = 0; v <= cap + 1e-9; v += stepY) {
         const double y = r.bottom() - (v / cap) * r.height();
         p.drawLine(QPointF(r.left(), y), QPointF(r.right(), y));
-        double shownV = v * mul;
+        double shownV = v;
         QString lbl;
         if (shownV >= 1e6) lbl = QString::number(shownV / 1e6, 'f', 1) + "M";
         else if (shownV >= 1e3) lbl = QString::number(shownV / 1e3, 'f', 0) + "k";
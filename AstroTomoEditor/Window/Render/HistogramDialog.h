@@ -4,6 +4,7 @@
 #include <QImage>
 #include <Services/DicomRange.h>
 #include "U8Span.h"
+#include "VolumeHistogram.h"
 #include "..\MainWindow\DialogShell.h"
 #include "..\MainWindow\TitleBar.h"
 
@@ -21,7 +22,9 @@ struct GaussianPeak {
 class HistogramDialog : public DialogShell {
     Q_OBJECT
 public:
-    explicit HistogramDialog(QWidget* parent, DicomInfo DI, vtkImageData* image = nullptr);
+    // hist — общий кеш гистограммы тома (иначе диалог держит свой)
+    explicit HistogramDialog(QWidget* parent, DicomInfo DI, vtkImageData* image = nullptr,
+        VolumeHistogram* hist = nullptr);
 
     // Фиксированная ось a..b для подписей (a ↔ HistMin, b ↔ HistMax)
     void setFixedAxis(bool enabled,
@@ -62,8 +65,9 @@ private:
     void setRangeAxis(double loAxis, double hiAxis, bool emitSig = true);
     GaussianPeak FindSecondPeak(const QVector<double>& s);
 
-    // Подсчёт гистограммы из тома в HistScale бинов (HistMin..HistMax)
+    // Гистограмма тома в HistScale бинов (HistMin..HistMax) из кеша
     void buildHistogram();
+    VolumeHistogram& histogram() { return mHistSrc ? *mHistSrc : mOwnHist; }
 
     // Маппинги бин ↔ [0..1] по ширине канвы
     inline double dataToX(int d) const {
@@ -117,6 +121,8 @@ private:
 private:
     // данные
     vtkImageData* mImage{ nullptr };
+    VolumeHistogram* mHistSrc{ nullptr };
+    VolumeHistogram  mOwnHist;
     QVector<quint64> mH;        // HistScale бинов
     QVector<double>  mSmooth;   // сглаженная кривая (визуализация)
     QImage           mCache;
@@ -134,8 +140,6 @@ private:
     int mLo{ static_cast<int>(HistMin) };
     int mHi{ static_cast<int>(HistMax) };
 
-    int SubStep = 2;
-
     // UI
     QWidget* mCanvas{ nullptr };
     QPushButton* mBtnAuto{ nullptr };
@@ -0,0 +1,485 @@
+﻿#include "MeshLassoCut.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+
+#include <vtkCellArray.h>
+#include <vtkNew.h>
+#include <vtkPointData.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+#include <vtkTriangleFilter.h>
+
+namespace
+{
+    constexpr int kLeafSize = 16;
+    constexpr int kLassoStrips = 64;
+
+    // Лассо в NDC: рёбра разложены по горизонтальным полосам
+    class LassoGrid
+    {
+    public:
+        explicit LassoGrid(const std::vector<std::array<double, 2>>& poly)
+            : mPoly(poly)
+        {
+            mLo[0] = mLo[1] = std::numeric_limits<double>::max();
+            mHi[0] = mHi[1] = std::numeric_limits<double>::lowest();
+            for (const auto& p : mPoly)
+                for (int a = 0; a < 2; ++a)
+                {
+                    mLo[a] = std::min(mLo[a], p[a]);
+                    mHi[a] = std::max(mHi[a], p[a]);
+                }
+
+            mStripH = std::max((mHi[1] - mLo[1]) / kLassoStrips, 1e-12);
+            mStrips.resize(kLassoStrips);
+            const int n = int(mPoly.size());
+            for (int e = 0; e < n; ++e)
+            {
+                const auto& a = mPoly[e];
+                const auto& b = mPoly[(e + 1) % n];
+                const int s0 = strip(std::min(a[1], b[1]));
+                const int s1 = strip(std::max(a[1], b[1]));
+                for (int s = s0; s <= s1; ++s)
+                    mStrips[s].push_back(e);
+            }
+        }
+
+        const double* lo() const { return mLo; }
+        const double* hi() const { return mHi; }
+
+        // чёт-нечет, как у заливки лассо на оверлее
+        bool contains(double x, double y) const
+        {
+            if (x < mLo[0] || x > mHi[0] || y < mLo[1] || y > mHi[1])
+                return false;
+
+            const int n = int(mPoly.size());
+            bool in = false;
+            for (int e : mStrips[strip(y)])
+            {
+                const auto& a = mPoly[e];
+                const auto& b = mPoly[(e + 1) % n];
+                if ((a[1] > y) != (b[1] > y))
+                {
+                    const double xc = a[0] + (y - a[1]) * (b[0] - a[0]) / (b[1] - a[1]);
+                    if (x < xc)
+                        in = !in;
+                }
+            }
+            return in;
+        }
+
+        // Ближайшее к p пересечение отрезка p→q с границей лассо, параметр по отрезку.
+        bool firstCrossing(const double p[2], const double q[2], double& sOut) const
+        {
+            const int n = int(mPoly.size());
+            const int s0 = strip(std::min(p[1], q[1]));
+            const int s1 = strip(std::max(p[1], q[1]));
+            const double dx = q[0] - p[0], dy = q[1] - p[1];
+
+            double best = 2.0;
+            for (int s = s0; s <= s1; ++s)
+                for (int e : mStrips[s])
+                {
+                    const auto& a = mPoly[e];
+                    const auto& b = mPoly[(e + 1) % n];
+                    const double ex = b[0] - a[0], ey = b[1] - a[1];
+                    const double den = dx * ey - dy * ex;
+                    if (std::abs(den) < 1e-300)
+                        continue;
+                    const double wx = a[0] - p[0], wy = a[1] - p[1];
+                    const double s_ = (wx * ey - wy * ex) / den;
+                    const double u = (wx * dy - wy * dx) / den;
+                    if (s_ >= 0.0 && s_ <= 1.0 && u >= 0.0 && u <= 1.0)
+                        best = std::min(best, s_);
+                }
+
+            if (best > 1.0)
+                return false;
+            sOut = best;
+            return true;
+        }
+
+    private:
+        int strip(double y) const
+        {
+            return std::clamp(int((y - mLo[1]) / mStripH), 0, kLassoStrips - 1);
+        }
+
+        const std::vector<std::array<double, 2>>& mPoly;
+        double mLo[2], mHi[2];
+        double mStripH = 1.0;
+        std::vector<std::vector<int>> mStrips;
+    };
+}
+
+void MeshLassoCut::clear()
+{
+    mSource = nullptr;
+    mStamp = 0;
+    mTri = nullptr;
+    mConn.clear();
+    mPts.clear();
+    mNodes.clear();
+    mOrder.clear();
+    mSide.clear();
+    mPieces[0].clear();
+    mPieces[1].clear();
+    mCutPoints.clear();
+    mCount[0] = mCount[1] = 0;
+}
+
+void MeshLassoCut::setMesh(vtkPolyData* mesh)
+{
+    if (mesh && mSource.GetPointer() == mesh && mesh->GetMTime() == mStamp)
+        return;
+
+    clear();
+    if (!mesh || !mesh->GetPoints() || mesh->GetNumberOfPolys() == 0)
+        return;
+
+    mSource = mesh;
+    mStamp = mesh->GetMTime();
+
+    // уже треугольники (обычный случай для STL из конвейера) — без копии
+    vtkCellArray* polys = mesh->GetPolys();
+    const bool pureTriangles = mesh->GetNumberOfStrips() == 0 && polys->IsHomogeneous() == 3;
+    if (pureTriangles)
+    {
+        mTri = mesh;
+    }
+    else
+    {
+        vtkNew<vtkTriangleFilter> tri;
+        tri->SetInputData(mesh);
+        tri->PassVertsOff();
+        tri->PassLinesOff();
+        tri->Update();
+        mTri = tri->GetOutput();
+    }
+
+    const vtkIdType nPts = mTri->GetNumberOfPoints();
+    mPts.resize(size_t(nPts) * 3);
+    for (vtkIdType i = 0; i < nPts; ++i)
+    {
+        double p[3];
+        mTri->GetPoint(i, p);
+        mPts[size_t(i) * 3 + 0] = float(p[0]);
+        mPts[size_t(i) * 3 + 1] = float(p[1]);
+        mPts[size_t(i) * 3 + 2] = float(p[2]);
+    }
+
+    vtkCellArray* tris = mTri->GetPolys();
+    mConn.reserve(size_t(tris->GetNumberOfCells()) * 3);
+    vtkIdType npts = 0;
+    const vtkIdType* ids = nullptr;
+    for (tris->InitTraversal(); tris->GetNextCell(npts, ids);)
+        if (npts == 3)
+            mConn.insert(mConn.end(), ids, ids + 3);
+
+    buildBvh();
+}
+
+void MeshLassoCut::buildBvh()
+{
+    const int nTri = int(mConn.size() / 3);
+    mOrder.resize(nTri);
+    for (int t = 0; t < nTri; ++t)
+        mOrder[t] = t;
+    if (nTri == 0)
+        return;
+
+    std::vector<float> box(size_t(nTri) * 6);
+    std::vector<float> cen(size_t(nTri) * 3);
+    for (int t = 0; t < nTri; ++t)
+    {
+        float* b = &box[size_t(t) * 6];
+        for (int a = 0; a < 3; ++a)
+        {
+            b[a] = std::numeric_limits<float>::max();
+            b[3 + a] = std::numeric_limits<float>::lowest();
+        }
+        for (int v = 0; v < 3; ++v)
+        {
+            const float* p = &mPts[size_t(mConn[size_t(t) * 3 + v]) * 3];
+            for (int a = 0; a < 3; ++a)
+            {
+                b[a] = std::min(b[a], p[a]);
+                b[3 + a] = std::max(b[3 + a], p[a]);
+            }
+        }
+        for (int a = 0; a < 3; ++a)
+            cen[size_t(t) * 3 + a] = 0.5f * (b[a] + b[3 + a]);
+    }
+
+    mNodes.clear();
+    mNodes.reserve(size_t(2 * nTri / kLeafSize + 2));
+
+    struct Task { int node, first, count; };
+    std::vector<Task> stack;
+    mNodes.push_back(Node{});
+    stack.push_back({ 0, 0, nTri });
+
+    while (!stack.empty())
+    {
+        const Task task = stack.back();
+        stack.pop_back();
+
+        Node node;
+        float clo[3], chi[3];
+        for (int a = 0; a < 3; ++a)
+        {
+            node.lo[a] = clo[a] = std::numeric_limits<float>::max();
+            node.hi[a] = chi[a] = std::numeric_limits<float>::lowest();
+        }
+        for (int i = task.first; i < task.first + task.count; ++i)
+        {
+            const int t = mOrder[i];
+            for (int a = 0; a < 3; ++a)
+            {
+                node.lo[a] = std::min(node.lo[a], box[size_t(t) * 6 + a]);
+                node.hi[a] = std::max(node.hi[a], box[size_t(t) * 6 + 3 + a]);
+                clo[a] = std::min(clo[a], cen[size_t(t) * 3 + a]);
+                chi[a] = std::max(chi[a], cen[size_t(t) * 3 + a]);
+            }
+        }
+
+        if (task.count <= kLeafSize)
+        {
+            node.first = task.first;
+            node.count = task.count;
+            mNodes[task.node] = node;
+            continue;
+        }
+
+        // деление по медиане центров вдоль самой длинной оси
+        int axis = 0;
+        for (int a = 1; a < 3; ++a)
+            if (chi[a] - clo[a] > chi[axis] - clo[axis])
+                axis = a;
+
+        const int half = task.count / 2;
+        std::nth_element(mOrder.begin() + task.first, mOrder.begin() + task.first + half,
+            mOrder.begin() + task.first + task.count,
+            [&](int x, int y) { return cen[size_t(x) * 3 + axis] < cen[size_t(y) * 3 + axis]; });
+
+        node.left = int(mNodes.size());
+        node.right = node.left + 1;
+        mNodes[task.node] = node;
+        mNodes.push_back(Node{});
+        mNodes.push_back(Node{});
+        stack.push_back({ node.left, task.first, half });
+        stack.push_back({ node.right, task.first + half, task.count - half });
+    }
+}
+
+bool MeshLassoCut::split(const std::vector<std::array<double, 2>>& lasso, const double M[16])
+{
+    mSide.clear();
+    mPieces[0].clear();
+    mPieces[1].clear();
+    mCutPoints.clear();
+    mCount[0] = mCount[1] = 0;
+
+    if (!mTri || mConn.empty() || lasso.size() < 3)
+        return false;
+
+    const LassoGrid grid(lasso);
+    const double* llo = grid.lo();
+    const double* lhi = grid.hi();
+
+    const vtkIdType nPts = vtkIdType(mPts.size() / 3);
+    const int nTri = int(mConn.size() / 3);
+    mSide.assign(size_t(nTri), int8_t(0));
+
+    // вершины: -1 — ещё не проецировалась, иначе 0/1; ndc и w — для точек разреза
+    std::vector<int8_t> vclass(size_t(nPts), int8_t(-1));
+    std::vector<std::array<double, 3>> vproj(static_cast<size_t>(nPts));
+
+    auto clip = [&](const float* p, double c[4]) {
+        for (int r = 0; r < 4; ++r)
+            c[r] = M[r * 4 + 0] * p[0] + M[r * 4 + 1] * p[1] + M[r * 4 + 2] * p[2] + M[r * 4 + 3];
+        };
+
+    auto classify = [&](vtkIdType v) -> int {
+        int8_t& c = vclass[size_t(v)];
+        if (c >= 0)
+            return c;
+        double h[4];
+        clip(&mPts[size_t(v) * 3], h);
+        auto& pr = vproj[size_t(v)];
+        pr = { 0.0, 0.0, h[3] };
+        if (h[3] <= 1e-12)
+            return c = 0; // за камерой
+        pr[0] = h[0] / h[3];
+        pr[1] = h[1] / h[3];
+        return c = grid.contains(pr[0], pr[1]) ? 1 : 0;
+        };
+
+    // узел целиком по одну сторону от прямоугольника лассо (все 8 углов)
+    auto culled = [&](const Node& n) -> bool {
+        int outL = 0, outR = 0, outB = 0, outT = 0, behind = 0;
+        for (int c = 0; c < 8; ++c)
+        {
+            const float p[3]{ (c & 1) ? n.hi[0] : n.lo[0], (c & 2) ? n.hi[1] : n.lo[1], (c & 4) ? n.hi[2] : n.lo[2] };
+            double h[4];
+            clip(p, h);
+            if (h[3] <= 1e-12) { ++behind; continue; }
+            if (h[0] < llo[0] * h[3]) ++outL;
+            if (h[0] > lhi[0] * h[3]) ++outR;
+            if (h[1] < llo[1] * h[3]) ++outB;
+            if (h[1] > lhi[1] * h[3]) ++outT;
+        }
+        return behind == 8 || outL + behind == 8 || outR + behind == 8
+            || outB + behind == 8 || outT + behind == 8;
+        };
+
+    std::unordered_map<unsigned long long, vtkIdType> edgePoint;
+    auto cutPoint = [&](vtkIdType a, vtkIdType b) -> vtkIdType {
+        const vtkIdType lo = std::min(a, b), hi = std::max(a, b);
+        const unsigned long long key = (unsigned long long)lo * (unsigned long long)nPts + (unsigned long long)hi;
+        auto it = edgePoint.find(key);
+        if (it != edgePoint.end())
+            return it->second;
+
+        // точка на границе лассо: параметр по экранному отрезку → по ребру (перспектива)
+        const auto& pl = vproj[size_t(lo)];
+        const auto& ph = vproj[size_t(hi)];
+        double t = 0.5;
+        double s = 0.0;
+        if (pl[2] > 1e-12 && ph[2] > 1e-12 && grid.firstCrossing(pl.data(), ph.data(), s))
+            t = s * pl[2] / (s * pl[2] + (1.0 - s) * ph[2]);
+
+        const vtkIdType id = nPts + vtkIdType(mCutPoints.size());
+        mCutPoints.push_back({ lo, hi, t });
+        edgePoint.emplace(key, id);
+        return id;
+        };
+
+    vtkIdType whole[2]{ 0, 0 };
+    std::vector<int> stack{ 0 };
+    while (!stack.empty())
+    {
+        const Node& n = mNodes[size_t(stack.back())];
+        stack.pop_back();
+        if (culled(n))
+            continue;
+        if (n.count == 0)
+        {
+            stack.push_back(n.left);
+            stack.push_back(n.right);
+            continue;
+        }
+
+        for (int i = n.first; i < n.first + n.count; ++i)
+        {
+            const int t = mOrder[i];
+            const vtkIdType* v = &mConn[size_t(t) * 3];
+            const int c0 = classify(v[0]), c1 = classify(v[1]), c2 = classify(v[2]);
+            if (c0 == c1 && c1 == c2)
+            {
+                mSide[size_t(t)] = int8_t(c0);
+                continue;
+            }
+
+            // одна вершина на своей стороне: (L, A, B) в исходном обходе
+            mSide[size_t(t)] = -1;
+            const int lone = (c0 != c1 && c0 != c2) ? 0 : (c1 != c0 && c1 != c2) ? 1 : 2;
+            const vtkIdType L = v[lone], A = v[(lone + 1) % 3], B = v[(lone + 2) % 3];
+            const int sideL = (lone == 0) ? c0 : (lone == 1) ? c1 : c2;
+            const vtkIdType pA = cutPoint(L, A);
+            const vtkIdType pB = cutPoint(L, B);
+
+            mPieces[sideL].push_back({ L, pA, pB });
+            mPieces[1 - sideL].push_back({ pA, A, B });
+            mPieces[1 - sideL].push_back({ pA, B, pB });
+        }
+    }
+
+    for (int8_t s : mSide)
+        if (s >= 0)
+            ++whole[s];
+    mCount[0] = whole[0] + vtkIdType(mPieces[0].size());
+    mCount[1] = whole[1] + vtkIdType(mPieces[1].size());
+    return true;
+}
+
+vtkSmartPointer<vtkPolyData> MeshLassoCut::extract(bool inside) const
+{
+    const int side = inside ? 1 : 0;
+    if (!mTri || mSide.empty() || mCount[side] == 0)
+        return nullptr;
+
+    const vtkIdType nPts = vtkIdType(mPts.size() / 3);
+    const vtkIdType nAll = nPts + vtkIdType(mCutPoints.size());
+    std::vector<vtkIdType> remap(size_t(nAll), -1);
+    vtkIdType used = 0;
+    auto mark = [&](vtkIdType v) {
+        if (remap[size_t(v)] < 0)
+            remap[size_t(v)] = used++;
+        };
+
+    const int nTri = int(mSide.size());
+    for (int t = 0; t < nTri; ++t)
+        if (mSide[size_t(t)] == side)
+            for (int k = 0; k < 3; ++k)
+                mark(mConn[size_t(t) * 3 + k]);
+    for (const auto& tri : mPieces[side])
+        for (vtkIdType v : tri)
+            mark(v);
+
+    vtkPoints* srcPts = mTri->GetPoints();
+    vtkNew<vtkPoints> pts;
+    pts->SetDataType(srcPts->GetDataType());
+    pts->SetNumberOfPoints(used);
+
+    vtkPointData* inPD = mTri->GetPointData();
+    auto out = vtkSmartPointer<vtkPolyData>::New();
+    vtkPointData* outPD = out->GetPointData();
+    outPD->InterpolateAllocate(inPD, used);
+
+    for (vtkIdType v = 0; v < nPts; ++v)
+    {
+        const vtkIdType o = remap[size_t(v)];
+        if (o < 0) continue;
+        double p[3];
+        srcPts->GetPoint(v, p);
+        pts->SetPoint(o, p);
+        outPD->CopyData(inPD, v, o);
+    }
+    for (size_t c = 0; c < mCutPoints.size(); ++c)
+    {
+        const vtkIdType o = remap[size_t(nPts) + c];
+        if (o < 0) continue;
+        const CutPoint& cp = mCutPoints[c];
+        double a[3], b[3];
+        srcPts->GetPoint(cp.a, a);
+        srcPts->GetPoint(cp.b, b);
+        pts->SetPoint(o, a[0] + cp.t * (b[0] - a[0]), a[1] + cp.t * (b[1] - a[1]), a[2] + cp.t * (b[2] - a[2]));
+        outPD->InterpolateEdge(inPD, o, cp.a, cp.b, cp.t);
+    }
+
+    vtkNew<vtkCellArray> polys;
+    polys->AllocateExact(mCount[side], mCount[side] * 3);
+    for (int t = 0; t < nTri; ++t)
+    {
+        if (mSide[size_t(t)] != side) continue;
+        const vtkIdType ids[3]{
+            remap[size_t(mConn[size_t(t) * 3 + 0])],
+            remap[size_t(mConn[size_t(t) * 3 + 1])],
+            remap[size_t(mConn[size_t(t) * 3 + 2])] };
+        polys->InsertNextCell(3, ids);
+    }
+    for (const auto& tri : mPieces[side])
+    {
+        const vtkIdType ids[3]{ remap[size_t(tri[0])], remap[size_t(tri[1])], remap[size_t(tri[2])] };
+        polys->InsertNextCell(3, ids);
+    }
+
+    out->SetPoints(pts);
+    out->SetPolys(polys);
+    return out;
+}
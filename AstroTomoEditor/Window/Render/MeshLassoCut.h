@@ -0,0 +1,60 @@
+﻿#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <vtkSmartPointer.h>
+#include <vtkType.h>
+#include <vtkWeakPointer.h>
+
+class vtkPolyData;
+
+// Разрез треугольной поверхности 2D-лассо экрана.
+// Вершины проецируются матрицей камеры по одному разу, принадлежность лассо — по полосам
+// рёбер лассо; делятся только треугольники, у которых вершины по разные стороны границы.
+// BVH по треугольникам строится один раз на меш и отсекает всё вне прямоугольника лассо:
+// такие треугольники заведомо снаружи и не проецируются.
+class MeshLassoCut
+{
+public:
+    void clear();
+    // Треугольный вид меша и BVH пересобираются, только если меш другой или менялся.
+    void setMesh(vtkPolyData* mesh);
+
+    // lasso — вершины в NDC камеры; worldToClip — мир → клип, 4x4 по строкам
+    // (vtkCamera::GetCompositeProjectionTransformMatrix). false — нечего резать.
+    bool split(const std::vector<std::array<double, 2>>& lasso, const double worldToClip[16]);
+
+    vtkIdType cellCount(bool inside) const { return mCount[inside ? 1 : 0]; }
+    // Часть после split: точки компактны, point data на точках разреза интерполируется.
+    vtkSmartPointer<vtkPolyData> extract(bool inside) const;
+
+private:
+    struct Node
+    {
+        float lo[3], hi[3];
+        int first = 0, count = 0; // лист, если count > 0
+        int left = -1, right = -1;
+    };
+
+    struct CutPoint
+    {
+        vtkIdType a, b; // ребро исходника
+        double t;       // точка = a + t * (b - a)
+    };
+
+    void buildBvh();
+
+    vtkWeakPointer<vtkPolyData> mSource;
+    vtkMTimeType mStamp = 0;
+    vtkSmartPointer<vtkPolyData> mTri;  // сам исходник, если он уже из треугольников
+    std::vector<vtkIdType> mConn;       // 3 * nTri
+    std::vector<float> mPts;            // 3 * nPts
+    std::vector<Node> mNodes;
+    std::vector<int> mOrder;            // треугольники в порядке листьев
+
+    // результат split
+    std::vector<int8_t> mSide;          // 0 — снаружи, 1 — внутри, -1 — разрезан
+    std::vector<std::array<vtkIdType, 3>> mPieces[2];
+    std::vector<CutPoint> mCutPoints;   // id = nPts + индекс
+    vtkIdType mCount[2]{ 0, 0 };
+};
@@ -0,0 +1,665 @@
+﻿#include "NarrowBandSurface.h"
+#include "SignedDistanceField.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+#include <unordered_map>
+
+#include <vtkAppendPolyData.h>
+#include <vtkCellArray.h>
+#include <vtkFlyingEdges3D.h>
+#include <vtkFloatArray.h>
+#include <vtkIdList.h>
+#include <vtkIdTypeArray.h>
+#include <vtkImageData.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+#include <vtkSMPTools.h>
+
+#include <QDebug>
+#include <QElapsedTimer>
+
+namespace
+{
+    struct Kernel
+    {
+        int r = 0;
+        std::vector<double> w;
+    };
+
+    // То же ядро, что строит vtkImageGaussianSmooth: радиус = int(sigma * factor).
+    Kernel MakeKernel(double sigmaVox, double factor)
+    {
+        Kernel k;
+        k.r = std::max(0, int(sigmaVox * factor));
+        k.w.resize(size_t(2 * k.r + 1));
+        double sum = 0.0;
+        for (int i = -k.r; i <= k.r; ++i)
+        {
+            const double v = (sigmaVox > 0.0) ? std::exp(-0.5 * double(i * i) / (sigmaVox * sigmaVox)) : 1.0;
+            k.w[size_t(i + k.r)] = v;
+            sum += v;
+        }
+        for (double& v : k.w) v /= sum;
+        return k;
+    }
+
+    struct Grid
+    {
+        const std::uint8_t* mask = nullptr;
+        int    dims[3]{};
+        double spacing[3]{};
+        double origin[3]{};
+        int    B = 48;
+        int    nb[3]{};
+        Kernel k[3];
+        int    halo[3]{};      // радиус ядра + полоса, в вокселях по оси
+        float  bandMm = 0.0f;
+
+        std::uint8_t at(int i, int j, int k) const
+        {
+            return mask[(size_t(k) * dims[1] + j) * size_t(dims[0]) + i];
+        }
+
+        // Узлы кирпича, включая общий слой с соседом (+1): ячейки покрываются ровно один раз.
+        void brickPoints(const int b[3], int lo[3], int hi[3]) const
+        {
+            for (int a = 0; a < 3; ++a)
+            {
+                lo[a] = b[a] * B;
+                hi[a] = std::min(lo[a] + B, dims[a] - 1);
+            }
+        }
+    };
+
+    // Кирпич занят, если в его узлах (с запасом 2 вокселя на сдвиг изо после гаусса)
+    // есть оба класса маски.
+    bool BrickHasBoundary(const Grid& g, const int b[3])
+    {
+        constexpr int kApron = 2;
+        int lo[3], hi[3];
+        g.brickPoints(b, lo, hi);
+        for (int a = 0; a < 3; ++a)
+        {
+            lo[a] = std::max(0, lo[a] - kApron);
+            hi[a] = std::min(g.dims[a] - 1, hi[a] + kApron);
+        }
+
+        const bool first = g.at(lo[0], lo[1], lo[2]) != 0;
+        for (int k = lo[2]; k <= hi[2]; ++k)
+            for (int j = lo[1]; j <= hi[1]; ++j)
+            {
+                const std::uint8_t* row = g.mask + (size_t(k) * g.dims[1] + j) * size_t(g.dims[0]);
+                for (int i = lo[0]; i <= hi[0]; ++i)
+                    if ((row[i] != 0) != first)
+                        return true;
+            }
+        return false;
+    }
+
+    // Гаусс вдоль одной оси, только для узлов в [lo, hi] (локальные индексы блока).
+    // На краях блока ядро обрезается и перенормируется; внутри объёма блок всегда
+    // шире ядра, так что обрезка случается только на границе объёма — как в глобальном пути.
+    void SmoothAxis(const float* in, float* out, const int n[3], int axis,
+        const Kernel& k, const int lo[3], const int hi[3])
+    {
+        const size_t stride[3] = { 1, size_t(n[0]), size_t(n[0]) * size_t(n[1]) };
+        for (int z = lo[2]; z <= hi[2]; ++z)
+            for (int y = lo[1]; y <= hi[1]; ++y)
+                for (int x = lo[0]; x <= hi[0]; ++x)
+                {
+                    const int p[3] = { x, y, z };
+                    const size_t c = size_t(z) * stride[2] + size_t(y) * stride[1] + size_t(x);
+                    const int t0 = std::max(-k.r, -p[axis]);
+                    const int t1 = std::min(k.r, n[axis] - 1 - p[axis]);
+
+                    double acc = 0.0, wsum = 0.0;
+                    for (int t = t0; t <= t1; ++t)
+                    {
+                        const double w = k.w[size_t(t + k.r)];
+                        acc += w * in[c + std::ptrdiff_t(t) * std::ptrdiff_t(stride[axis])];
+                        wsum += w;
+                    }
+                    out[c] = float(acc / wsum);
+                }
+    }
+
+    vtkSmartPointer<vtkPolyData> BuildBrick(const Grid& g, const int b[3])
+    {
+        int lo[3], hi[3];
+        g.brickPoints(b, lo, hi);
+
+        int blo[3], n[3];
+        for (int a = 0; a < 3; ++a)
+        {
+            blo[a] = std::max(0, lo[a] - g.halo[a]);
+            const int bhi = std::min(g.dims[a] - 1, hi[a] + g.halo[a]);
+            n[a] = bhi - blo[a] + 1;
+        }
+
+        const size_t N = size_t(n[0]) * size_t(n[1]) * size_t(n[2]);
+        std::vector<std::uint8_t> m(N);
+        for (int z = 0; z < n[2]; ++z)
+            for (int y = 0; y < n[1]; ++y)
+                std::memcpy(m.data() + (size_t(z) * n[1] + y) * size_t(n[0]),
+                    g.mask + (size_t(z + blo[2]) * g.dims[1] + size_t(y + blo[1])) * size_t(g.dims[0]) + blo[0],
+                    size_t(n[0]));
+
+        // Весь блок одного класса: SDF = ±полоса, iso=0 нет.
+        std::vector<float> sdf(N);
+        if (!SignedDistanceField::ComputeRaw(m.data(), n[0], n[1], n[2], g.spacing, sdf.data(), g.bandMm))
+            return nullptr;
+
+        // Локальные узлы кирпича и диапазоны, нужные следующим проходам гаусса.
+        int c[3], d[3], ylo[3], yhi[3], xlo[3], xhi[3];
+        for (int a = 0; a < 3; ++a)
+        {
+            c[a] = lo[a] - blo[a];
+            d[a] = hi[a] - blo[a];
+        }
+        for (int a = 0; a < 3; ++a)
+        {
+            ylo[a] = c[a]; yhi[a] = d[a];
+            xlo[a] = c[a]; xhi[a] = d[a];
+        }
+        ylo[2] = std::max(0, c[2] - g.k[2].r); yhi[2] = std::min(n[2] - 1, d[2] + g.k[2].r);
+        xlo[2] = ylo[2];                        xhi[2] = yhi[2];
+        xlo[1] = std::max(0, c[1] - g.k[1].r); xhi[1] = std::min(n[1] - 1, d[1] + g.k[1].r);
+
+        std::vector<float> t1(N), t2(N);
+        SmoothAxis(sdf.data(), t1.data(), n, 0, g.k[0], xlo, xhi);
+        SmoothAxis(t1.data(), t2.data(), n, 1, g.k[1], ylo, yhi);
+        SmoothAxis(t2.data(), sdf.data(), n, 2, g.k[2], c, d);
+
+        // Быстрый отказ: нет смены знака в узлах кирпича.
+        bool anyPos = false, anyNeg = false;
+        for (int z = c[2]; z <= d[2] && !(anyPos && anyNeg); ++z)
+            for (int y = c[1]; y <= d[1]; ++y)
+            {
+                const float* row = sdf.data() + (size_t(z) * n[1] + y) * size_t(n[0]);
+                for (int x = c[0]; x <= d[0]; ++x)
+                {
+                    if (row[x] > 0.0f) anyPos = true; else anyNeg = true;
+                }
+            }
+        if (!anyPos || !anyNeg)
+            return nullptr;
+
+        // Глобальные индексы в extent: координаты вершин origin + ijk*spacing
+        // одинаковы у соседних кирпичей.
+        vtkNew<vtkImageData> img;
+        img->SetExtent(lo[0], hi[0], lo[1], hi[1], lo[2], hi[2]);
+        img->SetOrigin(g.origin[0], g.origin[1], g.origin[2]);
+        img->SetSpacing(g.spacing[0], g.spacing[1], g.spacing[2]);
+        img->AllocateScalars(VTK_FLOAT, 1);
+
+        auto* dst = static_cast<float*>(img->GetScalarPointer());
+        const int w = d[0] - c[0] + 1;
+        for (int z = c[2]; z <= d[2]; ++z)
+            for (int y = c[1]; y <= d[1]; ++y)
+            {
+                std::memcpy(dst, sdf.data() + (size_t(z) * n[1] + y) * size_t(n[0]) + c[0], sizeof(float) * size_t(w));
+                dst += w;
+            }
+
+        vtkNew<vtkFlyingEdges3D> fe;
+        fe->SetInputData(img);
+        fe->SetValue(0, 0.0);
+        fe->ComputeNormalsOff();
+        fe->ComputeGradientsOff();
+        fe->ComputeScalarsOff();
+        fe->Update();
+
+        vtkPolyData* feOut = fe->GetOutput();
+        if (!feOut || feOut->GetNumberOfPolys() == 0)
+            return nullptr;
+
+        auto out = vtkSmartPointer<vtkPolyData>::New();
+        out->ShallowCopy(feOut);
+        return out;
+    }
+
+    // Сетка кирпичей, ядра гаусса и полоса по маске и параметрам.
+    bool SetupGrid(vtkImageData* mask, const NarrowBandSurface::Params& p, Grid& g)
+    {
+        if (!mask || mask->GetScalarType() != VTK_UNSIGNED_CHAR ||
+            mask->GetNumberOfScalarComponents() != 1)
+            return false;
+
+        g.mask = static_cast<const std::uint8_t*>(mask->GetScalarPointer());
+        mask->GetDimensions(g.dims);
+        mask->GetSpacing(g.spacing);
+        if (!g.mask || g.dims[0] < 2 || g.dims[1] < 2 || g.dims[2] < 2)
+            return false;
+
+        // origin узла (0,0,0) буфера, даже если extent не 0-базный
+        int ext[6];
+        mask->GetExtent(ext);
+        mask->GetOrigin(g.origin);
+        for (int a = 0; a < 3; ++a)
+            g.origin[a] += double(ext[2 * a]) * g.spacing[a];
+
+        g.B = std::max(8, p.brickSize);
+        for (int a = 0; a < 3; ++a)
+        {
+            g.nb[a] = std::max(1, (g.dims[a] - 1 + g.B - 1) / g.B);
+            g.k[a] = MakeKernel(p.sigmaMm[a] / std::max(1e-9, g.spacing[a]), p.radiusFactor);
+        }
+
+        // Полоса: точные расстояния нужны на радиус ядра + 2 вокселя от границы,
+        // дальше SDF обрезается — на положение iso=0 это не влияет.
+        double bandMm = 0.0;
+        for (int a = 0; a < 3; ++a)
+            bandMm = std::max(bandMm, double(g.k[a].r + 2) * g.spacing[a]);
+        g.bandMm = float(bandMm);
+        for (int a = 0; a < 3; ++a)
+            g.halo[a] = g.k[a].r + int(std::ceil(bandMm / std::max(1e-9, g.spacing[a])));
+        return true;
+    }
+
+    // 64-битный хэш блока маски B^3 (по 8 байт строки, хвост побайтно).
+    std::uint64_t HashCell(const Grid& g, const int c[3])
+    {
+        int lo[3], hi[3];
+        for (int a = 0; a < 3; ++a)
+        {
+            lo[a] = c[a] * g.B;
+            hi[a] = std::min(lo[a] + g.B, g.dims[a]) - 1;
+        }
+
+        std::uint64_t h = 1469598103934665603ull;
+        const size_t w = size_t(hi[0] - lo[0] + 1);
+        for (int k = lo[2]; k <= hi[2]; ++k)
+            for (int j = lo[1]; j <= hi[1]; ++j)
+            {
+                const std::uint8_t* row = g.mask + (size_t(k) * g.dims[1] + j) * size_t(g.dims[0]) + lo[0];
+                size_t i = 0;
+                for (; i + 8 <= w; i += 8)
+                {
+                    std::uint64_t v;
+                    std::memcpy(&v, row + i, sizeof(v));
+                    h = (h ^ v) * 1099511628211ull;
+                    h ^= h >> 29;
+                }
+                for (; i < w; ++i)
+                    h = (h ^ row[i]) * 1099511628211ull;
+            }
+        return h;
+    }
+
+    int FloorDiv(int a, int b) { return (a >= 0) ? a / b : -((-a + b - 1) / b); }
+
+    // FE-выход кирпича -> компактный патч; край патча (рёбра с одной гранью) лежит
+    // на гранях кирпича — только эти вершины потом сшиваются с соседями.
+    SurfaceBrickCache::Patch ToPatch(vtkPolyData* pd)
+    {
+        SurfaceBrickCache::Patch patch;
+        if (!pd || !pd->GetPoints())
+            return patch;
+
+        const vtkIdType np = pd->GetNumberOfPoints();
+        patch.pts.resize(size_t(np) * 3);
+        double x[3];
+        for (vtkIdType i = 0; i < np; ++i)
+        {
+            pd->GetPoint(i, x);
+            patch.pts[3 * size_t(i) + 0] = float(x[0]);
+            patch.pts[3 * size_t(i) + 1] = float(x[1]);
+            patch.pts[3 * size_t(i) + 2] = float(x[2]);
+        }
+
+        vtkCellArray* polys = pd->GetPolys();
+        patch.tris.reserve(size_t(polys->GetNumberOfCells()) * 3);
+        vtkNew<vtkIdList> ids;
+        for (vtkIdType c = 0; c < polys->GetNumberOfCells(); ++c)
+        {
+            polys->GetCellAtId(c, ids);
+            if (ids->GetNumberOfIds() != 3)
+                continue;
+            for (int k = 0; k < 3; ++k)
+                patch.tris.push_back(int(ids->GetId(k)));
+        }
+
+        std::vector<std::uint64_t> edges;
+        edges.reserve(patch.tris.size());
+        for (size_t t = 0; t < patch.tris.size(); t += 3)
+            for (int k = 0; k < 3; ++k)
+            {
+                const std::uint32_t a = std::uint32_t(patch.tris[t + k]);
+                const std::uint32_t b = std::uint32_t(patch.tris[t + (k + 1) % 3]);
+                edges.push_back((std::uint64_t(std::min(a, b)) << 32) | std::max(a, b));
+            }
+        std::sort(edges.begin(), edges.end());
+
+        std::vector<std::uint8_t> onSeam(size_t(np), 0);
+        for (size_t i = 0; i < edges.size();)
+        {
+            size_t j = i;
+            while (j < edges.size() && edges[j] == edges[i]) ++j;
+            if (j - i == 1)
+            {
+                onSeam[size_t(edges[i] >> 32)] = 1;
+                onSeam[size_t(edges[i] & 0xffffffffull)] = 1;
+            }
+            i = j;
+        }
+        for (vtkIdType i = 0; i < np; ++i)
+            if (onSeam[size_t(i)]) patch.seam.push_back(int(i));
+
+        return patch;
+    }
+
+    struct SeamKey
+    {
+        std::uint32_t x, y, z;
+        bool operator==(const SeamKey& o) const { return x == o.x && y == o.y && z == o.z; }
+    };
+
+    struct SeamKeyHash
+    {
+        size_t operator()(const SeamKey& k) const
+        {
+            std::uint64_t h = (std::uint64_t(k.x) * 73856093ull) ^ (std::uint64_t(k.y) * 19349663ull) ^ (std::uint64_t(k.z) * 83492791ull);
+            return size_t(h ^ (h >> 32));
+        }
+    };
+
+    SeamKey MakeSeamKey(const float* p)
+    {
+        SeamKey k;
+        std::memcpy(&k.x, p + 0, 4);
+        std::memcpy(&k.y, p + 1, 4);
+        std::memcpy(&k.z, p + 2, 4);
+        return k;
+    }
+
+    // Склейка патчей в порядке кирпичей: вершины шва с одинаковыми координатами
+    // получают один индекс, остальные переносятся как есть.
+    vtkSmartPointer<vtkPolyData> StitchPatches(const std::vector<SurfaceBrickCache::Patch>& patches)
+    {
+        std::vector<size_t> ptBase(patches.size() + 1, 0), triBase(patches.size() + 1, 0);
+        for (size_t b = 0; b < patches.size(); ++b)
+        {
+            ptBase[b + 1] = ptBase[b] + patches[b].pts.size() / 3;
+            triBase[b + 1] = triBase[b] + patches[b].tris.size() / 3;
+        }
+        if (triBase.back() == 0)
+            return nullptr;
+
+        // Глобальные индексы: последовательно, швы — через хэш точных координат.
+        std::vector<vtkIdType> remap(ptBase.back(), -1);
+        std::vector<std::uint8_t> owner(ptBase.back(), 0); // кто пишет координаты общей вершины
+        std::unordered_map<SeamKey, vtkIdType, SeamKeyHash> seamIds;
+        vtkIdType next = 0;
+        for (size_t b = 0; b < patches.size(); ++b)
+        {
+            const auto& patch = patches[b];
+            vtkIdType* rm = remap.data() + ptBase[b];
+            std::uint8_t* own = owner.data() + ptBase[b];
+            for (int v : patch.seam)
+            {
+                auto it = seamIds.emplace(MakeSeamKey(patch.pts.data() + 3 * size_t(v)), next);
+                rm[v] = it.first->second;
+                if (it.second)
+                {
+                    own[v] = 1;
+                    ++next;
+                }
+            }
+            const size_t np = patch.pts.size() / 3;
+            for (size_t v = 0; v < np; ++v)
+                if (rm[v] < 0)
+                {
+                    rm[v] = next++;
+                    own[v] = 1;
+                }
+        }
+
+        vtkNew<vtkFloatArray> coords;
+        coords->SetNumberOfComponents(3);
+        coords->SetNumberOfTuples(next);
+        float* dstPts = coords->GetPointer(0);
+
+        vtkNew<vtkIdTypeArray> offsets, conn;
+        offsets->SetNumberOfTuples(vtkIdType(triBase.back()) + 1);
+        conn->SetNumberOfTuples(vtkIdType(triBase.back()) * 3);
+        vtkIdType* off = offsets->GetPointer(0);
+        vtkIdType* con = conn->GetPointer(0);
+
+        vtkSMPTools::For(0, vtkIdType(patches.size()), [&](vtkIdType first, vtkIdType last)
+            {
+                for (vtkIdType b = first; b < last; ++b)
+                {
+                    const auto& patch = patches[size_t(b)];
+                    const vtkIdType* rm = remap.data() + ptBase[size_t(b)];
+                    const std::uint8_t* own = owner.data() + ptBase[size_t(b)];
+                    const size_t np = patch.pts.size() / 3;
+                    for (size_t v = 0; v < np; ++v)
+                        if (own[v])
+                            std::memcpy(dstPts + 3 * size_t(rm[v]), patch.pts.data() + 3 * v, 3 * sizeof(float));
+
+                    const size_t t0 = triBase[size_t(b)];
+                    for (size_t t = 0; t < patch.tris.size() / 3; ++t)
+                    {
+                        off[t0 + t] = vtkIdType(3 * (t0 + t));
+                        for (int k = 0; k < 3; ++k)
+                            con[3 * (t0 + t) + k] = rm[patch.tris[3 * t + k]];
+                    }
+                }
+            });
+        off[triBase.back()] = vtkIdType(3 * triBase.back());
+
+        vtkNew<vtkPoints> points;
+        points->SetData(coords);
+        vtkNew<vtkCellArray> polys;
+        polys->SetData(offsets, conn);
+
+        auto out = vtkSmartPointer<vtkPolyData>::New();
+        out->SetPoints(points);
+        out->SetPolys(polys);
+        return out;
+    }
+}
+
+vtkSmartPointer<vtkPolyData> NarrowBandSurface::Build(vtkImageData* mask, const Params& p,
+    const std::function<void(int, int)>& progress)
+{
+    Grid g;
+    if (!SetupGrid(mask, p, g))
+        return nullptr;
+
+    // --- 1) кирпичи у границы маски ---
+    const int total = g.nb[0] * g.nb[1] * g.nb[2];
+    std::vector<std::uint8_t> occupied(size_t(total), 0);
+    vtkSMPTools::For(0, total, [&](vtkIdType first, vtkIdType last)
+        {
+            for (vtkIdType id = first; id < last; ++id)
+            {
+                const int b[3] = { int(id % g.nb[0]), int((id / g.nb[0]) % g.nb[1]), int(id / (vtkIdType(g.nb[0]) * g.nb[1])) };
+                occupied[size_t(id)] = BrickHasBoundary(g, b) ? 1 : 0;
+            }
+        });
+
+    std::vector<int> work;
+    for (int id = 0; id < total; ++id)
+        if (occupied[size_t(id)]) work.push_back(id);
+
+    qDebug() << "[STL] narrow band: bricks" << work.size() << "/" << total
+        << "B" << g.B << "band mm" << g.bandMm
+        << "halo" << g.halo[0] << g.halo[1] << g.halo[2];
+
+    if (work.empty())
+        return nullptr;
+
+    // --- 2) SDF + гаусс + Flying Edges по занятым кирпичам, пачками ---
+    std::vector<vtkSmartPointer<vtkPolyData>> parts(work.size());
+    const int batch = 256;
+    for (size_t b0 = 0; b0 < work.size(); b0 += batch)
+    {
+        const size_t b1 = std::min(work.size(), b0 + batch);
+        vtkSMPTools::For(vtkIdType(b0), vtkIdType(b1), 1, [&](vtkIdType first, vtkIdType last)
+            {
+                for (vtkIdType w = first; w < last; ++w)
+                {
+                    const int id = work[size_t(w)];
+                    const int b[3] = { id % g.nb[0], (id / g.nb[0]) % g.nb[1], id / (g.nb[0] * g.nb[1]) };
+                    parts[size_t(w)] = BuildBrick(g, b);
+                }
+            });
+
+        if (progress)
+            progress(int(b1), int(work.size()));
+    }
+
+    // --- 3) склейка в порядке кирпичей (детерминированно) ---
+    vtkNew<vtkAppendPolyData> append;
+    int nonEmpty = 0;
+    for (auto& part : parts)
+    {
+        if (!part) continue;
+        append->AddInputData(part);
+        ++nonEmpty;
+    }
+    if (nonEmpty == 0)
+        return nullptr;
+
+    append->Update();
+
+    auto out = vtkSmartPointer<vtkPolyData>::New();
+    out->ShallowCopy(append->GetOutput());
+    qDebug() << "[STL] narrow band: patches" << nonEmpty << "polys" << out->GetNumberOfPolys();
+    return out;
+}
+
+vtkSmartPointer<vtkPolyData> NarrowBandSurface::BuildIncremental(vtkImageData* mask, const Params& p,
+    SurfaceBrickCache& cache, const std::function<void(int, int)>& progress)
+{
+    Grid g;
+    if (!SetupGrid(mask, p, g))
+        return nullptr;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const int total = g.nb[0] * g.nb[1] * g.nb[2];
+
+    // --- 1) хэши блоков маски: что поменялось с прошлого вызова ---
+    int nc[3];
+    for (int a = 0; a < 3; ++a)
+        nc[a] = (g.dims[a] + g.B - 1) / g.B;
+    const int cells = nc[0] * nc[1] * nc[2];
+
+    std::vector<std::uint64_t> hashes(size_t(cells), 0);
+    vtkSMPTools::For(0, cells, [&](vtkIdType first, vtkIdType last)
+        {
+            for (vtkIdType id = first; id < last; ++id)
+            {
+                const int c[3] = { int(id % nc[0]), int((id / nc[0]) % nc[1]), int(id / (vtkIdType(nc[0]) * nc[1])) };
+                hashes[size_t(id)] = HashCell(g, c);
+            }
+        });
+
+    const bool compatible =
+        cache.mPatches.size() == size_t(total) && cache.mCellHash.size() == size_t(cells) &&
+        std::equal(g.dims, g.dims + 3, cache.mDims) &&
+        std::equal(g.spacing, g.spacing + 3, cache.mSpacing) &&
+        std::equal(g.origin, g.origin + 3, cache.mOrigin) &&
+        cache.mParams.brickSize == p.brickSize && cache.mParams.radiusFactor == p.radiusFactor &&
+        std::equal(p.sigmaMm, p.sigmaMm + 3, cache.mParams.sigmaMm);
+
+    // --- 2) грязные кирпичи: область чтения кирпича (узлы ± ореол) задевает изменённый блок ---
+    std::vector<std::uint8_t> dirty(size_t(total), compatible ? 0 : 1);
+    int changedCells = 0;
+    if (compatible)
+    {
+        for (int id = 0; id < cells; ++id)
+        {
+            if (hashes[size_t(id)] == cache.mCellHash[size_t(id)])
+                continue;
+            ++changedCells;
+
+            const int c[3] = { id % nc[0], (id / nc[0]) % nc[1], id / (nc[0] * nc[1]) };
+            int b0[3], b1[3];
+            for (int a = 0; a < 3; ++a)
+            {
+                const int v0 = c[a] * g.B;
+                const int v1 = std::min(v0 + g.B, g.dims[a]) - 1;
+                b0[a] = std::max(0, FloorDiv(v0 - g.B - g.halo[a] + g.B - 1, g.B));
+                b1[a] = std::min(g.nb[a] - 1, FloorDiv(v1 + g.halo[a], g.B));
+            }
+            for (int z = b0[2]; z <= b1[2]; ++z)
+                for (int y = b0[1]; y <= b1[1]; ++y)
+                    for (int x = b0[0]; x <= b1[0]; ++x)
+                        dirty[size_t((z * g.nb[1] + y) * g.nb[0] + x)] = 1;
+        }
+    }
+    else
+    {
+        cache.clear();
+        cache.mPatches.resize(size_t(total));
+    }
+
+    std::vector<int> work;
+    for (int id = 0; id < total; ++id)
+        if (dirty[size_t(id)]) work.push_back(id);
+
+    // --- 3) пересчёт только грязных кирпичей ---
+    const int batch = 256;
+    for (size_t b0 = 0; b0 < work.size(); b0 += batch)
+    {
+        const size_t b1 = std::min(work.size(), b0 + batch);
+        vtkSMPTools::For(vtkIdType(b0), vtkIdType(b1), 1, [&](vtkIdType first, vtkIdType last)
+            {
+                for (vtkIdType w = first; w < last; ++w)
+                {
+                    const int id = work[size_t(w)];
+                    const int b[3] = { id % g.nb[0], (id / g.nb[0]) % g.nb[1], id / (g.nb[0] * g.nb[1]) };
+                    auto& patch = cache.mPatches[size_t(id)];
+                    patch = SurfaceBrickCache::Patch{};
+                    if (BrickHasBoundary(g, b))
+                        patch = ToPatch(BuildBrick(g, b));
+                }
+            });
+
+        if (progress)
+            progress(int(b1), int(work.size()));
+    }
+
+    std::copy(g.dims, g.dims + 3, cache.mDims);
+    std::copy(g.spacing, g.spacing + 3, cache.mSpacing);
+    std::copy(g.origin, g.origin + 3, cache.mOrigin);
+    cache.mParams = p;
+    cache.mCellHash.swap(hashes);
+
+    // --- 4) сшивка ---
+    auto out = StitchPatches(cache.mPatches);
+
+    qDebug() << "[STL] incremental narrow band:" << (compatible ? "cached" : "full")
+        << "changed cells" << changedCells << "rebuilt bricks" << work.size() << "/" << total
+        << "polys" << (out ? out->GetNumberOfPolys() : 0) << "in" << timer.elapsed() << "ms";
+
+    return out;
+}
+
+void SurfaceBrickCache::clear()
+{
+    std::fill(mDims, mDims + 3, 0);
+    std::fill(mSpacing, mSpacing + 3, 0.0);
+    std::fill(mOrigin, mOrigin + 3, 0.0);
+    mParams = NarrowBandSurface::Params{};
+    std::vector<std::uint64_t>().swap(mCellHash);
+    std::vector<Patch>().swap(mPatches);
+}
+
+qint64 SurfaceBrickCache::memoryBytes() const
+{
+    qint64 total = qint64(mCellHash.capacity()) * sizeof(std::uint64_t)
+        + qint64(mPatches.capacity()) * sizeof(Patch);
+    for (const Patch& p : mPatches)
+        total += qint64(p.pts.capacity()) * sizeof(float)
+            + qint64(p.tris.capacity() + p.seam.capacity()) * sizeof(int);
+    return total;
+}
@@ -0,0 +1,63 @@
+﻿#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <QtGlobal>
+#include <vtkSmartPointer.h>
+
+class vtkImageData;
+class vtkPolyData;
+class SurfaceBrickCache;
+
+// Узкополосная SDF-поверхность по бинарной u8-маске.
+// Объём режется на кирпичи; SDF (с обрезкой по полосе), гаусс и Flying Edges считаются
+// только в кирпичах у границы маски, каждый — в своём маленьком буфере с ореолом.
+// Значения в общих узлах соседних кирпичей совпадают бит-в-бит, поэтому вершины на швах
+// одинаковые и сливаются обычным vtkCleanPolyData (tolerance 0).
+class NarrowBandSurface
+{
+public:
+    struct Params
+    {
+        double sigmaMm[3]{ 0.9, 0.9, 1.4 };  // гаусс по SDF, как в полном SDF-пути
+        double radiusFactor = 3.0;           // радиус ядра = sigma * factor (как vtkImageGaussianSmooth)
+        int    brickSize = 48;               // узлов по стороне кирпича
+    };
+
+    // mask: u8 x 1, ненулевое = «внутри». Результат — треугольники iso=0 (точки на швах не слиты).
+    // progress(done, total) вызывается из вызывающего потока между пачками кирпичей.
+    static vtkSmartPointer<vtkPolyData> Build(vtkImageData* mask, const Params& p,
+        const std::function<void(int, int)>& progress = {});
+
+    // То же, но с кэшем между вызовами для маски той же геометрии: пересчитываются только
+    // кирпичи, у которых в пределах ореола поменялись воксели, остальные берутся из cache.
+    // Результат сшит: вершины на швах кирпичей слиты по точным координатам.
+    static vtkSmartPointer<vtkPolyData> BuildIncremental(vtkImageData* mask, const Params& p,
+        SurfaceBrickCache& cache, const std::function<void(int, int)>& progress = {});
+};
+
+// Состояние BuildIncremental: хэши блоков маски и треугольники каждого кирпича.
+class SurfaceBrickCache
+{
+public:
+    struct Patch
+    {
+        std::vector<float> pts;  // 3 * n
+        std::vector<int>   tris; // 3 * m, локальные индексы
+        std::vector<int>   seam; // вершины на краю патча (лежат на гранях кирпича)
+    };
+
+    void clear();
+    bool empty() const { return mPatches.empty(); }
+    qint64 memoryBytes() const;
+
+private:
+    friend class NarrowBandSurface;
+
+    int    mDims[3]{};
+    double mSpacing[3]{};
+    double mOrigin[3]{};
+    NarrowBandSurface::Params mParams;
+    std::vector<std::uint64_t> mCellHash; // по блокам маски B^3
+    std::vector<Patch> mPatches;          // по индексу кирпича
+};
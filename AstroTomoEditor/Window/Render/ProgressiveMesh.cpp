@@ -0,0 +1,478 @@
+#include "ProgressiveMesh.h"
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+
+#include <vtkCellArray.h>
+#include <vtkIdList.h>
+#include <vtkNew.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+#include <vtkSMPTools.h>
+
+#include <QDebug>
+#include <QElapsedTimer>
+
+namespace
+{
+    // Симметричная 4x4 квадрика: a2 ab ac ad b2 bc bd c2 cd d2
+    struct Quadric
+    {
+        std::array<double, 10> q{};
+
+        void addPlane(double a, double b, double c, double d, double w)
+        {
+            q[0] += w * a * a; q[1] += w * a * b; q[2] += w * a * c; q[3] += w * a * d;
+            q[4] += w * b * b; q[5] += w * b * c; q[6] += w * b * d;
+            q[7] += w * c * c; q[8] += w * c * d;
+            q[9] += w * d * d;
+        }
+
+        void add(const Quadric& o)
+        {
+            for (int i = 0; i < 10; ++i) q[i] += o.q[i];
+        }
+
+        double eval(const double* p) const
+        {
+            const double x = p[0], y = p[1], z = p[2];
+            return q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x
+                + q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y
+                + q[7] * z * z + 2.0 * q[8] * z
+                + q[9];
+        }
+    };
+
+    // Граница сдвигается только вдоль себя: штраф за уход с перпендикулярной плоскости.
+    constexpr double kBoundaryWeight = 1000.0;
+    // Стягивание, после которого нормаль грани повернулась сильнее ~78°, отклоняется.
+    constexpr double kMinNormalDot = 0.2;
+    // Ниже этого числа треугольников последовательность не продолжаем.
+    constexpr int kMinFaces = 64;
+
+    inline void sub3(const double* a, const double* b, double* r)
+    {
+        r[0] = a[0] - b[0]; r[1] = a[1] - b[1]; r[2] = a[2] - b[2];
+    }
+
+    inline void cross3(const double* a, const double* b, double* r)
+    {
+        r[0] = a[1] * b[2] - a[2] * b[1];
+        r[1] = a[2] * b[0] - a[0] * b[2];
+        r[2] = a[0] * b[1] - a[1] * b[0];
+    }
+
+    inline double dot3(const double* a, const double* b)
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    inline double norm3(const double* a) { return std::sqrt(dot3(a, a)); }
+
+    struct Candidate
+    {
+        double cost = 0.0;
+        int from = -1;
+        int to = -1;
+        unsigned stampFrom = 0;
+        unsigned stampTo = 0;
+
+        bool operator>(const Candidate& o) const { return cost > o.cost; }
+    };
+
+    // Рабочее состояние построения; после Build не нужно.
+    class Builder
+    {
+    public:
+        Builder(const std::vector<double>& pts, std::vector<int> tris)
+            : P(pts), T(std::move(tris))
+        {
+            nv = int(P.size() / 3);
+            nf = int(T.size() / 3);
+        }
+
+        void run(std::vector<int>& triDeath, std::vector<std::pair<int, int>>& collapses, std::vector<int>& liveTris)
+        {
+            triDeath.assign(size_t(nf), INT_MAX);
+            faceAlive.assign(size_t(nf), 1);
+            vertAlive.assign(size_t(nv), 1);
+            stamp.assign(size_t(nv), 0);
+            mark.assign(size_t(nv), 0);
+
+            buildAdjacency();
+            buildQuadrics();
+
+            int alive = nf;
+            liveTris.push_back(alive);
+
+            // стартовые кандидаты: по одному на неориентированное ребро
+            for (int u = 0; u < nv; ++u)
+            {
+                collectNeighbors(u, nbA);
+                for (int w : nbA)
+                    if (u < w) pushEdge(u, w);
+            }
+
+            while (!heap.empty() && alive > kMinFaces)
+            {
+                const Candidate c = heap.top();
+                heap.pop();
+
+                if (!vertAlive[c.from] || !vertAlive[c.to] ||
+                    stamp[c.from] != c.stampFrom || stamp[c.to] != c.stampTo)
+                    continue;
+
+                if (!canCollapse(c.from, c.to))
+                    continue;
+
+                const int step = int(collapses.size());
+                alive -= collapse(c.from, c.to, step, triDeath);
+                collapses.emplace_back(c.from, c.to);
+                liveTris.push_back(alive);
+
+                // квадрика v изменилась: старые кандидаты с v устарели, рёбра v — заново
+                ++stamp[c.to];
+                collectNeighbors(c.to, nbA);
+                for (int w : nbA)
+                    pushEdge(c.to, w);
+            }
+        }
+
+    private:
+        const std::vector<double>& P;
+        std::vector<int> T;
+        int nv = 0, nf = 0;
+
+        std::vector<std::vector<int>> vf;   // вершина -> грани (мёртвые вычищаются лениво)
+        std::vector<Quadric> Q;
+        std::vector<std::uint8_t> boundary;
+        std::vector<std::uint8_t> faceAlive, vertAlive;
+        std::vector<unsigned> stamp;
+        std::vector<unsigned> mark;
+        unsigned markId = 0;
+        std::vector<int> nbA, nbB;
+        std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> heap;
+
+        const double* pt(int v) const { return P.data() + 3 * size_t(v); }
+
+        void buildAdjacency()
+        {
+            std::vector<int> deg(size_t(nv), 0);
+            for (int f = 0; f < nf; ++f)
+                for (int k = 0; k < 3; ++k) ++deg[T[3 * f + k]];
+
+            vf.resize(size_t(nv));
+            for (int v = 0; v < nv; ++v)
+                vf[v].reserve(size_t(deg[v]));
+            for (int f = 0; f < nf; ++f)
+                for (int k = 0; k < 3; ++k) vf[T[3 * f + k]].push_back(f);
+        }
+
+        // число живых граней, содержащих обе вершины
+        int sharedFaces(int u, int v) const
+        {
+            int n = 0;
+            for (int f : vf[u])
+            {
+                if (!faceAlive[f]) continue;
+                const int* t = &T[3 * size_t(f)];
+                if (t[0] == v || t[1] == v || t[2] == v) ++n;
+            }
+            return n;
+        }
+
+        void buildQuadrics()
+        {
+            Q.assign(size_t(nv), Quadric{});
+            boundary.assign(size_t(nv), 0);
+
+            // плоскости граней считаем параллельно, складываем в вершины последовательно
+            std::vector<std::array<double, 5>> planes(static_cast<size_t>(nf));
+            vtkSMPTools::For(0, nf, [&](vtkIdType b, vtkIdType e)
+                {
+                    for (vtkIdType f = b; f < e; ++f)
+                    {
+                        const int* t = &T[3 * size_t(f)];
+                        double e1[3], e2[3], n[3];
+                        sub3(pt(t[1]), pt(t[0]), e1);
+                        sub3(pt(t[2]), pt(t[0]), e2);
+                        cross3(e1, e2, n);
+                        const double len = norm3(n);
+                        auto& pl = planes[size_t(f)];
+                        if (len <= 0.0)
+                        {
+                            pl = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+                            continue;
+                        }
+                        n[0] /= len; n[1] /= len; n[2] /= len;
+                        pl = { n[0], n[1], n[2], -dot3(n, pt(t[0])), 0.5 * len };
+                    }
+                });
+
+            for (int f = 0; f < nf; ++f)
+            {
+                const auto& pl = planes[size_t(f)];
+                if (pl[4] <= 0.0) continue;
+                for (int k = 0; k < 3; ++k)
+                    Q[T[3 * f + k]].addPlane(pl[0], pl[1], pl[2], pl[3], pl[4]);
+            }
+
+            // граничные рёбра: ровно одна грань
+            for (int f = 0; f < nf; ++f)
+            {
+                const auto& pl = planes[size_t(f)];
+                for (int k = 0; k < 3; ++k)
+                {
+                    const int a = T[3 * f + k];
+                    const int b = T[3 * f + (k + 1) % 3];
+                    if (sharedFaces(a, b) != 1)
+                        continue;
+
+                    boundary[a] = boundary[b] = 1;
+                    if (pl[4] <= 0.0) continue;
+
+                    double e[3], bn[3];
+                    sub3(pt(b), pt(a), e);
+                    cross3(e, pl.data(), bn);
+                    const double len = norm3(bn);
+                    if (len <= 0.0) continue;
+                    bn[0] /= len; bn[1] /= len; bn[2] /= len;
+                    const double d = -dot3(bn, pt(a));
+                    const double w = kBoundaryWeight * dot3(e, e);
+                    Q[a].addPlane(bn[0], bn[1], bn[2], d, w);
+                    Q[b].addPlane(bn[0], bn[1], bn[2], d, w);
+                }
+            }
+        }
+
+        void collectNeighbors(int v, std::vector<int>& out)
+        {
+            out.clear();
+            ++markId;
+            for (int f : vf[v])
+            {
+                if (!faceAlive[f]) continue;
+                for (int k = 0; k < 3; ++k)
+                {
+                    const int w = T[3 * size_t(f) + k];
+                    if (w == v || mark[w] == markId) continue;
+                    mark[w] = markId;
+                    out.push_back(w);
+                }
+            }
+        }
+
+        double cost(int from, int to) const
+        {
+            Quadric q = Q[from];
+            q.add(Q[to]);
+            return std::max(0.0, q.eval(pt(to)));
+        }
+
+        void pushEdge(int a, int b)
+        {
+            // граничная вершина не уезжает внутрь
+            const bool abOk = !(boundary[a] && !boundary[b]);
+            const bool baOk = !(boundary[b] && !boundary[a]);
+            if (!abOk && !baOk) return;
+
+            const double cab = abOk ? cost(a, b) : std::numeric_limits<double>::infinity();
+            const double cba = baOk ? cost(b, a) : std::numeric_limits<double>::infinity();
+
+            Candidate c;
+            if (cab <= cba) { c.cost = cab; c.from = a; c.to = b; }
+            else            { c.cost = cba; c.from = b; c.to = a; }
+            c.stampFrom = stamp[c.from];
+            c.stampTo = stamp[c.to];
+            heap.push(c);
+        }
+
+        bool canCollapse(int u, int v)
+        {
+            const int shared = sharedFaces(u, v);
+            if (shared < 1 || shared > 2)
+                return false;
+
+            // две граничные вершины через внутреннее ребро — перемычка
+            if (shared == 2 && boundary[u] && boundary[v])
+                return false;
+
+            // условие звена: общих соседей ровно столько, сколько общих граней
+            collectNeighbors(u, nbA);
+            collectNeighbors(v, nbB);
+            ++markId;
+            for (int w : nbA) mark[w] = markId;
+            int common = 0;
+            for (int w : nbB)
+                if (mark[w] == markId) ++common;
+            if (common != shared)
+                return false;
+
+            // грани u без v не должны перевернуться или выродиться
+            for (int f : vf[u])
+            {
+                if (!faceAlive[f]) continue;
+                const int* t = &T[3 * size_t(f)];
+                if (t[0] == v || t[1] == v || t[2] == v) continue;
+
+                const double* p[3] = { pt(t[0]), pt(t[1]), pt(t[2]) };
+                double e1[3], e2[3], n0[3], n1[3];
+                sub3(p[1], p[0], e1);
+                sub3(p[2], p[0], e2);
+                cross3(e1, e2, n0);
+
+                for (int k = 0; k < 3; ++k)
+                    if (t[k] == u) p[k] = pt(v);
+                sub3(p[1], p[0], e1);
+                sub3(p[2], p[0], e2);
+                cross3(e1, e2, n1);
+
+                const double l0 = norm3(n0), l1 = norm3(n1);
+                if (l1 <= 0.0)
+                    return false;
+                if (l0 > 0.0 && dot3(n0, n1) < kMinNormalDot * l0 * l1)
+                    return false;
+            }
+            return true;
+        }
+
+        // возвращает число выродившихся граней
+        int collapse(int u, int v, int step, std::vector<int>& triDeath)
+        {
+            int removed = 0;
+            for (int f : vf[u])
+            {
+                if (!faceAlive[f]) continue;
+                int* t = &T[3 * size_t(f)];
+                if (t[0] == v || t[1] == v || t[2] == v)
+                {
+                    faceAlive[f] = 0;
+                    triDeath[f] = step;
+                    ++removed;
+                    continue;
+                }
+                for (int k = 0; k < 3; ++k)
+                    if (t[k] == u) t[k] = v;
+                vf[v].push_back(f);
+            }
+
+            vf[u].clear();
+            vf[u].shrink_to_fit();
+            vertAlive[u] = 0;
+            Q[v].add(Q[u]);
+
+            auto& lst = vf[v];
+            lst.erase(std::remove_if(lst.begin(), lst.end(), [&](int f) { return !faceAlive[f]; }), lst.end());
+            return removed;
+        }
+    };
+}
+
+std::shared_ptr<ProgressiveMesh> ProgressiveMesh::Build(vtkPolyData* in)
+{
+    if (!in || !in->GetPoints() || in->GetNumberOfPolys() == 0)
+        return nullptr;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    auto pm = std::make_shared<ProgressiveMesh>();
+    pm->mPointType = in->GetPoints()->GetDataType();
+
+    const vtkIdType nv = in->GetNumberOfPoints();
+    if (nv >= vtkIdType(INT_MAX))
+        return nullptr;
+
+    pm->mPts.resize(size_t(nv) * 3);
+    for (vtkIdType i = 0; i < nv; ++i)
+        in->GetPoint(i, pm->mPts.data() + 3 * i);
+
+    vtkCellArray* polys = in->GetPolys();
+    pm->mTris.reserve(size_t(polys->GetNumberOfCells()) * 3);
+    {
+        vtkNew<vtkIdList> ids;
+        for (vtkIdType c = 0; c < polys->GetNumberOfCells(); ++c)
+        {
+            polys->GetCellAtId(c, ids);
+            if (ids->GetNumberOfIds() != 3)
+                continue;
+            const vtkIdType a = ids->GetId(0), b = ids->GetId(1), d = ids->GetId(2);
+            if (a == b || b == d || a == d)
+                continue;
+            pm->mTris.push_back(int(a));
+            pm->mTris.push_back(int(b));
+            pm->mTris.push_back(int(d));
+        }
+    }
+    if (pm->mTris.empty())
+        return nullptr;
+
+    std::vector<std::pair<int, int>> seq;
+    Builder builder(pm->mPts, pm->mTris);
+    builder.run(pm->mTriDeath, seq, pm->mLiveTris);
+
+    pm->mCollapses.reserve(seq.size());
+    for (const auto& s : seq)
+        pm->mCollapses.push_back({ s.first, s.second });
+
+    qDebug() << "[PM] built:" << pm->fullTriangles() << "->" << pm->minTriangles()
+        << "triangles," << pm->mCollapses.size() << "collapses in" << timer.elapsed() << "ms";
+
+    return pm;
+}
+
+vtkSmartPointer<vtkPolyData> ProgressiveMesh::Extract(vtkIdType targetTriangles) const
+{
+    if (mLiveTris.empty())
+        return nullptr;
+
+    // mLiveTris не возрастает: первый уровень, где треугольников <= target
+    auto it = std::lower_bound(mLiveTris.begin(), mLiveTris.end(), targetTriangles,
+        [](int live, vtkIdType t) { return vtkIdType(live) > t; });
+    const int level = (it == mLiveTris.end()) ? int(mLiveTris.size()) - 1 : int(it - mLiveTris.begin());
+
+    // представитель каждой вершины после level стягиваний:
+    // идём от поздних к ранним, цель стягивания к этому моменту уже разрешена
+    const int nv = int(mPts.size() / 3);
+    std::vector<int> rep(static_cast<size_t>(nv));
+    for (int v = 0; v < nv; ++v) rep[v] = v;
+    for (int s = level - 1; s >= 0; --s)
+        rep[mCollapses[s].from] = rep[mCollapses[s].to];
+
+    const int nf = int(mTris.size() / 3);
+    std::vector<int> remap(size_t(nv), -1);
+    int outPts = 0;
+
+    vtkNew<vtkCellArray> polys;
+    polys->AllocateExact(mLiveTris[level], 3 * vtkIdType(mLiveTris[level]));
+    for (int f = 0; f < nf; ++f)
+    {
+        if (mTriDeath[f] < level)
+            continue;
+        vtkIdType ids[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            const int r = rep[mTris[3 * size_t(f) + k]];
+            if (remap[r] < 0) remap[r] = outPts++;
+            ids[k] = remap[r];
+        }
+        polys->InsertNextCell(3, ids);
+    }
+
+    vtkNew<vtkPoints> points;
+    points->SetDataType(mPointType == 0 ? VTK_FLOAT : mPointType);
+    points->SetNumberOfPoints(outPts);
+    for (int v = 0; v < nv; ++v)
+        if (remap[v] >= 0)
+            points->SetPoint(remap[v], mPts.data() + 3 * size_t(v));
+
+    auto out = vtkSmartPointer<vtkPolyData>::New();
+    out->SetPoints(points);
+    out->SetPolys(polys);
+    return out;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <vtkSmartPointer.h>
+#include <vtkType.h>
+
+class vtkPolyData;
+
+// Прогрессивный меш (Hoppe) по квадрикам (Garland–Heckbert).
+// Build один раз считает всю последовательность стягиваний полурёбер u -> v
+// (v — существующая вершина, координаты не меняются), Extract по ней за O(V+F)
+// собирает меш с любым числом треугольников без повторной децимации.
+class ProgressiveMesh
+{
+public:
+    // in: треугольники с уже слитыми точками (после vtkCleanPolyData).
+    // Прочие ячейки игнорируются. nullptr, если треугольников нет.
+    static std::shared_ptr<ProgressiveMesh> Build(vtkPolyData* in);
+
+    vtkIdType fullTriangles() const { return mLiveTris.empty() ? 0 : mLiveTris.front(); }
+    vtkIdType minTriangles() const { return mLiveTris.empty() ? 0 : mLiveTris.back(); }
+
+    // Меш с наибольшим числом треугольников, не превышающим target
+    // (или самый грубый уровень, если target меньше minTriangles()).
+    vtkSmartPointer<vtkPolyData> Extract(vtkIdType targetTriangles) const;
+
+private:
+    struct Collapse
+    {
+        int from = -1;
+        int to = -1;
+    };
+
+    std::vector<double>   mPts;       // 3 * nv, исходные координаты
+    std::vector<int>      mTris;      // 3 * nf, исходная связность
+    std::vector<int>      mTriDeath;  // шаг, на котором треугольник выродился (INT_MAX — жив всегда)
+    std::vector<Collapse> mCollapses; // порядок стягиваний
+    std::vector<int>      mLiveTris;  // живых треугольников после k стягиваний, size = collapses + 1
+    int                   mPointType = 0; // VTK_FLOAT / VTK_DOUBLE как у входа
+};
@@ -0,0 +1,197 @@
+﻿#include "RenderScheduler.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <QGuiApplication>
+#include <QHash>
+#include <QScreen>
+
+#include <vtkCallbackCommand.h>
+#include <vtkCommand.h>
+#include <vtkRenderWindow.h>
+
+#include <Services/Trace.h>
+
+namespace
+{
+    // конец серии оверлей-запросов — столько мс без новых
+    constexpr int kBurstIdleMs = 150;
+
+    QHash<vtkRenderWindow*, RenderScheduler*>& registry()
+    {
+        static QHash<vtkRenderWindow*, RenderScheduler*> r;
+        return r;
+    }
+}
+
+RenderScheduler::RenderScheduler(QObject* parent)
+    : QObject(parent)
+{
+    mCb = vtkSmartPointer<vtkCallbackCommand>::New();
+    mCb->SetClientData(this);
+    mCb->SetCallback(&RenderScheduler::onEvent);
+
+    mTimer.setSingleShot(true);
+    mTimer.setTimerType(Qt::PreciseTimer);
+    connect(&mTimer, &QTimer::timeout, this, &RenderScheduler::flush);
+
+    mBurstEnd.setSingleShot(true);
+    mBurstEnd.setInterval(kBurstIdleMs);
+    connect(&mBurstEnd, &QTimer::timeout, this, [this]
+        {
+            mOverlayBurst = false;
+            emit overlayBurstChanged(false);
+        });
+
+    mClock.start();
+}
+
+RenderScheduler::~RenderScheduler()
+{
+    setRenderWindow(nullptr);
+}
+
+void RenderScheduler::setRenderWindow(vtkRenderWindow* rw)
+{
+    if (mWindow)
+    {
+        mWindow->RemoveObserver(mCb);
+        registry().remove(mWindow);
+    }
+    mTimer.stop();
+    mWindow = rw;
+    if (mWindow)
+    {
+        mWindow->AddObserver(vtkCommand::StartEvent, mCb);
+        mWindow->AddObserver(vtkCommand::EndEvent, mCb);
+        registry().insert(mWindow, this);
+    }
+}
+
+RenderScheduler* RenderScheduler::of(vtkRenderWindow* rw)
+{
+    return rw ? registry().value(rw, nullptr) : nullptr;
+}
+
+void RenderScheduler::request(vtkRenderWindow* rw, Kind kind)
+{
+    if (auto* s = of(rw))
+        s->requestRender(kind);
+    else if (rw)
+        rw->Render();
+}
+
+void RenderScheduler::requestRender(Kind kind)
+{
+    ++mStats.requests;
+
+    if (kind == Kind::Overlay)
+    {
+        if (!mOverlayBurst)
+        {
+            mOverlayBurst = true;
+            emit overlayBurstChanged(true);
+        }
+        mBurstEnd.start();
+    }
+
+    if (!mWindow || mTimer.isActive())
+        return; // уже запланирован — сольётся
+
+    // не чаще интервала от начала прошлого кадра; медленный кадр сам растягивает паузу,
+    // а события мыши, пришедшие за это время, попадут в один следующий кадр
+    double waitMs = 0.0;
+    if (mLastFrameStartNs >= 0)
+        waitMs = intervalMs() - double(mClock.nsecsElapsed() - mLastFrameStartNs) / 1.0e6;
+    mTimer.start(std::max(0, int(std::ceil(waitMs))));
+}
+
+void RenderScheduler::flush()
+{
+    mTimer.stop();
+    if (!mWindow)
+        return;
+
+    mOwnFrame = true;
+    mWindow->Render();
+    mOwnFrame = false;
+}
+
+void RenderScheduler::setMaxFps(int fps)
+{
+    mMaxFps = std::max(0, fps);
+}
+
+double RenderScheduler::intervalMs() const
+{
+    if (mMaxFps > 0)
+        return 1000.0 / mMaxFps;
+
+    double hz = 60.0;
+    if (auto* screen = QGuiApplication::primaryScreen())
+        if (screen->refreshRate() > 1.0)
+            hz = screen->refreshRate();
+    return 1000.0 / hz;
+}
+
+void RenderScheduler::resetStats()
+{
+    mStats = Stats{};
+    mFpsFrames = 0;
+    mFpsWindowNs = mClock.nsecsElapsed();
+}
+
+void RenderScheduler::onFrame(double ms)
+{
+    ++mStats.frames;
+    if (mOwnFrame)
+        ++mStats.scheduled;
+    mStats.lastMs = ms;
+    mStats.avgMs = (mStats.frames == 1) ? ms : 0.9 * mStats.avgMs + 0.1 * ms;
+    mStats.maxMs = std::max(mStats.maxMs, ms);
+
+    ++mFpsFrames;
+    const qint64 now = mClock.nsecsElapsed();
+    if (now - mFpsWindowNs >= 1000000000LL)
+    {
+        mStats.fps = mFpsFrames * 1.0e9 / double(now - mFpsWindowNs);
+        mFpsFrames = 0;
+        mFpsWindowNs = now;
+    }
+}
+
+void RenderScheduler::onEvent(vtkObject*, unsigned long evId, void* cd, void*)
+{
+    auto* self = static_cast<RenderScheduler*>(cd);
+    if (!self)
+        return;
+
+    switch (evId)
+    {
+    case vtkCommand::StartEvent:
+        // кадр уже идёт — отложенный запрос им и закрывается
+        self->mTimer.stop();
+        self->mFrameStartNs = self->mClock.nsecsElapsed();
+        self->mLastFrameStartNs = self->mFrameStartNs;
+#ifndef ASTRO_NO_TRACE
+        self->mTraceStartNs = Trace::Enabled() ? Trace::NowNs() : -1;
+#endif
+        break;
+
+    case vtkCommand::EndEvent:
+        if (self->mFrameStartNs >= 0)
+            self->onFrame(double(self->mClock.nsecsElapsed() - self->mFrameStartNs) / 1.0e6);
+        self->mFrameStartNs = -1;
+#ifndef ASTRO_NO_TRACE
+        if (self->mTraceStartNs >= 0)
+            Trace::Record("render", self->mOwnFrame ? "frame (scheduled)" : "frame",
+                self->mTraceStartNs, Trace::NowNs());
+        self->mTraceStartNs = -1;
+#endif
+        break;
+
+    default:
+        break;
+    }
+}
@@ -0,0 +1,81 @@
+﻿#pragma once
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <vtkSmartPointer.h>
+
+class vtkCallbackCommand;
+class vtkObject;
+class vtkRenderWindow;
+
+// Планировщик перерисовок окна VTK.
+// Запросы с событий мыши не рисуют синхронно, а сливаются в один кадр не чаще заданной
+// частоты (по умолчанию — частота экрана). Любой Render окна, кем бы он ни был вызван,
+// закрывает отложенный запрос. Серия запросов «только оверлей» (ховер, маркеры) отмечается
+// сигналом overlayBurstChanged: на это время RenderView разрешает LOD-прокси объёма.
+class RenderScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    enum class Kind { Full, Overlay };
+
+    struct Stats
+    {
+        quint64 requests = 0;  // запросов через планировщик
+        quint64 scheduled = 0; // кадров, нарисованных планировщиком
+        quint64 frames = 0;    // всех кадров окна
+        double lastMs = 0.0;
+        double avgMs = 0.0;    // сглаженное
+        double maxMs = 0.0;
+        double fps = 0.0;      // за последнюю секунду
+    };
+
+    explicit RenderScheduler(QObject* parent = nullptr);
+    ~RenderScheduler() override;
+
+    void setRenderWindow(vtkRenderWindow* rw);
+
+    // Планировщик окна rw, если он есть.
+    static RenderScheduler* of(vtkRenderWindow* rw);
+    // Запрос через планировщик окна; без планировщика — синхронный Render, как раньше.
+    static void request(vtkRenderWindow* rw, Kind kind = Kind::Full);
+
+    void requestRender(Kind kind = Kind::Full);
+    // Отложенный запрос — сразу (конец операции, снимок окна).
+    void flush();
+
+    // 0 — по частоте экрана.
+    void setMaxFps(int fps);
+    int maxFps() const { return mMaxFps; }
+
+    const Stats& stats() const { return mStats; }
+    void resetStats();
+
+signals:
+    void overlayBurstChanged(bool active);
+
+private:
+    static void onEvent(vtkObject* caller, unsigned long evId, void* cd, void*);
+
+    double intervalMs() const;
+    void onFrame(double ms);
+
+private:
+    vtkSmartPointer<vtkRenderWindow> mWindow;
+    vtkSmartPointer<vtkCallbackCommand> mCb;
+
+    QTimer mTimer;
+    QTimer mBurstEnd;
+    bool mOverlayBurst = false;
+    bool mOwnFrame = false;
+
+    int mMaxFps = 0;
+    QElapsedTimer mClock;
+    qint64 mFrameStartNs = -1;
+    qint64 mLastFrameStartNs = -1;
+    qint64 mTraceStartNs = -1;    // часы Trace, -1 — трассировка выключена
+    qint64 mFpsWindowNs = 0;
+    int mFpsFrames = 0;
+    Stats mStats;
+};
@@ -2,6 +2,7 @@
 #include <QVTKOpenGLNativeWidget.h>
 #include <vtkRenderer.h>
 #include <vtkRenderWindow.h>
+#include <vtkCallbackCommand.h>
 #include <vtkSmartVolumeMapper.h>
 #include <vtkVolume.h>
 #include <vtkVolumeProperty.h>
@@ -9,7 +10,6 @@
 #include <vtkPiecewiseFunction.h>
 #include <vtkCamera.h>
 #include <vtkImageData.h>
-#include <vtkGPUVolumeRayCastMapper.h>
 #include <vtkPointData.h>
 #include <vtkDataArray.h> 
 #include <vtkAutoInit.h>
@@ -34,9 +34,9 @@
 #include <vtkActor.h>
 #include <vtkProperty.h>
 #include <vtkPolyDataNormals.h>
-#include <vtkCellLocator.h>
 #include <vtkCell.h>
 #include <Services/DicomRange.h>
+#include <Services/MemoryRegistry.h>
 #include <QTimer>
 #include <QLineEdit>
 #include <vtkFlyingEdges3D.h>
@@ -448,22 +448,21 @@ namespace
     }
 
     bool closestSurfaceNormal(
-        vtkPolyData* surface,
-        vtkCellLocator* locator,
+        const SurfaceLocator& locator,
         const ContourPoint& pointWorld,
         double normal[3])
     {
-        if (!surface || !locator || !normal)
+        vtkPolyData* surface = locator.mesh();
+        if (!surface || !normal)
             return false;
 
-        double closest[3]{ 0.0, 0.0, 0.0 };
-        double dist2 = std::numeric_limits<double>::max();
-        vtkIdType cellId = -1;
-        int subId = 0;
-        locator->FindClosestPoint(pointWorld.data(), closest, cellId, subId, dist2);
-        if (cellId < 0)
+        SurfaceLocator::Hit hit;
+        if (!locator.closestPoint(pointWorld.data(), hit))
             return false;
 
+        const vtkIdType cellId = hit.cellId;
+        const double* closest = hit.point.data();
+
         vtkCell* cell = surface->GetCell(cellId);
         if (!cell || cell->GetNumberOfPoints() < 3)
             return false;
@@ -511,13 +510,15 @@ static vtkMatrix3x3* fetchDirectionMatrix(vtkImageData* img, vtkNew<vtkMatrix3x3
     return holder.GetPointer();
 }
 
-static vtkSmartPointer<vtkPolyData> clonePolyData(vtkPolyData* src)
+// STL-меши на месте не меняются (каждая правка строит новый), поэтому копии
+// для истории и «сохраняемого» меша делят массивы с исходником.
+static vtkSmartPointer<vtkPolyData> sharePolyData(vtkPolyData* src)
 {
     if (!src)
         return nullptr;
 
     auto out = vtkSmartPointer<vtkPolyData>::New();
-    out->DeepCopy(src);
+    out->ShallowCopy(src);
     return out;
 }
 
@@ -587,6 +588,7 @@ static void applyMenuStyle(QMenu* m, int width = 180)
 RenderView::RenderView(QWidget* parent) : QWidget(parent)
 {
     mStlModeController.setHistoryLimit(mHistoryLimit);
+    mStlModeController.setHistoryByteLimit(mStlHistoryBytes);
 
     auto* lay = new QVBoxLayout(this);
     lay->setContentsMargins(0, 0, 0, 0);
@@ -636,6 +638,16 @@ RenderView::RenderView(QWidget* parent) : QWidget(parent)
     repositionOverlay();
 
     mClip = std::make_unique<ClipBoxController>(this);
+    mLod = std::make_unique<VolumeLodController>(this);
+    mLod->setRenderWindow(mWindow);
+    mLod->setInteractor(mVtk->interactor());
+    mScheduler = std::make_unique<RenderScheduler>(this);
+    mScheduler->setRenderWindow(mWindow);
+    connect(mScheduler.get(), &RenderScheduler::overlayBurstChanged, this, [this](bool on)
+        {
+            if (mLod && mLod->setTransient(on))
+                mScheduler->requestRender();
+        });
     mClip->setRenderer(mRenderer);
     mClip->setInteractor(mVtk->interactor());
     connect(mClip.get(), &ClipBoxController::clippingChanged,
@@ -652,9 +664,15 @@ RenderView::RenderView(QWidget* parent) : QWidget(parent)
     connect(mBtnSTLSave, &QToolButton::clicked, this, &RenderView::onSaveBuiltStl);
 
     loadRenderSettings();
+    mLod->setFrameTimeTargetMs(mFrameTargetMs);
+    mScheduler->setMaxFps(mMaxFps);
+
+    registerMemorySources();
 }
 
 RenderView::~RenderView() {
+    for (int id : mMemorySources)
+        MemoryRegistry::instance().removeSource(id);
     if (mScissors) { mScissors->setOnFinished(nullptr); }
     if (mContour) { mContour->setOnFinished(nullptr); }
     if (mRemoveConn) { mRemoveConn->setOnFinished(nullptr); }
@@ -665,6 +683,68 @@ RenderView::~RenderView() {
     mContour.reset();
     mRemoveConn.reset();
     clearStlPreview();
+    if (mProbeTag && mVtk && mVtk->renderWindow())
+        mVtk->renderWindow()->RemoveObserver(mProbeTag);
+}
+
+static qint64 imageBytes(vtkImageData* im)
+{
+    return im ? qint64(im->GetActualMemorySize()) * 1024 : 0;
+}
+
+void RenderView::registerMemorySources()
+{
+    auto& reg = MemoryRegistry::instance();
+
+    // Снимки истории — полные копии тома: при нехватке памяти режем самые старые,
+    // сначала redo, потом undo (последний шаг назад держим до конца).
+    mMemorySources << reg.addSource("render.undo", tr("Volume undo/redo"),
+        [this] {
+            qint64 total = 0;
+            for (const auto& im : mUndoStack) total += imageBytes(im);
+            for (const auto& im : mRedoStack) total += imageBytes(im);
+            return total;
+        },
+        [this](qint64 want) {
+            qint64 freed = 0;
+            while (freed < want && !mRedoStack.isEmpty())
+                freed += imageBytes(mRedoStack.takeFirst());
+            while (freed < want && mUndoStack.size() > 1)
+                freed += imageBytes(mUndoStack.takeFirst());
+            if (freed > 0)
+                updateUndoRedoUi();
+            return freed;
+        }, 30);
+
+    mMemorySources << reg.addSource("render.stlHistory", tr("Surface undo/redo"),
+        [this] { return mStlModeController.historyBytes(); },
+        [this](qint64 want) {
+            const qint64 cur = mStlModeController.historyBytes();
+            const qint64 freed = mStlModeController.trimHistory(std::max<qint64>(0, cur - want));
+            if (freed > 0) {
+                trimStlSideHistory();
+                updateUndoRedoUi();
+            }
+            return freed;
+        }, 40);
+
+    // кэш кирпичей только ускоряет пересборку STL — сбрасывается первым и целиком
+    mMemorySources << reg.addSource("render.stlBricks", tr("Surface brick cache"),
+        [this] { return mStlBrickCache.memoryBytes(); },
+        [this](qint64) {
+            const qint64 freed = mStlBrickCache.memoryBytes();
+            mStlBrickCache.clear();
+            return freed;
+        }, 10);
+
+    mMemorySources << reg.addSource("render.volume", tr("Volume and visibility mask"),
+        [this] { return imageBytes(mImage) + imageBytes(mVisibleMask); });
+
+    mMemorySources << reg.addSource("render.templates", tr("Templates"),
+        [this] { return mTemplateDlg ? mTemplateDlg->memoryBytes() : qint64(0); });
+
+    mMemorySources << reg.addSource("render.tools", tr("Tool masks"),
+        [this] { return mRemoveConn ? mRemoveConn->workingBytes() : qint64(0); });
 }
 
 static QWidget* makeNativeOverlay(QWidget* owner)
@@ -872,6 +952,18 @@ void RenderView::buildOverlay()
                 mElectrodePanel->beginPick(id);
         });
 
+    // вырезы под электродами правят mImage на месте — гистограмма учитывает только их регион
+    connect(mElectrodePanel, &ElectrodePanel::regionEditStarted, this,
+        [this](std::array<int, 3> lo, std::array<int, 3> hi)
+        {
+            mHistogram.beginRegionEdit(mImage, lo.data(), hi.data());
+        });
+    connect(mElectrodePanel, &ElectrodePanel::regionEditFinished, this,
+        [this](std::array<int, 3> lo, std::array<int, 3> hi)
+        {
+            mHistogram.endRegionEdit(mImage, lo.data(), hi.data());
+        });
+
     connect(mElectrodePanel, &ElectrodePanel::pickCommitted, this,
         [this](ElectrodePanel::ElectrodeId id, std::array<int, 3> ijk, std::array<double, 3> w)
         {
@@ -1013,6 +1105,18 @@ void RenderView::buildOverlay()
             mVtk->renderWindow()->Render();
         });
 
+    connect(mElectrodePanel, &ElectrodePanel::searchAllRequested, this, [this]()
+        {
+            if (!mElectrodePanel || !mRenderer || !mVtk || !mVtk->renderWindow())
+                return;
+
+            // разметка без промежуточных рендеров, камера ставится один раз в конце
+            setViewPreset(ViewPreset::AP);
+            ElectrodeAutoIdentifier::SearchAll(mElectrodePanel, mRenderer, DI);
+            mElectrodePanel->refreshSearchButtons();
+            mVtk->renderWindow()->Render();
+        });
+
     connect(mElectrodePanel, &ElectrodePanel::electrodeAltRightClicked, this,
         [this](std::array<double, 3> world)
         {
@@ -1318,25 +1422,17 @@ void RenderView::captureElectrodesTemplateFromCurrentVolume()
     if (!mTemplateDlg->isCaptured(TemplateId::Electrodes))
     {
 
-        // Делаем КОПИЮ, чтобы не портить текущий volume/рендер.
-        Volume vol;
-        vol.clear();
-        vol.copy(mImage);
-        if (!vol.raw() || !vol.u8().valid)
-            return;
+        // Порог применяется при кодировании: копия всего тома не нужна.
+        SparseLabelVolume::Lut lut{};
+        for (int v = HistMax - 1; v < 256; ++v)
+            lut[v] = uint8_t(HistMax - 1);
 
-        const size_t total = vol.u8().size();
-        for (size_t i = 0; i < total; ++i)
-        {
-            const uint8_t v = vol.at(i);
-            if (v < HistMax - 1)
-                vol.at(i) = 0;
-            else
-                vol.at(i) = HistMax - 1;
-        }
+        SparseLabelVolume layer;
+        if (!layer.encode(mImage, &lut))
+            return;
 
         // Сохраняем в слот Electrodes. Диалог сам обновит UI.
-        mTemplateDlg->setCaptured(TemplateId::Electrodes, vol);
+        mTemplateDlg->setCaptured(TemplateId::Electrodes, std::move(layer));
     }
 }
 
@@ -1356,8 +1452,8 @@ void RenderView::beginElectrodesPreview()
     if (!mTemplateDlg->isCaptured(TemplateId::Electrodes))
         captureElectrodesTemplateFromCurrentVolume();
 
-    const auto* s = mTemplateDlg->slot(TemplateId::Electrodes);
-    if (!s || !s->hasData())
+    const SparseLabelVolume* layer = mTemplateDlg->layer(TemplateId::Electrodes);
+    if (!layer)
         return;
 
     // Запоминаем текущий volume и делаем «картинку для просмотра».
@@ -1375,7 +1471,8 @@ void RenderView::beginElectrodesPreview()
 
 
 
-    Volume templ = s->data;
+    Volume templ;
+    templ.set(layer->expand());
     if (!templ.raw() || !templ.u8().valid)
         return;
 
@@ -1392,6 +1489,9 @@ void RenderView::beginElectrodesPreview()
     {
         mRemoveConn->AddBy6Neighbors(templ, HistMax - 1);
     }
+    // слот хранит расширенный шаблон, как и раньше
+    if (auto* s = mTemplateDlg->slot(TemplateId::Electrodes))
+        s->data.encode(templ.raw());
 
     total = std::min(volPreview.u8().size(), templ.u8().size());
     for (size_t i = 0; i < total; ++i)
@@ -1640,12 +1740,10 @@ void RenderView::onTemplateCapture(TemplateId id)
 
     qDebug() << (int)mLastTemplateForStl;
 
-    Volume m_vol;
-    m_vol.clear();
-    m_vol.copy(mImage);
-    if (!m_vol.raw()) return;
+    SparseLabelVolume layer;
+    if (!layer.encode(mImage)) return;
 
-    mTemplateDlg->setCaptured(id, m_vol);
+    mTemplateDlg->setCaptured(id, std::move(layer));
 }
 
 QString getParentPath(const QString& path)
@@ -1726,46 +1824,28 @@ void RenderView::onTemplateSetVisible(TemplateId id, bool on)
 
 void RenderView::applyTemplateLayer(TemplateId id, bool visible)
 {
-    Volume m_vol;
-    m_vol.clear();
-    m_vol.copy(mImage);
-    if (!m_vol.raw()) return;
+    if (!mImage || !mTemplateDlg) return;
 
-    const auto* s = mTemplateDlg->slot(id);
-    Volume m_Template;
-    m_Template.clear();
-    m_Template = s->data;
-    if (!m_Template.raw()) return;
-
-    const auto& S = m_vol.u8();
-    const int* ext = S.ext;
-    const int nx = S.nx;
-    const int ny = S.ny;
-    const int nz = S.nz;
-    const size_t total = static_cast<size_t>(nx) * ny * nz;
-
-    for (size_t i = 0; i < total; i++)
-    {
-       if (visible)
-        {
-            if (m_Template.at(i))
-                m_vol.at(i) = m_Template.at(i);
-        }
-        else
-        {
-            if (m_Template.at(i))
-                m_vol.at(i) = 0u;
-        }
-    }
+    const SparseLabelVolume* layer = mTemplateDlg->layer(id);
+    if (!layer || !layer->matches(mImage)) return;
 
-    if (m_vol.raw())
-        m_vol.raw()->Modified();
+    // Правка на месте по кирпичам слоя; в undo уходит единственная копия тома.
+    pushImageUndoSnapshot();
 
+    int lo[3], hi[3];
+    const bool any = layer->bounds(lo, hi);
+    if (any)
+        mHistogram.beginRegionEdit(mImage, lo, hi);
 
-    if (mVtk && mVtk->renderWindow()) 
-        mVtk->renderWindow()->Render();
+    if (visible)
+        layer->paintInto(mImage);
+    else
+        layer->eraseFrom(mImage);
 
-    commitNewImage(m_vol.raw());
+    mImage->Modified();
+    if (any)
+        mHistogram.endRegionEdit(mImage, lo, hi);
+    updateAfterImageChange(true);
 }
 
 void RenderView::onTemplateClear(TemplateId id)
@@ -1829,7 +1909,7 @@ void RenderView::reloadHistogram()
 
     if (!mHistDlg) {
 
-        mHistDlg = new HistogramDialog(this, DI, mImage);
+        mHistDlg = new HistogramDialog(this, DI, mImage, &mHistogram);
         mHistDlg->setFixedAxis(true, DI.RealMin, DI.RealMax);
 
         // 1) при первом открытии — снять копии базовых функций
@@ -1905,13 +1985,14 @@ void RenderView::setMapperInput(vtkImageData* im)
         sc->Modified();
     im->Modified();
 
-    if (auto* gm = vtkGPUVolumeRayCastMapper::SafeDownCast(mVolume->GetMapper()))
-        gm->SetInputData(im);
-    else
-        mVolume->GetMapper()->SetInputDataObject(im);
+    auto* mapper = mLod ? mLod->fullMapper() : mVolume->GetMapper();
+    VolumeRenderBackend::setInput(mapper, im);
 
-    mVolume->GetMapper()->Modified();
+    mapper->Modified();
     mVolume->Modified();
+
+    if (mLod)
+        mLod->imageChanged(im);
 }
 
 void RenderView::updateUndoRedoUi()
@@ -2204,16 +2285,22 @@ void RenderView::updateAfterImageChange(bool reattachTools)
         mVtk->renderWindow()->Render();
 }
 
+void RenderView::pushImageUndoSnapshot()
+{
+    // текущий том → в undo (глубокая копия), очистить redo
+    if (!mImage)
+        return;
+
+    mUndoStack.push_back(cloneImage(mImage));
+    while (mUndoStack.size() > mHistoryLimit)
+        mUndoStack.pop_front();
+    mRedoStack.clear();
+}
+
 void RenderView::commitNewImage(vtkImageData* im)
 {
-    // 1) текущий том → в undo (глубокая копия), очистить redo
-    if (mImage)
-    {
-        mUndoStack.push_back(cloneImage(mImage));
-        while (mUndoStack.size() > mHistoryLimit)
-            mUndoStack.pop_front();
-        mRedoStack.clear();
-    }
+    // 1) текущий том → в undo
+    pushImageUndoSnapshot();
 
     // 2) принять новый том (возможно им владеет инструмент)
     if (im)
@@ -2228,23 +2315,29 @@ void RenderView::pushStlUndoSnapshot()
     if (!mIsoMesh)
         return;
 
-    mStlModeController.pushSurfaceUndoState(clonePolyData(mIsoMesh));
-
-    mStlSaveUndoStack.push_back(clonePolyData(mStlSaveMesh ? mStlSaveMesh.GetPointer() : mIsoMesh.GetPointer()));
-    while (mStlSaveUndoStack.size() > mHistoryLimit)
-        mStlSaveUndoStack.pop_front();
+    mStlModeController.pushSurfaceUndoState(mIsoMesh, mStlSaveMesh);
 
     mStlStepUndoStack.push_back(mCurrentStlStep);
-    while (mStlStepUndoStack.size() > mHistoryLimit)
-        mStlStepUndoStack.pop_front();
-
     mContourVisibleUndoStack.push_back(mVisibleContoursNow);
-    while (mContourVisibleUndoStack.size() > mHistoryLimit)
-        mContourVisibleUndoStack.pop_front();
 
     mStlStepRedoStack.clear();
-    mStlSaveRedoStack.clear();
     mContourVisibleRedoStack.clear();
+    trimStlSideHistory();
+}
+
+void RenderView::trimStlSideHistory()
+{
+    // История поверхностей режется по байтам — шаги и контуры держим той же глубины.
+    const int undoDepth = mStlModeController.undoDepth();
+    const int redoDepth = mStlModeController.redoDepth();
+    while (mStlStepUndoStack.size() > undoDepth)
+        mStlStepUndoStack.pop_front();
+    while (mContourVisibleUndoStack.size() > undoDepth)
+        mContourVisibleUndoStack.pop_front();
+    while (mStlStepRedoStack.size() > redoDepth)
+        mStlStepRedoStack.pop_front();
+    while (mContourVisibleRedoStack.size() > redoDepth)
+        mContourVisibleRedoStack.pop_front();
 }
 
 void RenderView::resetStlContourHistory()
@@ -2252,8 +2345,6 @@ void RenderView::resetStlContourHistory()
     mCurrentStlStep = 0;
     mStlStepUndoStack.clear();
     mStlStepRedoStack.clear();
-    mStlSaveUndoStack.clear();
-    mStlSaveRedoStack.clear();
     mContourVisibleUndoStack.clear();
     mContourVisibleRedoStack.clear();
     mSavedContours.clear();
@@ -2267,7 +2358,7 @@ void RenderView::applyNewStlSurface(vtkPolyData* poly)
         return;
 
     pushStlUndoSnapshot();
-    mIsoMesh = clonePolyData(poly);
+    mIsoMesh = sharePolyData(poly);
     ++mCurrentStlStep;
     rebuildContourOverlay();
 }
@@ -2310,45 +2401,35 @@ void RenderView::addSavedContours(const QVector<QVector<std::array<double, 3>>>&
         addSavedContour(contour);
 }
 
+const SurfaceLocator* RenderView::isoSurfaceLocator() const
+{
+    return mIsoLocator.sync(mIsoMesh) ? &mIsoLocator : nullptr;
+}
+
+bool RenderView::contourAttachedToSurface(const QVector<std::array<double, 3>>& contourPointsWorld) const
+{
+    const SurfaceLocator* locator = isoSurfaceLocator();
+    if (!locator || contourPointsWorld.size() < 3)
+        return false;
+
+    constexpr double kMaxAttachDistanceMm = 1.5;
+    return locator->allWithin(contourPointsWorld.constData(), size_t(contourPointsWorld.size()),
+        kMaxAttachDistanceMm * kMaxAttachDistanceMm);
+}
+
 void RenderView::keepOnlyContoursAttachedToCurrentSurface()
 {
     if (!mIsoMesh || mIsoMesh->GetNumberOfCells() == 0 || mVisibleContoursNow.isEmpty())
         return;
 
-    vtkNew<vtkCellLocator> surfaceLocator;
-    surfaceLocator->SetDataSet(mIsoMesh);
-    surfaceLocator->BuildLocator();
-
     QSet<int> validContours;
-    constexpr double kMaxAttachDistanceMm = 1.5;
-    const double maxDist2 = kMaxAttachDistanceMm * kMaxAttachDistanceMm;
-
     for (const int contourNumber : mVisibleContoursNow)
     {
         const int contourIndex = contourNumber - 1;
         if (contourIndex < 0 || contourIndex >= mSavedContours.size())
             continue;
 
-        const auto points = storedContourWorldPoints(mSavedContours[contourIndex]);
-        if (points.size() < 3)
-            continue;
-
-        bool isAttached = true;
-        for (const auto& p : points)
-        {
-            double closest[3]{};
-            double dist2 = std::numeric_limits<double>::max();
-            vtkIdType cellId = -1;
-            int subId = 0;
-            surfaceLocator->FindClosestPoint(p.data(), closest, cellId, subId, dist2);
-            if (cellId < 0 || dist2 > maxDist2)
-            {
-                isAttached = false;
-                break;
-            }
-        }
-
-        if (isAttached)
+        if (contourAttachedToSurface(storedContourWorldPoints(mSavedContours[contourIndex])))
             validContours.insert(contourNumber);
     }
 
@@ -2396,12 +2477,13 @@ void RenderView::rebuildContourOverlay()
     if (mSavedContours.isEmpty() || mVisibleContoursNow.isEmpty())
         return;
 
-    vtkNew<vtkCellLocator> surfaceLocator;
-    surfaceLocator->SetDataSet(mIsoMesh);
-    surfaceLocator->BuildLocator();
+    const SurfaceLocator* surfaceLocator = isoSurfaceLocator();
+    if (!surfaceLocator)
+        return;
 
     vtkNew<vtkPoints> points;
     vtkNew<vtkCellArray> lines;
+    std::vector<SurfaceLocator::Hit> hits;
 
     for (const int contourNumber : mVisibleContoursNow)
     {
@@ -2420,19 +2502,16 @@ void RenderView::rebuildContourOverlay()
         constexpr double kMaxAttachDistanceMm = 1.5;
         const double maxDist2 = kMaxAttachDistanceMm * kMaxAttachDistanceMm;
 
-        for (const auto& p : contourPoints)
+        hits.resize(size_t(pointCount));
+        surfaceLocator->closestPoints(contourPoints.constData(), hits.size(), hits.data());
+        for (const auto& hit : hits)
         {
-            double closest[3]{ 0.0, 0.0, 0.0 };
-            double dist2 = std::numeric_limits<double>::max();
-            vtkIdType cellId = -1;
-            int subId = 0;
-            surfaceLocator->FindClosestPoint(p.data(), closest, cellId, subId, dist2);
-            if (cellId < 0 || dist2 > maxDist2)
+            if (hit.cellId < 0 || hit.dist2 > maxDist2)
             {
                 contourStillOnSurface = false;
                 break;
             }
-            snappedPoints.push_back({ closest[0], closest[1], closest[2] });
+            snappedPoints.push_back(hit.point);
         }
 
         if (!contourStillOnSurface || snappedPoints.size() < 3)
@@ -2533,42 +2612,18 @@ StoredContourInfo RenderView::makeStoredContour(
     header.nContourPoint = static_cast<quint32>(fittedPoints.size());
     header.TotalDataSize = header.HeaderSize + header.nContourPoint * header.StoredContourPointSize;
 
-    vtkNew<vtkCellLocator> currentSurfaceLocator;
-    vtkPolyData* currentSurface = mIsoMesh.GetPointer();
-    if (currentSurface && currentSurface->GetNumberOfCells() > 0)
-    {
-        currentSurfaceLocator->SetDataSet(currentSurface);
-        currentSurfaceLocator->BuildLocator();
-    }
-    else
-    {
-        currentSurface = nullptr;
-    }
-
-    vtkNew<vtkCellLocator> normalSurfaceLocator;
-    vtkPolyData* normalSurface = mStlSaveMesh.GetPointer();
-    if (!normalSurface || normalSurface->GetNumberOfCells() == 0)
-        normalSurface = currentSurface;
+    // точки на текущую поверхность — одной параллельной пачкой
+    std::vector<SurfaceLocator::Hit> onSurface(size_t(fittedPoints.size()));
+    if (const SurfaceLocator* currentLocator = isoSurfaceLocator())
+        currentLocator->closestPoints(fittedPoints.constData(), onSurface.size(), onSurface.data());
 
-    if (normalSurface && normalSurface->GetNumberOfCells() > 0)
-    {
-        normalSurfaceLocator->SetDataSet(normalSurface);
-        normalSurfaceLocator->BuildLocator();
-    }
+    const SurfaceLocator* normalLocator = mStlSaveLocator.sync(mStlSaveMesh) ? &mStlSaveLocator : isoSurfaceLocator();
 
     for (int i = 0; i < fittedPoints.size(); ++i)
     {
         ContourPoint worldPointOnSurface = fittedPoints[i];
-        if (currentSurface)
-        {
-            double closest[3]{};
-            double dist2 = std::numeric_limits<double>::max();
-            vtkIdType cellId = -1;
-            int subId = 0;
-            currentSurfaceLocator->FindClosestPoint(fittedPoints[i].data(), closest, cellId, subId, dist2);
-            if (cellId >= 0)
-                worldPointOnSurface = { closest[0], closest[1], closest[2] };
-        }
+        if (onSurface[size_t(i)].cellId >= 0)
+            worldPointOnSurface = onSurface[size_t(i)].point;
 
         const auto savedPoint = worldToSavedStlCoords(worldPointOnSurface);
 
@@ -2581,7 +2636,7 @@ StoredContourInfo RenderView::makeStoredContour(
         ContourPoint viewPointAboveNormal2 = viewPointOnSurface;
 
         double normal[3]{ 0.0, 0.0, 0.0 };
-        if (closestSurfaceNormal(normalSurface, normalSurfaceLocator.GetPointer(), worldPointOnSurface, normal))
+        if (normalLocator && closestSurfaceNormal(*normalLocator, worldPointOnSurface, normal))
         {
             const ContourPoint worldAboveNormal{
                 worldPointOnSurface[0] + normal[0] * kContourNormalOffsetMm,
@@ -2636,39 +2691,14 @@ bool RenderView::saveContoursSidecar(const QString& stlPath) const
     QSet<int> contoursToSave = mVisibleContoursNow;
     if (!contoursToSave.isEmpty() && mIsoMesh && mIsoMesh->GetNumberOfCells() > 0)
     {
-        vtkNew<vtkCellLocator> surfaceLocator;
-        surfaceLocator->SetDataSet(mIsoMesh);
-        surfaceLocator->BuildLocator();
-
         QSet<int> stillVisibleOnCurrentSurface;
-        constexpr double kMaxAttachDistanceMm = 1.5;
-        const double maxDist2 = kMaxAttachDistanceMm * kMaxAttachDistanceMm;
         for (const int contourNumber : contoursToSave)
         {
             const int contourIndex = contourNumber - 1;
             if (contourIndex < 0 || contourIndex >= mSavedContours.size())
                 continue;
 
-            const auto points = storedContourWorldPoints(mSavedContours[contourIndex]);
-            if (points.size() < 3)
-                continue;
-
-            bool isOnSurface = true;
-            for (const auto& p : points)
-            {
-                double closest[3]{};
-                double dist2 = std::numeric_limits<double>::max();
-                vtkIdType cellId = -1;
-                int subId = 0;
-                surfaceLocator->FindClosestPoint(p.data(), closest, cellId, subId, dist2);
-                if (cellId < 0 || dist2 > maxDist2)
-                {
-                    isOnSurface = false;
-                    break;
-                }
-            }
-
-            if (isOnSurface)
+            if (contourAttachedToSurface(storedContourWorldPoints(mSavedContours[contourIndex])))
                 stillVisibleOnCurrentSurface.insert(contourNumber);
         }
 
@@ -2760,15 +2790,11 @@ void RenderView::onUndo()
         if (!mIsoMesh)
             return;
 
-        auto prevSurface = mStlModeController.undoSurface(mIsoMesh);
-        if (!prevSurface)
+        vtkSmartPointer<vtkPolyData> prevSurface, prevSave;
+        if (!mStlModeController.undoSurface(mIsoMesh, mStlSaveMesh, prevSurface, prevSave))
             return;
 
-        mStlSaveRedoStack.push_back(clonePolyData(mStlSaveMesh ? mStlSaveMesh.GetPointer() : mIsoMesh.GetPointer()));
-        while (mStlSaveRedoStack.size() > mHistoryLimit)
-            mStlSaveRedoStack.pop_front();
-        if (!mStlSaveUndoStack.isEmpty())
-            mStlSaveMesh = mStlSaveUndoStack.takeLast();
+        mStlSaveMesh = prevSave;
 
         mStlStepRedoStack.push_back(mCurrentStlStep);
         if (!mStlStepUndoStack.isEmpty())
@@ -2777,6 +2803,7 @@ void RenderView::onUndo()
         mContourVisibleRedoStack.push_back(mVisibleContoursNow);
         if (!mContourVisibleUndoStack.isEmpty())
             mVisibleContoursNow = mContourVisibleUndoStack.takeLast();
+        trimStlSideHistory();
 
         mIsoMesh = prevSurface;
         addStlPreview();
@@ -2784,7 +2811,7 @@ void RenderView::onUndo()
         updateUndoRedoUi();
 
         if (mContour)
-            mContour->attach(mVtk, mRenderer, mIsoMesh, mIsoActor);
+            mContour->attach(mVtk, mRenderer, mIsoMesh, mIsoActor, &mIsoLocator);
         if (mScissors)
             mScissors->attachSurface(mVtk, mRenderer, mIsoMesh, mIsoActor);
         rebuildContourOverlay();
@@ -2812,15 +2839,11 @@ void RenderView::onRedo()
         if (!mIsoMesh)
             return;
 
-        auto nextSurface = mStlModeController.redoSurface(mIsoMesh);
-        if (!nextSurface)
+        vtkSmartPointer<vtkPolyData> nextSurface, nextSave;
+        if (!mStlModeController.redoSurface(mIsoMesh, mStlSaveMesh, nextSurface, nextSave))
             return;
 
-        mStlSaveUndoStack.push_back(clonePolyData(mStlSaveMesh ? mStlSaveMesh.GetPointer() : mIsoMesh.GetPointer()));
-        while (mStlSaveUndoStack.size() > mHistoryLimit)
-            mStlSaveUndoStack.pop_front();
-        if (!mStlSaveRedoStack.isEmpty())
-            mStlSaveMesh = mStlSaveRedoStack.takeLast();
+        mStlSaveMesh = nextSave;
 
         mStlStepUndoStack.push_back(mCurrentStlStep);
         if (!mStlStepRedoStack.isEmpty())
@@ -2829,6 +2852,7 @@ void RenderView::onRedo()
         mContourVisibleUndoStack.push_back(mVisibleContoursNow);
         if (!mContourVisibleRedoStack.isEmpty())
             mVisibleContoursNow = mContourVisibleRedoStack.takeLast();
+        trimStlSideHistory();
 
         mIsoMesh = nextSurface;
         addStlPreview();
@@ -2836,7 +2860,7 @@ void RenderView::onRedo()
         updateUndoRedoUi();
 
         if (mContour)
-            mContour->attach(mVtk, mRenderer, mIsoMesh, mIsoActor);
+            mContour->attach(mVtk, mRenderer, mIsoMesh, mIsoActor, &mIsoLocator);
         if (mScissors)
             mScissors->attachSurface(mVtk, mRenderer, mIsoMesh, mIsoActor);
         rebuildContourOverlay();
@@ -2907,7 +2931,9 @@ bool RenderView::rebuildStlFromEditedImage(vtkImageData* editedImage)
         return false;
 
     rebuildVisibleMaskFromImage(editedImage);
-    auto nextMesh = VolumeStlExporter::BuildFromBinaryVoxelsNew(mVisibleMask, VisibleExportOptions{});
+    // Меш пересобирается только в кирпичах, задетых правкой (плюс ореол фильтра).
+    auto nextMesh = VolumeStlExporter::RebuildFromBinaryVoxelsIncremental(
+        mVisibleMask, mStlBrickCache, VisibleExportOptions{});
     if (!nextMesh || nextMesh->GetNumberOfCells() == 0)
         return false;
 
@@ -2970,7 +2996,7 @@ bool RenderView::ToolModeChanged(Action a)
             return false;
 
         setToolUiActive(true, a);
-        mContour->attach(mVtk, mRenderer, mIsoMesh, mIsoActor);
+        mContour->attach(mVtk, mRenderer, mIsoMesh, mIsoActor, &mIsoLocator);
         mContour->handle(a);
         return true;
     }
@@ -3062,6 +3088,7 @@ bool RenderView::AppModeChanged(App a)
 }
 
 #include <vtkUnsignedCharArray.h>
+#include <vtkSMPTools.h>
 #include <algorithm>
 
 void RenderView::rebuildVisibleMaskFromImage(vtkImageData* src)
@@ -3074,103 +3101,8 @@ void RenderView::rebuildVisibleMaskFromImage(vtkImageData* src)
     if (!mVisibleMask)
         mVisibleMask = vtkSmartPointer<vtkImageData>::New();
 
-    // копируем геометрию + данные (неважно какой тип), потом выделим u8
-    mVisibleMask->DeepCopy(src);
-    mVisibleMask->AllocateScalars(VTK_UNSIGNED_CHAR, 1);
-
-    auto* inScAny = src->GetPointData() ? src->GetPointData()->GetScalars() : nullptr;
-    auto* outU8 = vtkUnsignedCharArray::SafeDownCast(
-        mVisibleMask->GetPointData() ? mVisibleMask->GetPointData()->GetScalars() : nullptr
-    );
-
-    if (!inScAny || !outU8) {
+    if (!VolumeStlExporter::BuildBinaryMask(src, mHistMaskLo, mHistMaskHi, mVisibleMask))
         mVisibleMask = nullptr;
-        return;
-    }
-
-    int ext[6];
-    src->GetExtent(ext);
-
-    const int nx = ext[1] - ext[0] + 1;
-    const int ny = ext[3] - ext[2] + 1;
-    const int nz = ext[5] - ext[4] + 1;
-
-    // если объём слишком тонкий — проще занулить всё
-    if (nx < 4 || ny < 4 || nz < 4) {
-        outU8->FillValue(0);
-        mVisibleMask->Modified();
-        return;
-    }
-
-    const vtkIdType nPts = src->GetNumberOfPoints();
-    auto* outPtr = outU8->WritePointer(0, nPts);
-
-    // 1) делаем бинарь 0/255
-    // (если src тоже u8, можно ускорить, но универсально оставим так)
-    for (vtkIdType id = 0; id < nPts; ++id) 
-    {
-        const double v = inScAny->GetTuple1(id);
-        outPtr[id] = (v != 0.0 && v >= mHistMaskLo && v <= mHistMaskHi) ? 255u : 0u;
-    }
-
-    // 2) стираем первые 2 слоя по всем граням: 0,1 и n-2,n-1
-    constexpr int L = 2; // сколько слоёв стираем
-
-    auto clampi = [](int v, int lo, int hi) { return std::max(lo, std::min(v, hi)); };
-
-    const int i0 = ext[0], i1 = ext[1];
-    const int j0 = ext[2], j1 = ext[3];
-    const int k0 = ext[4], k1 = ext[5];
-
-    const int iL0 = i0;
-    const int iL1 = i0 + (L - 1);
-    const int iR0 = i1 - (L - 1);
-    const int iR1 = i1;
-
-    const int jL0 = j0;
-    const int jL1 = j0 + (L - 1);
-    const int jR0 = j1 - (L - 1);
-    const int jR1 = j1;
-
-    const int kL0 = k0;
-    const int kL1 = k0 + (L - 1);
-    const int kR0 = k1 - (L - 1);
-    const int kR1 = k1;
-
-    // helper: set voxel (i,j,k) = 0
-    auto zeroAt = [&](int i, int j, int k)
-        {
-            int ijk[3] = { i, j, k };
-            const vtkIdType id = src->ComputePointId(ijk);
-            outPtr[id] = 0u;
-        };
-
-    // X-грани (левая и правая)
-    for (int k = k0; k <= k1; ++k)
-        for (int j = j0; j <= j1; ++j)
-        {
-            for (int i = iL0; i <= iL1; ++i) zeroAt(i, j, k);
-            for (int i = iR0; i <= iR1; ++i) zeroAt(i, j, k);
-        }
-
-    // Y-грани (перед/зад)
-    for (int k = k0; k <= k1; ++k)
-        for (int i = i0; i <= i1; ++i)
-        {
-            for (int j = jL0; j <= jL1; ++j) zeroAt(i, j, k);
-            for (int j = jR0; j <= jR1; ++j) zeroAt(i, j, k);
-        }
-
-    // Z-грани (низ/верх)
-    for (int j = j0; j <= j1; ++j)
-        for (int i = i0; i <= i1; ++i)
-        {
-            for (int k = kL0; k <= kL1; ++k) zeroAt(i, j, k);
-            for (int k = kR0; k <= kR1; ++k) zeroAt(i, j, k);
-        }
-
-    outU8->Modified();
-    mVisibleMask->Modified();
 }
 
 
@@ -3243,7 +3175,7 @@ void RenderView::addStlPreview()
         mVtk->renderWindow()->Render();
 }
 
-bool RenderView::simplifyStlOnce(bool showFailureMessages, bool updatePreview, bool recordUndo)
+bool RenderView::simplifyStlOnce(bool showFailureMessages, bool updatePreview, bool recordUndo, int steps)
 {
     if (!mIsoMesh || mIsoMesh->GetNumberOfCells() == 0) {
         if (showFailureMessages)
@@ -3252,13 +3184,17 @@ bool RenderView::simplifyStlOnce(bool showFailureMessages, bool updatePreview, b
     }
 
     if (!mStlSaveMesh || mStlSaveMesh->GetNumberOfCells() == 0)
-        mStlSaveMesh = clonePolyData(mIsoMesh);
+        mStlSaveMesh = sharePolyData(mIsoMesh);
+
+    steps = std::max(1, steps);
 
     auto visibleSource = mIsoMesh;
     auto saveSource = mStlSaveMesh;
     double nextTargetMB = kFirstAimMB;
+    int stepsLeft = steps;
     if (!mSimplifyStarted)
     {
+        --stepsLeft;
         visibleSource = VolumeStlExporter::NormalizeSurface(mIsoMesh);
         saveSource = VolumeStlExporter::NormalizeSurface(mStlSaveMesh);
         if (!visibleSource || visibleSource->GetNumberOfCells() == 0 ||
@@ -3271,8 +3207,10 @@ bool RenderView::simplifyStlOnce(bool showFailureMessages, bool updatePreview, b
     }
     else
     {
-        nextTargetMB = std::max(kMinMB, mSimplifyTargetMB * kStepFactor);
+        nextTargetMB = mSimplifyTargetMB;
     }
+    for (int i = 0; i < stepsLeft; ++i)
+        nextTargetMB = std::max(kMinMB, nextTargetMB * kStepFactor);
 
     const std::int64_t targetBytes = static_cast<std::int64_t>(nextTargetMB * kMB);
 
@@ -3280,10 +3218,29 @@ bool RenderView::simplifyStlOnce(bool showFailureMessages, bool updatePreview, b
     const int smoothIter = first ? 16 : 10;
     const double passBand = first ? 0.12 : 0.16;;
 
-    auto simplified = VolumeStlExporter::SimplifyToTargetBytes(visibleSource, targetBytes, smoothIter, passBand);
-    auto saveSimplified = VolumeStlExporter::SimplifyToTargetBytes(saveSource, targetBytes, smoothIter, passBand);
-    auto nextVisibleMesh = clonePolyData(simplified);
-    auto nextSaveMesh = clonePolyData(saveSimplified);
+    // Стягивания считаются один раз на исходный меш; следующие шаги берут уровень из кэша,
+    // а не децимируют заново уже упрощённый (и сглаженный) результат.
+    auto simplifyCached = [&](SimplifyCache& cache, vtkPolyData* current, vtkPolyData* source)
+        -> vtkSmartPointer<vtkPolyData>
+        {
+            if (static_cast<std::int64_t>(VolumeStlExporter::estimateBinaryStlBytesFast(source)) <= targetBytes)
+                return source;
+
+            if (!cache.validFor(current))
+            {
+                cache.reset();
+                cache.pm = VolumeStlExporter::BuildProgressiveMesh(source, smoothIter, passBand);
+            }
+            if (!cache.pm)
+                return nullptr;
+
+            return VolumeStlExporter::SimplifyToTargetBytes(*cache.pm, targetBytes, smoothIter, passBand);
+        };
+
+    auto simplified = simplifyCached(mSimplifyVisibleCache, mIsoMesh, visibleSource);
+    auto saveSimplified = simplifyCached(mSimplifySaveCache, mStlSaveMesh, saveSource);
+    auto nextVisibleMesh = sharePolyData(simplified);
+    auto nextSaveMesh = sharePolyData(saveSimplified);
 
     if (!nextVisibleMesh || nextVisibleMesh->GetNumberOfCells() == 0 ||
         !nextSaveMesh || nextSaveMesh->GetNumberOfCells() == 0)
@@ -3298,10 +3255,12 @@ bool RenderView::simplifyStlOnce(bool showFailureMessages, bool updatePreview, b
 
     mIsoMesh = nextVisibleMesh;
     mStlSaveMesh = nextSaveMesh;
+    mSimplifyVisibleCache.remember(mIsoMesh);
+    mSimplifySaveCache.remember(mStlSaveMesh);
     mSimplifyTargetMB = nextTargetMB;
     mSimplifyStarted = true;
 
-    ++mCurrentStlStep;
+    mCurrentStlStep += steps;
 
     if (updatePreview)
     {
@@ -3310,7 +3269,7 @@ bool RenderView::simplifyStlOnce(bool showFailureMessages, bool updatePreview, b
         updateUndoRedoUi();
 
         if (mContour)
-            mContour->attach(mVtk, mRenderer, mIsoMesh, mIsoActor);
+            mContour->attach(mVtk, mRenderer, mIsoMesh, mIsoActor, &mIsoLocator);
         if (mScissors)
             mScissors->attachSurface(mVtk, mRenderer, mIsoMesh, mIsoActor);
     }
@@ -3320,19 +3279,21 @@ bool RenderView::simplifyStlOnce(bool showFailureMessages, bool updatePreview, b
 
 int RenderView::simplifyStlToLimit()
 {
-    int steps = 0;
     constexpr int kMaxAutoSimplifySteps = 64;
 
-    for (int i = 0; i < kMaxAutoSimplifySteps; ++i)
+    // Сколько шагов сделали бы последовательные нажатия до kMinMB;
+    // промежуточные уровни не строим — сразу последний из прогрессивного меша.
+    int steps = mSimplifyStarted ? 0 : 1;
+    double mb = mSimplifyStarted ? mSimplifyTargetMB : kFirstAimMB;
+    while (mb > kMinMB + 1e-9 && steps < kMaxAutoSimplifySteps)
     {
-        if (!simplifyStlOnce(false, false, false))
-            break;
-
+        mb = std::max(kMinMB, mb * kStepFactor);
         ++steps;
-        if (mSimplifyTargetMB <= kMinMB + 1e-9)
-            break;
     }
 
+    if (steps == 0 || !simplifyStlOnce(false, false, false, steps))
+        return 0;
+
     return steps;
 }
 
@@ -3382,6 +3343,7 @@ void RenderView::onBuildStl()
         mRenderer->RemoveActor(mIsoActor);
         mIsoActor = nullptr;
         mStlSaveMesh = nullptr;
+        mStlBrickCache.clear();
         rebuildContourOverlay();
         mVolume->SetVisibility(true);
         mPrevVolumeVisible = true;
@@ -3436,7 +3398,7 @@ void RenderView::onBuildStl()
 
     rebuildVisibleMaskFromImage(mImage);
     mIsoMesh = VolumeStlExporter::BuildFromBinaryVoxelsNew(mVisibleMask, opt);
-    mStlSaveMesh = clonePolyData(mIsoMesh);
+    mStlSaveMesh = sharePolyData(mIsoMesh);
     if (isCtrlDown())
     {
         emit showInfo(tr("Simplifying surface…"));
@@ -3466,7 +3428,7 @@ void RenderView::onBuildStl()
     qDebug() << "mIsoMeshNumber" << "  " << mIsoMesh->GetNumberOfCells();
 
     mStlModeController.setActive(true);
-    mStlModeController.resetSurfaceHistory(clonePolyData(mIsoMesh));
+    mStlModeController.resetSurfaceHistory();
     resetStlContourHistory();
     addStlPreview();
     updateStlSizeLabel();
@@ -3651,7 +3613,7 @@ void RenderView::openTfEditor()
 
     // 2) Создаём TF-editor один раз
     if (!mTfEditor) {
-        mTfEditor = new TransferFunctionEditor(this, mImage);
+        mTfEditor = new TransferFunctionEditor(this, mImage, &mHistogram);
         mTfEditor->setModal(false);
         mTfEditor->setWindowModality(Qt::NonModal);
 
@@ -3665,22 +3627,40 @@ void RenderView::openTfEditor()
 
                 prop->SetIndependentComponents(true);
 
-                // Маска по гистограмме в домене изображения (HU)
-                vtkSmartPointer<vtkPiecewiseFunction> masked = vtkSmartPointer<vtkPiecewiseFunction>::New();
+                // Маска по гистограмме в домене изображения (HU).
+                // Одна и та же пара в свойстве: правится на месте, без новых объектов на каждый сдвиг точки.
+                if (!mPreviewCTF) mPreviewCTF = vtkSmartPointer<vtkColorTransferFunction>::New();
+                if (!mPreviewOTF) mPreviewOTF = vtkSmartPointer<vtkPiecewiseFunction>::New();
+                if (c) mPreviewCTF->DeepCopy(c);
                 if (mHistMaskActive && o) 
                 {
-                    masked = BuildMaskedOTF(o, mHistMaskLo, mHistMaskHi); // lo/hi — в HU
+                    mPreviewOTF->DeepCopy(BuildMaskedOTF(o, mHistMaskLo, mHistMaskHi)); // lo/hi — в HU
                 }
                 else if (o) 
                 {
-                    masked->DeepCopy(o);
+                    mPreviewOTF->DeepCopy(o);
                 }
 
-                prop->SetColor(0, c ? c : mBaseCTF.GetPointer());
-                prop->SetScalarOpacity(0, masked ? masked.GetPointer() : mBaseOTF.GetPointer());
+                prop->SetColor(0, c ? mPreviewCTF.GetPointer() : mBaseCTF.GetPointer());
+                prop->SetScalarOpacity(0, o ? mPreviewOTF.GetPointer() : mBaseOTF.GetPointer());
                 prop->Modified();
-                if (auto* m = mVolume->GetMapper()) m->Modified();
-                if (mVtk && mVtk->renderWindow()) mVtk->renderWindow()->Render();
+
+                // видимость для «удаления связного» — из таблицы редактора, с той же маской
+                if (mRemoveConn && mTfEditor)
+                {
+                    TF::RgbaLut vis = mTfEditor->lut();
+                    if (mHistMaskActive)
+                        for (int v = 0; v < int(vis.size()); ++v)
+                            if (v < mHistMaskLo || v > mHistMaskHi)
+                                vis[v][3] = 0.0f;
+                    mRemoveConn->setVisibilityLut(vis);
+                }
+
+                // кадр — через планировщик: серия сдвигов точки даёт один рендер на кадр
+                if (mScheduler)
+                    mScheduler->requestRender();
+                else if (mVtk && mVtk->renderWindow())
+                    mVtk->renderWindow()->Render();
             });
 
         // Коммит: обновляем "базу", а в сцену кладём её + Hist-маску
@@ -3712,6 +3692,7 @@ void RenderView::openTfEditor()
                 prop->SetScalarOpacity(0, masked);
                 prop->Modified();
                 if (auto* m = mVolume->GetMapper()) m->Modified();
+                if (mRemoveConn) mRemoveConn->notifyTfChanged();
                 if (mVtk && mVtk->renderWindow()) mVtk->renderWindow()->Render();
 
                 // Обновим меню пресетов/кнопки, если нужно
@@ -4148,53 +4129,7 @@ void RenderView::setVolume(vtkSmartPointer<vtkImageData> image, DicomInfo Dicom,
         rw->AddRenderer(mRenderer);
     }
     pump(25);
-    // Полный сброс состояния "Электродов" при смене серии, чтобы
-    // ничего не наследовалось из предыдущего объёма.
-    if (mElectrodesPreviewActive)
-        endElectrodesPreview();
-
-    if (mAppActive && mCurrentApp == App::Electrodes)
-    {
-        setElectrodesUiActive(false);
-        setAppUiActive(false, mCurrentApp);
-    }
-
-    mElectrodeIJK.clear();
-    mImageBeforeElectrodes = nullptr;
-    mElectrodesPreviewImage = nullptr;
-    mElectrodesPreviewActive = false;
-    mElectrodesPreviewSavedCTF = nullptr;
-    mElectrodesPreviewSavedOTF = nullptr;
-
-    if (mElectrodePanel)
-        mElectrodePanel->resetState();
-
-    if (mRenderer)
-        ElectrodeSurfaceDetector::instance().clear(mRenderer);
-
-    // При загрузке нового исследования всегда сбрасываем STL-предпросмотр,
-    // чтобы в сцене не оставались старый меш и его оценка размера.
-    clearStlPreview();
-    mIsoMesh = nullptr;
-    mStlSaveMesh = nullptr;
-    mStlModeController.setActive(false);
-    mStlModeController.resetSurfaceHistory(nullptr);
-    resetStlContourHistory();
-    updateTopPanelForStlMode(false);
-    reloadToolsMenu();
-    mSimplifyStarted = false;
-    mSimplifyTargetMB = kFirstAimMB;
-
-    if (mBtnSTL)
-        mBtnSTL->setChecked(false);
-    if (mBtnSTLSave) {
-        mBtnSTLSave->setEnabled(false);
-        mBtnSTLSave->setVisible(false);
-    }
-    if (mBtnSTLSimplify) {
-        mBtnSTLSimplify->setEnabled(false);
-        mBtnSTLSimplify->setVisible(false);
-    }
+    resetSeriesState();
 
     DI = Dicom;
 
@@ -4206,13 +4141,13 @@ void RenderView::setVolume(vtkSmartPointer<vtkImageData> image, DicomInfo Dicom,
     const double factor = std::clamp(mSamplingFactor, 0.5, 10.0);
 
     // 2) настраиваем mapper/prop
-    auto mapper = vtkSmartPointer<vtkGPUVolumeRayCastMapper>::New();
+    const auto backend = VolumeRenderBackend::resolve(mVolumeBackend, mVtk ? mVtk->renderWindow() : nullptr);
+    auto mapper = VolumeRenderBackend::createMapper(backend);
     mapper->SetInputData(image);
-    mapper->SetBlendModeToComposite();
-    mapper->SetAutoAdjustSampleDistances(false);
     const double smin = std::min({ sp[0], sp[1], sp[2] });
-    mapper->SetSampleDistance(std::max(1 * smin, 0.05));
-    mapper->SetUseJittering(true);
+    VolumeRenderBackend::setSampleDistance(mapper, std::max(1 * smin, 0.05));
+    qDebug() << "[RenderView] volume backend" << VolumeRenderBackend::name(backend);
+    armBackendProbe();
 
 
     auto ctf = vtkSmartPointer<vtkColorTransferFunction>::New();
@@ -4264,6 +4199,10 @@ void RenderView::setVolume(vtkSmartPointer<vtkImageData> image, DicomInfo Dicom,
     mVolume = vol;
     updateElectrodePickContext();
 
+    mLod->attachToVolume(mVolume);
+    mLod->setBaseSampleDistance(std::max(1 * smin, 0.05));
+    mLod->imageChanged(mImage);
+
     updateGradientOpacity();
 
     setViewPreset(ViewPreset::AP);
@@ -4291,10 +4230,20 @@ void RenderView::setVolume(vtkSmartPointer<vtkImageData> image, DicomInfo Dicom,
     {
         mScissors = std::make_unique<ToolsScissors>(this);
         mScissors->setAllowNavigation(true);
-        mScissors->setOnImageReplaced([this](vtkImageData* im)
+        mScissors->setOnBeforeImageEdit([this]
             {
-                    commitNewImage(im);
-                    mScissors->attach(mVtk, mRenderer, mImage, mVolume);
+                pushImageUndoSnapshot();
+                int lo[3], hi[3];
+                mScissors->editRegion(lo, hi);
+                mHistogram.beginRegionEdit(mImage, lo, hi);
+            });
+        mScissors->setOnImageEdited([this](vtkImageData*)
+            {
+                // том изменён на месте — mImage тот же
+                int lo[3], hi[3];
+                mScissors->editRegion(lo, hi);
+                mHistogram.endRegionEdit(mImage, lo, hi);
+                updateAfterImageChange(true);
             });
         mScissors->setOnSurfaceReplaced([this](vtkPolyData* poly, QVector<QVector<std::array<double, 3>>> cutContours)
             {
@@ -4350,13 +4299,13 @@ void RenderView::setVolume(vtkSmartPointer<vtkImageData> image, DicomInfo Dicom,
                 addStlPreview();
                 updateStlSizeLabel();
                 updateUndoRedoUi();
-                mContour->attach(mVtk, mRenderer, mIsoMesh, mIsoActor);
+                mContour->attach(mVtk, mRenderer, mIsoMesh, mIsoActor, &mIsoLocator);
             });
         mContour->setOnFinished([this]() {
             setToolUiActive(false, mCurrentTool);
             });
     }
-    mContour->attach(mVtk, mRenderer, mIsoMesh, mIsoActor);
+    mContour->attach(mVtk, mRenderer, mIsoMesh, mIsoActor, &mIsoLocator);
 
     if (!mRemoveConn) 
     {
@@ -4368,6 +4317,10 @@ void RenderView::setVolume(vtkSmartPointer<vtkImageData> image, DicomInfo Dicom,
                     emit showInfo(tr("Ready"));
                     });
                 emit Progress(100);
+                // кисть: новая копия отличается от mImage только в своей сфере
+                int lo[3], hi[3];
+                if (mImage && im && mRemoveConn->editRegion(lo, hi))
+                    mHistogram.replaceRegion(mImage, im, lo, hi);
                 commitNewImage(im);
                 mRemoveConn->attach(mVtk, mRenderer, mImage, mVolume, mHistMaskLo, mHistMaskHi);
             });
@@ -4480,6 +4433,150 @@ void RenderView::setVolume(vtkSmartPointer<vtkImageData> image, DicomInfo Dicom,
     updateAfterImageChange(false);
 }
 
+qint64 RenderView::EditState::bytes() const
+{
+    qint64 total = imageBytes(image);
+    for (const auto& im : undo) total += imageBytes(im);
+    for (const auto& im : redo) total += imageBytes(im);
+    return total;
+}
+
+void RenderView::resetSeriesState()
+{
+    // Полный сброс состояния "Электродов" при смене серии, чтобы
+    // ничего не наследовалось из предыдущего объёма.
+    if (mElectrodesPreviewActive)
+        endElectrodesPreview();
+
+    if (mAppActive && mCurrentApp == App::Electrodes)
+    {
+        setElectrodesUiActive(false);
+        setAppUiActive(false, mCurrentApp);
+    }
+
+    mElectrodeIJK.clear();
+    mImageBeforeElectrodes = nullptr;
+    mElectrodesPreviewImage = nullptr;
+    mElectrodesPreviewActive = false;
+    mElectrodesPreviewSavedCTF = nullptr;
+    mElectrodesPreviewSavedOTF = nullptr;
+
+    if (mElectrodePanel)
+        mElectrodePanel->resetState();
+
+    if (mRenderer)
+        ElectrodeSurfaceDetector::instance().clear(mRenderer);
+
+    // При загрузке нового исследования всегда сбрасываем STL-предпросмотр,
+    // чтобы в сцене не оставались старый меш и его оценка размера.
+    clearStlPreview();
+    mIsoMesh = nullptr;
+    mStlSaveMesh = nullptr;
+    mStlModeController.setActive(false);
+    mStlModeController.resetSurfaceHistory();
+    resetStlContourHistory();
+    updateTopPanelForStlMode(false);
+    reloadToolsMenu();
+    mSimplifyStarted = false;
+    mSimplifyTargetMB = kFirstAimMB;
+    mSimplifyVisibleCache.reset();
+    mSimplifySaveCache.reset();
+    mStlBrickCache.clear();
+
+    if (mBtnSTL)
+        mBtnSTL->setChecked(false);
+    if (mBtnSTLSave) {
+        mBtnSTLSave->setEnabled(false);
+        mBtnSTLSave->setVisible(false);
+    }
+    if (mBtnSTLSimplify) {
+        mBtnSTLSimplify->setEnabled(false);
+        mBtnSTLSimplify->setVisible(false);
+    }
+}
+
+void RenderView::releaseVolume()
+{
+    resetSeriesState();
+    removeAllTemplateLayers();
+    mVisibleMask = nullptr;
+
+    if (mElectrodePanel)
+    {
+        ElectrodePanel::PickContext ctx;
+        ctx.vtkWidget = mVtk;
+        ctx.renderer = mRenderer;
+        mElectrodePanel->setPickContext(ctx);
+    }
+
+    // инструменты держат том (ToolsRemoveConnected — сильной ссылкой) и маппер
+    if (mScissors)
+        mScissors->attach(mVtk, mRenderer, nullptr, nullptr);
+    if (mRemoveConn)
+        mRemoveConn->attach(mVtk, mRenderer, nullptr, nullptr, mHistMaskLo, mHistMaskHi);
+
+    if (mClip)
+        mClip->attachToVolume(nullptr);
+    mLod->imageChanged(nullptr);
+    mLod->attachToVolume(nullptr);
+
+    if (mVolume)
+    {
+        if (auto* m = mVolume->GetMapper())
+            m->SetInputDataObject(nullptr);
+        if (mRenderer)
+            mRenderer->RemoveViewProp(mVolume);
+    }
+    mVolume = nullptr;
+    mImage = nullptr;
+
+    mUndoStack.clear();
+    mRedoStack.clear();
+    updateUndoRedoUi();
+}
+
+RenderView::EditState RenderView::takeEditState()
+{
+    EditState s;
+    if (!mImage)
+        return s;
+
+    if (!mUndoStack.isEmpty() || !mRedoStack.isEmpty())
+    {
+        s.image = mImage;
+        s.undo = std::move(mUndoStack);
+        s.redo = std::move(mRedoStack);
+    }
+    // иначе выгрузка сессии «освободила» бы массивы, которые ещё держит сцена
+    releaseVolume();
+    return s;
+}
+
+QStringList RenderView::unsavedSeriesWork() const
+{
+    QStringList work;
+    if (!mImage)
+        return work;
+    if (!mElectrodeIJK.isEmpty() || (mElectrodePanel && !mElectrodePanel->coordsWorld().isEmpty()))
+        work << tr("electrode positions");
+    if (!mSavedContours.isEmpty())
+        work << tr("contours");
+    if (mTemplateDlg && mTemplateDlg->hasUnsavedTemplates())
+        work << tr("unsaved templates");
+    return work;
+}
+
+void RenderView::restoreEditState(EditState state, DicomInfo Dicom, PatientInfo info)
+{
+    setVolume(state.image, Dicom, info);
+    if (mImage != state.image)
+        return;
+
+    mUndoStack = std::move(state.undo);
+    mRedoStack = std::move(state.redo);
+    updateUndoRedoUi();
+}
+
 void RenderView::saveTemplates(QString filename)
 {
     QFileInfo fi(filename);
@@ -4805,6 +4902,10 @@ void RenderView::loadRenderSettings()
 
     mSamplingFactor = s.value(kSamplingFactorKey, 0.35).toDouble();
     mSamplingFactor = std::clamp(mSamplingFactor, 0.5, 10.0);
+
+    mVolumeBackend = VolumeRenderBackend::fromInt(s.value(kVolumeBackendKey, 0).toInt());
+    mFrameTargetMs = std::clamp(s.value(kFrameTargetKey, 40).toInt(), 0, 500);
+    mMaxFps = std::clamp(s.value(kMaxFpsKey, 0).toInt(), 0, 240);
 }
 
 void RenderView::saveRenderSettings()
@@ -4813,6 +4914,9 @@ void RenderView::saveRenderSettings()
     s.setValue(kGradOpacityKey, mGradientOpacityOn);
     s.setValue(kInterpKey, (mInterpolation == VolumeInterpolation::Linear) ? 1 : 0);
     s.setValue(kSamplingFactorKey, mSamplingFactor);
+    s.setValue(kVolumeBackendKey, int(mVolumeBackend));
+    s.setValue(kFrameTargetKey, mFrameTargetMs);
+    s.setValue(kMaxFpsKey, mMaxFps);
 }
 
 void RenderView::setSamplingFactor(double f)
@@ -4832,6 +4936,93 @@ void RenderView::setSamplingFactor(double f)
     emit samplingFactorChanged(mSamplingFactor);
 }
 
+void RenderView::setVolumeBackend(VolumeRenderBackend::Kind k)
+{
+    if (mVolumeBackend == k)
+        return;
+
+    mVolumeBackend = k;
+    saveRenderSettings();
+
+    applyVolumeBackend();
+    armBackendProbe();
+}
+
+void RenderView::armBackendProbe()
+{
+    vtkRenderWindow* rw = mVtk ? mVtk->renderWindow() : nullptr;
+    if (!rw || mProbeTag || VolumeRenderBackend::isResolved(mVolumeBackend))
+        return;
+
+    // setVolume зовётся до показа 3D-вида: контекста ещё нет, и Auto временно дал Gpu.
+    // Пробуем в конце первого кадра, пока контекст текущий, маппер меняем уже после него
+    if (!mProbeCb)
+    {
+        mProbeCb = vtkSmartPointer<vtkCallbackCommand>::New();
+        mProbeCb->SetClientData(this);
+        mProbeCb->SetCallback([](vtkObject* caller, unsigned long, void* cd, void*)
+            {
+                auto* self = static_cast<RenderView*>(cd);
+                auto* w = static_cast<vtkRenderWindow*>(caller);
+                VolumeRenderBackend::resolve(self->mVolumeBackend, w);
+                if (!VolumeRenderBackend::isResolved(self->mVolumeBackend))
+                    return; // пустой отчёт о контексте — ждём следующий кадр
+                w->RemoveObserver(self->mProbeTag);
+                self->mProbeTag = 0;
+                QTimer::singleShot(0, self, [self] { self->applyVolumeBackend(); });
+            });
+    }
+    mProbeTag = rw->AddObserver(vtkCommand::EndEvent, mProbeCb);
+}
+
+void RenderView::applyVolumeBackend()
+{
+    if (!mVolume || !mImage || !mLod)
+        return;
+
+    const auto backend = VolumeRenderBackend::resolve(mVolumeBackend, mVtk ? mVtk->renderWindow() : nullptr);
+    if (VolumeRenderBackend::kindOf(mLod->fullMapper()) == backend)
+        return;
+
+    // новый маппер на тот же объём: вход, шаг луча и плоскости клипбокса переносятся
+    auto mapper = VolumeRenderBackend::createMapper(backend);
+    mapper->SetInputData(mImage);
+    mVolume->SetMapper(mapper);
+    mLod->attachToVolume(mVolume);
+    updateSamplingFromImage();
+    if (mClip)
+        mClip->applyNow();
+
+    qDebug() << "[RenderView] volume backend" << VolumeRenderBackend::name(backend);
+
+    if (mVtk && mVtk->renderWindow())
+        mVtk->renderWindow()->Render();
+}
+
+void RenderView::setFrameTimeTarget(int ms)
+{
+    ms = std::clamp(ms, 0, 500);
+    if (mFrameTargetMs == ms)
+        return;
+
+    mFrameTargetMs = ms;
+    saveRenderSettings();
+    if (mLod)
+        mLod->setFrameTimeTargetMs(mFrameTargetMs);
+}
+
+void RenderView::setMaxFps(int fps)
+{
+    fps = std::clamp(fps, 0, 240);
+    if (mMaxFps == fps)
+        return;
+
+    mMaxFps = fps;
+    saveRenderSettings();
+    if (mScheduler)
+        mScheduler->setMaxFps(mMaxFps);
+}
+
 void RenderView::updateSamplingFromImage()
 {
     if (!mImage || !mVolume) return;
@@ -4844,12 +5035,9 @@ void RenderView::updateSamplingFromImage()
     const double sd = std::max(factor * smin, 0.05); // 0.05 чтобы не улететь в ноль
     const double ud = std::max(factor * smin, 1e-3);
 
-    if (auto* gm = vtkGPUVolumeRayCastMapper::SafeDownCast(mVolume->GetMapper())) {
-        gm->SetAutoAdjustSampleDistances(false);
-        gm->SetSampleDistance(sd);
-        gm->SetUseJittering(true);
-        gm->Modified();
-    }
+    VolumeRenderBackend::setSampleDistance(mLod ? mLod->fullMapper() : mVolume->GetMapper(), sd);
+    if (mLod)
+        mLod->setBaseSampleDistance(sd);
 
     //if (auto* prop = mVolume->GetProperty()) {
     //    prop->SetScalarOpacityUnitDistance(ud);
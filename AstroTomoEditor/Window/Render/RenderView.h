@@ -13,10 +13,12 @@
 #include "VolumeStlExporter.h"
 #include <vtkCellArray.h>
 #include <vtkPoints.h>
+#include <vtkPolyData.h>
 #include <vtkTubeFilter.h>
 #include "Tools.h"
 #include "ToolsScissors.h"
 #include "ToolsContour.h"
+#include "SurfaceLocator.h"
 #include <vtkRenderer.h>
 #include <vtkVolume.h>
 #include <vtkImageData.h>
@@ -29,6 +31,11 @@
 #include "StlModeController.h"
 #include "WheelSpinButton.h"
 #include "U8Span.h"
+#include "ProgressiveMesh.h"
+#include "NarrowBandSurface.h"
+#include "VolumeRenderBackend.h"
+#include "VolumeLodController.h"
+#include "RenderScheduler.h"
 #include "TemplateDialog.h"
 #include "ElectrodePanel.h"
 #include <algorithm>
@@ -57,12 +64,16 @@ class vtkPolyDataMapper;
 class vtkColorTransferFunction;
 class vtkPiecewiseFunction;
 class vtkVolumeProperty;
+class vtkCallbackCommand;
 class TemplateDialog;
 
 enum class ViewPreset { AP, PA, LAO, RAO, L, R };
 
 static constexpr const char* kGradOpacityKey = "render/gradientOpacity";
 static constexpr const char* kInterpKey = "render/volumeInterpolation"; // 0 nearest, 1 linear
+static constexpr const char* kVolumeBackendKey = "render/volumeBackend"; // 0 auto, 1 gpu, 2 cpu
+static constexpr const char* kFrameTargetKey = "render/frameTimeTargetMs"; // 0 — без LOD
+static constexpr const char* kMaxFpsKey = "render/maxFps"; // 0 — по частоте экрана
 
 class RenderView : public QWidget
 {
@@ -71,6 +82,26 @@ public:
     explicit RenderView(QWidget* parent = nullptr);
     ~RenderView() override;
     void setVolume(vtkSmartPointer<vtkImageData> image, DicomInfo Dicom, PatientInfo info);
+
+    // Правленый том серии с историей undo/redo — переживает переключение серий в сессии.
+    // STL, контуры и слои шаблонов сюда не входят: restoreEditState строит вид с нуля, как setVolume,
+    // поэтому перед уходом серии спрашиваем про unsavedSeriesWork().
+    struct EditState
+    {
+        vtkSmartPointer<vtkImageData> image;
+        QVector<vtkSmartPointer<vtkImageData>> undo;
+        QVector<vtkSmartPointer<vtkImageData>> redo;
+
+        bool isEmpty() const { return !image; }
+        qint64 bytes() const;
+    };
+    // Серия уходит из вида: том отцепляется от сцены, маппера и инструментов, так что после
+    // выгрузки EditState вид не держит ссылок на его массивы. Пусто, если правок не было
+    // (том пересоберётся из срезов).
+    EditState takeEditState();
+    // ручная работа поверх тома, которую takeEditState не сохранит: названия для вопроса пользователю
+    QStringList unsavedSeriesWork() const;
+    void restoreEditState(EditState state, DicomInfo Dicom, PatientInfo info);
     void setViewPreset(ViewPreset v);
     void centerOnVolume();
     void hideOverlays();
@@ -91,6 +122,13 @@ public:
     void saveTemplates(QString savedir);
     void setSamplingFactor(double f);
     double samplingFactor() const { return mSamplingFactor; }
+    void setVolumeBackend(VolumeRenderBackend::Kind k);
+    void setFrameTimeTarget(int ms);
+    int frameTimeTarget() const { return mFrameTargetMs; }
+    void setMaxFps(int fps);
+    int maxFps() const { return mMaxFps; }
+    RenderScheduler::Stats renderStats() const { return mScheduler ? mScheduler->stats() : RenderScheduler::Stats{}; }
+    VolumeRenderBackend::Kind volumeBackend() const { return mVolumeBackend; }
 
 signals:
     void renderStarted();
@@ -131,6 +169,7 @@ private:
     vtkSmartPointer<vtkOrientationMarkerWidget> mOrMarker;
     vtkSmartPointer<vtkAxesActor> mAxes;
     vtkSmartPointer<vtkImageData> mVisibleMask;
+    SurfaceBrickCache mStlBrickCache; // патчи кирпичей для пересборки STL после правок
 
     QWidget* mRightOverlay{ nullptr };
     QWidget* mTopOverlay{ nullptr };
@@ -144,6 +183,8 @@ private:
     QToolButton* mBtnRAO{ nullptr };
 
     std::unique_ptr<ClipBoxController> mClip;
+    std::unique_ptr<VolumeLodController> mLod;
+    std::unique_ptr<RenderScheduler> mScheduler;
     QToolButton* mBtnClip{ nullptr };
 
     QToolButton* mBtnSTL{ nullptr };
@@ -154,6 +195,28 @@ private:
     double mSimplifyTargetMB = 3.0;
     bool   mSimplifyStarted = false;
 
+    // Прогрессивный меш для «Simplify»: строится один раз на исходный меш,
+    // следующие шаги только извлекают уровень. Годен, пока меш — наш последний результат.
+    struct SimplifyCache
+    {
+        std::shared_ptr<ProgressiveMesh> pm;
+        vtkSmartPointer<vtkPolyData> lastOut;
+        vtkMTimeType lastMTime = 0;
+
+        bool validFor(vtkPolyData* mesh) const
+        {
+            return pm && mesh && lastOut.GetPointer() == mesh && mesh->GetMTime() == lastMTime;
+        }
+        void remember(vtkPolyData* mesh)
+        {
+            lastOut = mesh;
+            lastMTime = mesh ? mesh->GetMTime() : 0;
+        }
+        void reset() { pm.reset(); lastOut = nullptr; lastMTime = 0; }
+    };
+    SimplifyCache mSimplifyVisibleCache;
+    SimplifyCache mSimplifySaveCache;
+
     QMenu* mTfMenu{ nullptr };
     vtkSmartPointer<vtkVolumeProperty> mProp;
     QToolButton* mBtnTF{ nullptr };
@@ -174,6 +237,9 @@ private:
 
     vtkSmartPointer<vtkPolyData> mIsoMesh = nullptr;
     vtkSmartPointer<vtkPolyData> mStlSaveMesh = nullptr;
+    // Локаторы поверхностей: пересобираются только при смене/правке меша
+    mutable SurfaceLocator mIsoLocator;
+    mutable SurfaceLocator mStlSaveLocator;
     vtkSmartPointer<vtkActor>    mIsoActor = nullptr;
 
     QToolButton* mBtnTools{ nullptr };
@@ -200,7 +266,7 @@ private:
     void setToolUiActive(bool on, Action a);
     void updateTopPanelForStlMode(bool stlModeOn);
     bool rebuildStlFromEditedImage(vtkImageData* editedImage);
-    bool simplifyStlOnce(bool showFailureMessages, bool updatePreview, bool recordUndo);
+    bool simplifyStlOnce(bool showFailureMessages, bool updatePreview, bool recordUndo, int steps = 1);
     int simplifyStlToLimit();
 
     QToolButton* mBtnUndo{ nullptr };
@@ -209,12 +275,12 @@ private:
     QVector<vtkSmartPointer<vtkImageData>> mUndoStack;
     QVector<vtkSmartPointer<vtkImageData>> mRedoStack;
     int  mHistoryLimit = 128;
+    qint64 mStlHistoryBytes = qint64(1024) * 1024 * 1024; // байты истории STL-поверхностей
     StlModeController mStlModeController;
+    QVector<int> mMemorySources; // id источников в MemoryRegistry
     int mCurrentStlStep = 0;
     QVector<int> mStlStepUndoStack;
     QVector<int> mStlStepRedoStack;
-    QVector<vtkSmartPointer<vtkPolyData>> mStlSaveUndoStack;
-    QVector<vtkSmartPointer<vtkPolyData>> mStlSaveRedoStack;
     QVector<QSet<int>> mContourVisibleUndoStack;
     QVector<QSet<int>> mContourVisibleRedoStack;
     QVector<StoredContourInfo> mSavedContours;
@@ -224,14 +290,18 @@ private:
     vtkSmartPointer<vtkActor> mContourOverlayActor = nullptr;
     vtkSmartPointer<vtkImageData> cloneImage(vtkImageData* src);
     void commitNewImage(vtkImageData* im);
+    void pushImageUndoSnapshot();
     void setMapperInput(vtkImageData* im);
     void pushStlUndoSnapshot();
+    void trimStlSideHistory();
     void resetStlContourHistory();
     void applyNewStlSurface(vtkPolyData* poly);
     void addSavedContour(const QVector<std::array<double, 3>>& contourPointsWorld);
     void addSavedContours(const QVector<QVector<std::array<double, 3>>>& contoursWorld);
     bool hasMatchingVisibleContour(const QVector<std::array<double, 3>>& contourPointsWorld) const;
     void keepOnlyContoursAttachedToCurrentSurface();
+    const SurfaceLocator* isoSurfaceLocator() const;
+    bool contourAttachedToSurface(const QVector<std::array<double, 3>>& contourPointsWorld) const;
     bool saveContoursSidecar(const QString& stlPath) const;
     std::array<double, 3> worldToSavedStlCoords(const std::array<double, 3>& world) const;
     std::array<double, 3> savedStlToWorldCoords(const std::array<double, 3>& saved) const;
@@ -240,6 +310,13 @@ private:
     void updateContourOverlayClipping();
     void rebuildContourOverlay();
     void updateUndoRedoUi();
+    void registerMemorySources();
+    // электроды, STL-режим и его кеши — всё, что строится поверх тома конкретной серии
+    void resetSeriesState();
+    void releaseVolume();
+    // маппер под mVolumeBackend; Auto до первого кадра — проба после него
+    void applyVolumeBackend();
+    void armBackendProbe();
     void applyCustomPresetByIndex(int idx, vtkVolumeProperty* prop, double dataMin, double dataMax);
 
     QToolButton* mBtnApps{ nullptr };
@@ -250,8 +327,11 @@ private:
     void setAppUiActive(bool on, App a);
 
     QPointer<HistogramDialog> mHistDlg;
+    VolumeHistogram mHistogram;   // общий для гистограммы и редактора TF
     vtkSmartPointer<vtkColorTransferFunction> mBaseCTF;
     vtkSmartPointer<vtkPiecewiseFunction>     mBaseOTF;
+    vtkSmartPointer<vtkColorTransferFunction> mPreviewCTF;   // TF сцены во время правки в редакторе TF
+    vtkSmartPointer<vtkPiecewiseFunction>     mPreviewOTF;
 
     QPointer<TemplateDialog> mTemplateDlg;
     std::unordered_map<TemplateId, Volume> mTemplateVolumes;
@@ -323,6 +403,11 @@ private:
 
     double mSamplingFactor = 0.35; // дефолт
     static constexpr const char* kSamplingFactorKey = "render/samplingFactor";
+    VolumeRenderBackend::Kind mVolumeBackend = VolumeRenderBackend::Kind::Auto;
+    vtkSmartPointer<vtkCallbackCommand> mProbeCb;
+    unsigned long mProbeTag = 0;
+    int mFrameTargetMs = 40; // цель по времени кадра при вращении, 0 — без LOD
+    int mMaxFps = 0;         // предел частоты кадров по запросам, 0 — частота экрана
 };
 
 static constexpr double kMB = 1024.0 * 1024.0;
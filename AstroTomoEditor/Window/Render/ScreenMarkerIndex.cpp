@@ -0,0 +1,188 @@
+﻿#include "ScreenMarkerIndex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <vtkCamera.h>
+#include <vtkMath.h>
+#include <vtkMatrix4x4.h>
+#include <vtkRenderer.h>
+
+bool ScreenMarkerIndex::ViewKey::operator==(const ViewKey& o) const
+{
+    return renderer == o.renderer && cameraStamp == o.cameraStamp
+        && size[0] == o.size[0] && size[1] == o.size[1]
+        && origin[0] == o.origin[0] && origin[1] == o.origin[1]
+        && aspect == o.aspect && cone == o.cone
+        && coneCenter == o.coneCenter && coneDeg == o.coneDeg;
+}
+
+void ScreenMarkerIndex::clear()
+{
+    mValid = false;
+    mKey = ViewKey{};
+    mWorld.clear();
+    mXY.clear();
+    mCellStart.clear();
+    mCellItems.clear();
+    mGridW = mGridH = 0;
+}
+
+void ScreenMarkerIndex::sync(vtkRenderer* ren, const std::vector<Point>& world,
+    const Point* coneCenter, double maxConeAngleDeg)
+{
+    auto* cam = ren ? ren->GetActiveCamera() : nullptr;
+    if (!cam)
+    {
+        clear();
+        return;
+    }
+
+    ViewKey key;
+    key.renderer = ren;
+    key.cameraStamp = cam->GetMTime();
+    const int* sz = ren->GetSize();
+    const int* org = ren->GetOrigin();
+    key.size[0] = sz[0];
+    key.size[1] = sz[1];
+    key.origin[0] = org[0];
+    key.origin[1] = org[1];
+    key.aspect = ren->GetTiledAspectRatio();
+    key.cone = coneCenter != nullptr;
+    if (coneCenter)
+    {
+        key.coneCenter = *coneCenter;
+        key.coneDeg = maxConeAngleDeg;
+    }
+
+    if (mValid && key == mKey && world == mWorld)
+        return;
+
+    mKey = key;
+    mWorld = world;
+    mValid = true;
+
+    const int n = static_cast<int>(mWorld.size());
+    mXY.assign(static_cast<size_t>(2 * n), std::numeric_limits<double>::quiet_NaN());
+
+    // мир -> view одной матрицей, как vtkRenderer::WorldToView; view -> дисплей по вьюпорту
+    double m[16];
+    vtkMatrix4x4::DeepCopy(m, cam->GetCompositeProjectionTransformMatrix(key.aspect, 0.0, 1.0));
+
+    double camPos[3]{ 0.0, 0.0, 0.0 };
+    cam->GetPosition(camPos);
+    const double cosMax = std::cos(vtkMath::RadiansFromDegrees(maxConeAngleDeg));
+    Point toCam{};
+    double camLen = 0.0;
+    if (coneCenter)
+    {
+        toCam = { camPos[0] - key.coneCenter[0], camPos[1] - key.coneCenter[1], camPos[2] - key.coneCenter[2] };
+        camLen = std::sqrt(toCam[0] * toCam[0] + toCam[1] * toCam[1] + toCam[2] * toCam[2]);
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+        const Point& p = mWorld[i];
+
+        if (coneCenter && camLen > 1e-9)
+        {
+            const double sx = p[0] - key.coneCenter[0];
+            const double sy = p[1] - key.coneCenter[1];
+            const double sz2 = p[2] - key.coneCenter[2];
+            const double len = std::sqrt(sx * sx + sy * sy + sz2 * sz2);
+            // точка в самом центре считается видимой
+            if (len > 1e-9 && (toCam[0] * sx + toCam[1] * sy + toCam[2] * sz2) < cosMax * camLen * len)
+                continue;
+        }
+
+        const double w = m[12] * p[0] + m[13] * p[1] + m[14] * p[2] + m[15];
+        if (std::abs(w) < 1e-12)
+            continue;
+
+        const double vx = (m[0] * p[0] + m[1] * p[1] + m[2] * p[2] + m[3]) / w;
+        const double vy = (m[4] * p[0] + m[5] * p[1] + m[6] * p[2] + m[7]) / w;
+
+        const double dx = (vx + 1.0) * 0.5 * key.size[0] + key.origin[0];
+        const double dy = (vy + 1.0) * 0.5 * key.size[1] + key.origin[1];
+        if (!std::isfinite(dx) || !std::isfinite(dy))
+            continue;
+
+        mXY[2 * i] = dx;
+        mXY[2 * i + 1] = dy;
+    }
+
+    // сетка покрывает вьюпорт с запасом в kMarginCells ячеек по краям
+    mGridX0 = key.origin[0] - int(kMarginCells * kCellPx);
+    mGridY0 = key.origin[1] - int(kMarginCells * kCellPx);
+    mGridW = int(std::ceil(key.size[0] / kCellPx)) + 2 * kMarginCells;
+    mGridH = int(std::ceil(key.size[1] / kCellPx)) + 2 * kMarginCells;
+
+    const int cells = std::max(0, mGridW * mGridH);
+    std::vector<int> cellOf(static_cast<size_t>(n), -1);
+    mCellStart.assign(static_cast<size_t>(cells) + 1, 0);
+
+    for (int i = 0; i < n; ++i)
+    {
+        const double x = mXY[2 * i];
+        if (std::isnan(x))
+            continue;
+
+        const int cx = int(std::floor((x - mGridX0) / kCellPx));
+        const int cy = int(std::floor((mXY[2 * i + 1] - mGridY0) / kCellPx));
+        if (cx < 0 || cy < 0 || cx >= mGridW || cy >= mGridH)
+            continue;
+
+        cellOf[i] = cy * mGridW + cx;
+        ++mCellStart[cellOf[i] + 1];
+    }
+
+    for (int c = 0; c < cells; ++c)
+        mCellStart[c + 1] += mCellStart[c];
+
+    mCellItems.assign(static_cast<size_t>(mCellStart[cells]), -1);
+    std::vector<int> fill(mCellStart.begin(), mCellStart.end() - 1);
+    for (int i = 0; i < n; ++i)
+        if (cellOf[i] >= 0)
+            mCellItems[fill[cellOf[i]]++] = i;
+}
+
+int ScreenMarkerIndex::nearest(double x, double y, double maxDistPx, double* outDistPx) const
+{
+    if (!mValid || mGridW <= 0 || mGridH <= 0 || maxDistPx < 0.0)
+        return -1;
+
+    const int cx0 = std::max(0, int(std::floor((x - maxDistPx - mGridX0) / kCellPx)));
+    const int cy0 = std::max(0, int(std::floor((y - maxDistPx - mGridY0) / kCellPx)));
+    const int cx1 = std::min(mGridW - 1, int(std::floor((x + maxDistPx - mGridX0) / kCellPx)));
+    const int cy1 = std::min(mGridH - 1, int(std::floor((y + maxDistPx - mGridY0) / kCellPx)));
+
+    const double maxD2 = maxDistPx * maxDistPx;
+    int best = -1;
+    double bestD2 = std::numeric_limits<double>::max();
+
+    for (int cy = cy0; cy <= cy1; ++cy)
+    {
+        for (int cx = cx0; cx <= cx1; ++cx)
+        {
+            const int c = cy * mGridW + cx;
+            for (int k = mCellStart[c]; k < mCellStart[c + 1]; ++k)
+            {
+                const int i = mCellItems[k];
+                const double dx = mXY[2 * i] - x;
+                const double dy = mXY[2 * i + 1] - y;
+                const double d2 = dx * dx + dy * dy;
+                // при равенстве — меньший индекс, как у прежнего линейного поиска
+                if (d2 <= maxD2 && (d2 < bestD2 || (d2 == bestD2 && i < best)))
+                {
+                    bestD2 = d2;
+                    best = i;
+                }
+            }
+        }
+    }
+
+    if (best >= 0 && outDistPx)
+        *outDistPx = std::sqrt(bestD2);
+    return best;
+}
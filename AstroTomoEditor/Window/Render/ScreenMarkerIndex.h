@@ -0,0 +1,54 @@
+﻿#pragma once
+#include <array>
+#include <vector>
+#include <vtkType.h>
+
+class vtkRenderer;
+
+// Экранный индекс маркеров для попадания мышью.
+// sync проецирует все точки одной композитной матрицей камеры и раскладывает
+// их по сетке; пока камера, вьюпорт и набор точек те же, повторные sync ничего не делают.
+// Точки за пределами конуса «видимой» полусферы (coneCenter) в индекс не попадают.
+class ScreenMarkerIndex
+{
+public:
+    using Point = std::array<double, 3>;
+
+    void clear();
+    void sync(vtkRenderer* ren, const std::vector<Point>& world,
+        const Point* coneCenter = nullptr, double maxConeAngleDeg = 85.0);
+
+    // индекс ближайшей точки не дальше maxDistPx от (x, y) в координатах дисплея VTK, иначе -1
+    int nearest(double x, double y, double maxDistPx, double* outDistPx = nullptr) const;
+
+    const std::vector<Point>& points() const { return mWorld; }
+
+private:
+    struct ViewKey
+    {
+        vtkRenderer* renderer = nullptr;
+        vtkMTimeType cameraStamp = 0;
+        int size[2]{ 0, 0 };
+        int origin[2]{ 0, 0 };
+        double aspect = 0.0;
+        bool cone = false;
+        Point coneCenter{};
+        double coneDeg = 0.0;
+
+        bool operator==(const ViewKey& o) const;
+    };
+
+    static constexpr double kCellPx = 32.0;
+    static constexpr int kMarginCells = 2;
+
+    ViewKey mKey;
+    bool mValid = false;
+    std::vector<Point> mWorld;
+    std::vector<double> mXY;            // 2 на точку
+    int mGridX0 = 0;
+    int mGridY0 = 0;
+    int mGridW = 0;
+    int mGridH = 0;
+    std::vector<int> mCellStart;        // CSR: mGridW * mGridH + 1
+    std::vector<int> mCellItems;
+};
@@ -0,0 +1,251 @@
+﻿#include "SignedDistanceField.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <vtkImageData.h>
+#include <vtkSMPTools.h>
+
+#include <QDebug>
+
+namespace
+{
+    constexpr double kInf = 1.0e30;
+    constexpr float  kInfF = 1.0e30f;
+
+    // Буферы одной линии: выделяются один раз на диапазон линий потока.
+    struct LineScratch
+    {
+        std::vector<double> g, f, d, z;
+        std::vector<int> v;
+        std::vector<std::uint8_t> in;
+
+        explicit LineScratch(int n)
+            : g(n), f(n), d(n), z(size_t(n) + 1), v(n), in(n) {}
+    };
+
+    // Нижняя огибающая парабол (Felzenszwalb–Huttenlocher):
+    // d[q] = min_p ( sp2*(q-p)^2 + f[p] ) по конечным f[p].
+    // Пишет только в позиции, где in[q] == want.
+    void Envelope1D(const double* f, int n, double sp2,
+        const std::uint8_t* in, std::uint8_t want,
+        int* v, double* z, double* d)
+    {
+        auto intersect = [&](int q, int p)
+            {
+                return ((f[q] + sp2 * double(q) * q) - (f[p] + sp2 * double(p) * p))
+                    / (2.0 * sp2 * double(q - p));
+            };
+
+        int k = -1;
+        for (int q = 0; q < n; ++q)
+        {
+            if (f[q] >= kInf)
+                continue;
+
+            if (k < 0)
+            {
+                k = 0;
+                v[0] = q;
+                z[0] = -std::numeric_limits<double>::infinity();
+                z[1] = std::numeric_limits<double>::infinity();
+                continue;
+            }
+
+            double s = intersect(q, v[k]);
+            while (s <= z[k])
+            {
+                --k;
+                s = intersect(q, v[k]);
+            }
+            ++k;
+            v[k] = q;
+            z[k] = s;
+            z[k + 1] = std::numeric_limits<double>::infinity();
+        }
+
+        if (k < 0)
+        {
+            for (int q = 0; q < n; ++q)
+                if (in[q] == want) d[q] = kInf;
+            return;
+        }
+
+        k = 0;
+        for (int q = 0; q < n; ++q)
+        {
+            while (z[k + 1] < double(q))
+                ++k;
+            if (in[q] != want)
+                continue;
+            const double dq = double(q - v[k]);
+            d[q] = sp2 * dq * dq + f[v[k]];
+        }
+    }
+
+    // Один проход по линии (Y или Z): g — квадрат дистанции до «чужого» класса
+    // после предыдущих осей. Для целей «внутри» источники — внешние воксели (f=0)
+    // и внутренние со своим g; для целей «снаружи» — наоборот.
+    void PassLine(LineScratch& s, int n, double sp2)
+    {
+        for (int q = 0; q < n; ++q)
+            s.f[q] = s.in[q] ? s.g[q] : 0.0;
+        Envelope1D(s.f.data(), n, sp2, s.in.data(), 1, s.v.data(), s.z.data(), s.d.data());
+
+        for (int q = 0; q < n; ++q)
+            s.f[q] = s.in[q] ? 0.0 : s.g[q];
+        Envelope1D(s.f.data(), n, sp2, s.in.data(), 0, s.v.data(), s.z.data(), s.d.data());
+    }
+}
+
+bool SignedDistanceField::ComputeRaw(const std::uint8_t* mask, int nx, int ny, int nz,
+    const double spacing[3], float* out, float clampMm)
+{
+    if (!mask || !out || nx <= 0 || ny <= 0 || nz <= 0)
+        return false;
+
+    const size_t sliceN = size_t(nx) * size_t(ny);
+    const size_t N = sliceN * size_t(nz);
+
+    // Оба класса должны присутствовать, иначе расстояние бесконечно.
+    const std::uint8_t* end = mask + N;
+    const bool anyIn = std::find_if(mask, end, [](std::uint8_t m) { return m != 0; }) != end;
+    const bool anyOut = std::find(mask, end, std::uint8_t(0)) != end;
+    if (!anyIn || !anyOut)
+        return false;
+
+    const double sx2 = spacing[0] * spacing[0];
+    const double sy2 = spacing[1] * spacing[1];
+    const double sz2 = spacing[2] * spacing[2];
+
+    // --- X: расстояние до ближайшего воксела другого класса в строке (два скана) ---
+    vtkSMPTools::For(0, vtkIdType(ny) * nz, [&](vtkIdType b, vtkIdType e)
+        {
+            for (vtkIdType line = b; line < e; ++line)
+            {
+                const std::uint8_t* m = mask + size_t(line) * nx;
+                float* o = out + size_t(line) * nx;
+
+                int lastIn = -1, lastOut = -1;
+                for (int i = 0; i < nx; ++i)
+                {
+                    const bool in = m[i] != 0;
+                    if (in) lastIn = i; else lastOut = i;
+                    const int opp = in ? lastOut : lastIn;
+                    o[i] = (opp < 0) ? kInfF : float(i - opp);
+                }
+
+                lastIn = -1; lastOut = -1;
+                for (int i = nx - 1; i >= 0; --i)
+                {
+                    const bool in = m[i] != 0;
+                    if (in) lastIn = i; else lastOut = i;
+                    const int opp = in ? lastOut : lastIn;
+                    float dx = o[i];
+                    if (opp >= 0)
+                        dx = std::min(dx, float(opp - i));
+                    o[i] = (dx >= kInfF) ? kInfF : float(sx2 * double(dx) * double(dx));
+                }
+            }
+        });
+
+    // --- Y: по столбцам каждого среза ---
+    if (ny > 1)
+    {
+        vtkSMPTools::For(0, nz, [&](vtkIdType kb, vtkIdType ke)
+            {
+                LineScratch s(ny);
+                for (vtkIdType k = kb; k < ke; ++k)
+                {
+                    const size_t base = size_t(k) * sliceN;
+                    for (int i = 0; i < nx; ++i)
+                    {
+                        for (int j = 0; j < ny; ++j)
+                        {
+                            const size_t n = base + size_t(j) * nx + i;
+                            s.g[j] = out[n];
+                            s.in[j] = mask[n] ? 1 : 0;
+                        }
+                        PassLine(s, ny, sy2);
+                        for (int j = 0; j < ny; ++j)
+                            out[base + size_t(j) * nx + i] = (s.d[j] >= kInf) ? kInfF : float(s.d[j]);
+                    }
+                }
+            });
+    }
+
+    // --- Z: по «колоннам» через срезы ---
+    if (nz > 1)
+    {
+        vtkSMPTools::For(0, ny, [&](vtkIdType jb, vtkIdType je)
+            {
+                LineScratch s(nz);
+                for (vtkIdType j = jb; j < je; ++j)
+                {
+                    const size_t base = size_t(j) * nx;
+                    for (int i = 0; i < nx; ++i)
+                    {
+                        for (int k = 0; k < nz; ++k)
+                        {
+                            const size_t n = base + size_t(k) * sliceN + i;
+                            s.g[k] = out[n];
+                            s.in[k] = mask[n] ? 1 : 0;
+                        }
+                        PassLine(s, nz, sz2);
+                        for (int k = 0; k < nz; ++k)
+                            out[base + size_t(k) * sliceN + i] = (s.d[k] >= kInf) ? kInfF : float(s.d[k]);
+                    }
+                }
+            });
+    }
+
+    // --- Знак и корень: > 0 внутри, < 0 снаружи ---
+    const float clamp = (clampMm > 0.0f) ? clampMm : std::numeric_limits<float>::max();
+    vtkSMPTools::For(0, vtkIdType(N), [&](vtkIdType b, vtkIdType e)
+        {
+            for (vtkIdType n = b; n < e; ++n)
+            {
+                const float d = std::min(std::sqrt(out[n]), clamp);
+                out[n] = mask[n] ? d : -d;
+            }
+        });
+
+    return true;
+}
+
+vtkSmartPointer<vtkImageData> SignedDistanceField::Compute(vtkImageData* maskU8, double outRange[2])
+{
+    if (!maskU8 || maskU8->GetScalarType() != VTK_UNSIGNED_CHAR ||
+        maskU8->GetNumberOfScalarComponents() != 1)
+        return nullptr;
+
+    int dims[3];
+    maskU8->GetDimensions(dims);
+    if (dims[0] <= 0 || dims[1] <= 0 || dims[2] <= 0)
+        return nullptr;
+
+    const auto* mask = static_cast<const std::uint8_t*>(maskU8->GetScalarPointer());
+    if (!mask)
+        return nullptr;
+
+    auto sdf = vtkSmartPointer<vtkImageData>::New();
+    sdf->CopyStructure(maskU8);
+    sdf->AllocateScalars(VTK_FLOAT, 1);
+
+    auto* out = static_cast<float*>(sdf->GetScalarPointer());
+    if (!out)
+        return nullptr;
+
+    if (!ComputeRaw(mask, dims[0], dims[1], dims[2], maskU8->GetSpacing(), out))
+    {
+        qDebug() << "[SDF] mask has only one class, distance undefined";
+        return nullptr;
+    }
+
+    if (outRange)
+        sdf->GetScalarRange(outRange);
+
+    return sdf;
+}
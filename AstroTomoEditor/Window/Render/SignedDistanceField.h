@@ -0,0 +1,23 @@
+﻿#pragma once
+#include <cstdint>
+#include <vtkSmartPointer.h>
+
+class vtkImageData;
+
+// Точное знаковое евклидово расстояние по бинарной u8-маске.
+// Раздельный EDT (Felzenszwalb–Huttenlocher) по осям X, Y, Z, параллельно по линиям,
+// внутренняя и внешняя дистанции считаются за один проход в один float-буфер.
+// Знак как у прежнего пути через vtkImageEuclideanDistance: > 0 внутри, < 0 снаружи.
+class SignedDistanceField
+{
+public:
+    // mask: ненулевое значение = «внутри», x — самая быстрая ось (nx*ny*nz подряд).
+    // out: nx*ny*nz float в мм. clampMm > 0 — ограничить |d| (узкая полоса).
+    // Возвращает false, если в маске нет одного из классов (расстояние не определено).
+    static bool ComputeRaw(const std::uint8_t* mask, int nx, int ny, int nz,
+        const double spacing[3], float* out, float clampMm = 0.0f);
+
+    // Обёртка над vtkImageData (u8 x 1): float-том той же геометрии.
+    // outRange (опц.) — min/max полученного SDF.
+    static vtkSmartPointer<vtkImageData> Compute(vtkImageData* maskU8, double outRange[2] = nullptr);
+};
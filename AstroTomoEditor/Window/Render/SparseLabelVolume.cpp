@@ -0,0 +1,221 @@
+﻿#include "SparseLabelVolume.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include <vtkImageData.h>
+#include <vtkSMPTools.h>
+
+namespace
+{
+    bool isU8x1(vtkImageData* img)
+    {
+        return img && img->GetScalarType() == VTK_UNSIGNED_CHAR
+            && img->GetNumberOfScalarComponents() == 1 && img->GetScalarPointer();
+    }
+}
+
+void SparseLabelVolume::clear()
+{
+    mGeom = nullptr;
+    mDims[0] = mDims[1] = mDims[2] = 0;
+    mBricks[0] = mBricks[1] = mBricks[2] = 0;
+    mSlot.clear();
+    mPayload.clear();
+}
+
+bool SparseLabelVolume::encode(vtkImageData* img, const Lut* lut)
+{
+    clear();
+    if (!isU8x1(img))
+        return false;
+
+    Lut id{};
+    for (int v = 0; v < 256; ++v)
+        id[v] = uint8_t(v);
+    const Lut& L = lut ? *lut : id;
+
+    img->GetDimensions(mDims);
+    for (int a = 0; a < 3; ++a)
+        mBricks[a] = (mDims[a] + kBrick - 1) / kBrick;
+
+    const int nx = mDims[0], ny = mDims[1], nz = mDims[2];
+    const size_t nBricks = size_t(mBricks[0]) * mBricks[1] * mBricks[2];
+    const auto* src = static_cast<const uint8_t*>(img->GetScalarPointer());
+    const size_t sx = size_t(nx), sxy = size_t(nx) * size_t(ny);
+
+    // 1) какие кирпичи заняты
+    std::vector<uint8_t> occupied(nBricks, 0);
+    const int bx = mBricks[0], by = mBricks[1];
+    vtkSMPTools::For(0, vtkIdType(nBricks), [&](vtkIdType first, vtkIdType last)
+        {
+            for (vtkIdType q = first; q < last; ++q)
+            {
+                const int bi = int(q % bx), bj = int((q / bx) % by), bk = int(q / (bx * by));
+                const int i0 = bi * kBrick, i1 = std::min(nx, i0 + kBrick);
+                const int j0 = bj * kBrick, j1 = std::min(ny, j0 + kBrick);
+                const int k0 = bk * kBrick, k1 = std::min(nz, k0 + kBrick);
+
+                bool any = false;
+                for (int k = k0; k < k1 && !any; ++k)
+                    for (int j = j0; j < j1 && !any; ++j)
+                    {
+                        const uint8_t* row = src + size_t(k) * sxy + size_t(j) * sx;
+                        for (int i = i0; i < i1; ++i)
+                            if (L[row[i]]) { any = true; break; }
+                    }
+                occupied[size_t(q)] = any ? 1 : 0;
+            }
+        });
+
+    // 2) раздаём места в payload
+    mSlot.assign(nBricks, -1);
+    int32_t used = 0;
+    for (size_t q = 0; q < nBricks; ++q)
+        if (occupied[q])
+            mSlot[q] = used++;
+    mPayload.assign(size_t(used) * kBrickVoxels, 0);
+
+    // 3) копируем содержимое занятых кирпичей
+    vtkSMPTools::For(0, vtkIdType(nBricks), [&](vtkIdType first, vtkIdType last)
+        {
+            for (vtkIdType q = first; q < last; ++q)
+            {
+                const int32_t s = mSlot[size_t(q)];
+                if (s < 0)
+                    continue;
+
+                const int bi = int(q % bx), bj = int((q / bx) % by), bk = int(q / (bx * by));
+                const int i0 = bi * kBrick, i1 = std::min(nx, i0 + kBrick);
+                const int j0 = bj * kBrick, j1 = std::min(ny, j0 + kBrick);
+                const int k0 = bk * kBrick, k1 = std::min(nz, k0 + kBrick);
+
+                uint8_t* dst = mPayload.data() + size_t(s) * kBrickVoxels;
+                for (int k = k0; k < k1; ++k)
+                    for (int j = j0; j < j1; ++j)
+                    {
+                        const uint8_t* row = src + size_t(k) * sxy + size_t(j) * sx;
+                        uint8_t* out = dst + (size_t(k - k0) * kBrick + size_t(j - j0)) * kBrick;
+                        for (int i = i0; i < i1; ++i)
+                            out[i - i0] = L[row[i]];
+                    }
+            }
+        });
+
+    mGeom = vtkSmartPointer<vtkImageData>::New();
+    mGeom->CopyStructure(img);
+    return true;
+}
+
+bool SparseLabelVolume::matches(vtkImageData* img) const
+{
+    if (!mGeom || !isU8x1(img))
+        return false;
+
+    int a[6], b[6];
+    mGeom->GetExtent(a);
+    img->GetExtent(b);
+    return std::equal(a, a + 6, b);
+}
+
+template <class Fn>
+size_t SparseLabelVolume::forEachLabel(vtkImageData* img, Fn&& fn) const
+{
+    if (!matches(img))
+        return 0;
+
+    const int nx = mDims[0], ny = mDims[1], nz = mDims[2];
+    const int bx = mBricks[0], by = mBricks[1];
+    const size_t sx = size_t(nx), sxy = size_t(nx) * size_t(ny);
+    auto* dst = static_cast<uint8_t*>(img->GetScalarPointer());
+
+    // кирпичи не пересекаются, так что запись по ним параллельна без гонок
+    std::atomic<size_t> total{ 0 };
+    vtkSMPTools::For(0, vtkIdType(mSlot.size()), [&](vtkIdType first, vtkIdType last)
+        {
+            size_t n = 0;
+            for (vtkIdType q = first; q < last; ++q)
+            {
+                const int32_t s = mSlot[size_t(q)];
+                if (s < 0)
+                    continue;
+
+                const int bi = int(q % bx), bj = int((q / bx) % by), bk = int(q / (bx * by));
+                const int i0 = bi * kBrick, i1 = std::min(nx, i0 + kBrick);
+                const int j0 = bj * kBrick, j1 = std::min(ny, j0 + kBrick);
+                const int k0 = bk * kBrick, k1 = std::min(nz, k0 + kBrick);
+
+                const uint8_t* brick = mPayload.data() + size_t(s) * kBrickVoxels;
+                for (int k = k0; k < k1; ++k)
+                    for (int j = j0; j < j1; ++j)
+                    {
+                        const uint8_t* in = brick + (size_t(k - k0) * kBrick + size_t(j - j0)) * kBrick;
+                        uint8_t* row = dst + size_t(k) * sxy + size_t(j) * sx;
+                        for (int i = i0; i < i1; ++i)
+                            if (const uint8_t v = in[i - i0])
+                            {
+                                fn(row[i], v);
+                                ++n;
+                            }
+                    }
+            }
+            total += n;
+        });
+    return total.load();
+}
+
+size_t SparseLabelVolume::paintInto(vtkImageData* img) const
+{
+    return forEachLabel(img, [](uint8_t& dst, uint8_t v) { dst = v; });
+}
+
+size_t SparseLabelVolume::eraseFrom(vtkImageData* img) const
+{
+    return forEachLabel(img, [](uint8_t& dst, uint8_t) { dst = 0; });
+}
+
+vtkSmartPointer<vtkImageData> SparseLabelVolume::expand() const
+{
+    if (!mGeom)
+        return nullptr;
+
+    auto out = vtkSmartPointer<vtkImageData>::New();
+    out->CopyStructure(mGeom);
+    out->AllocateScalars(VTK_UNSIGNED_CHAR, 1);
+    std::memset(out->GetScalarPointer(), 0, size_t(mDims[0]) * mDims[1] * mDims[2]);
+    paintInto(out);
+    return out;
+}
+
+bool SparseLabelVolume::bounds(int lo[3], int hi[3]) const
+{
+    int b0[3]{ mBricks[0], mBricks[1], mBricks[2] };
+    int b1[3]{ -1, -1, -1 };
+    const int bx = mBricks[0], by = mBricks[1];
+    for (size_t q = 0; q < mSlot.size(); ++q)
+    {
+        if (mSlot[q] < 0)
+            continue;
+        const int b[3]{ int(q % bx), int((q / bx) % by), int(q / (size_t(bx) * by)) };
+        for (int a = 0; a < 3; ++a)
+        {
+            b0[a] = std::min(b0[a], b[a]);
+            b1[a] = std::max(b1[a], b[a]);
+        }
+    }
+    if (b1[0] < 0)
+        return false;
+
+    for (int a = 0; a < 3; ++a)
+    {
+        lo[a] = b0[a] * kBrick;
+        hi[a] = std::min(mDims[a], (b1[a] + 1) * kBrick) - 1;
+    }
+    return true;
+}
+
+size_t SparseLabelVolume::memoryBytes() const
+{
+    return mPayload.capacity() + mSlot.capacity() * sizeof(int32_t);
+}
@@ -0,0 +1,55 @@
+﻿#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <vtkSmartPointer.h>
+
+class vtkImageData;
+
+// Разреженный U8-слой поверх геометрии серии: хранятся только кирпичи B^3, где есть
+// ненулевые воксели. Ноль — «нет метки». Геометрия (экстент/spacing/origin) держится
+// отдельным vtkImageData без скаляров.
+class SparseLabelVolume
+{
+public:
+    static constexpr int kBrick = 16;
+    using Lut = std::array<uint8_t, 256>;
+
+    void clear();
+    // Слой закодирован (пусть даже без единой метки).
+    bool isValid() const { return mGeom != nullptr; }
+
+    // Кодирует U8x1 том. lut переводит значение в сохраняемое (0 — не хранить), nullptr — как есть.
+    bool encode(vtkImageData* img, const Lut* lut = nullptr);
+    // Та же решётка вокселей, что у img (и img — U8x1).
+    bool matches(vtkImageData* img) const;
+
+    // Пишет ненулевые значения слоя в img, возвращает число вокселей.
+    size_t paintInto(vtkImageData* img) const;
+    // Обнуляет в img воксели, помеченные слоем, возвращает число вокселей.
+    size_t eraseFrom(vtkImageData* img) const;
+    // Плотный U8x1 том той же геометрии (для сохранения и превью).
+    vtkSmartPointer<vtkImageData> expand() const;
+
+    // Охват занятых кирпичей в индексах вокселей, включительно. false — меток нет.
+    bool bounds(int lo[3], int hi[3]) const;
+
+    size_t brickCount() const { return mPayload.size() / kBrickVoxels; }
+    size_t memoryBytes() const;
+
+private:
+    static constexpr size_t kBrickVoxels = size_t(kBrick) * kBrick * kBrick;
+
+    size_t brickIndex(int bi, int bj, int bk) const
+    {
+        return (size_t(bk) * size_t(mBricks[1]) + size_t(bj)) * size_t(mBricks[0]) + size_t(bi);
+    }
+    template <class Fn> size_t forEachLabel(vtkImageData* img, Fn&& fn) const;
+
+    vtkSmartPointer<vtkImageData> mGeom;
+    int mDims[3]{};
+    int mBricks[3]{};
+
+    std::vector<int32_t> mSlot;      // кирпич -> номер в mPayload, -1 — пустой
+    std::vector<uint8_t> mPayload;   // kBrickVoxels на каждый непустой кирпич
+};
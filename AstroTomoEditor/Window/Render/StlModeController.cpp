@@ -4,7 +4,12 @@
 
 void StlModeController::setHistoryLimit(int limit)
 {
-    mHistoryLimit = (limit > 0) ? limit : 1;
+    mHistory.setEntryLimit(limit);
+}
+
+void StlModeController::setHistoryByteLimit(qint64 bytes)
+{
+    mHistory.setByteLimit(bytes);
 }
 
 void StlModeController::setActive(bool active)
@@ -12,67 +17,55 @@ void StlModeController::setActive(bool active)
     mActive = active;
 }
 
-void StlModeController::resetSurfaceHistory(vtkPolyData* currentSurface)
+void StlModeController::resetSurfaceHistory()
 {
-    (void)currentSurface;
-    mSurfaceUndoStack.clear();
-    mSurfaceRedoStack.clear();
+    mHistory.clear();
 }
 
 bool StlModeController::canUndoSurface() const
 {
-    return !mSurfaceUndoStack.isEmpty();
+    return mHistory.canUndo();
 }
 
 bool StlModeController::canRedoSurface() const
 {
-    return !mSurfaceRedoStack.isEmpty();
+    return mHistory.canRedo();
 }
 
-void StlModeController::pushSurfaceUndoState(vtkPolyData* currentSurface)
+void StlModeController::pushSurfaceUndoState(vtkPolyData* currentSurface, vtkPolyData* currentSaveSurface)
 {
     if (!currentSurface)
         return;
 
-    mSurfaceUndoStack.push_back(cloneSurface(currentSurface));
-    while (mSurfaceUndoStack.size() > mHistoryLimit)
-        mSurfaceUndoStack.pop_front();
-
-    mSurfaceRedoStack.clear();
+    mHistory.push({ currentSurface, currentSaveSurface });
 }
 
-vtkSmartPointer<vtkPolyData> StlModeController::undoSurface(vtkPolyData* currentSurface)
+bool StlModeController::undoSurface(vtkPolyData* currentSurface, vtkPolyData* currentSaveSurface,
+    vtkSmartPointer<vtkPolyData>& surface, vtkSmartPointer<vtkPolyData>& saveSurface)
 {
     if (!canUndoSurface() || !currentSurface)
-        return nullptr;
+        return false;
 
-    mSurfaceRedoStack.push_back(cloneSurface(currentSurface));
-    while (mSurfaceRedoStack.size() > mHistoryLimit)
-        mSurfaceRedoStack.pop_front();
+    SurfaceHistory::State prev;
+    if (!mHistory.undo({ currentSurface, currentSaveSurface }, prev))
+        return false;
 
-    auto prev = mSurfaceUndoStack.takeLast();
-    return cloneSurface(prev);
+    surface = prev.surface;
+    saveSurface = prev.save;
+    return true;
 }
 
-vtkSmartPointer<vtkPolyData> StlModeController::redoSurface(vtkPolyData* currentSurface)
+bool StlModeController::redoSurface(vtkPolyData* currentSurface, vtkPolyData* currentSaveSurface,
+    vtkSmartPointer<vtkPolyData>& surface, vtkSmartPointer<vtkPolyData>& saveSurface)
 {
     if (!canRedoSurface() || !currentSurface)
-        return nullptr;
+        return false;
 
-    mSurfaceUndoStack.push_back(cloneSurface(currentSurface));
-    while (mSurfaceUndoStack.size() > mHistoryLimit)
-        mSurfaceUndoStack.pop_front();
+    SurfaceHistory::State next;
+    if (!mHistory.redo({ currentSurface, currentSaveSurface }, next))
+        return false;
 
-    auto next = mSurfaceRedoStack.takeLast();
-    return cloneSurface(next);
+    surface = next.surface;
+    saveSurface = next.save;
+    return true;
 }
-
-vtkSmartPointer<vtkPolyData> StlModeController::cloneSurface(vtkPolyData* src) const
-{
-    if (!src)
-        return nullptr;
-
-    auto out = vtkSmartPointer<vtkPolyData>::New();
-    out->DeepCopy(src);
-    return out;
-}
\ No newline at end of file
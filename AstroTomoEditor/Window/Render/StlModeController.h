@@ -1,33 +1,38 @@
 #pragma once
 
-#include <QVector>
 #include <vtkSmartPointer.h>
 
+#include "SurfaceHistory.h"
+
 class vtkPolyData;
 
 class StlModeController
 {
 public:
     void setHistoryLimit(int limit);
+    void setHistoryByteLimit(qint64 bytes);
 
     void setActive(bool active);
     bool isActive() const { return mActive; }
 
-    void resetSurfaceHistory(vtkPolyData* currentSurface);
+    void resetSurfaceHistory();
 
     bool canUndoSurface() const;
     bool canRedoSurface() const;
+    int undoDepth() const { return mHistory.undoDepth(); }
+    int redoDepth() const { return mHistory.redoDepth(); }
+    qint64 historyBytes() const { return mHistory.bytes(); }
+    qint64 trimHistory(qint64 limit) { return mHistory.trimTo(limit); }
 
-    void pushSurfaceUndoState(vtkPolyData* currentSurface);
+    // currentSaveSurface == nullptr — сохраняемый меш совпадает с видимым.
+    void pushSurfaceUndoState(vtkPolyData* currentSurface, vtkPolyData* currentSaveSurface = nullptr);
 
-    vtkSmartPointer<vtkPolyData> undoSurface(vtkPolyData* currentSurface);
-    vtkSmartPointer<vtkPolyData> redoSurface(vtkPolyData* currentSurface);
+    bool undoSurface(vtkPolyData* currentSurface, vtkPolyData* currentSaveSurface,
+        vtkSmartPointer<vtkPolyData>& surface, vtkSmartPointer<vtkPolyData>& saveSurface);
+    bool redoSurface(vtkPolyData* currentSurface, vtkPolyData* currentSaveSurface,
+        vtkSmartPointer<vtkPolyData>& surface, vtkSmartPointer<vtkPolyData>& saveSurface);
 
 private:
-    vtkSmartPointer<vtkPolyData> cloneSurface(vtkPolyData* src) const;
-
     bool mActive{ false };
-    int mHistoryLimit{ 128 };
-    QVector<vtkSmartPointer<vtkPolyData>> mSurfaceUndoStack;
-    QVector<vtkSmartPointer<vtkPolyData>> mSurfaceRedoStack;
+    SurfaceHistory mHistory;
 };
\ No newline at end of file
@@ -0,0 +1,166 @@
+﻿#include "SurfaceGeodesicGraph.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <queue>
+#include <utility>
+
+#include <vtkCellArray.h>
+#include <vtkPolyData.h>
+
+void SurfaceGeodesicGraph::clear()
+{
+    mPts.clear();
+    mOffsets.clear();
+    mNeighbors.clear();
+    mWeights.clear();
+    mDist.clear();
+    mParent.clear();
+    mSeen.clear();
+    mDone.clear();
+    mQuery = 0;
+}
+
+double SurfaceGeodesicGraph::distance(vtkIdType a, vtkIdType b) const
+{
+    const double* p = point(a);
+    const double* q = point(b);
+    const double dx = p[0] - q[0], dy = p[1] - q[1], dz = p[2] - q[2];
+    return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+void SurfaceGeodesicGraph::build(vtkPolyData* mesh)
+{
+    clear();
+    if (!mesh || !mesh->GetPoints() || !mesh->GetPolys())
+        return;
+
+    const vtkIdType nPts = mesh->GetNumberOfPoints();
+    mPts.resize(size_t(nPts) * 3);
+    for (vtkIdType i = 0; i < nPts; ++i)
+        mesh->GetPoint(i, &mPts[size_t(i) * 3]);
+
+    // 1) степени с повторами (ребро встречается в двух треугольниках)
+    vtkCellArray* polys = mesh->GetPolys();
+    std::vector<vtkIdType> degree(size_t(nPts) + 1, 0);
+    vtkIdType npts = 0;
+    const vtkIdType* ids = nullptr;
+    for (polys->InitTraversal(); polys->GetNextCell(npts, ids);)
+        for (vtkIdType k = 0; k < npts; ++k)
+        {
+            ++degree[size_t(ids[k])];
+            ++degree[size_t(ids[(k + 1) % npts])];
+        }
+
+    std::vector<vtkIdType> start(size_t(nPts) + 1, 0);
+    for (vtkIdType i = 0; i < nPts; ++i)
+        start[size_t(i) + 1] = start[size_t(i)] + degree[size_t(i)];
+
+    std::vector<vtkIdType> raw(size_t(start.back()));
+    std::vector<vtkIdType> fill(start.begin(), start.end() - 1);
+    for (polys->InitTraversal(); polys->GetNextCell(npts, ids);)
+        for (vtkIdType k = 0; k < npts; ++k)
+        {
+            const vtkIdType a = ids[k], b = ids[(k + 1) % npts];
+            raw[size_t(fill[size_t(a)]++)] = b;
+            raw[size_t(fill[size_t(b)]++)] = a;
+        }
+
+    // 2) без повторов и петель, веса — длины рёбер
+    mOffsets.assign(size_t(nPts) + 1, 0);
+    mNeighbors.reserve(raw.size() / 2 + 1);
+    mWeights.reserve(raw.size() / 2 + 1);
+    for (vtkIdType i = 0; i < nPts; ++i)
+    {
+        auto b = raw.begin() + start[size_t(i)];
+        auto e = raw.begin() + start[size_t(i) + 1];
+        std::sort(b, e);
+        e = std::unique(b, e);
+        for (auto it = b; it != e; ++it)
+        {
+            if (*it == i)
+                continue;
+            mNeighbors.push_back(*it);
+            mWeights.push_back(distance(i, *it));
+        }
+        mOffsets[size_t(i) + 1] = vtkIdType(mNeighbors.size());
+    }
+
+    mDist.resize(size_t(nPts));
+    mParent.resize(size_t(nPts));
+    mSeen.assign(size_t(nPts), 0);
+    mDone.assign(size_t(nPts), 0);
+}
+
+bool SurfaceGeodesicGraph::shortestPath(vtkIdType from, vtkIdType to, std::vector<vtkIdType>& path) const
+{
+    path.clear();
+
+    const vtkIdType nPts = pointCount();
+    if (empty() || from < 0 || to < 0 || from >= nPts || to >= nPts)
+        return false;
+
+    if (from == to)
+    {
+        path.push_back(from);
+        return true;
+    }
+
+    if (++mQuery == 0)
+    {
+        // переполнение счётчика — честно обнуляем метки
+        std::fill(mSeen.begin(), mSeen.end(), 0);
+        std::fill(mDone.begin(), mDone.end(), 0);
+        mQuery = 1;
+    }
+
+    using Entry = std::pair<double, vtkIdType>; // f = g + h
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open;
+
+    mSeen[size_t(from)] = mQuery;
+    mDist[size_t(from)] = 0.0;
+    mParent[size_t(from)] = -1;
+    open.emplace(distance(from, to), from);
+
+    bool found = false;
+    while (!open.empty())
+    {
+        const vtkIdType u = open.top().second;
+        open.pop();
+        if (mDone[size_t(u)] == mQuery)
+            continue;
+        mDone[size_t(u)] = mQuery;
+
+        if (u == to)
+        {
+            found = true;
+            break;
+        }
+
+        const double gu = mDist[size_t(u)];
+        for (vtkIdType k = mOffsets[size_t(u)]; k < mOffsets[size_t(u) + 1]; ++k)
+        {
+            const vtkIdType v = mNeighbors[size_t(k)];
+            if (mDone[size_t(v)] == mQuery)
+                continue;
+
+            const double g = gu + mWeights[size_t(k)];
+            if (mSeen[size_t(v)] != mQuery || g < mDist[size_t(v)])
+            {
+                mSeen[size_t(v)] = mQuery;
+                mDist[size_t(v)] = g;
+                mParent[size_t(v)] = u;
+                open.emplace(g + distance(v, to), v);
+            }
+        }
+    }
+
+    if (!found)
+        return false;
+
+    for (vtkIdType v = to; v >= 0; v = mParent[size_t(v)])
+        path.push_back(v);
+    std::reverse(path.begin(), path.end());
+    return true;
+}
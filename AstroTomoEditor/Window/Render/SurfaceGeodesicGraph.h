@@ -0,0 +1,42 @@
+﻿#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <vtkType.h>
+
+class vtkPolyData;
+
+// Граф рёбер треугольной поверхности в CSR: строится один раз на версию меша,
+// кратчайший путь — A* с евклидовой эвристикой (вес ребра — его длина, так что
+// эвристика допустима и путь тот же, что у Дейкстры), обходится только окрестность
+// отрезка между концами. Рабочие массивы переиспользуются между запросами.
+class SurfaceGeodesicGraph
+{
+public:
+    void clear();
+    bool empty() const { return mOffsets.size() < 2; }
+    vtkIdType pointCount() const { return vtkIdType(mPts.size() / 3); }
+
+    // Рёбра всех полигонов меша (ожидаются треугольники, но подойдёт любой полигон).
+    void build(vtkPolyData* mesh);
+
+    // Вершины пути от from до to включительно; false — не связаны.
+    bool shortestPath(vtkIdType from, vtkIdType to, std::vector<vtkIdType>& path) const;
+
+    const double* point(vtkIdType id) const { return &mPts[size_t(id) * 3]; }
+
+private:
+    double distance(vtkIdType a, vtkIdType b) const;
+
+    std::vector<double> mPts;           // 3 * nPts
+    std::vector<vtkIdType> mOffsets;    // nPts + 1
+    std::vector<vtkIdType> mNeighbors;
+    std::vector<double> mWeights;
+
+    // рабочие массивы A*: «версия» вместо очистки на каждый запрос
+    mutable std::vector<double> mDist;
+    mutable std::vector<vtkIdType> mParent;
+    mutable std::vector<uint32_t> mSeen;
+    mutable std::vector<uint32_t> mDone;
+    mutable uint32_t mQuery = 0;
+};
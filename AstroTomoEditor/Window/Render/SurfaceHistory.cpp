@@ -0,0 +1,620 @@
+﻿#include "SurfaceHistory.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <vtkCellArray.h>
+#include <vtkCellData.h>
+#include <vtkDataArray.h>
+#include <vtkFloatArray.h>
+#include <vtkIdTypeArray.h>
+#include <vtkPointData.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+
+#include <QDebug>
+
+// Серия подряд идущих элементов: src >= 0 — элементы src.. базы, src < 0 — литералы по порядку.
+struct SurfaceHistoryRun
+{
+    int count = 0;
+    int src = -1;
+};
+
+// Обратная дельта: как собрать версию из соседней (базовой).
+struct SurfaceHistory::Delta
+{
+    vtkIdType basePts = 0;
+    vtkIdType baseTris = 0;
+    vtkIdType nPts = 0;
+    vtkIdType nTris = 0;
+    int pointType = VTK_FLOAT;
+
+    std::vector<SurfaceHistoryRun> pointRuns;
+    std::vector<double> literalPts;     // 3 на литеральную точку
+    std::vector<SurfaceHistoryRun> triRuns;
+    std::vector<int> literalTris;       // 3 на литеральный треугольник, индексы версии
+
+    bool hasNormals = false;
+    std::string normalsName;
+    std::vector<float> literalNormals;  // 3 на литеральную точку
+    std::vector<int> normalFixIds;      // совпавшие точки, у которых нормаль другая
+    std::vector<float> normalFixes;
+
+    qint64 bytes() const
+    {
+        return qint64(sizeof(Delta))
+            + qint64(pointRuns.capacity() + triRuns.capacity()) * qint64(sizeof(SurfaceHistoryRun))
+            + qint64(literalPts.capacity()) * qint64(sizeof(double))
+            + qint64(literalTris.capacity() + normalFixIds.capacity()) * qint64(sizeof(int))
+            + qint64(literalNormals.capacity() + normalFixes.capacity()) * qint64(sizeof(float));
+    }
+};
+
+namespace
+{
+    using Run = SurfaceHistoryRun;
+
+    void AppendRun(std::vector<Run>& runs, int src)
+    {
+        if (!runs.empty())
+        {
+            Run& r = runs.back();
+            const bool extends = (src < 0) ? (r.src < 0) : (r.src >= 0 && r.src + r.count == src);
+            if (extends)
+            {
+                ++r.count;
+                return;
+            }
+        }
+        runs.push_back({ 1, src });
+    }
+
+    // Чисто треугольный меш (только Polys, в точках не больше одного массива — Normals):
+    // доступ к координатам и связности без копирования.
+    struct TriMesh
+    {
+        const float* pf = nullptr;
+        const double* pd = nullptr;
+        const vtkTypeInt64* c64 = nullptr;
+        const vtkTypeInt32* c32 = nullptr;
+        vtkFloatArray* normals = nullptr;
+        const float* nrm = nullptr;
+        vtkIdType nPts = 0;
+        vtkIdType nTris = 0;
+        int pointType = VTK_FLOAT;
+
+        bool init(vtkPolyData* p)
+        {
+            if (!p || !p->GetPoints() || !p->GetPolys())
+                return false;
+            if (p->GetNumberOfVerts() || p->GetNumberOfLines() || p->GetNumberOfStrips())
+                return false;
+            if (p->GetCellData()->GetNumberOfArrays() > 0)
+                return false;
+
+            vtkPointData* pdata = p->GetPointData();
+            if (pdata->GetNumberOfArrays() > 1)
+                return false;
+            if (pdata->GetNumberOfArrays() == 1)
+            {
+                normals = vtkFloatArray::SafeDownCast(pdata->GetNormals());
+                if (!normals || normals != pdata->GetArray(0) || normals->GetNumberOfComponents() != 3)
+                    return false;
+                nrm = normals->GetPointer(0);
+            }
+
+            vtkDataArray* pts = p->GetPoints()->GetData();
+            pointType = pts->GetDataType();
+            if (pts->GetNumberOfComponents() != 3)
+                return false;
+            if (pointType == VTK_FLOAT)
+                pf = static_cast<const float*>(pts->GetVoidPointer(0));
+            else if (pointType == VTK_DOUBLE)
+                pd = static_cast<const double*>(pts->GetVoidPointer(0));
+            else
+                return false;
+
+            vtkCellArray* polys = p->GetPolys();
+            nPts = p->GetNumberOfPoints();
+            nTris = polys->GetNumberOfCells();
+            if (nPts >= INT_MAX || nTris >= INT_MAX / 3)
+                return false;
+            if (polys->GetNumberOfConnectivityIds() != 3 * nTris || (nTris > 0 && polys->GetMaxCellSize() != 3))
+                return false;
+
+            if (polys->IsStorage64Bit())
+                c64 = polys->GetConnectivityArray64()->GetPointer(0);
+            else
+                c32 = polys->GetConnectivityArray32()->GetPointer(0);
+            return true;
+        }
+
+        double coord(vtkIdType i, int c) const { return pf ? double(pf[3 * i + c]) : pd[3 * i + c]; }
+        int id(vtkIdType k) const { return c64 ? int(c64[k]) : int(c32[k]); }
+    };
+
+    bool SameCoord(const TriMesh& a, vtkIdType i, const TriMesh& b, vtkIdType j)
+    {
+        return a.coord(i, 0) == b.coord(j, 0) && a.coord(i, 1) == b.coord(j, 1) && a.coord(i, 2) == b.coord(j, 2);
+    }
+
+    void CollectArrays(vtkPolyData* p, std::unordered_set<vtkDataArray*>& seen)
+    {
+        if (!p)
+            return;
+
+        auto add = [&](vtkDataArray* a) { if (a) seen.insert(a); };
+        if (p->GetPoints())
+            add(p->GetPoints()->GetData());
+        for (int i = 0; i < p->GetPointData()->GetNumberOfArrays(); ++i)
+            add(p->GetPointData()->GetArray(i));
+        for (int i = 0; i < p->GetCellData()->GetNumberOfArrays(); ++i)
+            add(p->GetCellData()->GetArray(i));
+        for (vtkCellArray* ca : { p->GetVerts(), p->GetLines(), p->GetPolys(), p->GetStrips() })
+        {
+            if (!ca)
+                continue;
+            add(ca->GetOffsetsArray());
+            add(ca->GetConnectivityArray());
+        }
+    }
+
+    // Байты уникальных массивов: общие у нескольких мешей считаются один раз.
+    qint64 UniqueBytes(vtkPolyData* a, vtkPolyData* b = nullptr)
+    {
+        std::unordered_set<vtkDataArray*> seen;
+        CollectArrays(a, seen);
+        CollectArrays(b, seen);
+
+        qint64 total = 0;
+        for (vtkDataArray* arr : seen)
+            total += qint64(arr->GetActualMemorySize()) * 1024;
+        return total;
+    }
+
+    bool SharesGeometry(vtkPolyData* a, vtkPolyData* b)
+    {
+        if (!a || !b)
+            return false;
+        if (a == b)
+            return true;
+        return a->GetPoints() && b->GetPoints()
+            && a->GetPoints()->GetData() == b->GetPoints()->GetData()
+            && a->GetPolys()->GetConnectivityArray() == b->GetPolys()->GetConnectivityArray()
+            && a->GetPointData()->GetNormals() == b->GetPointData()->GetNormals()
+            && a->GetNumberOfVerts() == b->GetNumberOfVerts()
+            && a->GetNumberOfLines() == b->GetNumberOfLines()
+            && a->GetNumberOfStrips() == b->GetNumberOfStrips();
+    }
+
+    vtkSmartPointer<vtkPolyData> Share(vtkPolyData* src)
+    {
+        if (!src)
+            return nullptr;
+        auto out = vtkSmartPointer<vtkPolyData>::New();
+        out->ShallowCopy(src);
+        return out;
+    }
+}
+
+// ------------------------- дельта -------------------------
+
+std::shared_ptr<const SurfaceHistory::Delta> SurfaceHistory::encodeDelta(vtkPolyData* target, vtkPolyData* base)
+{
+    TriMesh t, x;
+    if (!t.init(target) || !x.init(base))
+        return nullptr;
+    if (t.pointType != x.pointType || (t.nrm && !x.nrm))
+        return nullptr;
+
+    auto d = std::make_shared<Delta>();
+    d->basePts = x.nPts;
+    d->baseTris = x.nTris;
+    d->nPts = t.nPts;
+    d->nTris = t.nTris;
+    d->pointType = t.pointType;
+    d->hasNormals = t.nrm != nullptr;
+    if (d->hasNormals && t.normals->GetName())
+        d->normalsName = t.normals->GetName();
+
+    // --- точки: сначала продолжение серии, иначе бинарный поиск по координатам базы ---
+    std::vector<int> xOrder;
+    auto lessX = [&](int a, int b)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                const double va = x.coord(a, c), vb = x.coord(b, c);
+                if (va != vb) return va < vb;
+            }
+            return a < b;
+        };
+    auto findX = [&](vtkIdType i) -> int
+        {
+            auto it = std::lower_bound(xOrder.begin(), xOrder.end(), i, [&](int j, vtkIdType ti)
+                {
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        const double vj = x.coord(j, c), vt = t.coord(ti, c);
+                        if (vj != vt) return vj < vt;
+                    }
+                    return false;
+                });
+            return (it != xOrder.end() && SameCoord(t, i, x, *it)) ? *it : -1;
+        };
+
+    std::vector<int> t2x(static_cast<size_t>(t.nPts), -1);
+    std::vector<char> xUsed(static_cast<size_t>(x.nPts), 0);
+    int prev = -1;
+    for (vtkIdType i = 0; i < t.nPts; ++i)
+    {
+        int j = -1;
+        const int cand = prev + 1;
+        if (cand < x.nPts && !xUsed[cand] && SameCoord(t, i, x, cand))
+            j = cand;
+        else
+        {
+            if (xOrder.empty() && x.nPts > 0)
+            {
+                xOrder.resize(static_cast<size_t>(x.nPts));
+                for (int k = 0; k < int(x.nPts); ++k) xOrder[k] = k;
+                std::sort(xOrder.begin(), xOrder.end(), lessX);
+            }
+            j = findX(i);
+            // дубликаты координат: вторая и далее точки идут литералами
+            if (j >= 0 && xUsed[j])
+                j = -1;
+        }
+
+        AppendRun(d->pointRuns, j);
+        if (j >= 0)
+        {
+            xUsed[j] = 1;
+            t2x[i] = j;
+            prev = j;
+            if (t.nrm && std::memcmp(t.nrm + 3 * i, x.nrm + 3 * size_t(j), 3 * sizeof(float)) != 0)
+            {
+                d->normalFixIds.push_back(int(i));
+                d->normalFixes.insert(d->normalFixes.end(), t.nrm + 3 * i, t.nrm + 3 * i + 3);
+            }
+        }
+        else
+        {
+            for (int c = 0; c < 3; ++c)
+                d->literalPts.push_back(t.coord(i, c));
+            if (t.nrm)
+                d->literalNormals.insert(d->literalNormals.end(), t.nrm + 3 * i, t.nrm + 3 * i + 3);
+        }
+    }
+    std::vector<int>().swap(xOrder);
+    std::vector<char>().swap(xUsed);
+
+    // --- треугольники: продолжение серии, иначе поиск среди треугольников базы с той же первой вершиной ---
+    std::vector<int> firstOff, firstTris;
+    auto buildFirstIndex = [&]()
+        {
+            firstOff.assign(static_cast<size_t>(x.nPts) + 1, 0);
+            for (vtkIdType j = 0; j < x.nTris; ++j)
+                ++firstOff[static_cast<size_t>(x.id(3 * j)) + 1];
+            for (size_t k = 1; k < firstOff.size(); ++k)
+                firstOff[k] += firstOff[k - 1];
+            firstTris.resize(static_cast<size_t>(x.nTris));
+            std::vector<int> fill(firstOff.begin(), firstOff.end() - 1);
+            for (vtkIdType j = 0; j < x.nTris; ++j)
+                firstTris[fill[x.id(3 * j)]++] = int(j);
+        };
+    auto sameTri = [&](int j, int a, int b, int c)
+        {
+            return x.id(3 * vtkIdType(j)) == a && x.id(3 * vtkIdType(j) + 1) == b && x.id(3 * vtkIdType(j) + 2) == c;
+        };
+
+    int prevTri = -1;
+    for (vtkIdType f = 0; f < t.nTris; ++f)
+    {
+        const int ta = t.id(3 * f), tb = t.id(3 * f + 1), tc = t.id(3 * f + 2);
+        const int a = t2x[ta], b = t2x[tb], c = t2x[tc];
+
+        int j = -1;
+        if (a >= 0 && b >= 0 && c >= 0)
+        {
+            const int cand = prevTri + 1;
+            if (cand < x.nTris && sameTri(cand, a, b, c))
+                j = cand;
+            else
+            {
+                if (firstOff.empty())
+                    buildFirstIndex();
+                for (int k = firstOff[a]; k < firstOff[size_t(a) + 1]; ++k)
+                    if (sameTri(firstTris[k], a, b, c)) { j = firstTris[k]; break; }
+            }
+        }
+
+        AppendRun(d->triRuns, j);
+        if (j >= 0)
+            prevTri = j;
+        else
+        {
+            d->literalTris.push_back(ta);
+            d->literalTris.push_back(tb);
+            d->literalTris.push_back(tc);
+        }
+    }
+
+    d->pointRuns.shrink_to_fit();
+    d->triRuns.shrink_to_fit();
+    d->literalPts.shrink_to_fit();
+    d->literalTris.shrink_to_fit();
+    d->literalNormals.shrink_to_fit();
+    d->normalFixIds.shrink_to_fit();
+    d->normalFixes.shrink_to_fit();
+    return d;
+}
+
+vtkSmartPointer<vtkPolyData> SurfaceHistory::decodeDelta(const Delta& d, vtkPolyData* base)
+{
+    TriMesh x;
+    if (!x.init(base) || x.nPts != d.basePts || x.nTris != d.baseTris || (d.hasNormals && !x.nrm))
+        return nullptr;
+
+    auto points = vtkSmartPointer<vtkPoints>::New();
+    points->SetDataType(d.pointType);
+    points->SetNumberOfPoints(d.nPts);
+    float* of = (d.pointType == VTK_FLOAT) ? static_cast<float*>(points->GetData()->GetVoidPointer(0)) : nullptr;
+    double* od = of ? nullptr : static_cast<double*>(points->GetData()->GetVoidPointer(0));
+    auto put = [&](vtkIdType i, int c, double v)
+        {
+            if (of) of[3 * i + c] = float(v);
+            else    od[3 * i + c] = v;
+        };
+
+    vtkSmartPointer<vtkFloatArray> normals;
+    float* on = nullptr;
+    if (d.hasNormals)
+    {
+        normals = vtkSmartPointer<vtkFloatArray>::New();
+        normals->SetNumberOfComponents(3);
+        normals->SetNumberOfTuples(d.nPts);
+        if (!d.normalsName.empty())
+            normals->SetName(d.normalsName.c_str());
+        on = normals->GetPointer(0);
+    }
+
+    std::vector<int> x2t(static_cast<size_t>(x.nPts), -1);
+    vtkIdType i = 0;
+    size_t lit = 0;
+    for (const Run& r : d.pointRuns)
+    {
+        for (int k = 0; k < r.count; ++k, ++i)
+        {
+            if (r.src >= 0)
+            {
+                const int j = r.src + k;
+                x2t[j] = int(i);
+                for (int c = 0; c < 3; ++c) put(i, c, x.coord(j, c));
+                if (on) std::memcpy(on + 3 * i, x.nrm + 3 * size_t(j), 3 * sizeof(float));
+            }
+            else
+            {
+                for (int c = 0; c < 3; ++c) put(i, c, d.literalPts[3 * lit + c]);
+                if (on) std::memcpy(on + 3 * i, d.literalNormals.data() + 3 * lit, 3 * sizeof(float));
+                ++lit;
+            }
+        }
+    }
+    for (size_t k = 0; on && k < d.normalFixIds.size(); ++k)
+        std::memcpy(on + 3 * size_t(d.normalFixIds[k]), d.normalFixes.data() + 3 * k, 3 * sizeof(float));
+
+    auto offsets = vtkSmartPointer<vtkIdTypeArray>::New();
+    offsets->SetNumberOfValues(d.nTris + 1);
+    auto conn = vtkSmartPointer<vtkIdTypeArray>::New();
+    conn->SetNumberOfValues(3 * d.nTris);
+    vtkIdType* po = offsets->GetPointer(0);
+    vtkIdType* pc = conn->GetPointer(0);
+
+    vtkIdType f = 0;
+    size_t litTri = 0;
+    for (const Run& r : d.triRuns)
+    {
+        for (int k = 0; k < r.count; ++k, ++f)
+        {
+            if (r.src >= 0)
+            {
+                const vtkIdType j = r.src + k;
+                for (int c = 0; c < 3; ++c) pc[3 * f + c] = x2t[x.id(3 * j + c)];
+            }
+            else
+            {
+                for (int c = 0; c < 3; ++c) pc[3 * f + c] = d.literalTris[3 * litTri + c];
+                ++litTri;
+            }
+        }
+    }
+    for (vtkIdType k = 0; k <= d.nTris; ++k)
+        po[k] = 3 * k;
+
+    auto polys = vtkSmartPointer<vtkCellArray>::New();
+    polys->SetData(offsets, conn);
+
+    auto out = vtkSmartPointer<vtkPolyData>::New();
+    out->SetPoints(points);
+    out->SetPolys(polys);
+    if (normals)
+        out->GetPointData()->SetNormals(normals);
+    return out;
+}
+
+// ------------------------- стеки -------------------------
+
+void SurfaceHistory::setEntryLimit(int limit)
+{
+    mEntryLimit = (limit > 0) ? limit : 1;
+    trim();
+}
+
+void SurfaceHistory::setByteLimit(qint64 bytes)
+{
+    mByteLimit = (bytes > 0) ? bytes : 0;
+    trim();
+}
+
+void SurfaceHistory::clear()
+{
+    mUndo.clear();
+    mRedo.clear();
+}
+
+qint64 SurfaceHistory::bytes() const
+{
+    qint64 total = 0;
+    for (const Slot& s : mUndo) total += s.bytes;
+    for (const Slot& s : mRedo) total += s.bytes;
+    return total;
+}
+
+void SurfaceHistory::push(const State& current)
+{
+    if (!current.surface)
+        return;
+
+    pushTop(mUndo, current);
+    mRedo.clear();
+    trim();
+}
+
+bool SurfaceHistory::undo(const State& current, State& out)
+{
+    if (mUndo.empty() || !current.surface)
+        return false;
+
+    out = popTop(mUndo);
+    pushTop(mRedo, current);
+    trim();
+    return true;
+}
+
+bool SurfaceHistory::redo(const State& current, State& out)
+{
+    if (mRedo.empty() || !current.surface)
+        return false;
+
+    out = popTop(mRedo);
+    pushTop(mUndo, current);
+    trim();
+    return true;
+}
+
+SurfaceHistory::Slot SurfaceHistory::makeSlot(const State& s)
+{
+    Slot slot;
+    slot.surface.full = Share(s.surface);
+    slot.saveIsSurface = !s.save || SharesGeometry(s.save, s.surface);
+    if (!slot.saveIsSurface)
+        slot.save.full = Share(s.save);
+    updateBytes(slot);
+    return slot;
+}
+
+SurfaceHistory::State SurfaceHistory::stateOf(const Slot& s)
+{
+    State st;
+    st.surface = s.surface.full;
+    st.save = s.saveIsSurface ? s.surface.full : s.save.full;
+    return st;
+}
+
+void SurfaceHistory::compress(Slot& older, const State& neighbour)
+{
+    auto tryDelta = [](Version& v, vtkPolyData* base)
+        {
+            if (!v.full || !base)
+                return;
+            const qint64 fullBytes = UniqueBytes(v.full);
+            auto d = encodeDelta(v.full, base);
+            // дельта имеет смысл, только если заметно меньше самого меша
+            if (!d || d->bytes() * 2 > fullBytes)
+                return;
+            v.delta = std::move(d);
+            v.full = nullptr;
+        };
+
+    tryDelta(older.surface, neighbour.surface);
+    if (!older.saveIsSurface)
+        tryDelta(older.save, neighbour.save ? neighbour.save.GetPointer() : neighbour.surface.GetPointer());
+    updateBytes(older);
+}
+
+bool SurfaceHistory::expand(Slot& s, const State& neighbour)
+{
+    auto restore = [](Version& v, vtkPolyData* base)
+        {
+            if (v.full || !v.delta)
+                return v.full != nullptr;
+            v.full = decodeDelta(*v.delta, base);
+            v.delta.reset();
+            return v.full != nullptr;
+        };
+
+    bool ok = restore(s.surface, neighbour.surface);
+    if (!s.saveIsSurface)
+        ok = restore(s.save, neighbour.save ? neighbour.save.GetPointer() : neighbour.surface.GetPointer()) && ok;
+    updateBytes(s);
+    return ok;
+}
+
+void SurfaceHistory::updateBytes(Slot& s)
+{
+    vtkPolyData* save = s.saveIsSurface ? nullptr : s.save.full.GetPointer();
+    s.bytes = UniqueBytes(s.surface.full, save);
+    if (s.surface.delta) s.bytes += s.surface.delta->bytes();
+    if (!s.saveIsSurface && s.save.delta) s.bytes += s.save.delta->bytes();
+}
+
+void SurfaceHistory::pushTop(Stack& st, const State& s)
+{
+    if (!st.empty())
+        compress(st.back(), s);
+    st.push_back(makeSlot(s));
+}
+
+SurfaceHistory::State SurfaceHistory::popTop(Stack& st)
+{
+    Slot top = std::move(st.back());
+    st.pop_back();
+
+    State out = stateOf(top);
+    if (!st.empty() && !expand(st.back(), out))
+    {
+        // база дельты не совпала — более старые версии восстановить нельзя
+        qWarning() << "[SurfaceHistory] delta base mismatch, dropping" << st.size() << "older versions";
+        st.clear();
+    }
+    return out;
+}
+
+void SurfaceHistory::trim()
+{
+    while (int(mUndo.size()) > mEntryLimit) mUndo.pop_front();
+    while (int(mRedo.size()) > mEntryLimit) mRedo.pop_front();
+
+    trimTo(mByteLimit);
+}
+
+qint64 SurfaceHistory::trimTo(qint64 limit)
+{
+    // по байтам: сначала самые старые undo, потом самые дальние redo; вершины стеков не трогаем
+    const qint64 before = bytes();
+    qint64 total = before;
+    while (total > limit)
+    {
+        Stack* st = (mUndo.size() > 1) ? &mUndo : (mRedo.size() > 1) ? &mRedo : nullptr;
+        if (!st)
+            break;
+        total -= st->front().bytes;
+        st->pop_front();
+    }
+    return before - total;
+}
@@ -0,0 +1,77 @@
+﻿#pragma once
+#include <deque>
+#include <memory>
+#include <QtGlobal>
+#include <vtkSmartPointer.h>
+
+class vtkPolyData;
+
+// История STL-поверхностей, ограниченная по байтам.
+// Меши после построения на месте не меняются (каждая правка даёт новый меш), поэтому
+// снимок не копируется глубоко, а делит массивы с отданным мешем.
+// Вершина стека хранится целиком; версии под ней по возможности ужимаются в обратную
+// дельту к соседней, более новой версии: ссылки на совпавшие точки и треугольники плюс литералы.
+class SurfaceHistory
+{
+public:
+    struct State
+    {
+        vtkSmartPointer<vtkPolyData> surface;
+        vtkSmartPointer<vtkPolyData> save; // nullptr или тот же меш — «как surface»
+    };
+
+    void setEntryLimit(int limit);
+    void setByteLimit(qint64 bytes);
+    void clear();
+
+    bool canUndo() const { return !mUndo.empty(); }
+    bool canRedo() const { return !mRedo.empty(); }
+    int undoDepth() const { return int(mUndo.size()); }
+    int redoDepth() const { return int(mRedo.size()); }
+    qint64 bytes() const;
+    // Выселение по давлению памяти: ужать до limit байт (вершины стеков остаются), вернуть освобождённое.
+    qint64 trimTo(qint64 limit);
+
+    // current уходит в undo, redo сбрасывается.
+    void push(const State& current);
+    // current уходит в противоположный стек, out — восстановленное состояние.
+    bool undo(const State& current, State& out);
+    bool redo(const State& current, State& out);
+
+private:
+    struct Delta;
+
+    struct Version
+    {
+        vtkSmartPointer<vtkPolyData> full;
+        std::shared_ptr<const Delta> delta; // если full == nullptr
+    };
+
+    struct Slot
+    {
+        Version surface;
+        Version save;
+        bool saveIsSurface = true;
+        qint64 bytes = 0;
+    };
+
+    using Stack = std::deque<Slot>;
+
+    static std::shared_ptr<const Delta> encodeDelta(vtkPolyData* target, vtkPolyData* base);
+    static vtkSmartPointer<vtkPolyData> decodeDelta(const Delta& d, vtkPolyData* base);
+
+    static Slot makeSlot(const State& s);
+    static State stateOf(const Slot& s);
+    static void compress(Slot& older, const State& neighbour);
+    static bool expand(Slot& s, const State& neighbour);
+    static void updateBytes(Slot& s);
+
+    static void pushTop(Stack& st, const State& s);
+    static State popTop(Stack& st);
+    void trim();
+
+    int mEntryLimit = 128;
+    qint64 mByteLimit = qint64(1024) * 1024 * 1024;
+    Stack mUndo;
+    Stack mRedo;
+};
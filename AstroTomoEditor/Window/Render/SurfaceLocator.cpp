@@ -0,0 +1,105 @@
+﻿#include "SurfaceLocator.h"
+
+#include <atomic>
+
+#include <vtkGenericCell.h>
+#include <vtkNew.h>
+#include <vtkPolyData.h>
+#include <vtkSMPThreadLocalObject.h>
+#include <vtkSMPTools.h>
+#include <vtkStaticCellLocator.h>
+
+void SurfaceLocator::clear()
+{
+    mMesh = nullptr;
+    mStamp = 0;
+    mLocator = nullptr;
+}
+
+bool SurfaceLocator::isStale(vtkPolyData* mesh) const
+{
+    return !mLocator || mMesh.GetPointer() != mesh || !mesh || mesh->GetMTime() != mStamp;
+}
+
+bool SurfaceLocator::sync(vtkPolyData* mesh)
+{
+    if (!mesh || mesh->GetNumberOfCells() == 0)
+    {
+        clear();
+        return false;
+    }
+
+    if (!isStale(mesh))
+        return true;
+
+    // ячейки строятся здесь, а не лениво внутри параллельных запросов
+    if (mesh->NeedToBuildCells())
+        mesh->BuildCells();
+
+    mLocator = vtkSmartPointer<vtkStaticCellLocator>::New();
+    mLocator->SetDataSet(mesh);
+    mLocator->BuildLocator();
+
+    mMesh = mesh;
+    mStamp = mesh->GetMTime();
+    return true;
+}
+
+bool SurfaceLocator::closestPoint(const double p[3], Hit& hit) const
+{
+    hit = Hit{};
+    if (!mLocator)
+        return false;
+
+    vtkNew<vtkGenericCell> cell;
+    int subId = 0;
+    mLocator->FindClosestPoint(p, hit.point.data(), cell, hit.cellId, subId, hit.dist2);
+    return hit.cellId >= 0;
+}
+
+void SurfaceLocator::closestPoints(const Point* pts, size_t count, Hit* hits) const
+{
+    if (!mLocator)
+    {
+        for (size_t i = 0; i < count; ++i)
+            hits[i] = Hit{};
+        return;
+    }
+
+    vtkSMPThreadLocalObject<vtkGenericCell> cells;
+    vtkSMPTools::For(0, vtkIdType(count), [&](vtkIdType b, vtkIdType e)
+        {
+            vtkGenericCell* cell = cells.Local();
+            for (vtkIdType i = b; i < e; ++i)
+            {
+                Hit& hit = hits[size_t(i)];
+                hit = Hit{};
+                int subId = 0;
+                mLocator->FindClosestPoint(pts[size_t(i)].data(), hit.point.data(), cell, hit.cellId, subId, hit.dist2);
+            }
+        });
+}
+
+bool SurfaceLocator::allWithin(const Point* pts, size_t count, double maxDist2) const
+{
+    if (!mLocator)
+        return false;
+
+    std::atomic<bool> ok{ true };
+    vtkSMPThreadLocalObject<vtkGenericCell> cells;
+    vtkSMPTools::For(0, vtkIdType(count), [&](vtkIdType b, vtkIdType e)
+        {
+            vtkGenericCell* cell = cells.Local();
+            for (vtkIdType i = b; i < e && ok.load(std::memory_order_relaxed); ++i)
+            {
+                double closest[3]{};
+                double dist2 = 0.0;
+                vtkIdType cellId = -1;
+                int subId = 0;
+                mLocator->FindClosestPoint(pts[size_t(i)].data(), closest, cell, cellId, subId, dist2);
+                if (cellId < 0 || dist2 > maxDist2)
+                    ok.store(false, std::memory_order_relaxed);
+            }
+        });
+    return ok.load();
+}
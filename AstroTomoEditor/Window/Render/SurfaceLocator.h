@@ -0,0 +1,44 @@
+﻿#pragma once
+#include <array>
+#include <cstddef>
+#include <vtkSmartPointer.h>
+#include <vtkType.h>
+#include <vtkWeakPointer.h>
+
+class vtkPolyData;
+class vtkStaticCellLocator;
+
+// Локатор ячеек поверхности для запросов «ближайшая точка на меше».
+// Один на версию меша: sync пересобирает его, только если меш другой или менялся.
+// Пачки точек обрабатываются параллельно (vtkStaticCellLocator потокобезопасен
+// в варианте запроса с собственной vtkGenericCell).
+class SurfaceLocator
+{
+public:
+    using Point = std::array<double, 3>;
+
+    struct Hit
+    {
+        Point point{};
+        double dist2 = 0.0;
+        vtkIdType cellId = -1;
+    };
+
+    void clear();
+    // true — локатор готов для mesh (пустой меш — false)
+    bool sync(vtkPolyData* mesh);
+    bool isStale(vtkPolyData* mesh) const;
+
+    vtkPolyData* mesh() const { return mMesh; }
+
+    bool closestPoint(const double p[3], Hit& hit) const;
+    // hits[i] для pts[i]
+    void closestPoints(const Point* pts, size_t count, Hit* hits) const;
+    // Все точки не дальше sqrt(maxDist2) от поверхности; выходит, как только нашлась дальняя.
+    bool allWithin(const Point* pts, size_t count, double maxDist2) const;
+
+private:
+    vtkWeakPointer<vtkPolyData> mMesh;
+    vtkMTimeType mStamp = 0;
+    vtkSmartPointer<vtkStaticCellLocator> mLocator;
+};
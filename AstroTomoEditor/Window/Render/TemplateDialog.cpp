@@ -1,5 +1,7 @@
 ﻿#include "TemplateDialog.h"
 
+#include <utility>
+
 #include <QToolButton>
 #include <QLabel>
 #include <QGridLayout>
@@ -9,6 +11,8 @@
 #include <QEvent>
 #include <QFileDialog>
 #include <QDir>
+#include <QFile>
+#include <QFileInfo>
 #include <QStandardPaths>
 #include <QSettings>
 
@@ -486,10 +490,10 @@ void TemplateDialog::onSaveAllTemplates(bool hide, bool saveto, const QString& s
 
     QStringList failed;
 
-    for (const auto& kv : mSlots)
+    for (auto& kv : mSlots)
     {
         const TemplateId id = kv.first;
-        const Slot& slot = kv.second;
+        Slot& slot = kv.second;
 
         if (!slot.hasData())
             continue;
@@ -499,6 +503,8 @@ void TemplateDialog::onSaveAllTemplates(bool hide, bool saveto, const QString& s
 
         if (!saveSlotTo3dr(filePath, slot))
             failed << fileName;
+        else
+            slot.dirty = false;
     }
 
     if (!failed.isEmpty()) 
@@ -522,7 +528,19 @@ bool TemplateDialog::saveSlotTo3dr(const QString& filePath, const Slot& s)
     if (!s.hasData())
         return false;
 
-    vtkImageData* img = s.data.raw();
+    // слой ни разу не читался: файл на диске и есть шаблон — копируем без разбора
+    if (!s.data.isValid())
+    {
+        const QString from = QFileInfo(s.pendingPath).canonicalFilePath();
+        if (from.isEmpty())
+            return false;
+        if (from == QFileInfo(filePath).canonicalFilePath())
+            return true;
+        QFile::remove(filePath);
+        return QFile::copy(from, filePath);
+    }
+
+    vtkSmartPointer<vtkImageData> img = s.data.expand();
     if (!img)
         return false;
 
@@ -549,17 +567,35 @@ void TemplateDialog::retranslateUi()
     applyTexts();
 }
 
+qint64 TemplateDialog::memoryBytes() const
+{
+    qint64 total = 0;
+    for (const auto& [id, s] : mSlots)
+        total += qint64(s.data.memoryBytes());
+    return total;
+}
+
+bool TemplateDialog::hasUnsavedTemplates() const
+{
+    for (const auto& [id, s] : mSlots)
+        if (s.dirty && s.hasData())
+            return true;
+    return false;
+}
+
 bool TemplateDialog::isCaptured(TemplateId id)
 {
     auto& s = mSlots[id];
     return s.hasData();
 }
 
-void TemplateDialog::setCaptured(TemplateId id, Volume img)
+void TemplateDialog::setCaptured(TemplateId id, SparseLabelVolume layer)
 {
     auto& s = mSlots[id];
-    s.data = img;
+    s.data = std::move(layer);
+    s.pendingPath.clear();
     s.visible = true;
+    s.dirty = true;
 
     refreshAll();
 }
@@ -588,6 +624,16 @@ TemplateDialog::Slot* TemplateDialog::slot(TemplateId id)
     return it == mSlots.end() ? nullptr : &it->second;
 }
 
+const SparseLabelVolume* TemplateDialog::layer(TemplateId id)
+{
+    Slot* s = slot(id);
+    if (!s || !s->hasData())
+        return nullptr;
+    if (!s->data.isValid() && !loadSlotFromMini3dr(*s))
+        return nullptr;
+    return &s->data;
+}
+
 // Папка: <DicomPath>/Templates-Series-<SeriesNumberSafe>
 QString TemplateDialog::templatesFolderPath() const
 {
@@ -606,31 +652,26 @@ QString TemplateDialog::templatesFolderPath() const
     return base.filePath(tplFolderName);
 }
 
-bool TemplateDialog::loadSlotFromMini3dr(TemplateId id,
-    const QString& filePath,
-    vtkImageData* seriesImage)
+// Плотный том нужен только на время чтения: в слоте остаются непустые кирпичи.
+bool TemplateDialog::loadSlotFromMini3dr(Slot& s)
 {
-    if (!seriesImage)
+    if (!mSeriesGeom || s.pendingPath.isEmpty())
         return false;
 
     auto img = vtkSmartPointer<vtkImageData>::New();
 
-    img->CopyStructure(seriesImage);
+    img->CopyStructure(mSeriesGeom);
 
     img->AllocateScalars(VTK_UNSIGNED_CHAR, 1);
 
     QString err;
-    if (!Save3DR::readmini3dr_into(filePath, img, &err)) 
+    if (!Save3DR::readmini3dr_into(s.pendingPath, img, &err))
+        return false;
+    if (!s.data.encode(img))
         return false;
 
-    img->Modified();
-
-    Volume v;
-    v.copy(img);
-
-    auto& s = mSlots[id];
-    s.data = std::move(v);
-    s.visible = false;
+    // путь нужен до успешного чтения: после сбоя слот можно загрузить ещё раз
+    s.pendingPath.clear();
     return true;
 }
 
@@ -640,6 +681,9 @@ void TemplateDialog::loadAllTemplatesFromDisk(vtkImageData* seriesImage)
     if (!seriesImage)
         return;
 
+    mSeriesGeom = vtkSmartPointer<vtkImageData>::New();
+    mSeriesGeom->CopyStructure(seriesImage);
+
     const QString folder = templatesFolderPath();
     if (folder.isEmpty())
         return;
@@ -659,8 +703,13 @@ void TemplateDialog::loadAllTemplatesFromDisk(vtkImageData* seriesImage)
         if (!QFileInfo::exists(filePath))
             continue;
 
-        if (loadSlotFromMini3dr(id, filePath, seriesImage))
-            ++loaded;
+        // файл читается лениво, при первом обращении к слою
+        auto& s = mSlots[id];
+        s.data.clear();
+        s.pendingPath = filePath;
+        s.visible = false;
+        s.dirty = false;
+        ++loaded;
     }
 
     if (loaded > 0)
@@ -8,7 +8,7 @@
 #include <QVector>
 #include <QImage>
 #include <Services/DicomRange.h>
-#include "U8Span.h"
+#include "SparseLabelVolume.h"
 #include "..\MainWindow\DialogShell.h"
 #include "..\MainWindow\TitleBar.h"
 
@@ -52,17 +52,24 @@ public:
     void setOnFinished(std::function<void()> cb) { m_onFinished = std::move(cb); }
 
     struct Slot {
-        Volume data;
+        SparseLabelVolume data;
+        QString pendingPath;   // mini3dr на диске, читается при первом обращении
         bool visible = false;
-        bool hasData() const { return data.raw(); }
+        bool dirty = false;    // захвачен и ещё не записан в mini3dr
+        bool hasData() const { return data.isValid() || !pendingPath.isEmpty(); }
     };
 
     // доступ из RenderView (без копий)
     const Slot* slot(TemplateId id) const;
     Slot* slot(TemplateId id);
+    // слой шаблона (отложенный файл дочитывается здесь), nullptr — нет данных
+    const SparseLabelVolume* layer(TemplateId id);
     void loadAllTemplatesFromDisk(vtkImageData* mImage);
     QString templatesFolderPath() const;
     bool isCaptured(TemplateId id);
+    // байты загруженных слоёв (отложенные файлы не считаются)
+    qint64 memoryBytes() const;
+    bool hasUnsavedTemplates() const;
 signals:
     // ВАЖНО: отдаем ГРАНИЦЫ В ДАННЫХ HistMin..HistMax
     void requestCapture(TemplateId id);       // нажали Save
@@ -72,7 +79,7 @@ signals:
     void requestClearScene();
 
 public slots:
-    void setCaptured(TemplateId id, Volume img);
+    void setCaptured(TemplateId id, SparseLabelVolume layer);
     void onSaveAllTemplates(bool hide = false, bool saveto = false, const QString& savedir = {});
     void onClearScene();
 
@@ -95,12 +102,13 @@ private:
     void applyTexts();
     QString safeSeriesFolderName(QString series) const;
 
-    bool loadSlotFromMini3dr(TemplateId id, const QString& filePath, vtkImageData* mImage);
+    bool loadSlotFromMini3dr(Slot& s);
 
 private:
     const DicomInfo* mDinfo = nullptr;
     // данные
     vtkImageData* mImage{ nullptr };
+    vtkSmartPointer<vtkImageData> mSeriesGeom;   // геометрия для отложенных шаблонов
     const QSize mSize{ 420, 140 };
 
     struct Row {
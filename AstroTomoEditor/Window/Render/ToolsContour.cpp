@@ -1,4 +1,5 @@
 ﻿#include "ToolsContour.h"
+#include "RenderScheduler.h"
 
 #include <QEvent>
 #include <QKeyEvent>
@@ -13,11 +14,9 @@
 
 #include <vtkActor.h>
 #include <vtkCellArray.h>
-#include <vtkCellLocator.h>
 #include <vtkCellPicker.h>
 #include <vtkCleanPolyData.h>
 #include <vtkClipPolyData.h>
-#include <vtkDijkstraGraphGeodesicPath.h>
 #include <vtkFeatureEdges.h>
 #include <vtkGlyph3DMapper.h>
 #include <vtkLinearSubdivisionFilter.h>
@@ -179,7 +178,8 @@ ToolsContour::ToolsContour(QWidget* hostParent)
 void ToolsContour::attach(QVTKOpenGLNativeWidget* vtk,
     vtkRenderer* renderer,
     vtkPolyData* mesh,
-    vtkActor* meshActor)
+    vtkActor* meshActor,
+    SurfaceLocator* surfaceLocator)
 {
     if (m_vtk && m_vtk != vtk)
         m_vtk->removeEventFilter(this);
@@ -188,6 +188,7 @@ void ToolsContour::attach(QVTKOpenGLNativeWidget* vtk,
     m_renderer = renderer;
     m_mesh = mesh;
     m_meshActor = meshActor;
+    m_sharedSurfaceLocator = surfaceLocator;
 
     invalidateCaches();
     ensureCaches();
@@ -221,6 +222,8 @@ void ToolsContour::start()
     m_state = State::Collecting;
     m_controlIds.clear();
     m_controlWorldPoints.clear();
+    m_segmentCache.clear();
+    m_dragIndex = -1;
     m_rawContourWorldPoints.clear();
     m_displayContourWorldPoints.clear();
 
@@ -240,6 +243,8 @@ void ToolsContour::cancel()
     m_state = State::Off;
     m_controlIds.clear();
     m_controlWorldPoints.clear();
+    m_segmentCache.clear();
+    m_dragIndex = -1;
     m_rawContourWorldPoints.clear();
     m_displayContourWorldPoints.clear();
 
@@ -288,6 +293,11 @@ bool ToolsContour::eventFilter(QObject* obj, QEvent* ev)
 
         if (me->button() == Qt::LeftButton)
         {
+            // захват уже поставленной точки — перетаскивание
+            m_dragIndex = controlIndexAt(me->pos());
+            if (m_dragIndex >= 0)
+                return true;
+
             vtkIdType pointId = -1;
             WorldPoint worldPoint{};
 
@@ -318,6 +328,28 @@ bool ToolsContour::eventFilter(QObject* obj, QEvent* ev)
         break;
     }
 
+    case QEvent::MouseMove:
+    {
+        if (m_dragIndex < 0)
+            break;
+
+        auto* me = static_cast<QMouseEvent*>(ev);
+        moveControlPoint(m_dragIndex, me->pos());
+        return true;
+    }
+
+    case QEvent::MouseButtonRelease:
+    {
+        auto* me = static_cast<QMouseEvent*>(ev);
+        if (me->button() == Qt::LeftButton && m_dragIndex >= 0)
+        {
+            m_dragIndex = -1;
+            return true;
+        }
+
+        break;
+    }
+
     case QEvent::ContextMenu:
         return true;
 
@@ -380,27 +412,132 @@ bool ToolsContour::pickPoint(const QPoint& viewPos, vtkIdType& pointId, WorldPoi
     return true;
 }
 
+int ToolsContour::controlIndexAt(const QPoint& viewPos) const
+{
+    if (!m_vtk || !m_renderer || m_controlWorldPoints.isEmpty())
+        return -1;
+
+    const double dpr = m_vtk->devicePixelRatioF();
+
+    int rwH = 0;
+    if (auto* rw = m_vtk->renderWindow())
+        rwH = rw->GetSize()[1];
+
+    if (rwH <= 0)
+        rwH = static_cast<int>(m_vtk->height() * dpr);
+
+    const double xd = static_cast<double>(viewPos.x()) * dpr;
+    const double yd = static_cast<double>(rwH - 1) - static_cast<double>(viewPos.y()) * dpr;
+    const double radius = m_controlGrabRadiusPx * dpr;
+
+    // точка за складкой сетки видна в проекции, но не на экране: сверяем с глубиной
+    // последнего кадра. Маркер сам лежит ближе точки на свой радиус — это не заслонение.
+    vtkRenderWindow* rw = m_vtk->renderWindow();
+    const double markerR = m_previewSphereSource ? m_previewSphereSource->GetRadius() : 1.0;
+    const double hiddenTol2 = (2.0 * markerR + 0.5) * (2.0 * markerR + 0.5);
+
+    auto occluded = [&](const WorldPoint& p, const double d[3]) -> bool
+        {
+            if (!rw)
+                return false;
+
+            const int px = static_cast<int>(std::lround(d[0]));
+            const int py = static_cast<int>(std::lround(d[1]));
+            const int* sz = rw->GetSize();
+            if (px < 0 || py < 0 || px >= sz[0] || py >= sz[1])
+                return true;
+
+            const double z = rw->GetZbufferDataAtPoint(px, py);
+            if (z >= d[2])
+                return false;
+
+            m_renderer->SetDisplayPoint(d[0], d[1], z);
+            m_renderer->DisplayToWorld();
+            double w[4]{};
+            m_renderer->GetWorldPoint(w);
+            if (w[3] != 0.0)
+                for (int k = 0; k < 3; ++k)
+                    w[k] /= w[3];
+
+            return distanceSquared(p, WorldPoint{ w[0], w[1], w[2] }) > hiddenTol2;
+        };
+
+    int best = -1;
+    double bestDist2 = radius * radius;
+    for (int i = 0; i < m_controlWorldPoints.size(); ++i)
+    {
+        const WorldPoint& p = m_controlWorldPoints[i];
+        m_renderer->SetWorldPoint(p[0], p[1], p[2], 1.0);
+        m_renderer->WorldToDisplay();
+
+        double d[3]{};
+        m_renderer->GetDisplayPoint(d);
+
+        const double dx = d[0] - xd;
+        const double dy = d[1] - yd;
+        const double dist2 = dx * dx + dy * dy;
+        if (dist2 <= bestDist2 && !occluded(p, d))
+        {
+            bestDist2 = dist2;
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+void ToolsContour::moveControlPoint(int index, const QPoint& viewPos)
+{
+    if (index < 0 || index >= m_controlWorldPoints.size())
+        return;
+
+    vtkIdType pointId = -1;
+    WorldPoint worldPoint{};
+    if (!pickPoint(viewPos, pointId, worldPoint))
+        return;
+
+    if (distanceSquared(m_controlWorldPoints[index], worldPoint) < 1e-12)
+        return;
+
+    m_controlIds[index] = pointId;
+    m_controlWorldPoints[index] = worldPoint;
+
+    rebuildContourFromControls();
+    updatePreviewGeometry();
+    renderNow();
+}
+
 void ToolsContour::invalidateCaches()
 {
     m_pathMesh = nullptr;
     m_pathPointLocator = nullptr;
     m_surfaceLocator = nullptr;
+    m_ownSurfaceLocator.clear();
+    m_pathGraph.clear();
+    m_segmentCache.clear();
+    m_cacheMeshStamp = 0;
     m_cacheValid = false;
 }
 
 bool ToolsContour::ensureCaches()
 {
-    if (m_cacheValid && m_pathMesh && m_pathPointLocator && m_surfaceLocator)
+    // граф и локаторы живут, пока меш тот же и не менялся
+    if (m_cacheValid && m_mesh && m_mesh->GetMTime() == m_cacheMeshStamp
+        && m_pathMesh && m_pathPointLocator && surface() && !m_pathGraph.empty())
         return true;
 
+    if (m_cacheValid)
+        invalidateCaches();
+
     if (!m_mesh || m_mesh->GetNumberOfPoints() == 0 || m_mesh->GetNumberOfCells() == 0)
         return false;
 
     rebuildPathCacheFromMesh();
 
-    if (!m_pathMesh || !m_pathPointLocator || !m_surfaceLocator)
+    if (!m_pathMesh || !m_pathPointLocator || !surface() || m_pathGraph.empty())
         return false;
 
+    m_cacheMeshStamp = m_mesh->GetMTime();
     m_cacheValid = true;
     return true;
 }
@@ -466,9 +603,30 @@ void ToolsContour::rebuildPathCacheFromMesh()
     m_pathPointLocator->SetDataSet(m_pathMesh);
     m_pathPointLocator->BuildLocator();
 
-    m_surfaceLocator = vtkSmartPointer<vtkCellLocator>::New();
-    m_surfaceLocator->SetDataSet(m_mesh);
-    m_surfaceLocator->BuildLocator();
+    m_pathGraph.build(m_pathMesh);
+
+    // локатор исходной поверхности: общий уже готов, если RenderView его синхронизировал
+    m_surfaceLocator = m_sharedSurfaceLocator ? m_sharedSurfaceLocator : &m_ownSurfaceLocator;
+    if (!m_surfaceLocator->sync(m_mesh))
+        m_surfaceLocator = nullptr;
+}
+
+const SurfaceLocator* ToolsContour::surface() const
+{
+    return (m_surfaceLocator && !m_surfaceLocator->isStale(m_mesh)) ? m_surfaceLocator : nullptr;
+}
+
+void ToolsContour::projectToSurface(WorldPoint* pts, size_t count) const
+{
+    const SurfaceLocator* locator = surface();
+    if (!locator || count == 0)
+        return;
+
+    std::vector<SurfaceLocator::Hit> hits(count);
+    locator->closestPoints(pts, count, hits.data());
+    for (size_t i = 0; i < count; ++i)
+        if (hits[i].cellId >= 0)
+            pts[i] = hits[i].point;
 }
 
 vtkIdType ToolsContour::findClosestPathPointId(const double worldPoint[3]) const
@@ -485,7 +643,7 @@ bool ToolsContour::computeGeodesicSegment(const WorldPoint& fromPoint,
 {
     outPath.clear();
 
-    if (!m_mesh || !m_pathMesh)
+    if (!m_mesh || !m_pathMesh || m_pathGraph.empty())
         return false;
 
     const double from[3] = { fromPoint[0], fromPoint[1], fromPoint[2] };
@@ -496,41 +654,18 @@ bool ToolsContour::computeGeodesicSegment(const WorldPoint& fromPoint,
     if (startVertex < 0 || endVertex < 0)
         return false;
 
-    vtkNew<vtkDijkstraGraphGeodesicPath> dijkstra;
-    dijkstra->SetInputData(m_pathMesh);
-    dijkstra->SetStartVertex(startVertex);
-    dijkstra->SetEndVertex(endVertex);
-    dijkstra->Update();
-
-    vtkPolyData* out = dijkstra->GetOutput();
-    if (!out || !out->GetPoints() || out->GetNumberOfPoints() == 0)
+    // A* по постоянному графу: путь от start к end, раскрывается только окрестность
+    std::vector<vtkIdType> vertices;
+    if (!m_pathGraph.shortestPath(startVertex, endVertex, vertices))
         return false;
 
-    outPath.reserve(static_cast<size_t>(out->GetNumberOfPoints()));
-    for (vtkIdType i = 0; i < out->GetNumberOfPoints(); ++i)
+    outPath.reserve(vertices.size());
+    for (vtkIdType id : vertices)
     {
-        double p[3]{};
-        out->GetPoint(i, p);
+        const double* p = m_pathGraph.point(id);
         outPath.push_back({ p[0], p[1], p[2] });
     }
 
-    const auto dist2ToFrom = [&](const WorldPoint& p)
-        {
-            const double dx = p[0] - fromPoint[0];
-            const double dy = p[1] - fromPoint[1];
-            const double dz = p[2] - fromPoint[2];
-            return dx * dx + dy * dy + dz * dz;
-        };
-
-    if (outPath.size() >= 2)
-    {
-        const double frontDist = dist2ToFrom(outPath.front());
-        const double backDist = dist2ToFrom(outPath.back());
-
-        if (backDist < frontDist)
-            std::reverse(outPath.begin(), outPath.end());
-    }
-
     if (!outPath.empty())
     {
         outPath.front() = fromPoint;
@@ -639,17 +774,40 @@ void ToolsContour::rebuildContourFromControls()
         return;
     }
 
-    std::vector<WorldPoint> segment;
+    // Сегменты с теми же концами берутся из прошлой сборки: добавление или
+    // перетаскивание точки пересчитывает только два соседних сегмента.
+    std::vector<CachedSegment> previous;
+    previous.swap(m_segmentCache);
 
     auto appendSegment = [&](int fromIndex, int toIndex, bool skipFirstPoint)
         {
-            if (!computeGeodesicSegment(m_controlWorldPoints[fromIndex], m_controlWorldPoints[toIndex], segment))
-                return false;
+            const WorldPoint& from = m_controlWorldPoints[fromIndex];
+            const WorldPoint& to = m_controlWorldPoints[toIndex];
+
+            auto cached = std::find_if(previous.begin(), previous.end(), [&](const CachedSegment& s)
+                {
+                    return s.from == from && s.to == to;
+                });
+
+            CachedSegment segment;
+            if (cached != previous.end())
+            {
+                segment = std::move(*cached);
+                previous.erase(cached);
+            }
+            else
+            {
+                segment.from = from;
+                segment.to = to;
+                if (!computeGeodesicSegment(from, to, segment.path))
+                    return false;
+            }
 
             const int beginIndex = skipFirstPoint ? 1 : 0;
-            for (int i = beginIndex; i < static_cast<int>(segment.size()); ++i)
-                m_rawContourWorldPoints.push_back(segment[static_cast<size_t>(i)]);
+            for (int i = beginIndex; i < static_cast<int>(segment.path.size()); ++i)
+                m_rawContourWorldPoints.push_back(segment.path[static_cast<size_t>(i)]);
 
+            m_segmentCache.push_back(std::move(segment));
             return true;
         };
 
@@ -787,7 +945,7 @@ QVector<ToolsContour::WorldPoint> ToolsContour::smoothClosedLoopOnSurface(const
     int iterations,
     double factor) const
 {
-    if (!m_mesh || !m_surfaceLocator || closedLoop.size() < 3)
+    if (!m_mesh || !surface() || closedLoop.size() < 3)
         return closedLoop;
 
     QVector<WorldPoint> current = closedLoop;
@@ -803,22 +961,15 @@ QVector<ToolsContour::WorldPoint> ToolsContour::smoothClosedLoopOnSurface(const
             const WorldPoint& cur = current[i];
             const WorldPoint& nxt = current[(i + 1) % current.size()];
 
-            WorldPoint blended{};
+            WorldPoint& blended = next[i];
             for (int axis = 0; axis < 3; ++axis)
             {
                 const double neighborMean = 0.5 * (prev[axis] + nxt[axis]);
                 blended[axis] = (1.0 - factor) * cur[axis] + factor * neighborMean;
             }
-
-            double closest[3]{};
-            double dist2 = 0.0;
-            vtkIdType cellId = -1;
-            int subId = -1;
-
-            m_surfaceLocator->FindClosestPoint(blended.data(), closest, cellId, subId, dist2);
-            next[i] = { closest[0], closest[1], closest[2] };
         }
 
+        projectToSurface(next.data(), size_t(next.size()));
         current.swap(next);
     }
 
@@ -830,7 +981,7 @@ std::vector<ToolsContour::WorldPoint> ToolsContour::smoothOpenPathOnSurface(cons
     double lambda,
     double mu) const
 {
-    if (!m_mesh || !m_surfaceLocator || path.size() < 3 || iterations <= 0)
+    if (!m_mesh || !surface() || path.size() < 3 || iterations <= 0)
         return path;
 
     std::vector<WorldPoint> current = path;
@@ -839,16 +990,6 @@ std::vector<ToolsContour::WorldPoint> ToolsContour::smoothOpenPathOnSurface(cons
     lambda = std::clamp(lambda, 0.0, 1.0);
     mu = std::clamp(mu, -1.0, -1e-6);
 
-    auto projectToSurface = [&](WorldPoint& p)
-        {
-            double closest[3]{};
-            double dist2 = 0.0;
-            vtkIdType cellId = -1;
-            int subId = -1;
-            m_surfaceLocator->FindClosestPoint(p.data(), closest, cellId, subId, dist2);
-            p = { closest[0], closest[1], closest[2] };
-        };
-
     auto laplacianPoint = [](const WorldPoint& prev, const WorldPoint& cur, const WorldPoint& next)
         {
             WorldPoint lap{};
@@ -864,16 +1005,16 @@ std::vector<ToolsContour::WorldPoint> ToolsContour::smoothOpenPathOnSurface(cons
             const WorldPoint lap = laplacianPoint(current[i - 1], current[i], current[i + 1]);
             for (int axis = 0; axis < 3; ++axis)
                 work[i][axis] = current[i][axis] + lambda * lap[axis];
-            projectToSurface(work[i]);
         }
+        projectToSurface(work.data() + 1, work.size() - 2);
 
         for (size_t i = 1; i + 1 < work.size(); ++i)
         {
             const WorldPoint lap = laplacianPoint(work[i - 1], work[i], work[i + 1]);
             for (int axis = 0; axis < 3; ++axis)
                 current[i][axis] = work[i][axis] + mu * lap[axis];
-            projectToSurface(current[i]);
         }
+        projectToSurface(current.data() + 1, current.size() - 2);
     }
 
     return current;
@@ -883,21 +1024,21 @@ vtkSmartPointer<vtkPoints> ToolsContour::projectLoopToMesh(
     const QVector<WorldPoint>& loop,
     vtkPolyData* mesh) const
 {
-    vtkNew<vtkCellLocator> locator;
-    locator->SetDataSet(mesh);
-    locator->BuildLocator();
+    // mesh — та же поверхность, что m_mesh, если общий локатор к ней и привязан
+    SurfaceLocator local;
+    const SurfaceLocator* locator = surface();
+    if (!locator || locator->mesh() != mesh)
+        locator = local.sync(mesh) ? &local : nullptr;
+    if (!locator)
+        return nullptr;
 
-    vtkSmartPointer<vtkPoints> pts = vtkSmartPointer<vtkPoints>::New();
+    std::vector<SurfaceLocator::Hit> hits(size_t(loop.size()));
+    locator->closestPoints(loop.constData(), hits.size(), hits.data());
 
-    for (const auto& p : loop)
-    {
-        double closest[3]{};
-        double dist2 = 0.0;
-        vtkIdType cellId = -1;
-        int subId = -1;
-        locator->FindClosestPoint(p.data(), closest, cellId, subId, dist2);
-        pts->InsertNextPoint(closest);
-    }
+    vtkSmartPointer<vtkPoints> pts = vtkSmartPointer<vtkPoints>::New();
+    pts->SetNumberOfPoints(vtkIdType(hits.size()));
+    for (size_t i = 0; i < hits.size(); ++i)
+        pts->SetPoint(vtkIdType(i), hits[i].point.data());
 
     return pts;
 }
@@ -1214,8 +1355,8 @@ void ToolsContour::updatePreviewGeometry()
 
 void ToolsContour::renderNow()
 {
-    if (m_vtk && m_vtk->renderWindow())
-        m_vtk->renderWindow()->Render();
+    if (m_vtk)
+        RenderScheduler::request(m_vtk->renderWindow());
 }
 
 double ToolsContour::distanceSquared(const WorldPoint& a, const WorldPoint& b)
@@ -1234,23 +1375,11 @@ bool ToolsContour::almostEqual(const WorldPoint& a, const WorldPoint& b, double
 QVector<ToolsContour::WorldPoint> ToolsContour::projectClosedLoopToSurface(
     const QVector<WorldPoint>& closedLoop) const
 {
-    if (!m_surfaceLocator || closedLoop.isEmpty())
+    if (!surface() || closedLoop.isEmpty())
         return closedLoop;
 
-    QVector<WorldPoint> projected;
-    projected.reserve(closedLoop.size());
-
-    for (const auto& p : closedLoop)
-    {
-        double closest[3]{};
-        double dist2 = 0.0;
-        vtkIdType cellId = -1;
-        int subId = -1;
-
-        m_surfaceLocator->FindClosestPoint(p.data(), closest, cellId, subId, dist2);
-        projected.push_back({ closest[0], closest[1], closest[2] });
-    }
-
+    QVector<WorldPoint> projected = closedLoop;
+    projectToSurface(projected.data(), size_t(projected.size()));
     return projected;
 }
 
@@ -1,6 +1,8 @@
 ﻿#pragma once
 
 #include "Tools.h"
+#include "SurfaceGeodesicGraph.h"
+#include "SurfaceLocator.h"
 
 #include <QObject>
 #include <QPoint>
@@ -17,7 +19,6 @@
 class QVTKOpenGLNativeWidget;
 
 class vtkActor;
-class vtkCellLocator;
 class vtkCellPicker;
 class vtkGlyph3DMapper;
 class vtkPoints;
@@ -38,7 +39,8 @@ public:
     void attach(QVTKOpenGLNativeWidget* vtk,
         vtkRenderer* renderer,
         vtkPolyData* mesh,
-        vtkActor* meshActor);
+        vtkActor* meshActor,
+        SurfaceLocator* surfaceLocator = nullptr);
 
     bool handle(Action a);
     void onViewResized();
@@ -69,12 +71,27 @@ private:
 
     using WorldPoint = std::array<double, 3>;
 
+    // Готовый сегмент между двумя контрольными точками: при перестройке контура
+    // пересчитываются только сегменты с изменившимися концами.
+    struct CachedSegment
+    {
+        WorldPoint from{};
+        WorldPoint to{};
+        std::vector<WorldPoint> path;
+    };
+
 private:
     bool pickPoint(const QPoint& viewPos, vtkIdType& pointId, WorldPoint& worldPoint) const;
+    int controlIndexAt(const QPoint& viewPos) const;
+    void moveControlPoint(int index, const QPoint& viewPos);
 
     bool ensureCaches();
     void invalidateCaches();
     vtkIdType findClosestPathPointId(const double worldPoint[3]) const;
+    // Локатор m_mesh (общий из RenderView, если передан), nullptr — не готов.
+    const SurfaceLocator* surface() const;
+    // Точки на поверхность, пачкой и параллельно; без попадания точка остаётся как есть.
+    void projectToSurface(WorldPoint* pts, size_t count) const;
     void rebuildPathCacheFromMesh();
 
     bool computeGeodesicSegment(const WorldPoint& fromPoint,
@@ -130,7 +147,11 @@ private:
 
     vtkSmartPointer<vtkPolyData> m_pathMesh;
     vtkSmartPointer<vtkStaticPointLocator> m_pathPointLocator;
-    vtkSmartPointer<vtkCellLocator> m_surfaceLocator;
+    SurfaceLocator* m_sharedSurfaceLocator = nullptr;
+    SurfaceLocator m_ownSurfaceLocator;
+    SurfaceLocator* m_surfaceLocator = nullptr;
+    SurfaceGeodesicGraph m_pathGraph;
+    vtkMTimeType m_cacheMeshStamp = 0;
     bool m_cacheValid = false;
 
     State m_state = State::Off;
@@ -138,6 +159,8 @@ private:
 
     QVector<vtkIdType> m_controlIds;
     QVector<WorldPoint> m_controlWorldPoints;
+    std::vector<CachedSegment> m_segmentCache;
+    int m_dragIndex = -1;
 
     // Контур по сегментам геодезики.
     QVector<WorldPoint> m_rawContourWorldPoints;
@@ -165,6 +188,8 @@ private:
     int m_previewSurfaceRelaxIterations = 2;
     double m_previewSurfaceRelaxFactor = 0.12;
 
+    int m_controlGrabRadiusPx = 8;
+
     int m_pathfindingSubdivisionIterations = 1;
     double m_maxPathfindingSubdivisionGrowthRatio = 12.0;
 
@@ -1,4 +1,5 @@
 ﻿#include "ToolsRemoveConnected.h"
+#include "RenderScheduler.h"
 
 #include <QWidget>
 #include <QMouseEvent>
@@ -38,6 +39,7 @@
 #include <vtkProperty.h>
 
 #include "Tools.h"
+#include <Services/Trace.h>
 #include <vtkFlyingEdges3D.h>
 #include <vtkImageMask.h>
 
@@ -75,6 +77,30 @@ void ToolsRemoveConnected::attach(QVTKOpenGLNativeWidget* vtk,
     onViewResized();
 }
 
+#ifndef ASTRO_NO_TRACE
+// Имя действия для трассировки (литерал — Trace хранит указатель)
+static const char* actionTraceName(Action a)
+{
+    switch (a)
+    {
+    case Action::RemoveUnconnected: return "RemoveUnconnected";
+    case Action::RemoveConnected:   return "RemoveConnected";
+    case Action::SmartDeleting:     return "SmartDeleting";
+    case Action::RemoveSelected:    return "RemoveSelected";
+    case Action::VoxelEraser:       return "VoxelEraser";
+    case Action::VoxelRecovery:     return "VoxelRecovery";
+    case Action::AddBase:           return "AddBase";
+    case Action::FillEmpty:         return "FillEmpty";
+    case Action::TotalSmoothing:    return "TotalSmoothing";
+    case Action::SurfaceMapping:    return "SurfaceMapping";
+    case Action::PeelRecovery:      return "PeelRecovery";
+    case Action::Plus:              return "Plus";
+    case Action::Minus:             return "Minus";
+    default:                        return "Tool";
+    }
+}
+#endif
+
 static void forwardMouseToWidget(QWidget* target, QMouseEvent* me)
 {
     if (!target || !me) return;
@@ -165,22 +191,21 @@ void ToolsRemoveConnected::rebuildVisibilityLUT()
     auto* pwf = prop->GetScalarOpacity(0);
     if (!pwf) return;
 
-    // работаем по целым HU
-    const int lo = HistMin;
-    const int hi = HistMax;
-    const int bins = hi - lo + 1;
-    if (bins <= 0) return;
+    TF::RgbaLut lut;
+    TF::SampleLut(nullptr, pwf, lut);
+    setVisibilityLut(lut);
+}
 
-    mLutMin = lo;
-    mLutMax = hi;
-    mLutBins = bins;
-    mVisibleLut.assign(bins, 0);
+void ToolsRemoveConnected::setVisibilityLut(const TF::RgbaLut& lut)
+{
+    // работаем по целым значениям HistMin..HistMax
+    mLutMin = HistMin;
+    mLutMax = HistMax;
+    mLutBins = int(lut.size());
+    mVisibleLut.assign(lut.size(), 0);
 
-    for (int v = lo; v <= hi; ++v) 
-    {
-        const double op = pwf->GetValue(static_cast<double>(v));
-        mVisibleLut[v - lo] = (op > 0) ? 1 : 0;
-    }
+    for (size_t v = 0; v < lut.size(); ++v)
+        mVisibleLut[v] = (lut[v][3] > 0.0f) ? 1 : 0;
 }
 
 uint8_t ToolsRemoveConnected::GetAverageVisibleValue()
@@ -415,6 +440,18 @@ void ToolsRemoveConnected::onViewResized()
     m_overlay->setGeometry(r);
 }
 
+qint64 ToolsRemoveConnected::workingBytes() const
+{
+    // m_vol смотрит на изображение RenderView — его учитывает сам RenderView
+    qint64 total = 0;
+    if (vtkImageData* b = m_bin.raw())
+        total += qint64(b->GetActualMemorySize()) * 1024;
+    if (m_hasOrig)
+        if (vtkImageData* o = m_orig.raw())
+            total += qint64(o->GetActualMemorySize()) * 1024;
+    return total;
+}
+
 void ToolsRemoveConnected::cancel()
 {
     m_state = State::Off;
@@ -541,7 +578,7 @@ void ToolsRemoveConnected::updateHover(const QPoint& pDevice)
             }
         }
 
-        if (auto* rw = m_vtk->renderWindow()) rw->Render();
+        RenderScheduler::request(m_vtk->renderWindow(), RenderScheduler::Kind::Overlay);
         if (m_overlay) m_overlay->setCursor(Qt::CrossCursor);
     }
     else
@@ -549,7 +586,7 @@ void ToolsRemoveConnected::updateHover(const QPoint& pDevice)
         m_hasHover = false;
         if (mHoverActor)  mHoverActor->SetVisibility(0);
         if (mBrushActor)  mBrushActor->SetVisibility(0);
-        if (auto* rw = m_vtk->renderWindow()) rw->Render();
+        RenderScheduler::request(m_vtk->renderWindow(), RenderScheduler::Kind::Overlay);
         if (m_overlay) m_overlay->setCursor(Qt::ForbiddenCursor);
     }
 }
@@ -564,6 +601,7 @@ void ToolsRemoveConnected::start(Action a, HoverMode hm)
     
     m_mode = a;
     m_hm = hm;
+    m_hasEditRegion = false;
     m_vol.clear();
     m_vol.copy(m_image);
     m_bin.clear();
@@ -576,26 +614,7 @@ void ToolsRemoveConnected::start(Action a, HoverMode hm)
         currentprogress = 0;
         progress(0);
 
-        switch (m_mode)
-        {
-        case Action::Plus:
-            PlusVoxels();
-            break;
-        case Action::Minus:
-            MinusVoxels();
-            break;
-        case Action::TotalSmoothing:
-            TotalSmoothingVolume();
-            break;
-        case Action::PeelRecovery:
-            PeelRecoveryVolume();
-            break;
-        case Action::SurfaceMapping:
-            SurfaceMappingVolume();
-            break;
-        default:
-            break;
-        }
+        applyToWholeVolume();
 
         if (m_vol.raw())
             m_vol.raw()->Modified();
@@ -646,6 +665,7 @@ void ToolsRemoveConnected::onLeftClick(const QPoint& pDevice)
 
     m_vol.clear();
     m_vol.copy(m_image);
+    m_hasEditRegion = false;
 
     m_bin.clear();
     onViewResized();
@@ -656,57 +676,7 @@ void ToolsRemoveConnected::onLeftClick(const QPoint& pDevice)
 
     int seed[3]{ 0,0,0 };
     if (screenToSeedIJK(pDevice, seed))
-    {
-        // === кисти работают без floodFill ===
-        if (m_mode == Action::VoxelEraser)
-        {
-            applyVoxelErase(seed);
-            successfulfunc = true;
-        }
-        else if (m_mode == Action::VoxelRecovery)
-        {
-            applyVoxelRecover(seed);
-            successfulfunc = true;
-        }
-        else
-        {
-            std::vector<uint8_t> mark;
-            const int cnt = floodFill6(m_bin, seed, mark);
-            if (cnt > 0)
-            {
-                progress(10);
-                status(tr("Find avarege visible value"));
-                AverageVisibleValue = GetAverageVisibleValue();
-
-                switch (m_mode)
-                {
-                case Action::RemoveUnconnected:
-                    applyKeepOnlySelected(mark);
-                    break;
-                case Action::RemoveSelected:
-                    applyRemoveSelected(mark);
-                    break;
-                case Action::RemoveConnected:
-                    RemoveConnectedRegions(mark, seed);
-                    break;
-                case Action::SmartDeleting:
-                    RemoveConnectedRegions(mark, seed);
-                    SmartDeleting(seed);
-                    break;
-                case Action::AddBase:
-                    AddBaseToBounds(mark, seed);
-                    break;
-                case Action::FillEmpty:
-                    FillEmptyRegions(mark, seed);
-                    break;
-                default:
-                    break;
-                }
-
-                successfulfunc = true;
-            }
-        }
-    }
+        successfulfunc = applyAtSeed(seed);
 
     if (successfulfunc)
     {
@@ -729,6 +699,132 @@ void ToolsRemoveConnected::onLeftClick(const QPoint& pDevice)
     }
 }
 
+void ToolsRemoveConnected::applyToWholeVolume()
+{
+    TRACE_SCOPE("tools", actionTraceName(m_mode));
+    switch (m_mode)
+    {
+    case Action::Plus:
+        PlusVoxels();
+        break;
+    case Action::Minus:
+        MinusVoxels();
+        break;
+    case Action::TotalSmoothing:
+        TotalSmoothingVolume();
+        break;
+    case Action::PeelRecovery:
+        PeelRecoveryVolume();
+        break;
+    case Action::SurfaceMapping:
+        SurfaceMappingVolume();
+        break;
+    default:
+        break;
+    }
+}
+
+bool ToolsRemoveConnected::applyAtSeed(const int seed[3])
+{
+    TRACE_SCOPE("tools", actionTraceName(m_mode));
+    // === кисти работают без floodFill ===
+    if (m_mode == Action::VoxelEraser)
+    {
+        applyVoxelErase(seed);
+        return true;
+    }
+    if (m_mode == Action::VoxelRecovery)
+    {
+        applyVoxelRecover(seed);
+        return true;
+    }
+
+    std::vector<uint8_t> mark;
+    int cnt = 0;
+    {
+        TRACE_SCOPE("tools", "floodFill6");
+        cnt = floodFill6(m_bin, seed, mark);
+    }
+    if (cnt <= 0)
+        return false;
+
+    progress(10);
+    status(tr("Find avarege visible value"));
+    AverageVisibleValue = GetAverageVisibleValue();
+
+    switch (m_mode)
+    {
+    case Action::RemoveUnconnected:
+        applyKeepOnlySelected(mark);
+        break;
+    case Action::RemoveSelected:
+        applyRemoveSelected(mark);
+        break;
+    case Action::RemoveConnected:
+        RemoveConnectedRegions(mark, seed);
+        break;
+    case Action::SmartDeleting:
+        RemoveConnectedRegions(mark, seed);
+        SmartDeleting(seed);
+        break;
+    case Action::AddBase:
+        AddBaseToBounds(mark, seed);
+        break;
+    case Action::FillEmpty:
+        FillEmptyRegions(mark, seed);
+        break;
+    default:
+        break;
+    }
+    return true;
+}
+
+vtkSmartPointer<vtkImageData> ToolsRemoveConnected::runOffscreen(Action a,
+    vtkImageData* image,
+    const int seed[3],
+    const TF::RgbaLut& visibility,
+    double histLo,
+    double histHi)
+{
+    if (!image) return nullptr;
+
+    m_image = image;
+    mHistLo = histLo;
+    mHistHi = histHi;
+    setVisibilityLut(visibility);
+
+    m_mode = a;
+    m_vol.clear();
+    m_vol.copy(image);
+    m_bin.clear();
+    makeBinaryMask(image);
+    currentprogress = 0;
+
+    bool ok = true;
+    switch (a)
+    {
+    case Action::SurfaceMapping:
+        // без вида стартовая точка задаётся явно, а не ищется от центра экрана
+        SurfaceMappingFromSeed(seed);
+        break;
+    case Action::Minus:
+    case Action::Plus:
+    case Action::TotalSmoothing:
+    case Action::PeelRecovery:
+        applyToWholeVolume();
+        break;
+    default:
+        ok = applyAtSeed(seed);
+        break;
+    }
+
+    vtkSmartPointer<vtkImageData> out = ok ? m_vol.smart() : nullptr;
+    m_bin.clear();
+    m_vol.clear();
+    m_image = nullptr;
+    return out;
+}
+
 static inline size_t linearIdx(int i, int j, int k, const int ext[6], int nx, int ny) {
     return size_t(k - ext[4]) * (nx * ny) + size_t(j - ext[2]) * nx + size_t(i - ext[0]);
 }
@@ -783,6 +879,23 @@ void ToolsRemoveConnected::EnsureOriginalSnapshot(vtkImageData* _image)
     m_hasOrig = true;
 }
 
+void ToolsRemoveConnected::setEditRegion(const int ext[6], int i0, int i1, int j0, int j1, int k0, int k1)
+{
+    m_editLo[0] = i0 - ext[0]; m_editHi[0] = i1 - ext[0];
+    m_editLo[1] = j0 - ext[2]; m_editHi[1] = j1 - ext[2];
+    m_editLo[2] = k0 - ext[4]; m_editHi[2] = k1 - ext[4];
+    m_hasEditRegion = i0 <= i1 && j0 <= j1 && k0 <= k1;
+}
+
+bool ToolsRemoveConnected::editRegion(int lo[3], int hi[3]) const
+{
+    if (!m_hasEditRegion)
+        return false;
+    std::copy(m_editLo, m_editLo + 3, lo);
+    std::copy(m_editHi, m_editHi + 3, hi);
+    return true;
+}
+
 void ToolsRemoveConnected::applyVoxelErase(const int seed[3])
 {
     vtkImageData* im = m_vol.raw();
@@ -808,6 +921,7 @@ void ToolsRemoveConnected::applyVoxelErase(const int seed[3])
     const int j1 = std::min(ext[3], seed[1] + R);
     const int k0 = std::max(ext[4], seed[2] - R);
     const int k1 = std::min(ext[5], seed[2] + R);
+    setEditRegion(ext, i0, i1, j0, j1, k0, k1);
 
     auto* p0 = static_cast<unsigned char*>(
         im->GetScalarPointer(ext[0], ext[2], ext[4]));
@@ -873,6 +987,7 @@ void ToolsRemoveConnected::applyVoxelRecover(const int seed[3])
     const int j1 = std::min(ext[3], seed[1] + R);
     const int k0 = std::max(ext[4], seed[2] - R);
     const int k1 = std::min(ext[5], seed[2] + R);
+    setEditRegion(ext, i0, i1, j0, j1, k0, k1);
 
     auto* baseCur = static_cast<unsigned char*>(
         curIm->GetScalarPointer(ext[0], ext[2], ext[4]));
@@ -1361,6 +1476,7 @@ void ToolsRemoveConnected::applyThreshold3D(vtkImageData* image, double threshol
 // ---- ядро ----
 void ToolsRemoveConnected::makeBinaryMask(vtkImageData* image)
 {
+    TRACE_SCOPE("tools", "makeBinaryMask");
     m_bin.set(image, [&](uint8_t v) -> uint8_t
         {
             if (v <= 0u)
@@ -1371,6 +1487,9 @@ void ToolsRemoveConnected::makeBinaryMask(vtkImageData* image)
 
             return mVisibleLut[v];
         });
+
+    m_binBricks.build(m_bin.raw());
+    m_binBricks.classifyAbove(0.0);
 }
 
 double ToolsRemoveConnected::ClearingVolume(Volume& vol,
@@ -1767,15 +1886,10 @@ bool ToolsRemoveConnected::screenToSeedIJK(const QPoint& pDevice, int ijk[3]) co
     if (std::abs(dy) < tiny) dy = (dy >= 0 ? tiny : -tiny);
     if (std::abs(dz) < tiny) dz = (dz >= 0 ? tiny : -tiny);
 
-    // Текущий воксель — по floor (а не round!)
-    int ix = static_cast<int>(std::floor(sx + 0.5)); // можно без +0.5, если надо жёстче
-    int iy = static_cast<int>(std::floor(sy + 0.5));
-    int iz = static_cast<int>(std::floor(sz + 0.5));
-
     // Направление шага по каждой оси
-    int stepx = (dx > 0) ? +1 : -1;
-    int stepy = (dy > 0) ? +1 : -1;
-    int stepz = (dz > 0) ? +1 : -1;
+    const int stepx = (dx > 0) ? +1 : -1;
+    const int stepy = (dy > 0) ? +1 : -1;
+    const int stepz = (dz > 0) ? +1 : -1;
 
     // Границы «следующей» плоскости сетки по каждой оси
     auto nextBoundary = [&](double s, int step)->double {
@@ -1783,54 +1897,72 @@ bool ToolsRemoveConnected::screenToSeedIJK(const QPoint& pDevice, int ijk[3]) co
         return step > 0 ? (cell + 1.0) : cell; // если идём +, то правая грань; если -, то левая
         };
 
-    double txMax = (nextBoundary(sx, stepx) - sx) / dx;
-    double tyMax = (nextBoundary(sy, stepy) - sy) / dy;
-    double tzMax = (nextBoundary(sz, stepz) - sz) / dz;
-
     // Сколько t нужно, чтобы пересечь одну ячейку по оси
     const double txDelta = 1.0 / std::abs(dx);
     const double tyDelta = 1.0 / std::abs(dy);
     const double tzDelta = 1.0 / std::abs(dz);
 
-    // Бросаем луч, пока внутри экстента и не прошли конец (t>1)
+    // Бросаем луч, пока внутри экстента и не прошли конец отрезка
     auto inExt = [&](int i, int j, int k)->bool {
         return (i >= ext[0] && i <= ext[1] && j >= ext[2] && j <= ext[3] && k >= ext[4] && k <= ext[5]);
         };
 
-    int maxIters = (ext[1] - ext[0] + 1) + (ext[3] - ext[2] + 1) + (ext[5] - ext[4] + 1); // верхняя оценка
-    double t = 0.0;
+    // Воксельный DDA на отрезке луча t ∈ [t0, t1]
+    auto march = [&](double t0, double t1) -> bool {
+        const double px = sx + dx * t0, py = sy + dy * t0, pz = sz + dz * t0;
 
-    // Перед DDA — если старт внутри и воксель видимый, берём сразу
-    if (inExt(ix, iy, iz) && atBin(ix, iy, iz) != 0) {
-        ijk[0] = ix; ijk[1] = iy; ijk[2] = iz; return true;
-    }
+        // Текущий воксель — по floor (а не round!)
+        int ix = static_cast<int>(std::floor(px + 0.5)); // можно без +0.5, если надо жёстче
+        int iy = static_cast<int>(std::floor(py + 0.5));
+        int iz = static_cast<int>(std::floor(pz + 0.5));
 
-    while (t <= 1.0 && maxIters-- > 0) {
-        // выбираем по какой оси пересекаем ближайшую грань
-        if (txMax < tyMax) {
-            if (txMax < tzMax) {
-                ix += stepx; t = txMax; txMax += txDelta;
-            }
-            else {
-                iz += stepz; t = tzMax; tzMax += tzDelta;
-            }
+        double txMax = t0 + (nextBoundary(px, stepx) - px) / dx;
+        double tyMax = t0 + (nextBoundary(py, stepy) - py) / dy;
+        double tzMax = t0 + (nextBoundary(pz, stepz) - pz) / dz;
+
+        int maxIters = (ext[1] - ext[0] + 1) + (ext[3] - ext[2] + 1) + (ext[5] - ext[4] + 1); // верхняя оценка
+        double t = t0;
+
+        // Перед DDA — если старт внутри и воксель видимый, берём сразу
+        if (inExt(ix, iy, iz) && atBin(ix, iy, iz) != 0) {
+            ijk[0] = ix; ijk[1] = iy; ijk[2] = iz; return true;
         }
-        else {
-            if (tyMax < tzMax) {
-                iy += stepy; t = tyMax; tyMax += tyDelta;
+
+        while (t <= t1 && maxIters-- > 0) {
+            // выбираем по какой оси пересекаем ближайшую грань
+            if (txMax < tyMax) {
+                if (txMax < tzMax) {
+                    ix += stepx; t = txMax; txMax += txDelta;
+                }
+                else {
+                    iz += stepz; t = tzMax; tzMax += tzDelta;
+                }
             }
             else {
-                iz += stepz; t = tzMax; tzMax += tzDelta;
+                if (tyMax < tzMax) {
+                    iy += stepy; t = tyMax; tyMax += tyDelta;
+                }
+                else {
+                    iz += stepz; t = tzMax; tzMax += tzDelta;
+                }
             }
-        }
 
-        if (!inExt(ix, iy, iz)) continue;
-        if (atBin(ix, iy, iz) != 0) {
-            ijk[0] = ix; ijk[1] = iy; ijk[2] = iz;
-            return true;
+            if (!inExt(ix, iy, iz)) continue;
+            if (atBin(ix, iy, iz) != 0) {
+                ijk[0] = ix; ijk[1] = iy; ijk[2] = iz;
+                return true;
+            }
         }
-    }
-    return false;
+        return false;
+        };
+
+    // Пустые кирпичи маски пролетаем целиком, DDA — только внутри непустых
+    if (m_binBricks.isStale(m_bin.raw()))
+        return march(0.0, 1.0);
+
+    const double a[3]{ sx - ext[0], sy - ext[2], sz - ext[4] };
+    const double b[3]{ ex - ext[0], ey - ext[2], ez - ext[4] };
+    return m_binBricks.forEachVisibleSpan(a, b, march);
 }
 
 int ToolsRemoveConnected::floodFill6(const Volume& bin,
@@ -3807,6 +3939,12 @@ void ToolsRemoveConnected::SurfaceMappingVolume()
         return;
     }
 
+    SurfaceMappingFromSeed(seed);
+}
+
+void ToolsRemoveConnected::SurfaceMappingFromSeed(const int seed[3])
+{
+    TRACE_SCOPE("tools", "SurfaceMappingFromSeed");
     progress(25);
     status(tr("Finding connected regions"));
 
@@ -8,6 +8,8 @@
 #include <QPoint>
 
 #include "U8Span.h"
+#include "VolumeBrickGrid.h"
+#include "TransferFunction.h"
 #include <vtkSphereSource.h>
 #include <vtkImplicitPolyDataDistance.h>
 #include <QPolygon.h>
@@ -55,6 +57,9 @@ public:
     // коллбэки на замену изображения (DeepCopy внутрь) и завершение инструмента
     void setOnImageReplaced(std::function<void(vtkImageData*)> cb) { m_onImageReplaced = std::move(cb); }
     void Unsuccessful(std::function<void(vtkImageData*)> cb) { m_Unsuccessful = std::move(cb); }
+    // Регион, в котором новая копия отличается от прежнего тома (индексы от начала экстента).
+    // Известен только для кистей; false — правка могла задеть весь том.
+    bool editRegion(int lo[3], int hi[3]) const;
     void setOnFinished(std::function<void()> cb) { m_onFinished = std::move(cb); }
 
     // запуск инструмента выбранным действием
@@ -63,6 +68,18 @@ public:
     // отмена (снятие overlay, выход из режима)
     void cancel();
 
+    // рабочие буферы инструмента (бинарная маска, оригинал) — для учёта памяти
+    qint64 workingBytes() const;
+
+    // Действие без вида (бенчмарк): seed — воксель «клика», для SurfaceMapping — стартовая точка.
+    // Возвращает изменённую копию image или nullptr, если из seed нечего выделить.
+    vtkSmartPointer<vtkImageData> runOffscreen(Action a,
+        vtkImageData* image,
+        const int seed[3],
+        const TF::RgbaLut& visibility,
+        double histLo,
+        double histHi);
+
     // обновление позиции overlay при ресайзе вида
     void onViewResized();
 
@@ -76,6 +93,8 @@ public:
 
     // дергаем при изменении TF/OTF, чтобы пересчитать видимость
     void notifyTfChanged() { rebuildVisibilityLUT(); }
+    // видимость из готовой таблицы TF (opacity > 0), без опроса OTF
+    void setVisibilityLut(const TF::RgbaLut& lut);
     void setHoverHighlightSizeVoxels(int r) { m_hoverRadiusVoxels = std::max(1, r); }
     void EnsureOriginalSnapshot(vtkImageData* _image);
     void ClearOriginalSnapshot();
@@ -97,6 +116,8 @@ private:
     void onLeftClick(const QPoint& pDevice);
     void start(Action a, HoverMode hm);
     void redraw();
+    bool applyAtSeed(const int seed[3]);   // действия по клику; false — пустая компонента
+    void applyToWholeVolume();             // действия без клика
 
     // ядро
     void RecoveryNonVisibleVoxels(Volume& volume);
@@ -123,6 +144,7 @@ private:
     void FindSurf(Volume& volNew, std::vector<uint8_t>& mark);
     void ConnectSurfaceToVolume(Volume& volNew, const std::vector<uint8_t>& mark, int shift);
     void SurfaceMappingVolume();
+    void SurfaceMappingFromSeed(const int seed[3]);
     bool pickSeedNearScreenPoint(const QPoint& p0, int outSeed[3]) const;
 
     uint8_t GetAverageVisibleValue();
@@ -163,6 +185,7 @@ private:
 
     Volume        m_vol;
     Volume        m_bin;
+    VolumeBrickGrid m_binBricks; // кирпичи m_bin: лучи пикинга пропускают пустоту
 
     Action m_mode{};
     HoverMode m_hm{ HoverMode::None };
@@ -170,6 +193,11 @@ private:
     Volume m_orig;
     bool   m_hasOrig{ false };
 
+    bool m_hasEditRegion{ false };
+    int  m_editLo[3]{ 0, 0, 0 };
+    int  m_editHi[3]{ -1, -1, -1 };
+    void setEditRegion(const int ext[6], int i0, int i1, int j0, int j1, int k0, int k1);
+
     std::function<void(vtkImageData*)> m_onImageReplaced;
     std::function<void(vtkImageData*)> m_Unsuccessful;
     std::function<void()>              m_onFinished;
@@ -8,9 +8,12 @@
 // VTK
 #include <vtkRenderer.h>
 #include <vtkCamera.h>
+#include <vtkMatrix3x3.h>
+#include <vtkMatrix4x4.h>
+#include <vtkSMPTools.h>
 #include <vtkImageData.h>
 #include <vtkVolume.h>
-#include <vtkGPUVolumeRayCastMapper.h>
+#include "VolumeRenderBackend.h"
 #include <vtkPoints.h>
 #include <vtkPolygon.h>
 #include <vtkCellArray.h>
@@ -21,6 +24,8 @@
 #include <vtkSmartPointer.h>
 #include <vtkRenderWindow.h>
 #include <QPainterPath.h>
+#include <QImage>
+#include <QPolygonF>
 #include <vtkSelectPolyData.h>
 #include <vtkClipPolyData.h>
 #include <vtkCleanPolyData.h>
@@ -37,8 +42,11 @@
 #include <vtkAppendPolyData.h>
 #include <vtkContourTriangulator.h>
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
+#include <map>
+#include <vector>
 #include <vtkTransformPolyDataFilter.h>
 #include <vtkTransform.h>
 #include <vtkTriangleFilter.h>
@@ -538,21 +546,18 @@ void ToolsScissors::finish()
         return;
     }
 
-    vtkImageData* out = applyPolygonCut(m_pts, m_cutInside);
+    const bool cut = applyPolygonCut(m_pts, m_cutInside);
     repeat();
 
-    qDebug() << "finish image result =" << (out ? "ok" : "null");
+    qDebug() << "finish image result =" << (cut ? "cut" : "nothing");
 
-    if (!out)
+    if (!cut)
         return;
 
-    if (auto* gm = vtkGPUVolumeRayCastMapper::SafeDownCast(m_volume->GetMapper()))
-        gm->SetInputData(out);
+    if (m_onImageEdited)
+        m_onImageEdited(m_image);
     else
-        m_volume->GetMapper()->SetInputDataObject(out);
-
-    if (m_onImageReplaced)
-        m_onImageReplaced(out);
+        VolumeRenderBackend::setInput(m_volume->GetMapper(), m_image);
 
     if (m_vtk && m_vtk->renderWindow())
         m_vtk->renderWindow()->Render();
@@ -607,357 +612,190 @@ void ToolsScissors::paintOverlay(QPainter& p)
         p.drawEllipse(m_cursorPos, 2, 2);
 }
 
-vtkImageData* ToolsScissors::applyPolygonCut(vtkImageData* sourceImage, const QVector<QPoint>& pts2D, bool cutInside)
+namespace
 {
-    if (!m_renderer || !m_vtk || !sourceImage) return nullptr;
-
-    // 0) Вспомогалка: взять DirectionMatrix (или I)
-    vtkNew<vtkMatrix3x3> M;
-    if (auto* dm = sourceImage->GetDirectionMatrix()) M->DeepCopy(dm);
-    else M->Identity();
+    // Отрезок вокселей [i0, i1] строки j одного слоя — под очистку.
+    struct CutRun { int j, i0, i1; };
 
-    // построим D^T (world->IJK поворот)
-    double DT[3][3]{
-        { M->GetElement(0,0), M->GetElement(1,0), M->GetElement(2,0) },
-        { M->GetElement(0,1), M->GetElement(1,1), M->GetElement(2,1) },
-        { M->GetElement(0,2), M->GetElement(1,2), M->GetElement(2,2) },
-    };
+    template <typename T>
+    void ClearCutRuns(vtkImageData* image, const std::vector<std::vector<CutRun>>& runs)
+    {
+        int ext[6]; image->GetExtent(ext);
+        vtkIdType inc[3]; image->GetIncrements(inc);
+        const int nc = image->GetNumberOfScalarComponents();
+        T* base = static_cast<T*>(image->GetScalarPointer(ext[0], ext[2], ext[4]));
 
-    // origin и spacing изображения
-    double org[3]; sourceImage->GetOrigin(org);
-    double sp[3]; sourceImage->GetSpacing(sp);
+        vtkSMPTools::For(0, vtkIdType(runs.size()), [&](vtkIdType k0, vtkIdType k1)
+            {
+                for (vtkIdType k = k0; k < k1; ++k)
+                    for (const CutRun& r : runs[size_t(k)])
+                    {
+                        T* p = base + k * inc[2] + vtkIdType(r.j - ext[2]) * inc[1] + vtkIdType(r.i0 - ext[0]) * inc[0];
+                        std::fill(p, p + vtkIdType(r.i1 - r.i0 + 1) * nc, T(0));
+                    }
+            });
+    }
+}
 
-    // --- 1) POV камеры (лучи) ---
+bool ToolsScissors::applyPolygonCut(vtkImageData* image, const QVector<QPoint>& pts2D, bool cutInside)
+{
+    if (!m_renderer || !m_vtk || !image || pts2D.size() < 3) return false;
     auto* cam = m_renderer->GetActiveCamera();
-    if (!cam) return nullptr;
-
-    // Нормаль к плоскости экрана — это и есть направление "от камеры вглубь"
-    double vpn[3]; cam->GetViewPlaneNormal(vpn); // направлена ОТ камеры к сцене
-    // Приведём её к единичному масштабу и переведём в IJK
-    auto mulDT = [&](const double v[3], double out[3]) {
-        out[0] = DT[0][0] * v[0] + DT[0][1] * v[1] + DT[0][2] * v[2];
-        out[1] = DT[1][0] * v[0] + DT[1][1] * v[1] + DT[1][2] * v[2];
-        out[2] = DT[2][0] * v[0] + DT[2][1] * v[1] + DT[2][2] * v[2];
-        };
-    double dirW[3]{ vpn[0], vpn[1], vpn[2] }, dirIJK[3]{};
-    double nrm = std::sqrt(dirW[0] * dirW[0] + dirW[1] * dirW[1] + dirW[2] * dirW[2]);
-    if (nrm < 1e-12) nrm = 1.0;
-    for (int i = 0; i < 3; ++i) dirW[i] /= nrm;
-    mulDT(dirW, dirIJK);
-
-    double pos[3]; cam->GetPosition(pos);
-    double foc[3]; cam->GetFocalPoint(foc);
-
-    double dir[3]{ foc[0] - pos[0], foc[1] - pos[1], foc[2] - pos[2] };
-    double len = std::sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
-    if (len < 1e-12) len = 1.0;
-    for (int i = 0; i < 3; ++i) dir[i] /= len;
-
-    // z-слой на дисплее берём по текущему фокусу
-    double focDisp[3]{ 0,0,0 };
-    m_renderer->SetWorldPoint(foc[0], foc[1], foc[2], 1.0);
-    m_renderer->WorldToDisplay();
-    m_renderer->GetDisplayPoint(focDisp);
-
-    // --- 2) Qt->VTK: инвертируем Y и учитываем DPR/размер окна ---
-    const double dpr = m_vtk ? m_vtk->devicePixelRatioF() : 1.0;
-    int rwW = 0, rwH = 0;
-    if (auto* rw = m_vtk ? m_vtk->renderWindow() : nullptr) {
-        const int* sz = rw->GetSize(); rwW = sz[0]; rwH = sz[1];
-    }
-    else {
-        rwW = int(m_vtk->width() * dpr);
-        rwH = int(m_vtk->height() * dpr);
-    }
+    auto* rw = m_vtk->renderWindow();
+    if (!cam || !rw || !image->GetScalarPointer()) return false;
 
-    vtkNew<vtkPoints> worldPts;
-    worldPts->SetNumberOfPoints(pts2D.size());
-    for (int i = 0; i < pts2D.size(); ++i) {
-        const double xd = pts2D[i].x() * dpr;
-        const double yd = (rwH - 1) - pts2D[i].y() * dpr; // ВАЖНО: инверсия Y
-        m_renderer->SetDisplayPoint(xd, yd, focDisp[2]);
-        m_renderer->DisplayToWorld();
-        double w[4]; m_renderer->GetWorldPoint(w);
-        if (std::abs(w[3]) > 1e-12) { w[0] /= w[3]; w[1] /= w[3]; w[2] /= w[3]; }
-        worldPts->SetPoint(i, w[0], w[1], w[2]);
-    }
+    // --- 1) Лассо → битовая карта экрана (один раз), строки сверху вниз, как у Qt ---
+    const double dpr = m_vtk->devicePixelRatioF();
+    const int* sz = rw->GetSize();
+    const int rwW = sz[0], rwH = sz[1];
+    if (rwW <= 0 || rwH <= 0) return false;
 
-    // --- 3) World→IJK: поворот D^T и сдвиг на origin ---
-    vtkNew<vtkPoints> ijkPts;
-    ijkPts->SetNumberOfPoints(worldPts->GetNumberOfPoints());
-    for (vtkIdType i = 0; i < worldPts->GetNumberOfPoints(); ++i) {
-        double w[3]; worldPts->GetPoint(i, w);
-        // world -> (world - origin)
-        double rel[3]{ w[0] - org[0], w[1] - org[1], w[2] - org[2] };
-        // повернуть D^T
-        double p[3]; mulDT(rel, p);
-        // НЕ делим на spacing здесь — мы зададим spacing в p2s
-        ijkPts->SetPoint(i, p[0], p[1], p[2]);
+    QImage lasso(rwW, rwH, QImage::Format_Grayscale8);
+    lasso.fill(0);
+    {
+        // центр пикселя p — в p + 0.5, а точка экрана q ищется в пикселе round(q)
+        QPolygonF poly;
+        poly.reserve(pts2D.size());
+        for (const QPoint& q : pts2D)
+            poly << QPointF(q.x() * dpr + 0.5, q.y() * dpr + 0.5);
+
+        QPainter painter(&lasso);
+        painter.setRenderHint(QPainter::Antialiasing, false);
+        painter.setPen(Qt::NoPen);
+        painter.setBrush(Qt::white);
+        painter.drawPolygon(poly, Qt::OddEvenFill);
+    }
+    const uchar* bits = lasso.constBits();
+    const qsizetype stride = lasso.bytesPerLine();
+
+    // --- 2) IJK → клип-координаты одной матрицей: P * [D * diag(sp) | origin] ---
+    // z-диапазон 0..1 — как у DisplayToWorld, т.е. прежний фрустум от near до far
+    vtkMatrix4x4* P = cam->GetCompositeProjectionTransformMatrix(m_renderer->GetTiledAspectRatio(), 0.0, 1.0);
+
+    vtkNew<vtkMatrix3x3> D;
+    if (auto* dm = image->GetDirectionMatrix()) D->DeepCopy(dm);
+    else D->Identity();
+    double org[3]; image->GetOrigin(org);
+    double sp[3]; image->GetSpacing(sp);
+
+    double T[4][4]{};
+    for (int r = 0; r < 3; ++r)
+    {
+        for (int c = 0; c < 3; ++c)
+            T[r][c] = D->GetElement(r, c) * sp[c];
+        T[r][3] = org[r];
     }
+    T[3][3] = 1.0;
 
-    // Собираем полигон в IJK-пространстве
-    vtkNew<vtkPolygon> poly;
-    poly->GetPointIds()->SetNumberOfIds(ijkPts->GetNumberOfPoints());
-    for (vtkIdType i = 0; i < ijkPts->GetNumberOfPoints(); ++i)
-        poly->GetPointIds()->SetId(i, i);
-
-    // --- 4) FRUSTUM: near/far per-vertex, сборка замкнутого полиэдра в IJK ---
-    vtkNew<vtkPoints> nearW, farW;
-    nearW->SetNumberOfPoints(pts2D.size());
-    farW->SetNumberOfPoints(pts2D.size());
-
-    for (int i = 0; i < pts2D.size(); ++i) {
-        const double xd = pts2D[i].x() * dpr;
-        const double yd = (rwH - 1) - pts2D[i].y() * dpr; // инверсия Y
-
-        // near (z = 0)
-        m_renderer->SetDisplayPoint(xd, yd, 0.0);
-        m_renderer->DisplayToWorld();
-        double nw[4]; m_renderer->GetWorldPoint(nw);
-        if (std::abs(nw[3]) > 1e-12) { nw[0] /= nw[3]; nw[1] /= nw[3]; nw[2] /= nw[3]; }
-        nearW->SetPoint(i, nw[0], nw[1], nw[2]);
-
-        // far (z = 1)
-        m_renderer->SetDisplayPoint(xd, yd, 1.0);
-        m_renderer->DisplayToWorld();
-        double fw[4]; m_renderer->GetWorldPoint(fw);
-        if (std::abs(fw[3]) > 1e-12) { fw[0] /= fw[3]; fw[1] /= fw[3]; fw[2] /= fw[3]; }
-        farW->SetPoint(i, fw[0], fw[1], fw[2]);
-    }
+    double A[4][4]{};
+    for (int r = 0; r < 4; ++r)
+        for (int c = 0; c < 4; ++c)
+            for (int m = 0; m < 4; ++m)
+                A[r][c] += P->GetElement(r, m) * T[m][c];
 
-    // World -> IJK: (w - origin) * D^T
-    auto toIJK = [&](vtkPoints* srcW, vtkPoints* dstIJK) 
+    double* vp = m_renderer->GetViewport();
+    const double sx = 0.5 * rwW * (vp[2] - vp[0]), ox = rwW * vp[0];
+    const double sy = 0.5 * rwH * (vp[3] - vp[1]), oy = rwH * vp[1];
+
+    // --- 3) Классификация центров вокселей, параллельно по z: отрезки строк под очистку ---
+    int ext[6]; image->GetExtent(ext);
+    const int nz = ext[5] - ext[4] + 1;
+    std::vector<std::vector<CutRun>> runs(size_t(std::max(0, nz)));
+
+    vtkSMPTools::For(0, vtkIdType(nz), [&](vtkIdType kb, vtkIdType ke)
         {
-            dstIJK->SetNumberOfPoints(srcW->GetNumberOfPoints());
-            for (vtkIdType i = 0; i < srcW->GetNumberOfPoints(); ++i) 
+            for (vtkIdType kk = kb; kk < ke; ++kk)
             {
-                double w[3]; srcW->GetPoint(i, w);
-                double rel[3]{ w[0] - org[0], w[1] - org[1], w[2] - org[2] };
-                double p[3];
-                p[0] = DT[0][0] * rel[0] + DT[0][1] * rel[1] + DT[0][2] * rel[2];
-                p[1] = DT[1][0] * rel[0] + DT[1][1] * rel[1] + DT[1][2] * rel[2];
-                p[2] = DT[2][0] * rel[0] + DT[2][1] * rel[1] + DT[2][2] * rel[2];
-                dstIJK->SetPoint(i, p);
+                const int k = ext[4] + int(kk);
+                auto& slice = runs[size_t(kk)];
+
+                for (int j = ext[2]; j <= ext[3]; ++j)
+                {
+                    // вдоль строки клип-координаты линейны по i
+                    double b[4];
+                    for (int r = 0; r < 4; ++r)
+                        b[r] = A[r][1] * j + A[r][2] * k + A[r][3];
+
+                    int runStart = -1;
+                    for (int i = ext[0]; i <= ext[1]; ++i)
+                    {
+                        const double x = b[0] + A[0][0] * i;
+                        const double y = b[1] + A[1][0] * i;
+                        const double z = b[2] + A[2][0] * i;
+                        const double w = b[3] + A[3][0] * i;
+
+                        bool inside = false;
+                        if (w > 1e-12)
+                        {
+                            const double zn = z / w;
+                            if (zn >= 0.0 && zn <= 1.0)
+                            {
+                                const long px = std::lround((x / w + 1.0) * sx + ox);
+                                const long py = std::lround((rwH - 1) - ((y / w + 1.0) * sy + oy));
+                                inside = px >= 0 && py >= 0 && px < rwW && py < rwH
+                                    && bits[py * stride + px] != 0;
+                            }
+                        }
+
+                        // семантика меню: Scissors — убрать внутри, Inverse — снаружи
+                        const bool clear = (inside == cutInside);
+                        if (clear && runStart < 0)
+                            runStart = i;
+                        else if (!clear && runStart >= 0)
+                        {
+                            slice.push_back({ j, runStart, i - 1 });
+                            runStart = -1;
+                        }
+                    }
+                    if (runStart >= 0)
+                        slice.push_back({ j, runStart, ext[1] });
+                }
             }
-        };
-
-    vtkNew<vtkPoints> nearIJK, farIJK;
-    toIJK(nearW, nearIJK);
-    toIJK(farW, farIJK);
-
-    // Общая таблица точек: [ near(0..N-1), far(N..2N-1) ]
-    const vtkIdType N = static_cast<vtkIdType>(pts2D.size());
-    vtkNew<vtkPoints> allPts; allPts->SetNumberOfPoints(2 * N);
-    for (vtkIdType i = 0; i < N; ++i) {
-        double p[3];
-        nearIJK->GetPoint(i, p); allPts->SetPoint(i, p);
-        farIJK->GetPoint(i, p); allPts->SetPoint(N + i, p);
-    }
+        });
 
-    vtkNew<vtkCellArray> faces;
+    int lo[3]{ ext[1] - ext[0] + 1, ext[3] - ext[2] + 1, nz };
+    int hi[3]{ -1, -1, -1 };
+    for (int kk = 0; kk < nz; ++kk)
+        for (const CutRun& r : runs[size_t(kk)])
+        {
+            lo[0] = std::min(lo[0], r.i0 - ext[0]);
+            hi[0] = std::max(hi[0], r.i1 - ext[0]);
+            lo[1] = std::min(lo[1], r.j - ext[2]);
+            hi[1] = std::max(hi[1], r.j - ext[2]);
+            lo[2] = std::min(lo[2], kk);
+            hi[2] = std::max(hi[2], kk);
+        }
+    if (hi[0] < 0)
+        return false;
+    std::copy(lo, lo + 3, m_editLo);
+    std::copy(hi, hi + 3, m_editHi);
 
-    // Near cap: тот же порядок, что рисовали
-    {
-        vtkNew<vtkPolygon> cap;
-        cap->GetPointIds()->SetNumberOfIds(N);
-        for (vtkIdType i = 0; i < N; ++i) cap->GetPointIds()->SetId(i, i);
-        faces->InsertNextCell(cap);
-    }
+    // --- 4) Снимок для undo до правки, затем очистка на месте ---
+    if (m_onBeforeImageEdit)
+        m_onBeforeImageEdit();
 
-    // Far cap: обратный порядок, индексы смещены на N
+    switch (image->GetScalarType())
     {
-        vtkNew<vtkPolygon> cap;
-        cap->GetPointIds()->SetNumberOfIds(N);
-        for (vtkIdType i = 0; i < N; ++i) cap->GetPointIds()->SetId(i, N + (N - 1 - i));
-        faces->InsertNextCell(cap);
-    }
-
-    // Боковые панели: квадраты → два треугольника
-    for (vtkIdType i = 0; i < N; ++i) {
-        const vtkIdType i0 = i;
-        const vtkIdType i1 = (i + 1) % N;
-        const vtkIdType j0 = N + i0;
-        const vtkIdType j1 = N + i1;
-
-        // tri1: near(i0), near(i1), far(i1)
-        faces->InsertNextCell(3);
-        faces->InsertCellPoint(i0);
-        faces->InsertCellPoint(i1);
-        faces->InsertCellPoint(j1);
-
-        // tri2: near(i0), far(i1), far(i0)
-        faces->InsertNextCell(3);
-        faces->InsertCellPoint(i0);
-        faces->InsertCellPoint(j1);
-        faces->InsertCellPoint(j0);
+        vtkTemplateMacro(ClearCutRuns<VTK_TT>(image, runs));
+    default:
+        return false;
     }
 
-    vtkNew<vtkPolyData> frustumIJK;
-    frustumIJK->SetPoints(allPts);
-    frustumIJK->SetPolys(faces);
-
-    // Немного подчистим и триангулируем (надёжность)
-    vtkNew<vtkCleanPolyData> clean;
-    clean->SetInputData(frustumIJK);
-    clean->ConvertPolysToLinesOff();
-    clean->Update();
-
-    vtkNew<vtkTriangleFilter> tri;
-    tri->SetInputConnection(clean->GetOutputPort());
-    tri->Update();
-
-    // --- 5) Растеризация в сетку изображения ---
-    int   ext[6]; sourceImage->GetExtent(ext);
-
-    vtkNew<vtkPolyDataToImageStencil> p2s;
-    p2s->SetInputConnection(tri->GetOutputPort());
-    p2s->SetOutputOrigin(0.0, 0.0, 0.0);   // важно: точки уже в IJK*spacing
-    p2s->SetOutputSpacing(sp);
-    p2s->SetOutputWholeExtent(ext);
-    p2s->Update();
-
-    vtkNew<vtkImageStencil> sten;
-    sten->SetInputData(sourceImage);
-    sten->SetStencilConnection(p2s->GetOutputPort());
-    // семантика меню: Scissors = оставить внутри, Inverse = снаружи
-    sten->SetReverseStencil(cutInside);
-    sten->SetBackgroundValue(0);
-    sten->Update();
-
-    // Возвращаем новый vtkImageData во владение VTK (жить будет, пока держим ссылку в маппере и RenderView)
-    vtkImageData* out = vtkImageData::New();
-    out->DeepCopy(sten->GetOutput());
-    return out;
+    image->Modified();
+    return true;
 }
 
-vtkImageData* ToolsScissors::applyPolygonCut(const QVector<QPoint>& pts2D, bool cutInside)
+void ToolsScissors::editRegion(int lo[3], int hi[3]) const
 {
-    return applyPolygonCut(m_image, pts2D, cutInside);
+    std::copy(m_editLo, m_editLo + 3, lo);
+    std::copy(m_editHi, m_editHi + 3, hi);
 }
 
-static vtkSmartPointer<vtkPolyData> BuildScreenFrustumWorld(
-    QVTKOpenGLNativeWidget* vtk,
-    vtkRenderer* renderer,
-    const QVector<QPoint>& pts2D)
+bool ToolsScissors::applyPolygonCut(const QVector<QPoint>& pts2D, bool cutInside)
 {
-    if (!vtk || !renderer || pts2D.size() < 3)
-        return nullptr;
-
-    const double dpr = vtk->devicePixelRatioF();
-
-    int rwW = 0, rwH = 0;
-    if (auto* rw = vtk->renderWindow()) {
-        const int* sz = rw->GetSize();
-        rwW = sz[0];
-        rwH = sz[1];
-    }
-    else {
-        rwW = int(vtk->width() * dpr);
-        rwH = int(vtk->height() * dpr);
-    }
-
-    vtkNew<vtkPoints> nearW;
-    vtkNew<vtkPoints> farW;
-    nearW->SetNumberOfPoints(pts2D.size());
-    farW->SetNumberOfPoints(pts2D.size());
-
-    for (int i = 0; i < pts2D.size(); ++i)
-    {
-        const double xd = pts2D[i].x() * dpr;
-        const double yd = (rwH - 1) - pts2D[i].y() * dpr;
-
-        renderer->SetDisplayPoint(xd, yd, 0.0);
-        renderer->DisplayToWorld();
-        double nw[4];
-        renderer->GetWorldPoint(nw);
-        if (std::abs(nw[3]) < 1e-12)
-            return nullptr;
-        nearW->SetPoint(i, nw[0] / nw[3], nw[1] / nw[3], nw[2] / nw[3]);
-
-        renderer->SetDisplayPoint(xd, yd, 1.0);
-        renderer->DisplayToWorld();
-        double fw[4];
-        renderer->GetWorldPoint(fw);
-        if (std::abs(fw[3]) < 1e-12)
-            return nullptr;
-        farW->SetPoint(i, fw[0] / fw[3], fw[1] / fw[3], fw[2] / fw[3]);
-    }
-
-    const vtkIdType N = static_cast<vtkIdType>(pts2D.size());
-
-    vtkNew<vtkPoints> allPts;
-    allPts->SetNumberOfPoints(2 * N);
-
-    for (vtkIdType i = 0; i < N; ++i)
-    {
-        double p[3];
-        nearW->GetPoint(i, p);
-        allPts->SetPoint(i, p);
-
-        farW->GetPoint(i, p);
-        allPts->SetPoint(N + i, p);
-    }
-
-    vtkNew<vtkCellArray> faces;
-
-    {
-        vtkNew<vtkPolygon> cap;
-        cap->GetPointIds()->SetNumberOfIds(N);
-        for (vtkIdType i = 0; i < N; ++i)
-            cap->GetPointIds()->SetId(i, i);
-        faces->InsertNextCell(cap);
-    }
-
-    {
-        vtkNew<vtkPolygon> cap;
-        cap->GetPointIds()->SetNumberOfIds(N);
-        for (vtkIdType i = 0; i < N; ++i)
-            cap->GetPointIds()->SetId(i, N + (N - 1 - i));
-        faces->InsertNextCell(cap);
-    }
-
-    for (vtkIdType i = 0; i < N; ++i)
-    {
-        const vtkIdType i0 = i;
-        const vtkIdType i1 = (i + 1) % N;
-        const vtkIdType j0 = N + i0;
-        const vtkIdType j1 = N + i1;
-
-        faces->InsertNextCell(3);
-        faces->InsertCellPoint(i0);
-        faces->InsertCellPoint(i1);
-        faces->InsertCellPoint(j1);
-
-        faces->InsertNextCell(3);
-        faces->InsertCellPoint(i0);
-        faces->InsertCellPoint(j1);
-        faces->InsertCellPoint(j0);
-    }
-
-    vtkNew<vtkPolyData> frustum;
-    frustum->SetPoints(allPts);
-    frustum->SetPolys(faces);
-
-    vtkNew<vtkCleanPolyData> clean;
-    clean->SetInputData(frustum);
-    clean->ConvertPolysToLinesOff();
-    clean->ConvertLinesToPointsOff();
-    clean->ConvertStripsToPolysOn();
-    clean->Update();
-
-    vtkNew<vtkTriangleFilter> tri;
-    tri->SetInputConnection(clean->GetOutputPort());
-    tri->Update();
-
-    auto out = vtkSmartPointer<vtkPolyData>::New();
-    out->DeepCopy(tri->GetOutput());
-    return out;
+    return applyPolygonCut(m_image, pts2D, cutInside);
 }
 
-#include <vtkImplicitPolyDataDistance.h>
-#include <vtkClipPolyData.h>
-#include <vtkPolyDataConnectivityFilter.h>
-
 vtkPolyData* ToolsScissors::applySurfaceCut(const QVector<QPoint>& pts2D, bool cutInside)
 {
     if (!m_renderer || !m_vtk || !mSurfaceMesh)
@@ -966,81 +804,52 @@ vtkPolyData* ToolsScissors::applySurfaceCut(const QVector<QPoint>& pts2D, bool c
     if (pts2D.size() < 3)
         return nullptr;
 
-    auto frustum = BuildScreenFrustumWorld(m_vtk, m_renderer, pts2D);
-    if (!frustum || frustum->GetNumberOfCells() == 0)
+    auto* cam = m_renderer->GetActiveCamera();
+    auto* rw = m_vtk->renderWindow();
+    if (!cam || !rw)
         return nullptr;
 
-    qDebug() << "applySurfaceCut: frustum cells =" << frustum->GetNumberOfCells();
-
-    vtkNew<vtkCleanPolyData> inputClean;
-    inputClean->SetInputData(mSurfaceMesh);
-    inputClean->Update();
-
-    vtkNew<vtkTriangleFilter> inputTri;
-    inputTri->SetInputConnection(inputClean->GetOutputPort());
-    inputTri->Update();
-
-    qDebug() << "applySurfaceCut: input cells =" << inputTri->GetOutput()->GetNumberOfCells();
-
-    vtkNew<vtkImplicitPolyDataDistance> implicitFrustum;
-    implicitFrustum->SetInput(frustum);
-
-    vtkNew<vtkClipPolyData> clip;
-    clip->SetInputConnection(inputTri->GetOutputPort());
-    clip->SetClipFunction(implicitFrustum);
-
-    // Очень важно: получить ОБЕ части
-    clip->GenerateClippedOutputOn();
-
-    // Знак тут больше не принципиален, потому что ниже мы сами выберем нужную часть.
-    clip->SetInsideOut(false);
-    clip->Update();
-
-    vtkPolyData* partA = clip->GetOutput();
-    vtkPolyData* partB = clip->GetClippedOutput();
-
-    const vtkIdType cellsA = partA ? partA->GetNumberOfCells() : 0;
-    const vtkIdType cellsB = partB ? partB->GetNumberOfCells() : 0;
-
-    qDebug() << "applySurfaceCut: partA cells =" << cellsA;
-    qDebug() << "applySurfaceCut: partB cells =" << cellsB;
-
-    if (cellsA == 0 && cellsB == 0)
+    const int* sz = rw->GetSize();
+    const int rwW = sz[0], rwH = sz[1];
+    if (rwW <= 0 || rwH <= 0)
         return nullptr;
 
-    vtkPolyData* chosen = nullptr;
+    // лассо → NDC того же вьюпорта; z 0..1, как у прежнего фрустума near..far
+    const double dpr = m_vtk->devicePixelRatioF();
+    const double* vp = m_renderer->GetViewport();
+    const double sx = 0.5 * rwW * (vp[2] - vp[0]), ox = rwW * vp[0];
+    const double sy = 0.5 * rwH * (vp[3] - vp[1]), oy = rwH * vp[1];
 
-    if (cutInside)
+    std::vector<std::array<double, 2>> lasso;
+    lasso.reserve(size_t(pts2D.size()));
+    for (const QPoint& q : pts2D)
     {
-        // Обычные ножницы: удаляем меньший выделенный кусок, оставляем большую часть
-        chosen = (cellsA >= cellsB) ? partA : partB;
-    }
-    else
-    {
-        // Inverse scissors: оставляем только выделенный кусок, обычно он меньше
-        if (cellsA == 0) chosen = partB;
-        else if (cellsB == 0) chosen = partA;
-        else chosen = (cellsA <= cellsB) ? partA : partB;
+        const double xd = q.x() * dpr;
+        const double yd = (rwH - 1) - q.y() * dpr;
+        lasso.push_back({ (xd - ox) / sx - 1.0, (yd - oy) / sy - 1.0 });
     }
 
-    if (!chosen || chosen->GetNumberOfCells() == 0)
+    vtkMatrix4x4* P = cam->GetCompositeProjectionTransformMatrix(m_renderer->GetTiledAspectRatio(), 0.0, 1.0);
+
+    mSurfaceCut.setMesh(mSurfaceMesh);
+    if (!mSurfaceCut.split(lasso, P->GetData()))
         return nullptr;
 
-    vtkNew<vtkCleanPolyData> clean;
-    clean->SetInputData(chosen);
-    clean->Update();
+    const vtkIdType cellsIn = mSurfaceCut.cellCount(true);
+    const vtkIdType cellsOut = mSurfaceCut.cellCount(false);
 
-    vtkNew<vtkTriangleFilter> tri;
-    tri->SetInputConnection(clean->GetOutputPort());
-    tri->Update();
+    qDebug() << "applySurfaceCut: inside cells =" << cellsIn << "outside cells =" << cellsOut;
 
-    qDebug() << "applySurfaceCut: final cells =" << tri->GetOutput()->GetNumberOfCells();
+    if (cellsIn == 0 || cellsOut == 0)
+        return nullptr; // лассо не задело поверхность или накрыло её целиком
 
-    if (!tri->GetOutput() || tri->GetOutput()->GetNumberOfCells() == 0)
+    // Ножницы убирают выделенное, обратные — оставляют только его
+    auto chosen = mSurfaceCut.extract(!cutInside);
+    if (!chosen || chosen->GetNumberOfCells() == 0)
         return nullptr;
 
     vtkPolyData* out = vtkPolyData::New();
-    out->DeepCopy(tri->GetOutput());
+    out->ShallowCopy(chosen);
     return out;
 }
 
@@ -1055,24 +864,67 @@ vtkPolyData* ToolsScissors::closeSurfaceCutHoles(
     if (!caps || caps->GetNumberOfCells() == 0)
         return nullptr;
 
-    vtkNew<vtkAppendPolyData> append;
-    append->AddInputData(openSurface);
-    append->AddInputData(caps);
-    append->Update();
+    // Крышки строятся по граничным точкам поверхности с теми же координатами:
+    // сшиваем их точным совпадением, без повторной чистки всего меша.
+    vtkNew<vtkTriangleFilter> capTri;
+    capTri->SetInputData(caps);
+    capTri->PassVertsOff();
+    capTri->PassLinesOff();
+    capTri->Update();
+    vtkPolyData* capMesh = capTri->GetOutput();
+    if (!capMesh || !capMesh->GetPoints() || capMesh->GetNumberOfPolys() == 0)
+        return nullptr;
 
-    vtkNew<vtkCleanPolyData> clean;
-    clean->SetInputConnection(append->GetOutputPort());
-    clean->Update();
+    vtkPoints* capPts = capMesh->GetPoints();
+    const vtkIdType nCap = capPts->GetNumberOfPoints();
+    std::map<std::array<double, 3>, vtkIdType> capIndex;
+    for (vtkIdType i = 0; i < nCap; ++i)
+    {
+        std::array<double, 3> p{};
+        capPts->GetPoint(i, p.data());
+        capIndex.emplace(p, -1);
+    }
 
-    vtkNew<vtkTriangleFilter> tri;
-    tri->SetInputConnection(clean->GetOutputPort());
-    tri->Update();
+    vtkNew<vtkPoints> points;
+    points->DeepCopy(openSurface->GetPoints());
+    for (vtkIdType i = 0, n = points->GetNumberOfPoints(); i < n; ++i)
+    {
+        std::array<double, 3> p{};
+        points->GetPoint(i, p.data());
+        auto it = capIndex.find(p);
+        if (it != capIndex.end() && it->second < 0)
+            it->second = i;
+    }
 
-    if (!tri->GetOutput() || tri->GetOutput()->GetNumberOfCells() == 0)
-        return nullptr;
+    std::vector<vtkIdType> capToOut(static_cast<size_t>(nCap));
+    for (vtkIdType i = 0; i < nCap; ++i)
+    {
+        std::array<double, 3> p{};
+        capPts->GetPoint(i, p.data());
+        vtkIdType& id = capIndex[p];
+        if (id < 0)
+            id = points->InsertNextPoint(p.data()); // центр веера и т.п.
+        capToOut[size_t(i)] = id;
+    }
+
+    vtkNew<vtkCellArray> polys;
+    polys->DeepCopy(openSurface->GetPolys());
+    vtkCellArray* capPolys = capMesh->GetPolys();
+    vtkIdType npts = 0;
+    const vtkIdType* ids = nullptr;
+    for (capPolys->InitTraversal(); capPolys->GetNextCell(npts, ids);)
+    {
+        if (npts != 3)
+            continue;
+        const vtkIdType tri[3]{ capToOut[size_t(ids[0])], capToOut[size_t(ids[1])], capToOut[size_t(ids[2])] };
+        if (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2])
+            continue;
+        polys->InsertNextCell(3, tri);
+    }
 
     vtkPolyData* out = vtkPolyData::New();
-    out->DeepCopy(tri->GetOutput());
+    out->SetPoints(points);
+    out->SetPolys(polys);
 
     qDebug() << "closeSurfaceCutHoles: contours =" << cutContours.size()
         << "cap cells =" << caps->GetNumberOfCells()
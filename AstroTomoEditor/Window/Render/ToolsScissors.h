@@ -6,6 +6,7 @@
 #include <functional>
 #include <vtkVolume.h>
 #include <vtkWeakPointer.h>
+#include "MeshLassoCut.h"
 
 class QVTKOpenGLNativeWidget;
 class vtkRenderer;
@@ -35,8 +36,12 @@ public:
         vtkPolyData* mesh,
         vtkActor* actor);
 
-    // Колбэк, чтобы заменить mImage в RenderView (иначе только маппер обновится)
-    void setOnImageReplaced(std::function<void(vtkImageData*)> cb) { m_onImageReplaced = std::move(cb); }
+    // Вырез тома идёт на месте: before — снимок для undo до правки вокселей,
+    // edited — том уже изменён (иначе только маппер обновится)
+    void setOnBeforeImageEdit(std::function<void()> cb) { m_onBeforeImageEdit = std::move(cb); }
+    void setOnImageEdited(std::function<void(vtkImageData*)> cb) { m_onImageEdited = std::move(cb); }
+    // Регион текущего выреза тома в индексах от начала экстента; валиден с вызова before
+    void editRegion(int lo[3], int hi[3]) const;
     void setOnSurfaceReplaced(std::function<void(vtkPolyData*, QVector<QVector<std::array<double, 3>>>)> cb) { mOnSurfaceReplaced = std::move(cb); }
 
     // Обработка выбора из меню Tools (Scissors / InverseScissors)
@@ -73,8 +78,12 @@ private:
     vtkWeakPointer<vtkPolyData> mSurfaceMesh;
     vtkWeakPointer<vtkActor>    mSurfaceActor;
     bool mSurfaceMode = false;
+    MeshLassoCut mSurfaceCut; // BVH живёт, пока меш тот же
 
-    std::function<void(vtkImageData*)> m_onImageReplaced;
+    std::function<void()> m_onBeforeImageEdit;
+    int m_editLo[3]{ 0, 0, 0 };
+    int m_editHi[3]{ -1, -1, -1 };
+    std::function<void(vtkImageData*)> m_onImageEdited;
     std::function<void(vtkPolyData*, QVector<QVector<std::array<double, 3>>>)> mOnSurfaceReplaced;
     std::function<void()> m_onFinished;
 
@@ -84,9 +93,10 @@ private:
     void redraw();
     void repeat();
 
-    // Построение маски/вырез тома
-    vtkImageData* applyPolygonCut(vtkImageData* sourceImage, const QVector<QPoint>& pts2D, bool cutInside);
-    vtkImageData* applyPolygonCut(const QVector<QPoint>& pts2D, bool cutInside);
+    // Вырез тома на месте: лассо → битовая карта экрана, центры вокселей проецируются
+    // матрицей камеры. false — ни один воксель не попал под вырез.
+    bool applyPolygonCut(vtkImageData* image, const QVector<QPoint>& pts2D, bool cutInside);
+    bool applyPolygonCut(const QVector<QPoint>& pts2D, bool cutInside);
     vtkPolyData* applySurfaceCut(const QVector<QPoint>& pts2D, bool cutInside);
     vtkPolyData* closeSurfaceCutHoles(
         vtkPolyData* openSurface,
@@ -1,4 +1,5 @@
 ﻿#include "TransferFunction.h"
+#include <algorithm>
 #include <vtkSmartPointer.h>
 #include <vtkVolumeProperty.h>
 #include <vtkColorTransferFunction.h>
@@ -438,4 +439,25 @@ QVector<TF::CustomPreset> TF::LoadCustomPresets()
         if (!P.points.isEmpty()) out.push_back(std::move(P));
     }
     return out;
-}
\ No newline at end of file
+}
+
+void TF::SampleLut(vtkColorTransferFunction* ctf, vtkPiecewiseFunction* otf, RgbaLut& out)
+{
+    constexpr int n = int(HistScale);
+    double rgb[3 * n];
+    double alpha[n];
+
+    if (ctf && ctf->GetSize() > 0)
+        ctf->GetTable(double(HistMin), double(HistMax), n, rgb);
+    else
+        std::fill(rgb, rgb + 3 * n, 1.0);
+
+    if (otf && otf->GetSize() > 0)
+        otf->GetTable(double(HistMin), double(HistMax), n, alpha);
+    else
+        std::fill(alpha, alpha + n, 0.0);
+
+    for (int v = 0; v < n; ++v)
+        out[v] = { float(rgb[3 * v]), float(rgb[3 * v + 1]), float(rgb[3 * v + 2]),
+            float(std::clamp(alpha[v], 0.0, 1.0)) };
+}
@@ -2,6 +2,7 @@
 // TransferFunction.h
 // Небольшой модуль с пресетами цветовой/прозрачностной передаточной функции для VTK.
 
+#include <array>
 #include <functional>
 #include <memory>
 #include <vtkSmartPointer.h>
@@ -80,6 +81,11 @@ namespace TF {
     bool SaveCustomPreset(const CustomPreset& P);
     QVector<CustomPreset> LoadCustomPresets();
 
+    // Таблица TF по значениям вокселя HistMin..HistMax: r, g, b, opacity.
+    using RgbaLut = std::array<std::array<float, 4>, HistScale>;
+    // По одному GetTable на функцию. Без ctf — белый, без otf — прозрачность 0.
+    void SampleLut(vtkColorTransferFunction* ctf, vtkPiecewiseFunction* otf, RgbaLut& out);
+
     void ApplyPoints(vtkVolumeProperty* prop,
         const QVector<TFPoint>& pts,
         double min = double(HistMin),
@@ -274,40 +274,6 @@ private:
 
 // ===== TransferFunctionEditor ===============================================
 
-static QVector<quint64> buildHistogram256Fast(vtkImageData* img,
-    int sampleStep = 2,
-    bool ignoreZeros = true,
-    double zeroEps = 1e-12)
-{
-    QVector<quint64> h(256, 0);
-    if (!img) return h;
-
-
-    int ext[6];
-    img->GetExtent(ext);
-
-    const int nx = ext[1] - ext[0] + 1;
-    const int ny = ext[3] - ext[2] + 1;
-    const int nz = ext[5] - ext[4] + 1;
-
-    vtkIdType incX, incY, incZ;  // ВНИМАНИЕ: ИНКРЕМЕНТЫ В БАЙТАХ
-    img->GetIncrements(incX, incY, incZ);
-
-    // стартовый адрес (xmin, ymin, zmin)
-    auto* p0 = static_cast<const uint8_t*>(
-        img->GetScalarPointer(ext[0], ext[2], ext[4]));
-
-    for (int i = 0; i < nx * ny * nz; i++)
-        h[(int)*(p0 + i)]++;
-
-    if (ignoreZeros)
-        h[0] = 0;
-
-    if (ignoreZeros)
-       h[0] = 0;
-    return h;
-}
-
 static QString sliderCss(const QColor& color)
 {
     const QString c = QString("rgb(%1,%2,%3)")
@@ -329,16 +295,22 @@ static QString sliderCss(const QColor& color)
         "}";
 }
 
-TransferFunctionEditor::TransferFunctionEditor(QWidget* parent, vtkImageData* imgU8)
-    : DialogShell(parent, tr("Transfer function"), WindowType::TranferFunction)
+TransferFunctionEditor::TransferFunctionEditor(QWidget* parent, vtkImageData* imgU8, VolumeHistogram* hist)
+    : DialogShell(parent, tr("Transfer function"), WindowType::TranferFunction), mHistSrc(hist)
 {
     setModal(true);
 
+    mCtf = vtkSmartPointer<vtkColorTransferFunction>::New();
+    mOtf = vtkSmartPointer<vtkPiecewiseFunction>::New();
+    mPreviewTimer.setSingleShot(true);
+    mPreviewTimer.setInterval(0);
+    connect(&mPreviewTimer, &QTimer::timeout, this, [this] { emit preview(mCtf, mOtf); });
+
     const QSize base(760, 420);
     resize(sizeHint().expandedTo(base));
 
     // гистограмма и диапазон
-    mHist = buildHistogram256Fast(imgU8, /*step=*/2, /*ignoreZeros=*/true, /*eps=*/1e-12);
+    mHist = histogramOf(imgU8);
     mMin = HistMin;
     mMax = HistMax;
 
@@ -432,12 +404,9 @@ TransferFunctionEditor::TransferFunctionEditor(QWidget* parent, vtkImageData* im
     connect(mB, &QSlider::valueChanged, this, &TransferFunctionEditor::onRgbChanged);
 
     connect(mBB, &QDialogButtonBox::accepted, this, [this] {
-        rebuildPreview(false);
-        auto* c = makeCTF(mPts);
-        auto* o = makeOTF(mPts);
-        emit committed(c, o);
-        c->Delete();
-        o->Delete();
+        mPreviewTimer.stop();
+        syncFunctions();
+        emit committed(mCtf, mOtf);
         accept();
         });
     connect(mBB, &QDialogButtonBox::rejected, this, &QDialog::reject);
@@ -705,17 +674,37 @@ void TransferFunctionEditor::onAutoColors()
 
 void TransferFunctionEditor::rebuildPreview(bool emitPreview)
 {
-    if (!emitPreview) return;
-    auto* c = makeCTF(mPts);
-    auto* o = makeOTF(mPts);
-    emit preview(c, o);
-    c->Delete(); o->Delete();
+    syncFunctions();
+    if (emitPreview)
+        mPreviewTimer.start();
+}
+
+void TransferFunctionEditor::syncFunctions()
+{
+    fillCTF(mCtf, mPts);
+    fillOTF(mOtf, mPts);
+    TF::SampleLut(mCtf, mOtf, mLut);
+}
+
+// Берём из кеша тома; нули (фон) не показываем
+QVector<quint64> TransferFunctionEditor::histogramOf(vtkImageData* img)
+{
+    QVector<quint64> h(HistScale, 0);
+    if (!img) return h;
+
+    VolumeHistogram& src = mHistSrc ? *mHistSrc : mOwnHist;
+    const VolumeHistogram::Counts& counts = src.counts(img);
+    for (int v = 0; v < int(HistScale); ++v)
+        h[v] = counts[v];
+
+    h[0] = 0;
+    return h;
 }
 
 void TransferFunctionEditor::refreshHistogram(vtkImageData* img)
 {
     double minPhys = static_cast<double>(HistMin), maxPhys = static_cast<double>(HistMax);
-    mHist = buildHistogram256Fast(img, /*step=*/2, /*ignoreZeros=*/true, /*eps=*/1e-12);
+    mHist = histogramOf(img);
     // Синхронизируем ось редактора с реальным диапазоном данных
     mMin = minPhys;
     mMax = maxPhys;
@@ -794,11 +783,10 @@ void TransferFunctionEditor::setFromVtk(vtkColorTransferFunction* ctf,
     rebuildPreview(true);
 }
 
-vtkColorTransferFunction* TransferFunctionEditor::makeCTF(const QVector<TfPoint>& pts)
+void TransferFunctionEditor::fillCTF(vtkColorTransferFunction* c, const QVector<TfPoint>& pts)
 {
-    auto* c = vtkColorTransferFunction::New();
     c->RemoveAllPoints();
-    if (pts.isEmpty()) return c;
+    if (pts.isEmpty()) return;
 
     auto mapX = [&](double x)->double {
         return mMin + (x / static_cast<double>(HistScale)) * (mMax - mMin);
@@ -817,13 +805,11 @@ vtkColorTransferFunction* TransferFunctionEditor::makeCTF(const QVector<TfPoint>
         pts.back().color.redF(),
         pts.back().color.greenF(),
         pts.back().color.blueF());
-    return c;
 }
-vtkPiecewiseFunction* TransferFunctionEditor::makeOTF(const QVector<TfPoint>& pts)
+void TransferFunctionEditor::fillOTF(vtkPiecewiseFunction* o, const QVector<TfPoint>& pts)
 {
-    auto* o = vtkPiecewiseFunction::New();
     o->RemoveAllPoints();
-    if (pts.isEmpty()) return o;
+    if (pts.isEmpty()) return;
 
     auto mapX = [&](double x)->double {
         return mMin + (x / static_cast<double>(HistScale)) * (mMax - mMin);
@@ -833,5 +819,4 @@ vtkPiecewiseFunction* TransferFunctionEditor::makeOTF(const QVector<TfPoint>& pt
     for (const auto& p : pts)
         o->AddPoint(mapX(p.x), std::clamp(p.a, 0.0, 1.0));
     o->AddPoint(mapX(static_cast<double>(HistMax)) + 1.0, std::clamp(pts.back().a, 0.0, 1.0));
-    return o;
 }
@@ -3,7 +3,11 @@
 #include <QVector>
 #include <QColor>
 #include <QPointer> 
+#include <QTimer>
+#include <vtkSmartPointer.h>
 #include "../../Services/DicomRange.h"
+#include "VolumeHistogram.h"
+#include "TransferFunction.h"
 #include <QDialogButtonBox> 
 
 class QWidget;
@@ -28,7 +32,8 @@ class TransferFunctionEditor : public DialogShell
 {
     Q_OBJECT
 public:
-    explicit TransferFunctionEditor(QWidget* parent, vtkImageData* imgU8);
+    // hist — общий кеш гистограммы тома (иначе редактор держит свой)
+    explicit TransferFunctionEditor(QWidget* parent, vtkImageData* imgU8, VolumeHistogram* hist = nullptr);
     ~TransferFunctionEditor() override = default;
     void setFixedAxis(double axisMin, double axisMax) { mMin = axisMin;  mMax = axisMax; };
 
@@ -38,7 +43,11 @@ public:
         vtkPiecewiseFunction* otf,
         double minVal, double maxVal);
     void refreshHistogram(vtkImageData* img);
+
+    // TF текущих точек по значениям 0..255 (без hist-маски сцены)
+    const TF::RgbaLut& lut() const { return mLut; }
 signals:
+    // ctf/otf — одна и та же пара на всё время жизни редактора, правится на месте
     void preview(vtkColorTransferFunction* ctf, vtkPiecewiseFunction* otf);
     void committed(vtkColorTransferFunction* ctf, vtkPiecewiseFunction* otf);
     void presetSaved();
@@ -50,8 +59,11 @@ private slots:
 
 private:
     void rebuildPreview(bool emitPreview);
-    vtkColorTransferFunction* makeCTF(const QVector<TfPoint>& pts);
-    vtkPiecewiseFunction* makeOTF(const QVector<TfPoint>& pts);
+    QVector<quint64> histogramOf(vtkImageData* img);
+    void fillCTF(vtkColorTransferFunction* c, const QVector<TfPoint>& pts);
+    void fillOTF(vtkPiecewiseFunction* o, const QVector<TfPoint>& pts);
+    // точки -> mCtf/mOtf/mLut
+    void syncFunctions();
 
 protected:
     void changeEvent(QEvent* e) override;
@@ -77,5 +89,12 @@ private:
     QVector<TfPoint>  mPts;
     int               mSel{ -1 };
     QVector<quint64>  mHist;   // HistScale столбцов
+    VolumeHistogram*  mHistSrc{ nullptr };
+    VolumeHistogram   mOwnHist;
+
+    vtkSmartPointer<vtkColorTransferFunction> mCtf;
+    vtkSmartPointer<vtkPiecewiseFunction>     mOtf;
+    TF::RgbaLut mLut{};
+    QTimer      mPreviewTimer;   // правки за один проход цикла событий -> один preview
     double mMin{ HistMin }, mMax{ HistMax };
 };
\ No newline at end of file
@@ -0,0 +1,347 @@
+﻿#include "VolumeBrickGrid.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vtkImageData.h>
+#include <vtkPiecewiseFunction.h>
+#include <vtkSMPTools.h>
+
+namespace
+{
+    constexpr int kOpacityBins = 4096;
+
+    template <typename T>
+    void scanBricks(const T* s, int nc, const int dims[3], const int nb[3],
+        const int b0[3], const int b1[3], double* mins, double* maxs)
+    {
+        const int B = VolumeBrickGrid::kBrick;
+        const vtkIdType bx = b1[0] - b0[0] + 1;
+        const vtkIdType by = b1[1] - b0[1] + 1;
+        const vtkIdType bz = b1[2] - b0[2] + 1;
+        const size_t rowStride = size_t(dims[0]) * size_t(nc);
+        const size_t sliceStride = rowStride * size_t(dims[1]);
+
+        vtkSMPTools::For(0, bx * by * bz, [&](vtkIdType first, vtkIdType last)
+            {
+                for (vtkIdType q = first; q < last; ++q)
+                {
+                    const int bi = b0[0] + int(q % bx);
+                    const int bj = b0[1] + int((q / bx) % by);
+                    const int bk = b0[2] + int(q / (bx * by));
+
+                    const int i0 = bi * B, i1 = std::min(dims[0], i0 + B);
+                    const int j0 = bj * B, j1 = std::min(dims[1], j0 + B);
+                    const int k0 = bk * B, k1 = std::min(dims[2], k0 + B);
+
+                    T lo = std::numeric_limits<T>::max();
+                    T hi = std::numeric_limits<T>::lowest();
+                    for (int k = k0; k < k1; ++k)
+                        for (int j = j0; j < j1; ++j)
+                        {
+                            const T* row = s + size_t(k) * sliceStride + size_t(j) * rowStride;
+                            for (int i = i0; i < i1; ++i)
+                            {
+                                const T v = row[size_t(i) * size_t(nc)];
+                                lo = std::min(lo, v);
+                                hi = std::max(hi, v);
+                            }
+                        }
+
+                    const size_t id = (size_t(bk) * size_t(nb[1]) + size_t(bj)) * size_t(nb[0]) + size_t(bi);
+                    mins[id] = double(lo);
+                    maxs[id] = double(hi);
+                }
+            });
+    }
+}
+
+void VolumeBrickGrid::clear()
+{
+    mImage = nullptr;
+    mStamp = 0;
+    mDims[0] = mDims[1] = mDims[2] = 0;
+    mBricks[0] = mBricks[1] = mBricks[2] = 0;
+    mMin.clear();
+    mMax.clear();
+    mVisible.clear();
+    mMode = Mode::None;
+    mOpacity = nullptr;
+    mOpacityStamp = 0;
+    mBinPrefix.clear();
+}
+
+bool VolumeBrickGrid::isStale(vtkImageData* image) const
+{
+    if (!image || mImage.GetPointer() != image)
+        return true;
+
+    int dims[3];
+    image->GetDimensions(dims);
+    if (dims[0] != mDims[0] || dims[1] != mDims[1] || dims[2] != mDims[2])
+        return true;
+
+    // MTime vtkImageData включает point data и массивы скаляров
+    return image->GetMTime() != mStamp;
+}
+
+void VolumeBrickGrid::build(vtkImageData* image)
+{
+    clear();
+    if (!image || !image->GetScalarPointer())
+        return;
+
+    image->GetDimensions(mDims);
+    if (mDims[0] <= 0 || mDims[1] <= 0 || mDims[2] <= 0)
+        return;
+
+    for (int a = 0; a < 3; ++a)
+        mBricks[a] = (mDims[a] + kBrick - 1) / kBrick;
+
+    const size_t n = size_t(mBricks[0]) * size_t(mBricks[1]) * size_t(mBricks[2]);
+    mMin.assign(n, 0.0);
+    mMax.assign(n, 0.0);
+    mVisible.assign(n, 1);
+    mImage = image;
+
+    const int b0[3]{ 0, 0, 0 };
+    const int b1[3]{ mBricks[0] - 1, mBricks[1] - 1, mBricks[2] - 1 };
+    scan(b0, b1);
+
+    mStamp = image->GetMTime();
+}
+
+void VolumeBrickGrid::scan(const int b0[3], const int b1[3])
+{
+    vtkImageData* image = mImage;
+    if (!image) return;
+
+    void* p = image->GetScalarPointer();
+    if (!p) return;
+
+    const int nc = std::max(1, image->GetNumberOfScalarComponents());
+    switch (image->GetScalarType())
+    {
+        vtkTemplateMacro(scanBricks(static_cast<const VTK_TT*>(p), nc, mDims, mBricks,
+            b0, b1, mMin.data(), mMax.data()));
+    default:
+        return;
+    }
+
+    if (mMode == Mode::None)
+        return;
+
+    for (int bk = b0[2]; bk <= b1[2]; ++bk)
+        for (int bj = b0[1]; bj <= b1[1]; ++bj)
+            for (int bi = b0[0]; bi <= b1[0]; ++bi)
+            {
+                const size_t id = brickIndex(bi, bj, bk);
+                mVisible[id] = rangeVisible(mMin[id], mMax[id]) ? 1 : 0;
+            }
+}
+
+void VolumeBrickGrid::updateRegion(const int lo[3], const int hi[3])
+{
+    if (empty() || !mImage)
+        return;
+
+    int b0[3], b1[3];
+    for (int a = 0; a < 3; ++a)
+    {
+        const int v0 = std::clamp(std::min(lo[a], hi[a]), 0, mDims[a] - 1);
+        const int v1 = std::clamp(std::max(lo[a], hi[a]), 0, mDims[a] - 1);
+        b0[a] = v0 / kBrick;
+        b1[a] = v1 / kBrick;
+    }
+    scan(b0, b1);
+
+    mStamp = mImage->GetMTime();
+}
+
+bool VolumeBrickGrid::rangeVisible(double lo, double hi) const
+{
+    if (mMode == Mode::Above)
+        return hi > mThreshold;
+    if (mMode != Mode::Opacity || mBinPrefix.empty())
+        return true;
+
+    // значения вне таблицы (появились после classify) — честно считаем видимыми
+    if (lo < mBinLo || hi > mBinHi)
+        return true;
+
+    const int last = int(mBinPrefix.size()) - 2;
+    const int b0 = std::clamp(int((lo - mBinLo) / mBinW), 0, last);
+    const int b1 = std::clamp(int((hi - mBinLo) / mBinW), 0, last);
+    return mBinPrefix[b1 + 1] - mBinPrefix[b0] > 0;
+}
+
+void VolumeBrickGrid::classify(vtkPiecewiseFunction* opacity, double threshold)
+{
+    if (empty())
+        return;
+
+    if (!opacity)
+    {
+        mMode = Mode::None;
+        std::fill(mVisible.begin(), mVisible.end(), uint8_t(1));
+        return;
+    }
+
+    mMode = Mode::Opacity;
+    mThreshold = threshold;
+    mOpacity = opacity;
+    mOpacityStamp = opacity->GetMTime();
+
+    mBinLo = *std::min_element(mMin.begin(), mMin.end());
+    mBinHi = *std::max_element(mMax.begin(), mMax.end());
+    const int bins = kOpacityBins;
+    mBinW = (mBinHi > mBinLo) ? (mBinHi - mBinLo) / bins : 1.0;
+
+    // TF кусочно-линейная: максимум на бине — в его краях или в узлах внутри
+    std::vector<uint8_t> vis(bins, 0);
+    double prev = opacity->GetValue(mBinLo);
+    for (int b = 0; b < bins; ++b)
+    {
+        const double next = opacity->GetValue(mBinLo + (b + 1) * mBinW);
+        vis[b] = (prev > threshold || next > threshold) ? 1 : 0;
+        prev = next;
+    }
+    for (int n = 0; n < opacity->GetSize(); ++n)
+    {
+        double node[4];
+        opacity->GetNodeValue(n, node);
+        if (node[1] <= threshold || node[0] < mBinLo || node[0] > mBinHi)
+            continue;
+        vis[std::clamp(int((node[0] - mBinLo) / mBinW), 0, bins - 1)] = 1;
+    }
+
+    mBinPrefix.assign(bins + 1, 0);
+    for (int b = 0; b < bins; ++b)
+        mBinPrefix[b + 1] = mBinPrefix[b] + vis[b];
+
+    for (size_t id = 0; id < mVisible.size(); ++id)
+        mVisible[id] = rangeVisible(mMin[id], mMax[id]) ? 1 : 0;
+}
+
+void VolumeBrickGrid::classifyAbove(double threshold)
+{
+    if (empty())
+        return;
+
+    mMode = Mode::Above;
+    mThreshold = threshold;
+    mOpacity = nullptr;
+    mBinPrefix.clear();
+
+    for (size_t id = 0; id < mVisible.size(); ++id)
+        mVisible[id] = (mMax[id] > threshold) ? 1 : 0;
+}
+
+bool VolumeBrickGrid::isClassifiedFor(vtkPiecewiseFunction* opacity, double threshold) const
+{
+    return mMode == Mode::Opacity && opacity && mOpacity.GetPointer() == opacity
+        && opacity->GetMTime() == mOpacityStamp && threshold == mThreshold;
+}
+
+bool VolumeBrickGrid::forEachVisibleSpan(const double a[3], const double b[3],
+    const std::function<bool(double, double)>& visit) const
+{
+    if (empty())
+        return visit(0.0, 1.0);
+
+    // в единицах кирпича: воксель i занимает [i, i+1) после сдвига на полвокселя
+    double u0[3], du[3];
+    double lenVox2 = 0.0;
+    for (int ax = 0; ax < 3; ++ax)
+    {
+        u0[ax] = (a[ax] + 0.5) / kBrick;
+        du[ax] = (b[ax] - a[ax]) / kBrick;
+        lenVox2 += (b[ax] - a[ax]) * (b[ax] - a[ax]);
+    }
+
+    // отсечение луча по коробке объёма
+    double tIn = 0.0, tOut = 1.0;
+    for (int ax = 0; ax < 3; ++ax)
+    {
+        const double hiB = double(mDims[ax]) / kBrick;
+        if (std::abs(du[ax]) < 1e-12)
+        {
+            if (u0[ax] < 0.0 || u0[ax] >= hiB) return false;
+            continue;
+        }
+        double t0 = (0.0 - u0[ax]) / du[ax];
+        double t1 = (hiB - u0[ax]) / du[ax];
+        if (t0 > t1) std::swap(t0, t1);
+        tIn = std::max(tIn, t0);
+        tOut = std::min(tOut, t1);
+    }
+    if (tIn > tOut)
+        return false;
+
+    const double inf = std::numeric_limits<double>::infinity();
+    int c[3], step[3];
+    double tMax[3], tDelta[3];
+    for (int ax = 0; ax < 3; ++ax)
+    {
+        const double p = u0[ax] + du[ax] * tIn;
+        c[ax] = std::clamp(int(std::floor(p)), 0, mBricks[ax] - 1);
+        if (du[ax] > 1e-12)
+        {
+            step[ax] = 1;
+            tMax[ax] = (c[ax] + 1 - u0[ax]) / du[ax];
+            tDelta[ax] = 1.0 / du[ax];
+        }
+        else if (du[ax] < -1e-12)
+        {
+            step[ax] = -1;
+            tMax[ax] = (c[ax] - u0[ax]) / du[ax];
+            tDelta[ax] = -1.0 / du[ax];
+        }
+        else
+        {
+            step[ax] = 0;
+            tMax[ax] = inf;
+            tDelta[ax] = inf;
+        }
+    }
+
+    // запас в один воксель по обе стороны отрезка — на округление у вызывающего
+    const double pad = lenVox2 > 1e-18 ? 1.0 / std::sqrt(lenVox2) : 1.0;
+    auto emit = [&](double t0, double t1) -> bool {
+        return visit(std::max(0.0, t0 - pad), std::min(1.0, t1 + pad));
+        };
+
+    bool open = false;
+    double spanBeg = tIn;
+    double t = tIn;
+    int guard = mBricks[0] + mBricks[1] + mBricks[2] + 3;
+    while (guard-- > 0)
+    {
+        const bool vis = mVisible[brickIndex(c[0], c[1], c[2])] != 0;
+        if (vis && !open)
+        {
+            open = true;
+            spanBeg = t;
+        }
+        else if (!vis && open)
+        {
+            open = false;
+            if (emit(spanBeg, t)) return true;
+        }
+
+        const int ax = (tMax[0] < tMax[1])
+            ? (tMax[0] < tMax[2] ? 0 : 2)
+            : (tMax[1] < tMax[2] ? 1 : 2);
+        if (tMax[ax] >= tOut)
+            break;
+
+        c[ax] += step[ax];
+        if (c[ax] < 0 || c[ax] >= mBricks[ax])
+            break;
+        t = tMax[ax];
+        tMax[ax] += tDelta[ax];
+    }
+
+    if (open)
+        return emit(spanBeg, tOut);
+    return false;
+}
@@ -0,0 +1,71 @@
+﻿#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <vtkType.h>
+#include <vtkWeakPointer.h>
+
+class vtkImageData;
+class vtkPiecewiseFunction;
+
+// Грубая сетка кирпичей B^3 над объёмом: min/max скаляра (компонента 0) в каждом кирпиче
+// и бит «в кирпиче может быть видимое». Нужна, чтобы лучи пикинга перескакивали пустоту
+// кирпичами, а не шагали по вокселям.
+// Координаты — непрерывные индексы вокселей от начала экстента (воксель i — центр в i).
+class VolumeBrickGrid
+{
+public:
+    static constexpr int kBrick = 8;
+
+    void clear();
+    bool empty() const { return mVisible.empty(); }
+
+    // Полный пересчёт min/max (параллельно). Классификация сбрасывается: все кирпичи видимы.
+    void build(vtkImageData* image);
+    // Правка вокселей [lo..hi] (индексы от начала экстента) уже внесена в image:
+    // пересчитываются только задетые кирпичи, классификация сохраняется.
+    void updateRegion(const int lo[3], const int hi[3]);
+    // image другой или менялся после build/updateRegion.
+    bool isStale(vtkImageData* image) const;
+
+    // Видим кирпич, если на [min, max] opacity где-то > threshold (TF кусочно-линейная,
+    // так что оценка точная по узлам и краям бинов, а не по выборке).
+    void classify(vtkPiecewiseFunction* opacity, double threshold);
+    // Видим кирпич, если max > threshold (для бинарных масок).
+    void classifyAbove(double threshold);
+    bool isClassifiedFor(vtkPiecewiseFunction* opacity, double threshold) const;
+
+    // Луч a + t * (b - a), t в [0, 1]: visit(t0, t1) по порядку для отрезков через видимые
+    // кирпичи (с запасом в воксель). visit вернул true — обход прекращается, результат true.
+    // Пустая сетка — один отрезок [0, 1].
+    bool forEachVisibleSpan(const double a[3], const double b[3],
+        const std::function<bool(double, double)>& visit) const;
+
+private:
+    enum class Mode { None, Opacity, Above };
+
+    size_t brickIndex(int bi, int bj, int bk) const
+    {
+        return (size_t(bk) * size_t(mBricks[1]) + size_t(bj)) * size_t(mBricks[0]) + size_t(bi);
+    }
+    void scan(const int b0[3], const int b1[3]);
+    bool rangeVisible(double lo, double hi) const;
+
+    vtkWeakPointer<vtkImageData> mImage;
+    vtkMTimeType mStamp = 0;
+    int mDims[3]{};
+    int mBricks[3]{};
+
+    std::vector<double>  mMin;
+    std::vector<double>  mMax;
+    std::vector<uint8_t> mVisible;
+
+    Mode mMode = Mode::None;
+    double mThreshold = 0.0;
+    vtkWeakPointer<vtkPiecewiseFunction> mOpacity;
+    vtkMTimeType mOpacityStamp = 0;
+    double mBinLo = 0.0;
+    double mBinHi = 0.0;
+    double mBinW = 1.0;
+    std::vector<int> mBinPrefix; // число видимых бинов левее, size = bins + 1
+};
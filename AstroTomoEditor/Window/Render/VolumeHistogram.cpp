@@ -0,0 +1,182 @@
+﻿#include "VolumeHistogram.h"
+#include <algorithm>
+#include <vtkImageData.h>
+#include <vtkSMPThreadLocal.h>
+#include <vtkSMPTools.h>
+
+void VolumeHistogram::clear()
+{
+    mImage = nullptr;
+    mStamp = 0;
+    mValid = false;
+    mEditOpen = false;
+    mCounts.fill(0);
+}
+
+bool VolumeHistogram::isStale(vtkImageData* image) const
+{
+    return !mValid || !image || mImage != image || image->GetMTime() != mStamp;
+}
+
+// Каждый поток копит свои бины; внутри строки — четыре чередующихся набора счётчиков,
+// чтобы соседние одинаковые значения не упирались в один и тот же счётчик.
+bool VolumeHistogram::scan(vtkImageData* image, const int lo[3], const int hi[3], Counts& out)
+{
+    out.fill(0);
+    if (!image || image->GetScalarType() != VTK_UNSIGNED_CHAR
+        || image->GetNumberOfScalarComponents() != 1)
+        return false;
+
+    const auto* s = static_cast<const uint8_t*>(image->GetScalarPointer());
+    if (!s)
+        return false;
+
+    int dims[3];
+    image->GetDimensions(dims);
+
+    int a[3], b[3];
+    for (int d = 0; d < 3; ++d)
+    {
+        a[d] = std::max(lo[d], 0);
+        b[d] = std::min(hi[d], dims[d] - 1);
+        if (a[d] > b[d])
+            return true;
+    }
+
+    const size_t sx = size_t(dims[0]);
+    const size_t sxy = sx * size_t(dims[1]);
+    const int rowLen = b[0] - a[0] + 1;
+
+    vtkSMPThreadLocal<Counts> local(Counts{});
+    vtkSMPTools::For(a[2], b[2] + 1, [&](vtkIdType k0, vtkIdType k1)
+        {
+            Counts& acc = local.Local();
+            uint32_t sub[4][kBins];
+
+            for (vtkIdType k = k0; k < k1; ++k)
+            {
+                std::fill(&sub[0][0], &sub[0][0] + 4 * kBins, 0u);
+
+                for (int j = a[1]; j <= b[1]; ++j)
+                {
+                    const uint8_t* row = s + size_t(k) * sxy + size_t(j) * sx + size_t(a[0]);
+                    int i = 0;
+                    for (; i + 4 <= rowLen; i += 4)
+                    {
+                        ++sub[0][row[i]];
+                        ++sub[1][row[i + 1]];
+                        ++sub[2][row[i + 2]];
+                        ++sub[3][row[i + 3]];
+                    }
+                    for (; i < rowLen; ++i)
+                        ++sub[0][row[i]];
+                }
+
+                for (int v = 0; v < kBins; ++v)
+                    acc[v] += uint64_t(sub[0][v]) + sub[1][v] + sub[2][v] + sub[3][v];
+            }
+        });
+
+    for (auto it = local.begin(); it != local.end(); ++it)
+        for (int v = 0; v < kBins; ++v)
+            out[v] += (*it)[v];
+    return true;
+}
+
+const VolumeHistogram::Counts& VolumeHistogram::counts(vtkImageData* image)
+{
+    if (!isStale(image))
+        return mCounts;
+
+    mImage = image;
+    mEditOpen = false;
+    mValid = false;
+    if (!image)
+    {
+        mCounts.fill(0);
+        return mCounts;
+    }
+
+    int dims[3];
+    image->GetDimensions(dims);
+    const int lo[3]{ 0, 0, 0 };
+    const int hi[3]{ dims[0] - 1, dims[1] - 1, dims[2] - 1 };
+
+    mValid = scan(image, lo, hi, mCounts);
+    mStamp = image->GetMTime();
+    return mCounts;
+}
+
+bool VolumeHistogram::valueRange(vtkImageData* image, int& lo, int& hi)
+{
+    const Counts& h = counts(image);
+
+    lo = 0;
+    while (lo < kBins && h[lo] == 0)
+        ++lo;
+    if (lo == kBins)
+        return false;
+
+    hi = kBins - 1;
+    while (hi > lo && h[hi] == 0)
+        --hi;
+    return true;
+}
+
+void VolumeHistogram::beginRegionEdit(vtkImageData* image, const int lo[3], const int hi[3])
+{
+    // Кеш устарел — инкремент бессмыслен, следующий counts() всё равно пересчитает.
+    mEditOpen = false;
+    if (isStale(image))
+        return;
+
+    Counts region;
+    if (!scan(image, lo, hi, region))
+        return;
+
+    for (int v = 0; v < kBins; ++v)
+        mCounts[v] -= region[v];
+    mEditOpen = true;
+}
+
+void VolumeHistogram::endRegionEdit(vtkImageData* image, const int lo[3], const int hi[3])
+{
+    // Без открытой правки кеш уже устарел по MTime или пересчитан заново.
+    if (!mEditOpen)
+        return;
+    mEditOpen = false;
+    if (!image || mImage != image)
+    {
+        mValid = false;
+        return;
+    }
+
+    Counts region;
+    if (!scan(image, lo, hi, region))
+    {
+        mValid = false;
+        return;
+    }
+
+    for (int v = 0; v < kBins; ++v)
+        mCounts[v] += region[v];
+    mStamp = image->GetMTime();
+}
+
+void VolumeHistogram::replaceRegion(vtkImageData* before, vtkImageData* after, const int lo[3], const int hi[3])
+{
+    if (!before || !after)
+        return;
+
+    int db[3], da[3];
+    before->GetDimensions(db);
+    after->GetDimensions(da);
+    if (db[0] != da[0] || db[1] != da[1] || db[2] != da[2])
+        return; // другая геометрия — следующий counts() пересчитает целиком
+
+    beginRegionEdit(before, lo, hi);
+    if (!mEditOpen)
+        return;
+    mImage = after;
+    endRegionEdit(after, lo, hi);
+}
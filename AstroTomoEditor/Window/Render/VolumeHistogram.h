@@ -0,0 +1,41 @@
+﻿#pragma once
+#include <array>
+#include <cstdint>
+#include <vtkType.h>
+#include <vtkWeakPointer.h>
+
+class vtkImageData;
+
+// Точная гистограмма U8-тома (256 бинов) по всем вокселям, кеш по MTime.
+// Правку известного региона можно учесть без полного прохода: beginRegionEdit вычитает
+// регион до правки, endRegionEdit добавляет его после.
+class VolumeHistogram
+{
+public:
+    static constexpr int kBins = 256;
+    using Counts = std::array<uint64_t, kBins>;
+
+    void clear();
+    // image другой или менялся после последнего подсчёта.
+    bool isStale(vtkImageData* image) const;
+
+    // Актуальная гистограмма image (при необходимости — параллельный пересчёт).
+    const Counts& counts(vtkImageData* image);
+    // Занятые бины [lo..hi] — то же, что GetScalarRange для U8. false — пустой том.
+    bool valueRange(vtkImageData* image, int& lo, int& hi);
+
+    // Регион [lo..hi] в индексах от начала экстента, включительно.
+    void beginRegionEdit(vtkImageData* image, const int lo[3], const int hi[3]);
+    void endRegionEdit(vtkImageData* image, const int lo[3], const int hi[3]);
+    // Том заменён копией, которая отличается от before только в регионе [lo..hi].
+    void replaceRegion(vtkImageData* before, vtkImageData* after, const int lo[3], const int hi[3]);
+
+private:
+    static bool scan(vtkImageData* image, const int lo[3], const int hi[3], Counts& out);
+
+    vtkWeakPointer<vtkImageData> mImage;
+    vtkMTimeType mStamp = 0;
+    bool mValid = false;
+    bool mEditOpen = false;
+    Counts mCounts{};
+};
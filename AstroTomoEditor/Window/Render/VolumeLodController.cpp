@@ -0,0 +1,366 @@
+﻿#include "VolumeLodController.h"
+#include "VolumeRenderBackend.h"
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include <vector>
+
+#include <QtConcurrent/QtConcurrentRun>
+#include <QDebug>
+
+#include <vtkCallbackCommand.h>
+#include <vtkCommand.h>
+#include <vtkImageData.h>
+#include <vtkInteractorStyle.h>
+#include <vtkMatrix3x3.h>
+#include <vtkPlaneCollection.h>
+#include <vtkPointData.h>
+#include <vtkRenderWindow.h>
+#include <vtkRenderWindowInteractor.h>
+#include <vtkSMPTools.h>
+#include <vtkVolume.h>
+#include <vtkVolumeMapper.h>
+
+namespace
+{
+    // Среднее по блоку f^3 (у краёв — по тем вокселям, что есть).
+    template <typename T>
+    void DownsampleAverage(const T* src, const int sd[3], int nc, int f, T* dst, const int dd[3])
+    {
+        const size_t sSlice = size_t(sd[0]) * sd[1];
+        const size_t dSlice = size_t(dd[0]) * dd[1];
+
+        vtkSMPTools::For(0, dd[2], [&](vtkIdType kb, vtkIdType ke)
+            {
+                std::vector<double> acc(static_cast<size_t>(nc));
+                for (vtkIdType k = kb; k < ke; ++k)
+                {
+                    const int z0 = int(k) * f, z1 = std::min(z0 + f, sd[2]);
+                    for (int j = 0; j < dd[1]; ++j)
+                    {
+                        const int y0 = j * f, y1 = std::min(y0 + f, sd[1]);
+                        for (int i = 0; i < dd[0]; ++i)
+                        {
+                            const int x0 = i * f, x1 = std::min(x0 + f, sd[0]);
+                            std::fill(acc.begin(), acc.end(), 0.0);
+                            for (int z = z0; z < z1; ++z)
+                                for (int y = y0; y < y1; ++y)
+                                {
+                                    const T* row = src + (size_t(z) * sSlice + size_t(y) * sd[0]) * nc;
+                                    for (int x = x0; x < x1; ++x)
+                                        for (int c = 0; c < nc; ++c)
+                                            acc[c] += double(row[size_t(x) * nc + c]);
+                                }
+
+                            const double inv = 1.0 / double((z1 - z0) * (y1 - y0) * (x1 - x0));
+                            T* out = dst + (size_t(k) * dSlice + size_t(j) * dd[0] + i) * nc;
+                            for (int c = 0; c < nc; ++c)
+                            {
+                                const double v = acc[c] * inv;
+                                out[c] = std::is_integral<T>::value ? T(std::lround(v)) : T(v);
+                            }
+                        }
+                    }
+                }
+            });
+    }
+
+    vtkSmartPointer<vtkImageData> Downsample(vtkImageData* src, int f)
+    {
+        int sd[3];
+        src->GetDimensions(sd);
+        const int dd[3]{ (sd[0] + f - 1) / f, (sd[1] + f - 1) / f, (sd[2] + f - 1) / f };
+
+        double sp[3], org[3];
+        src->GetSpacing(sp);
+        src->GetOrigin(org);
+
+        // центр блока в индексах исходника — (f-1)/2 вдоль каждой оси направления
+        double shift[3]{ 0.5 * (f - 1) * sp[0], 0.5 * (f - 1) * sp[1], 0.5 * (f - 1) * sp[2] };
+        double worldShift[3]{ shift[0], shift[1], shift[2] };
+        if (auto* M = src->GetDirectionMatrix())
+            M->MultiplyPoint(shift, worldShift);
+
+        auto out = vtkSmartPointer<vtkImageData>::New();
+        out->SetDimensions(dd[0], dd[1], dd[2]);
+        out->SetSpacing(sp[0] * f, sp[1] * f, sp[2] * f);
+        out->SetOrigin(org[0] + worldShift[0], org[1] + worldShift[1], org[2] + worldShift[2]);
+        if (auto* M = src->GetDirectionMatrix())
+            out->SetDirectionMatrix(M);
+
+        const int nc = src->GetNumberOfScalarComponents();
+        out->AllocateScalars(src->GetScalarType(), nc);
+
+        switch (src->GetScalarType())
+        {
+            vtkTemplateMacro(DownsampleAverage(static_cast<const VTK_TT*>(src->GetScalarPointer()), sd, nc, f,
+                static_cast<VTK_TT*>(out->GetScalarPointer()), dd));
+        default:
+            return nullptr;
+        }
+        return out;
+    }
+}
+
+VolumeLodController::VolumeLodController(QObject* parent)
+    : QObject(parent)
+{
+    mCb = vtkSmartPointer<vtkCallbackCommand>::New();
+    mCb->SetClientData(this);
+    mCb->SetCallback(&VolumeLodController::onEvent);
+
+    mClock.start();
+
+    // правки тома идут сериями — прокси строим, когда они утихнут
+    mBuildDelay.setSingleShot(true);
+    mBuildDelay.setInterval(300);
+    connect(&mBuildDelay, &QTimer::timeout, this, &VolumeLodController::startBuild);
+    connect(&mWatcher, &QFutureWatcher<BuildResult>::finished, this, &VolumeLodController::onBuildFinished);
+}
+
+VolumeLodController::~VolumeLodController()
+{
+    if (mStyle) mStyle->RemoveObserver(mCb);
+    if (mWindow) mWindow->RemoveObserver(mCb);
+    mWatcher.waitForFinished();
+}
+
+void VolumeLodController::setRenderWindow(vtkRenderWindow* rw)
+{
+    if (mWindow) mWindow->RemoveObserver(mCb);
+    mWindow = rw;
+    if (mWindow)
+    {
+        mWindow->AddObserver(vtkCommand::StartEvent, mCb);
+        mWindow->AddObserver(vtkCommand::EndEvent, mCb);
+    }
+}
+
+void VolumeLodController::setInteractor(vtkRenderWindowInteractor* iren)
+{
+    if (mStyle) mStyle->RemoveObserver(mCb);
+    mInteractor = iren;
+    mStyle = iren ? iren->GetInteractorStyle() : nullptr;
+    if (mStyle)
+    {
+        mStyle->AddObserver(vtkCommand::StartInteractionEvent, mCb);
+        mStyle->AddObserver(vtkCommand::EndInteractionEvent, mCb);
+    }
+}
+
+void VolumeLodController::attachToVolume(vtkVolume* vol)
+{
+    mInteracting = false;
+    mLevel = 0;
+    mVolume = vol;
+    mFull = vol ? vol->GetMapper() : nullptr;
+    std::fill(std::begin(mFrameMs), std::end(mFrameMs), -1.0);
+    rebuildProxyMappers();
+}
+
+void VolumeLodController::imageChanged(vtkImageData* im)
+{
+    applyLevel(0);
+    mImage = im;
+    ++mVersion;
+
+    // устаревший прокси показал бы удалённые структуры — лучше полный объём
+    for (auto& p : mProxy)
+        p = Proxy{};
+
+    if (mImage && mTargetMs > 0)
+        mBuildDelay.start();
+}
+
+void VolumeLodController::setFrameTimeTargetMs(int ms)
+{
+    mTargetMs = std::max(0, ms);
+    if (mTargetMs == 0)
+    {
+        applyLevel(0);
+        return;
+    }
+    if (mImage && mBuiltVersion != mVersion)
+        mBuildDelay.start();
+}
+
+void VolumeLodController::setBaseSampleDistance(double sd)
+{
+    mBaseSampleDistance = sd;
+    for (int l = 1; l < kLevels; ++l)
+        if (mProxy[l - 1].mapper)
+            VolumeRenderBackend::setSampleDistance(mProxy[l - 1].mapper, sd * (1 << l));
+}
+
+bool VolumeLodController::setTransient(bool on)
+{
+    mTransient = on;
+    if (mInteracting)
+        return false; // уровнем управляет вращение
+
+    const int before = mLevel;
+    applyLevel(on ? pickLevel() : 0);
+    return mLevel != before;
+}
+
+vtkAbstractVolumeMapper* VolumeLodController::fullMapper() const
+{
+    if (mFull)
+        return mFull;
+    return mVolume ? mVolume->GetMapper() : nullptr;
+}
+
+void VolumeLodController::startBuild()
+{
+    if (!mImage || mTargetMs <= 0)
+        return;
+
+    if (mWatcher.isRunning())
+    {
+        mBuildPending = true;
+        return;
+    }
+
+    mBuildPending = false;
+    const quint64 version = mVersion;
+    // ножницы, шаблоны и срезы электродов правят mImage на месте прямо в GUI-потоке —
+    // воркер читает собственную копию, снятую при этой версии
+    auto src = vtkSmartPointer<vtkImageData>::New();
+    src->DeepCopy(mImage);
+    mWatcher.setFuture(QtConcurrent::run([src, version]()
+        {
+            BuildResult r;
+            r.version = version;
+            r.images[0] = Downsample(src, 2);
+            if (r.images[0])
+                r.images[1] = Downsample(r.images[0], 2);
+            return r;
+        }));
+}
+
+void VolumeLodController::onBuildFinished()
+{
+    const BuildResult r = mWatcher.result();
+
+    if (r.version == mVersion)
+    {
+        for (int i = 0; i < kLevels - 1; ++i)
+            mProxy[i].image = r.images[i];
+        mBuiltVersion = r.version;
+        rebuildProxyMappers();
+    }
+
+    if (mBuildPending || (mBuiltVersion != mVersion && !mBuildDelay.isActive()))
+        startBuild();
+}
+
+void VolumeLodController::rebuildProxyMappers()
+{
+    const auto kind = VolumeRenderBackend::kindOf(mFull);
+    for (int l = 1; l < kLevels; ++l)
+    {
+        Proxy& p = mProxy[l - 1];
+        if (!p.image || !mFull || kind == VolumeRenderBackend::Kind::Auto)
+        {
+            p.mapper = nullptr;
+            continue;
+        }
+        if (p.mapper && VolumeRenderBackend::kindOf(p.mapper) == kind &&
+            p.mapper->GetInputDataObject(0, 0) == p.image.GetPointer())
+            continue;
+
+        p.mapper = VolumeRenderBackend::createMapper(kind);
+        p.mapper->SetInputData(p.image);
+        p.mapper->SetBlendMode(vtkVolumeMapper::SafeDownCast(mFull) ?
+            vtkVolumeMapper::SafeDownCast(mFull)->GetBlendMode() : vtkVolumeMapper::COMPOSITE_BLEND);
+        VolumeRenderBackend::setSampleDistance(p.mapper, mBaseSampleDistance * (1 << l));
+    }
+}
+
+int VolumeLodController::pickLevel() const
+{
+    if (mTargetMs <= 0 || mFrameMs[0] < 0.0)
+        return 0;
+
+    // без замера прокси оцениваем: каждый уровень примерно вчетверо дешевле
+    int coarsest = 0;
+    for (int l = 0; l < kLevels; ++l)
+    {
+        if (l > 0 && !mProxy[l - 1].mapper)
+            break;
+        coarsest = l;
+        const double est = (mFrameMs[l] >= 0.0) ? mFrameMs[l] : mFrameMs[0] / double(1 << (2 * l));
+        if (est <= mTargetMs)
+            return l;
+    }
+    return coarsest;
+}
+
+void VolumeLodController::applyLevel(int level)
+{
+    if (!mVolume || !mFull)
+        return;
+
+    vtkAbstractVolumeMapper* target = (level > 0 && mProxy[level - 1].mapper)
+        ? static_cast<vtkAbstractVolumeMapper*>(mProxy[level - 1].mapper.GetPointer())
+        : mFull.GetPointer();
+    if (target == mFull)
+        level = 0;
+
+    mLevel = level;
+    vtkAbstractVolumeMapper* current = mVolume->GetMapper();
+    if (current == target)
+        return;
+
+    // плоскости клипбокса могли поменяться на любом из мапперов
+    VolumeRenderBackend::setClippingPlanes(target, current ? current->GetClippingPlanes() : nullptr);
+    mVolume->SetMapper(target);
+}
+
+void VolumeLodController::onFrameRendered(double ms)
+{
+    double& ema = mFrameMs[mLevel];
+    ema = (ema < 0.0) ? ms : 0.7 * ema + 0.3 * ms;
+
+    // не укладываемся в цель во время вращения — следующий кадр на более грубом уровне
+    if ((mInteracting || mTransient) && mTargetMs > 0 && ema > 1.25 * mTargetMs &&
+        mLevel + 1 < kLevels && mProxy[mLevel].mapper)
+    {
+        applyLevel(mLevel + 1);
+    }
+}
+
+void VolumeLodController::onEvent(vtkObject*, unsigned long evId, void* cd, void*)
+{
+    auto* self = static_cast<VolumeLodController*>(cd);
+    if (!self)
+        return;
+
+    switch (evId)
+    {
+    case vtkCommand::StartEvent:
+        self->mFrameStartNs = self->mClock.nsecsElapsed();
+        break;
+
+    case vtkCommand::EndEvent:
+        if (self->mFrameStartNs >= 0 && self->mVolume && self->mVolume->GetVisibility())
+            self->onFrameRendered(double(self->mClock.nsecsElapsed() - self->mFrameStartNs) / 1.0e6);
+        self->mFrameStartNs = -1;
+        break;
+
+    case vtkCommand::StartInteractionEvent:
+        self->mInteracting = true;
+        self->applyLevel(self->pickLevel());
+        break;
+
+    case vtkCommand::EndInteractionEvent:
+        // полный объём нарисует Render, который стиль делает после отпускания кнопки
+        self->mInteracting = false;
+        self->applyLevel(self->mTransient ? self->pickLevel() : 0);
+        break;
+
+    default:
+        break;
+    }
+}
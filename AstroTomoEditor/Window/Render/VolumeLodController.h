@@ -0,0 +1,101 @@
+﻿#pragma once
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QFutureWatcher>
+#include <vtkSmartPointer.h>
+#include <vtkType.h>
+
+class vtkAbstractVolumeMapper;
+class vtkCallbackCommand;
+class vtkImageData;
+class vtkObject;
+class vtkRenderWindow;
+class vtkRenderWindowInteractor;
+class vtkVolume;
+class vtkVolumeMapper;
+
+// Уровни детализации объёма при вращении камеры.
+// Для каждой версии тома в фоне строятся прокси 2x и 4x (среднее по блоку);
+// пока стиль интерактора вращает/двигает камеру, на vtkVolume стоит маппер прокси
+// с более крупным шагом луча, по окончании возвращается маппер полного разрешения.
+// Уровень выбирается по замеренному времени кадра и цели из настроек.
+class VolumeLodController : public QObject
+{
+    Q_OBJECT
+public:
+    explicit VolumeLodController(QObject* parent = nullptr);
+    ~VolumeLodController() override;
+
+    void setRenderWindow(vtkRenderWindow* rw);
+    void setInteractor(vtkRenderWindowInteractor* iren);
+
+    // Маппер полного разрешения берётся из vol (вызывать и после замены маппера).
+    void attachToVolume(vtkVolume* vol);
+    // Новая версия тома: прокси сбрасываются и пересобираются в фоне.
+    void imageChanged(vtkImageData* im);
+
+    // 0 — LOD выключен.
+    void setFrameTimeTargetMs(int ms);
+    int frameTimeTargetMs() const { return mTargetMs; }
+    // Шаг луча полного разрешения, у прокси он больше в factor раз.
+    void setBaseSampleDistance(double sd);
+
+    // Серия кадров без движения камеры (ховер, оверлеи): прокси по тому же правилу, что при
+    // вращении. true — маппер на объёме сменился, нужен кадр.
+    bool setTransient(bool on);
+
+    // Маппер полного разрешения (во время вращения на объёме может стоять прокси).
+    vtkAbstractVolumeMapper* fullMapper() const;
+    int currentLevel() const { return mLevel; }
+
+private:
+    static constexpr int kLevels = 3; // 0 — полный, 1 — 2x, 2 — 4x
+
+    struct Proxy
+    {
+        vtkSmartPointer<vtkImageData> image;
+        vtkSmartPointer<vtkVolumeMapper> mapper;
+    };
+
+    struct BuildResult
+    {
+        quint64 version = 0;
+        vtkSmartPointer<vtkImageData> images[kLevels - 1];
+    };
+
+    static void onEvent(vtkObject* caller, unsigned long evId, void* cd, void*);
+
+    void startBuild();
+    void onBuildFinished();
+    void rebuildProxyMappers();
+    int pickLevel() const;
+    void applyLevel(int level);
+    void onFrameRendered(double ms);
+
+private:
+    vtkSmartPointer<vtkRenderWindow> mWindow;
+    vtkSmartPointer<vtkRenderWindowInteractor> mInteractor;
+    vtkSmartPointer<vtkVolume> mVolume;
+    vtkSmartPointer<vtkAbstractVolumeMapper> mFull;
+    vtkSmartPointer<vtkImageData> mImage;
+    vtkSmartPointer<vtkCallbackCommand> mCb;
+    vtkSmartPointer<vtkObject> mStyle;
+
+    Proxy mProxy[kLevels - 1];
+    quint64 mVersion = 0;
+    quint64 mBuiltVersion = 0;
+    bool mBuildPending = false;
+    QTimer mBuildDelay;
+    QFutureWatcher<BuildResult> mWatcher;
+
+    int mTargetMs = 40;
+    double mBaseSampleDistance = 1.0;
+    double mFrameMs[kLevels]{ -1.0, -1.0, -1.0 }; // сглаженное время кадра по уровням
+    QElapsedTimer mClock;
+    qint64 mFrameStartNs = -1;
+    bool mInteracting = false;
+    bool mTransient = false;
+    int mLevel = 0;
+};
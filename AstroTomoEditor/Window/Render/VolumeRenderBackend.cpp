@@ -0,0 +1,228 @@
+﻿#include "VolumeRenderBackend.h"
+
+#include <algorithm>
+#include <cctype>
+#include <string>
+
+#include <vtkCamera.h>
+#include <vtkFixedPointVolumeRayCastMapper.h>
+#include <vtkGPUVolumeRayCastMapper.h>
+#include <vtkImageData.h>
+#include <vtkPlaneCollection.h>
+#include <vtkRenderer.h>
+#include <vtkRenderWindow.h>
+#include <vtkVolume.h>
+#include <vtkVolumeProperty.h>
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QtGlobal>
+
+namespace
+{
+    // -1 — проба ещё не делалась
+    int gProbed = -1;
+
+    bool IsSoftwareRenderer(std::string caps)
+    {
+        std::transform(caps.begin(), caps.end(), caps.begin(),
+            [](unsigned char c) { return char(std::tolower(c)); });
+
+        static const char* kSoftware[] = {
+            "llvmpipe", "softpipe", "swrast", "software rasterizer",
+            "microsoft basic render", "gdi generic", "swiftshader"
+        };
+        for (const char* s : kSoftware)
+            if (caps.find(s) != std::string::npos)
+                return true;
+        return false;
+    }
+
+    VolumeRenderBackend::Kind ProbeContext(vtkRenderWindow* rw)
+    {
+        using Kind = VolumeRenderBackend::Kind;
+
+        const char* report = rw->ReportCapabilities();
+        const std::string caps = report ? report : "";
+        if (caps.empty())
+            return Kind::Auto; // контекста ещё нет — решить нельзя
+
+        if (IsSoftwareRenderer(caps))
+        {
+            qDebug() << "[VolumeBackend] software OpenGL, using CPU ray caster";
+            return Kind::Cpu;
+        }
+
+        auto prop = vtkSmartPointer<vtkVolumeProperty>::New();
+        auto gpu = vtkSmartPointer<vtkGPUVolumeRayCastMapper>::New();
+        if (!gpu->IsRenderSupported(rw, prop))
+        {
+            qDebug() << "[VolumeBackend] GPU ray casting not supported, using CPU ray caster";
+            return Kind::Cpu;
+        }
+        return Kind::Gpu;
+    }
+}
+
+VolumeRenderBackend::Kind VolumeRenderBackend::fromInt(int v)
+{
+    switch (v)
+    {
+    case 1: return Kind::Gpu;
+    case 2: return Kind::Cpu;
+    default: return Kind::Auto;
+    }
+}
+
+const char* VolumeRenderBackend::name(Kind k)
+{
+    switch (k)
+    {
+    case Kind::Gpu: return "GPU";
+    case Kind::Cpu: return "CPU";
+    default: return "Auto";
+    }
+}
+
+VolumeRenderBackend::Kind VolumeRenderBackend::resolve(Kind requested, vtkRenderWindow* rw)
+{
+    const QByteArray env = qgetenv("ASTRO_VOLUME_BACKEND").trimmed().toLower();
+    if (env == "gpu") return Kind::Gpu;
+    if (env == "cpu") return Kind::Cpu;
+
+    if (requested != Kind::Auto)
+        return requested;
+
+    if (gProbed >= 0)
+        return fromInt(gProbed);
+
+    // без контекста ведём себя как раньше (GPU), но пробу не запоминаем
+    const Kind k = rw ? ProbeContext(rw) : Kind::Auto;
+    if (k == Kind::Auto)
+        return Kind::Gpu;
+
+    gProbed = int(k);
+    qDebug() << "[VolumeBackend] auto ->" << name(k);
+    return k;
+}
+
+bool VolumeRenderBackend::isResolved(Kind requested)
+{
+    const QByteArray env = qgetenv("ASTRO_VOLUME_BACKEND").trimmed().toLower();
+    return env == "gpu" || env == "cpu" || requested != Kind::Auto || gProbed >= 0;
+}
+
+vtkSmartPointer<vtkVolumeMapper> VolumeRenderBackend::createMapper(Kind k)
+{
+    if (k == Kind::Cpu)
+    {
+        auto m = vtkSmartPointer<vtkFixedPointVolumeRayCastMapper>::New();
+        m->SetBlendModeToComposite();
+        m->SetAutoAdjustSampleDistances(0);
+        m->SetLockSampleDistanceToInputSpacing(0);
+        m->SetImageSampleDistance(1.0f);
+        m->SetCropping(0);
+        return m;
+    }
+
+    auto m = vtkSmartPointer<vtkGPUVolumeRayCastMapper>::New();
+    m->SetBlendModeToComposite();
+    m->SetAutoAdjustSampleDistances(false);
+    m->SetUseJittering(true);
+    m->SetCropping(0);
+    return m;
+}
+
+VolumeRenderBackend::Kind VolumeRenderBackend::kindOf(vtkAbstractVolumeMapper* m)
+{
+    if (vtkGPUVolumeRayCastMapper::SafeDownCast(m)) return Kind::Gpu;
+    if (vtkFixedPointVolumeRayCastMapper::SafeDownCast(m)) return Kind::Cpu;
+    return Kind::Auto;
+}
+
+void VolumeRenderBackend::setInput(vtkAbstractVolumeMapper* m, vtkImageData* im)
+{
+    if (!m)
+        return;
+
+    if (auto* vm = vtkVolumeMapper::SafeDownCast(m))
+        vm->SetInputData(im);
+    else
+        m->SetInputDataObject(im);
+}
+
+void VolumeRenderBackend::setSampleDistance(vtkAbstractVolumeMapper* m, double sd)
+{
+    if (auto* gm = vtkGPUVolumeRayCastMapper::SafeDownCast(m))
+    {
+        gm->SetAutoAdjustSampleDistances(false);
+        gm->SetSampleDistance(float(sd));
+        gm->SetUseJittering(true);
+        gm->Modified();
+    }
+    else if (auto* cm = vtkFixedPointVolumeRayCastMapper::SafeDownCast(m))
+    {
+        cm->SetAutoAdjustSampleDistances(0);
+        cm->SetSampleDistance(float(sd));
+        cm->SetInteractiveSampleDistance(float(2.0 * sd));
+        cm->Modified();
+    }
+}
+
+void VolumeRenderBackend::setClippingPlanes(vtkAbstractVolumeMapper* m, vtkPlaneCollection* planes)
+{
+    if (!m)
+        return;
+
+    if (auto* vm = vtkVolumeMapper::SafeDownCast(m))
+        vm->SetCropping(false);
+
+    m->RemoveAllClippingPlanes();
+    if (planes)
+        m->SetClippingPlanes(planes);
+    m->Modified();
+}
+
+double VolumeRenderBackend::benchmark(Kind k, vtkImageData* im, vtkVolumeProperty* prop, int frames, int size)
+{
+    if (!im || !prop || frames <= 0)
+        return -1.0;
+
+    auto rw = vtkSmartPointer<vtkRenderWindow>::New();
+    rw->SetOffScreenRendering(1);
+    rw->SetSize(size, size);
+
+    auto ren = vtkSmartPointer<vtkRenderer>::New();
+    rw->AddRenderer(ren);
+
+    // пустой кадр поднимает контекст: до него ReportCapabilities() пуст и Auto уходит в запасной путь
+    rw->Render();
+    k = resolve(k, rw);
+    auto mapper = createMapper(k);
+    setInput(mapper, im);
+
+    double sp[3]{ 1, 1, 1 };
+    im->GetSpacing(sp);
+    setSampleDistance(mapper, std::max(std::min({ sp[0], sp[1], sp[2] }), 0.05));
+
+    auto vol = vtkSmartPointer<vtkVolume>::New();
+    vol->SetMapper(mapper);
+    vol->SetProperty(prop);
+    ren->AddVolume(vol);
+    ren->ResetCamera();
+
+    // первый кадр — загрузка текстур и градиентов, в замер не входит
+    rw->Render();
+
+    QElapsedTimer t;
+    t.start();
+    for (int i = 0; i < frames; ++i)
+    {
+        ren->GetActiveCamera()->Azimuth(360.0 / frames);
+        rw->Render();
+    }
+
+    const double ms = double(t.nsecsElapsed()) / 1.0e6 / frames;
+    qDebug() << "[VolumeBackend] benchmark" << name(k) << size << "px:" << ms << "ms/frame";
+    return ms;
+}
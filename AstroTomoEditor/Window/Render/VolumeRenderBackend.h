@@ -0,0 +1,43 @@
+﻿#pragma once
+#include <vtkSmartPointer.h>
+
+class vtkAbstractVolumeMapper;
+class vtkImageData;
+class vtkPlaneCollection;
+class vtkRenderWindow;
+class vtkVolumeMapper;
+class vtkVolumeProperty;
+
+// Выбор и общая настройка маппера объёма.
+// Gpu — vtkGPUVolumeRayCastMapper, Cpu — многопоточный vtkFixedPointVolumeRayCastMapper
+// для машин без пригодного GPU (виртуалки, тонкие клиенты, программный OpenGL).
+// Клиппинг, шаг луча и вход задаются здесь одинаково для обоих; интерполяция
+// и градиентная прозрачность живут в vtkVolumeProperty и работают с любым.
+class VolumeRenderBackend
+{
+public:
+    enum class Kind { Auto = 0, Gpu = 1, Cpu = 2 };
+
+    static Kind fromInt(int v);
+    static const char* name(Kind k);
+
+    // Auto -> Gpu/Cpu по пробе контекста rw (результат кэшируется на процесс).
+    // Переменная окружения ASTRO_VOLUME_BACKEND=gpu|cpu перекрывает любой выбор.
+    static Kind resolve(Kind requested, vtkRenderWindow* rw);
+    // false — resolve вернёт Gpu наугад: Auto, а контекста для пробы ещё не было
+    static bool isResolved(Kind requested);
+
+    static vtkSmartPointer<vtkVolumeMapper> createMapper(Kind k);
+    static Kind kindOf(vtkAbstractVolumeMapper* m);
+
+    static void setInput(vtkAbstractVolumeMapper* m, vtkImageData* im);
+    // Шаг луча в мм; CPU-маппер при вращении берёт вдвое больший.
+    static void setSampleDistance(vtkAbstractVolumeMapper* m, double sd);
+    // planes == nullptr — снять плоскости. Cropping всегда выключается: с OBB-плоскостями он мешает.
+    static void setClippingPlanes(vtkAbstractVolumeMapper* m, vtkPlaneCollection* planes);
+
+    // Замер без окна на экране: offscreen size x size, frames кадров с поворотом камеры.
+    // Auto решается пробой уже созданного контекста. Среднее время кадра в мс (< 0 — нет входа).
+    static double benchmark(Kind k, vtkImageData* im, vtkVolumeProperty* prop,
+        int frames = 20, int size = 512);
+};
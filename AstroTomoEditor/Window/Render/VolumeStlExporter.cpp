@@ -1,4 +1,8 @@
 ﻿#include "VolumeStlExporter.h"
+#include "SignedDistanceField.h"
+#include "NarrowBandSurface.h"
+#include "ProgressiveMesh.h"
+#include <Services/Trace.h>
 #include <vtkImageConstantPad.h>
 #include <vtkFlyingEdges3D.h>
 #include <vtkTriangleFilter.h>
@@ -8,6 +12,7 @@
 #include <vtkWindowedSincPolyDataFilter.h>
 #include <vtkPolyDataNormals.h>
 #include <vtkPointData.h>
+#include <vtkUnsignedCharArray.h>
 #include <algorithm>
 #include <cmath>
 #include <limits>
@@ -37,7 +42,13 @@
 #include <vtkPoints.h>
 #include <vtkIdList.h>
 #include <vtkMath.h>
+#include <vtkCellArray.h>
+#include <vtkFloatArray.h>
+#include <vtkDoubleArray.h>
+#include <vtkIdTypeArray.h>
+#include <vtkSMPTools.h>
 #include <cstring>
+#include <vector>
 
 #pragma pack(push, 1)
 typedef struct MYSTLHEADER
@@ -255,6 +266,183 @@ namespace
     }
 }
 
+namespace
+{
+    constexpr qsizetype kStlRecordBytes = 50;            // 12 float + uint16 attr
+    constexpr vtkIdType kStlChunkTriangles = 1 << 16;    // ~3.2 MB на кусок
+    constexpr int       kStlChunksInFlight = 8;          // кусков упаковывается за раз
+
+    // Точное число треугольников в STL так, как его пишет SaveStlMyBinary_NoCenter:
+    // есть polys -> после vtkTriangleFilter (polygon/strip из n точек = n-2 треугольника);
+    // нет polys -> ячейки ровно из 3 точек.
+    quint64 CountStlTriangles(vtkPolyData* pd)
+    {
+        if (!pd)
+            return 0;
+
+        auto sumTriangulated = [](vtkCellArray* ca) -> quint64
+            {
+                if (!ca) return 0;
+                quint64 n = 0;
+                const vtkIdType cells = ca->GetNumberOfCells();
+                if (ca->GetNumberOfConnectivityIds() == 3 * cells)
+                {
+                    // Частый случай: все ячейки — треугольники, проверяем offsets без обхода.
+                    bool allTri = true;
+                    for (vtkIdType c = 0; c < cells && allTri; ++c)
+                        allTri = (ca->GetCellSize(c) == 3);
+                    if (allTri)
+                        return quint64(cells);
+                }
+                for (vtkIdType c = 0; c < cells; ++c)
+                {
+                    const vtkIdType sz = ca->GetCellSize(c);
+                    if (sz >= 3) n += quint64(sz - 2);
+                }
+                return n;
+            };
+
+        if (pd->GetNumberOfPolys() > 0)
+            return sumTriangulated(pd->GetPolys()) + sumTriangulated(pd->GetStrips());
+
+        auto countExact3 = [](vtkCellArray* ca) -> quint64
+            {
+                if (!ca) return 0;
+                quint64 n = 0;
+                for (vtkIdType c = 0; c < ca->GetNumberOfCells(); ++c)
+                    if (ca->GetCellSize(c) == 3) ++n;
+                return n;
+            };
+        return countExact3(pd->GetVerts()) + countExact3(pd->GetLines()) + countExact3(pd->GetStrips());
+    }
+
+    // true, если в pd только polys и все они — треугольники (vtkTriangleFilter не нужен).
+    bool IsPureTriangleMesh(vtkPolyData* pd)
+    {
+        if (!pd || pd->GetNumberOfPolys() == 0)
+            return false;
+        if (pd->GetNumberOfVerts() > 0 || pd->GetNumberOfLines() > 0 || pd->GetNumberOfStrips() > 0)
+            return false;
+        return CountStlTriangles(pd) == quint64(pd->GetNumberOfPolys()) &&
+            pd->GetPolys()->GetNumberOfConnectivityIds() == 3 * pd->GetNumberOfPolys();
+    }
+
+    struct StlCenterSum
+    {
+        double x = 0.0, y = 0.0, z = 0.0;
+    };
+
+    // Упаковка записей [t0, t1) прямо из сырых буферов точек/связности.
+    // Арифметика та же, что у прежнего поячеечного пути (double, vtkMath::Cross/Normalize),
+    // поэтому файл совпадает побайтно.
+    template <typename PT, typename IdT>
+    void PackStlRecords(const PT* pts, const IdT* conn, vtkIdType t0, vtkIdType t1,
+        const double center[3], bool recomputeNormals, char* dst, StlCenterSum& sum)
+    {
+        const quint16 attrLE = qToLittleEndian<quint16>(0);
+
+        for (vtkIdType t = t0; t < t1; ++t, dst += kStlRecordBytes)
+        {
+            const IdT* ids = conn + 3 * t;
+
+            double p[3][3], cp[3][3];
+            for (int v = 0; v < 3; ++v)
+            {
+                const PT* src = pts + 3 * vtkIdType(ids[v]);
+                for (int a = 0; a < 3; ++a)
+                {
+                    p[v][a] = double(src[a]);
+                    cp[v][a] = p[v][a] - center[a];
+                }
+            }
+
+            sum.x += ((p[0][0] + p[1][0] + p[2][0]) / 3.0) - center[0];
+            sum.y += ((p[0][1] + p[1][1] + p[2][1]) / 3.0) - center[1];
+            sum.z += ((p[0][2] + p[1][2] + p[2][2]) / 3.0) - center[2];
+
+            double n[3]{ 0.0, 0.0, 0.0 };
+            if (recomputeNormals)
+            {
+                double u[3]{ cp[1][0] - cp[0][0], cp[1][1] - cp[0][1], cp[1][2] - cp[0][2] };
+                double w[3]{ cp[2][0] - cp[0][0], cp[2][1] - cp[0][1], cp[2][2] - cp[0][2] };
+                vtkMath::Cross(u, w, n);
+                if (vtkMath::Normalize(n) == 0.0)
+                    n[0] = n[1] = n[2] = 0.0;
+            }
+
+            float block[12] = {
+                f32(n[0]),     f32(n[1]),     f32(n[2]),
+                f32(cp[0][0]), f32(cp[0][1]), f32(cp[0][2]),
+                f32(cp[1][0]), f32(cp[1][1]), f32(cp[1][2]),
+                f32(cp[2][0]), f32(cp[2][1]), f32(cp[2][2])
+            };
+            for (float& f : block)
+                FloatToLE(f);
+
+            std::memcpy(dst, block, sizeof(block));
+            std::memcpy(dst + sizeof(block), &attrLE, sizeof(attrLE));
+        }
+    }
+
+    // Пакует треугольники кусками параллельно и пишет куски в файл строго по порядку.
+    template <typename PT, typename IdT>
+    bool StreamStlRecords(QSaveFile& out, const PT* pts, const IdT* conn, vtkIdType triCount,
+        const double center[3], bool recomputeNormals, StlCenterSum& total)
+    {
+        const vtkIdType chunks = (triCount + kStlChunkTriangles - 1) / kStlChunkTriangles;
+        std::vector<std::vector<char>> buffers(size_t(std::min<vtkIdType>(chunks, kStlChunksInFlight)));
+        std::vector<StlCenterSum> sums(buffers.size());
+
+        for (vtkIdType c0 = 0; c0 < chunks; c0 += kStlChunksInFlight)
+        {
+            const vtkIdType c1 = std::min<vtkIdType>(chunks, c0 + kStlChunksInFlight);
+
+            vtkSMPTools::For(c0, c1, 1, [&](vtkIdType first, vtkIdType last)
+                {
+                    for (vtkIdType c = first; c < last; ++c)
+                    {
+                        const vtkIdType t0 = c * kStlChunkTriangles;
+                        const vtkIdType t1 = std::min(triCount, t0 + kStlChunkTriangles);
+                        auto& buf = buffers[size_t(c - c0)];
+                        buf.resize(size_t(t1 - t0) * size_t(kStlRecordBytes));
+                        sums[size_t(c - c0)] = StlCenterSum{};
+                        PackStlRecords(pts, conn, t0, t1, center, recomputeNormals, buf.data(), sums[size_t(c - c0)]);
+                    }
+                });
+
+            for (vtkIdType c = c0; c < c1; ++c)
+            {
+                const auto& buf = buffers[size_t(c - c0)];
+                if (!WriteAll(out, buf.data(), qsizetype(buf.size())))
+                    return false;
+
+                // суммы складываем по порядку кусков — результат детерминирован
+                total.x += sums[size_t(c - c0)].x;
+                total.y += sums[size_t(c - c0)].y;
+                total.z += sums[size_t(c - c0)].z;
+            }
+        }
+        return true;
+    }
+
+    template <typename IdT>
+    bool StreamStlRecordsAnyPoints(QSaveFile& out, vtkPoints* points, const IdT* conn, vtkIdType triCount,
+        const double center[3], bool recomputeNormals, StlCenterSum& total)
+    {
+        vtkDataArray* data = points->GetData();
+        if (auto* f = vtkArrayDownCast<vtkFloatArray>(data))
+            return StreamStlRecords(out, f->GetPointer(0), conn, triCount, center, recomputeNormals, total);
+        if (auto* d = vtkArrayDownCast<vtkDoubleArray>(data))
+            return StreamStlRecords(out, d->GetPointer(0), conn, triCount, center, recomputeNormals, total);
+
+        // Редкий тип координат: копия в double (GetPoint даёт те же значения).
+        std::vector<double> tmp(size_t(points->GetNumberOfPoints()) * 3);
+        for (vtkIdType i = 0; i < points->GetNumberOfPoints(); ++i)
+            points->GetPoint(i, tmp.data() + 3 * i);
+        return StreamStlRecords(out, tmp.data(), conn, triCount, center, recomputeNormals, total);
+    }
+}
+
 bool VolumeStlExporter::SaveStlMyBinary_NoCenter(
     vtkPolyData* pd,
     const QString& filePath,
@@ -268,10 +456,10 @@ bool VolumeStlExporter::SaveStlMyBinary_NoCenter(
     if (!pd || filePath.isEmpty())
         return false;
 
-    // --- 0) Треангуляция (на всякий случай) ---
+    // --- 0) Треангуляция (только если в polys есть не-треугольники / strips) ---
     vtkSmartPointer<vtkPolyData> triPd = pd;
     vtkNew<vtkTriangleFilter> tri;
-    if (pd->GetNumberOfPolys() > 0)
+    if (pd->GetNumberOfPolys() > 0 && !IsPureTriangleMesh(pd))
     {
         tri->SetInputData(pd);
         tri->PassLinesOff();
@@ -291,88 +479,79 @@ bool VolumeStlExporter::SaveStlMyBinary_NoCenter(
         !std::isfinite(b[4]) || !std::isfinite(b[5]))
         return false;
 
-    const double meshCx = 0.5 * (b[0] + b[1]);
-    const double meshCy = 0.5 * (b[2] + b[3]);
-    const double meshCz = 0.5 * (b[4] + b[5]);
-
-    const double sx = (b[1] - b[0]);
-    const double sy = (b[3] - b[2]);
-    const double sz = (b[5] - b[4]);
-
     // --- 2) Центр объёма в world: origin + localHalfSize ---
     // localHalfSize = (size/2) в мм. НЕ size.
-    const double centerWorldX = VolumeOriginX + VolumeCenterX;
-    const double centerWorldY = VolumeOriginY + VolumeCenterY;
-    const double centerWorldZ = VolumeOriginZ + VolumeCenterZ;
+    const double centerWorld[3] = {
+        VolumeOriginX + VolumeCenterX,
+        VolumeOriginY + VolumeCenterY,
+        VolumeOriginZ + VolumeCenterZ
+    };
 
     // --- 3) Диагностика ---
     qDebug() << "SaveSTL file:" << filePath;
     qDebug() << "Volume origin (world):" << VolumeOriginX << VolumeOriginY << VolumeOriginZ;
     qDebug() << "Volume center LOCAL (half-size mm):" << VolumeCenterX << VolumeCenterY << VolumeCenterZ;
     qDebug() << "Anchor / centerWorld (origin+localCenter):"
-        << centerWorldX << centerWorldY << centerWorldZ;
+        << centerWorld[0] << centerWorld[1] << centerWorld[2];
 
+    // --- 4) Треугольники: в быстром пути это сама связность polys (offsets 0,3,6,...),
+    // иначе (нет polys — strips/lines из 3 точек) собираем id по ячейкам, как раньше.
+    const bool fastPath = IsPureTriangleMesh(triPd);
+    std::vector<vtkIdType> legacyIds;
+    vtkIdType triCount = 0;
 
-    // --- 4) Считаем треугольники ---
-    const vtkIdType cellCount = triPd->GetNumberOfCells();
-    quint32 triCount = 0;
-    for (vtkIdType ci = 0; ci < cellCount; ++ci)
+    if (fastPath)
     {
-        vtkCell* c = triPd->GetCell(ci);
-        if (c && c->GetNumberOfPoints() == 3)
-            ++triCount;
+        triCount = triPd->GetNumberOfPolys();
     }
-    if (triCount == 0)
+    else
+    {
+        const vtkIdType cellCount = triPd->GetNumberOfCells();
+        vtkNew<vtkIdList> cellIds;
+        for (vtkIdType ci = 0; ci < cellCount; ++ci)
+        {
+            triPd->GetCellPoints(ci, cellIds);
+            if (cellIds->GetNumberOfIds() != 3)
+                continue;
+            legacyIds.push_back(cellIds->GetId(0));
+            legacyIds.push_back(cellIds->GetId(1));
+            legacyIds.push_back(cellIds->GetId(2));
+        }
+        triCount = vtkIdType(legacyIds.size() / 3);
+    }
+
+    if (triCount == 0 || triCount > vtkIdType(std::numeric_limits<quint32>::max()))
         return false;
 
     if (outCenterShiftX) *outCenterShiftX = 0.0;
     if (outCenterShiftY) *outCenterShiftY = 0.0;
     if (outCenterShiftZ) *outCenterShiftZ = 0.0;
 
-    vtkPoints* pts = triPd->GetPoints();
-    double p0[3], p1[3], p2[3];
-    double sumCenterX = 0.0;
-    double sumCenterY = 0.0;
-    double sumCenterZ = 0.0;
-    quint32 centerTriCount = 0;
+    qDebug() << "Cells total:" << triPd->GetNumberOfCells()
+        << "Points total:" << triPd->GetNumberOfPoints()
+        << "Triangles:" << triCount
+        << (fastPath ? "(raw buffers)" : "(per-cell)");
 
-    for (vtkIdType ci = 0; ci < cellCount; ++ci)
     {
-        vtkCell* c = triPd->GetCell(ci);
-        if (!c || c->GetNumberOfPoints() != 3)
-            continue;
-
-        pts->GetPoint(c->GetPointId(0), p0);
-        pts->GetPoint(c->GetPointId(1), p1);
-        pts->GetPoint(c->GetPointId(2), p2);
-
-        const double centerX = ((p0[0] + p1[0] + p2[0]) / 3.0) - centerWorldX;
-        const double centerY = ((p0[1] + p1[1] + p2[1]) / 3.0) - centerWorldY;
-        const double centerZ = ((p0[2] + p1[2] + p2[2]) / 3.0) - centerWorldZ;
-
-        sumCenterX += centerX;
-        sumCenterY += centerY;
-        sumCenterZ += centerZ;
-        ++centerTriCount;
+        vtkIdType id0 = 0;
+        if (fastPath)
+        {
+            vtkNew<vtkIdList> firstIds;
+            triPd->GetCellPoints(0, firstIds);
+            id0 = firstIds->GetId(0);
+        }
+        else
+        {
+            id0 = legacyIds[0];
+        }
+        double p0[3];
+        triPd->GetPoints()->GetPoint(id0, p0);
+        qDebug() << "First p0 world:" << p0[0] << p0[1] << p0[2];
+        qDebug() << "First p0 centered:"
+            << p0[0] - centerWorld[0] << p0[1] - centerWorld[1] << p0[2] - centerWorld[2];
     }
 
-    const double stlCenterShiftX = centerTriCount > 0 ? sumCenterX / centerTriCount : 0.0;
-    const double stlCenterShiftY = centerTriCount > 0 ? sumCenterY / centerTriCount : 0.0;
-    const double stlCenterShiftZ = centerTriCount > 0 ? sumCenterZ / centerTriCount : 0.0;
-
-    if (outCenterShiftX) *outCenterShiftX = stlCenterShiftX;
-    if (outCenterShiftY) *outCenterShiftY = stlCenterShiftY;
-    if (outCenterShiftZ) *outCenterShiftZ = stlCenterShiftZ;
-
-    qDebug() << "STL center shift:"
-        << stlCenterShiftX << stlCenterShiftY << stlCenterShiftZ;
-    qDebug() << "STL triangle centers used:" << centerTriCount;
-
-    qDebug() << "Cells total:" << cellCount
-        << "Points total:" << triPd->GetNumberOfPoints()
-        << "Triangles:" << triCount;
-
-    // --- 5) Пишем файл ---
+    // --- 5) Пишем файл: заголовок, число треугольников, записи кусками по порядку ---
     QSaveFile out(filePath);
     if (!out.open(QIODevice::WriteOnly))
         return false;
@@ -380,89 +559,43 @@ bool VolumeStlExporter::SaveStlMyBinary_NoCenter(
     // В хедер пишем anchor = VolumeOrigin + VolumeCenterLocal (world-центр объёма)
     MYSTLHEADER h{};
     InitSTLHeader(&h, float(VolumeCenterX), float(VolumeCenterZ), float(VolumeCenterY));
-    //InitSTLHeader(&h, float(VolumeCenterX - stlCenterShiftX), float(VolumeCenterZ - stlCenterShiftZ), float(VolumeCenterY - stlCenterShiftY));
 
     if (!WriteAll(out, &h, sizeof(h))) return false;
 
-    const quint32 triCountLE = qToLittleEndian(triCount);
+    const quint32 triCountLE = qToLittleEndian(quint32(triCount));
     if (!WriteAll(out, &triCountLE, sizeof(triCountLE))) return false;
 
-    const quint16 attrLE = qToLittleEndian<quint16>(0);
-
-    double n[3];
-
-    bool firstPrinted = false;
-
-    for (vtkIdType ci = 0; ci < cellCount; ++ci)
+    // --- 6) Координаты центрируются относительно centerWorld: в STL они локальные вокруг (0,0,0) ---
+    StlCenterSum sum;
+    bool written = false;
+    if (fastPath)
     {
-        vtkCell* c = triPd->GetCell(ci);
-        if (!c || c->GetNumberOfPoints() != 3)
-            continue;
-
-        const vtkIdType id0 = c->GetPointId(0);
-        const vtkIdType id1 = c->GetPointId(1);
-        const vtkIdType id2 = c->GetPointId(2);
-
-        pts->GetPoint(id0, p0);
-        pts->GetPoint(id1, p1);
-        pts->GetPoint(id2, p2);
-
-        if (!firstPrinted)
-        {
-            qDebug() << "First p0 world:" << p0[0] << p0[1] << p0[2];
-        }
-
-        // --- 6) Центрируем относительно centerWorld: в STL координаты станут локальными вокруг (0,0,0) ---
-        const double cp0[3]{ p0[0] - centerWorldX, p0[1] - centerWorldY, p0[2] - centerWorldZ};
-        const double cp1[3]{ p1[0] - centerWorldX, p1[1] - centerWorldY, p1[2] - centerWorldZ};
-        const double cp2[3]{ p2[0] - centerWorldX, p2[1] - centerWorldY, p2[2] - centerWorldZ};
-        //const double cp0[3]{ p0[0] - centerWorldX - stlCenterShiftX, p0[1] - centerWorldY - stlCenterShiftY, p0[2] - centerWorldZ - stlCenterShiftZ };
-        //const double cp1[3]{ p1[0] - centerWorldX - stlCenterShiftX, p1[1] - centerWorldY - stlCenterShiftY, p1[2] - centerWorldZ - stlCenterShiftZ };
-        //const double cp2[3]{ p2[0] - centerWorldX - stlCenterShiftX, p2[1] - centerWorldY - stlCenterShiftY, p2[2] - centerWorldZ - stlCenterShiftZ };
-
-        if (!firstPrinted)
-        {
-            qDebug() << "First p0 centered:" << cp0[0] << cp0[1] << cp0[2];
-            firstPrinted = true;
-        }
-
-        // --- 7) Нормаль (в локальных координатах тоже ок) ---
-        if (recomputeNormals)
-        {
-            double u[3]{ cp1[0] - cp0[0], cp1[1] - cp0[1], cp1[2] - cp0[2] };
-            double v[3]{ cp2[0] - cp0[0], cp2[1] - cp0[1], cp2[2] - cp0[2] };
-            vtkMath::Cross(u, v, n);
-            if (vtkMath::Normalize(n) == 0.0)
-                n[0] = n[1] = n[2] = 0.0;
-        }
+        vtkCellArray* polys = triPd->GetPolys();
+        if (polys->IsStorage64Bit())
+            written = StreamStlRecordsAnyPoints(out, triPd->GetPoints(),
+                polys->GetConnectivityArray64()->GetPointer(0), triCount, centerWorld, recomputeNormals, sum);
         else
-        {
-            n[0] = n[1] = n[2] = 0.0;
-        }
-
-        float block[12] = {
-            f32(n[0]),   f32(n[1]),   f32(n[2]),
-            f32(cp0[0]), f32(cp0[1]), f32(cp0[2]),
-            f32(cp1[0]), f32(cp1[1]), f32(cp1[2]),
-            f32(cp2[0]), f32(cp2[1]), f32(cp2[2])
-        };
+            written = StreamStlRecordsAnyPoints(out, triPd->GetPoints(),
+                polys->GetConnectivityArray32()->GetPointer(0), triCount, centerWorld, recomputeNormals, sum);
+    }
+    else
+    {
+        written = StreamStlRecordsAnyPoints(out, triPd->GetPoints(),
+            legacyIds.data(), triCount, centerWorld, recomputeNormals, sum);
+    }
+    if (!written)
+        return false;
 
-        // STL binary -> little-endian
-        for (int i = 0; i < 12; ++i)
-        {
-            quint32 u32;
-            static_assert(sizeof(float) == sizeof(quint32));
-            std::memcpy(&u32, &block[i], sizeof(u32));
-            u32 = qToLittleEndian(u32);
-            std::memcpy(&block[i], &u32, sizeof(u32));
-        }
+    const double stlCenterShiftX = sum.x / double(triCount);
+    const double stlCenterShiftY = sum.y / double(triCount);
+    const double stlCenterShiftZ = sum.z / double(triCount);
 
-        if (!WriteAll(out, block, sizeof(block)))
-            return false;
+    if (outCenterShiftX) *outCenterShiftX = stlCenterShiftX;
+    if (outCenterShiftY) *outCenterShiftY = stlCenterShiftY;
+    if (outCenterShiftZ) *outCenterShiftZ = stlCenterShiftZ;
 
-        if (!WriteAll(out, &attrLE, sizeof(attrLE)))
-            return false;
-    }
+    qDebug() << "STL center shift:"
+        << stlCenterShiftX << stlCenterShiftY << stlCenterShiftZ;
 
     return out.commit();
 }
@@ -476,20 +609,19 @@ QString VolumeStlExporter::prettyBytes(quint64 bytes)
     return QString::number(b / (1024.0 * 1024.0 * 1024.0), 'f', 2) + " GB";
 }
 
-// Быстрый путь: если mesh после TriangleFilter — polys == triangles.
-// Если не уверен, можно сделать "медленный" подсчет, но он может быть дорогим.
+// Точный размер файла SaveStlMyBinary_NoCenter: считаем треугольники по offsets,
+// без vtkTriangleFilter (для чисто треугольного меша это просто GetNumberOfPolys()).
 quint64 VolumeStlExporter::estimateBinaryStlBytesFast(vtkPolyData* pd)
 {
     if (!pd) return 0;
-    const quint64 tri = quint64(pd->GetNumberOfPolys());
-    return 84ull + 50ull * tri;
+    return 84ull + 50ull * CountStlTriangles(pd);
 }
 
 QString VolumeStlExporter::makeStlSizeText(vtkPolyData* pd)
 {
     if (!pd) return QString();
-    const quint64 tri = quint64(pd->GetNumberOfPolys());
-    const quint64 bytes = 84ull + 50ull * tri;
+    const quint64 tri = CountStlTriangles(pd);
+    const quint64 bytes = estimateBinaryStlBytesFast(pd);
     const double volumeCm3 = estimateEnclosedVolumeCm3(pd);
 
     if (std::isfinite(volumeCm3) && volumeCm3 > 0.0)
@@ -555,43 +687,6 @@ static vtkSmartPointer<vtkImageData> CloseAndPadMask(vtkImageData* mask, int rad
     return pad->GetOutput();
 }
 
-static inline std::int64_t EstimateBinaryStlSizeBytesTriangulated(vtkPolyData* pd)
-{
-    if (!pd) return 0;
-
-    vtkNew<vtkTriangleFilter> tri;
-    tri->SetInputData(pd);
-    tri->PassLinesOff();
-    tri->PassVertsOff();
-    tri->Update();
-
-    auto* out = tri->GetOutput();
-    const std::int64_t tris = static_cast<std::int64_t>(out ? out->GetNumberOfPolys() : 0);
-    return 84 + 50 * tris;
-}
-
-
-static inline double Clamp01(double v) { return std::clamp(v, 0.0, 0.99); }
-
-// рассчитывает targetReduction так, чтобы попасть в targetBytes (примерно)
-static inline double ComputeReductionForTargetBytes(vtkPolyData* pd, std::int64_t targetBytes)
-{
-    if (!pd) return 0.0;
-    const std::int64_t curCells = static_cast<std::int64_t>(pd->GetNumberOfCells());
-    if (curCells <= 0) return 0.0;
-
-    const std::int64_t curBytes = EstimateBinaryStlSizeBytesTriangulated(pd);
-    if (curBytes <= targetBytes) return 0.0; // уже меньше цели
-
-    // сколько треугольников хотим получить
-    const std::int64_t targetTris = std::max<std::int64_t>(1, (targetBytes - 84) / 50);
-    const double keep = static_cast<double>(targetTris) / static_cast<double>(curCells);
-    const double reduction = 1.0 - keep;
-
-    // чуть ограничим, чтобы DecimatePro не сходил с ума за один шаг
-    return Clamp01(reduction);
-}
-
 vtkSmartPointer<vtkPolyData> VolumeStlExporter::NormalizeSurface(vtkPolyData* in)
 {
     if (!in || in->GetNumberOfCells() == 0) return nullptr;
@@ -632,7 +727,7 @@ vtkSmartPointer<vtkPolyData> VolumeStlExporter::NormalizeSurface(vtkPolyData* in
 }
 
 
-// “попасть в цель” за 1-3 шага (PreserveTopology иногда не дает ровно дойти)
+// Один проход: последовательность стягиваний считается один раз, уровень берётся точно по размеру
 vtkSmartPointer<vtkPolyData> VolumeStlExporter::SimplifyToTargetBytes(
     vtkPolyData* in,
     std::int64_t targetBytes,
@@ -642,30 +737,14 @@ vtkSmartPointer<vtkPolyData> VolumeStlExporter::SimplifyToTargetBytes(
     if (!in || in->GetNumberOfCells() == 0)
         return nullptr;
 
-    vtkSmartPointer<vtkPolyData> cur = in;
-
-    // максимум 3 попытки поджаться ближе к цели
-    for (int i = 0; i < 3; ++i)
-    {
-        const std::int64_t curBytes = EstimateBinaryStlSizeBytesTriangulated(cur);
-        if (curBytes <= targetBytes)
-            break;
-
-        double red = ComputeReductionForTargetBytes(cur, targetBytes);
-
-        // если расчет дал почти 0, но размер все еще больше цели, значит уперлись в preserve topology
-        if (red < 0.01)
-            red = 0.10; // легкий пинок
-
-        // чтобы не убить форму: не делаем супер-агрессивно за раз
-        red = std::clamp(red, 0.05, 0.85);
+    if (std::int64_t(estimateBinaryStlBytesFast(in)) <= targetBytes)
+        return in;
 
-        cur = SimplifySurface(cur, red, smoothIter, passBand);
-        if (!cur || cur->GetNumberOfCells() == 0)
-            return nullptr;
-    }
+    auto pm = BuildProgressiveMesh(in, smoothIter, passBand);
+    if (!pm)
+        return nullptr;
 
-    return cur;
+    return SimplifyToTargetBytes(*pm, targetBytes, smoothIter, passBand);
 }
 
 
@@ -839,8 +918,6 @@ static vtkSmartPointer<vtkPolyData> ExtractLargestFromMask(
 #include <vtkImageCast.h>
 #include <vtkExtractVOI.h>
 #include <vtkImageThreshold.h>
-#include <vtkImageEuclideanDistance.h>
-#include <vtkImageMathematics.h>
 #include <vtkImageGaussianSmooth.h>
 #include <limits>
 #include <vtkBox.h>
@@ -1004,15 +1081,121 @@ static inline void ExpandBBoxByPercent(int b[6], double percent /*0.10 = 10%*/)
 #include <vtkImageChangeInformation.h>
 
 
+bool VolumeStlExporter::BuildBinaryMask(vtkImageData* src, double lo, double hi, vtkImageData* out)
+{
+    if (!src || !out)
+        return false;
+
+    // нужна только геометрия: данные src всё равно заменяются u8-маской
+    out->CopyStructure(src);
+    out->AllocateScalars(VTK_UNSIGNED_CHAR, 1);
+
+    auto* inScAny = src->GetPointData() ? src->GetPointData()->GetScalars() : nullptr;
+    auto* outU8 = vtkUnsignedCharArray::SafeDownCast(
+        out->GetPointData() ? out->GetPointData()->GetScalars() : nullptr
+    );
+
+    if (!inScAny || !outU8)
+        return false;
+
+    int ext[6];
+    src->GetExtent(ext);
+
+    const int nx = ext[1] - ext[0] + 1;
+    const int ny = ext[3] - ext[2] + 1;
+    const int nz = ext[5] - ext[4] + 1;
+
+    // если объём слишком тонкий — проще занулить всё
+    if (nx < 4 || ny < 4 || nz < 4) {
+        outU8->FillValue(0);
+        out->Modified();
+        return true;
+    }
+
+    const vtkIdType nPts = src->GetNumberOfPoints();
+    auto* outPtr = outU8->WritePointer(0, nPts);
+
+    // 1) делаем бинарь 0/255
+    // (если src тоже u8, можно ускорить, но универсально оставим так)
+    // GetComponent без общего буфера кортежа — можно читать из нескольких потоков
+    vtkSMPTools::For(0, nPts, [&](vtkIdType first, vtkIdType last)
+        {
+            for (vtkIdType id = first; id < last; ++id)
+            {
+                const double v = inScAny->GetComponent(id, 0);
+                outPtr[id] = (v != 0.0 && v >= lo && v <= hi) ? 255u : 0u;
+            }
+        });
+
+    // 2) стираем первые 2 слоя по всем граням: 0,1 и n-2,n-1
+    constexpr int L = 2; // сколько слоёв стираем
+
+    const int i0 = ext[0], i1 = ext[1];
+    const int j0 = ext[2], j1 = ext[3];
+    const int k0 = ext[4], k1 = ext[5];
+
+    const int iL0 = i0;
+    const int iL1 = i0 + (L - 1);
+    const int iR0 = i1 - (L - 1);
+    const int iR1 = i1;
+
+    const int jL0 = j0;
+    const int jL1 = j0 + (L - 1);
+    const int jR0 = j1 - (L - 1);
+    const int jR1 = j1;
+
+    const int kL0 = k0;
+    const int kL1 = k0 + (L - 1);
+    const int kR0 = k1 - (L - 1);
+    const int kR1 = k1;
+
+    // helper: set voxel (i,j,k) = 0
+    auto zeroAt = [&](int i, int j, int k)
+        {
+            int ijk[3] = { i, j, k };
+            const vtkIdType id = src->ComputePointId(ijk);
+            outPtr[id] = 0u;
+        };
+
+    // X-грани (левая и правая)
+    for (int k = k0; k <= k1; ++k)
+        for (int j = j0; j <= j1; ++j)
+        {
+            for (int i = iL0; i <= iL1; ++i) zeroAt(i, j, k);
+            for (int i = iR0; i <= iR1; ++i) zeroAt(i, j, k);
+        }
+
+    // Y-грани (перед/зад)
+    for (int k = k0; k <= k1; ++k)
+        for (int i = i0; i <= i1; ++i)
+        {
+            for (int j = jL0; j <= jL1; ++j) zeroAt(i, j, k);
+            for (int j = jR0; j <= jR1; ++j) zeroAt(i, j, k);
+        }
+
+    // Z-грани (низ/верх)
+    for (int j = j0; j <= j1; ++j)
+        for (int i = i0; i <= i1; ++i)
+        {
+            for (int k = kL0; k <= kL1; ++k) zeroAt(i, j, k);
+            for (int k = kR0; k <= kR1; ++k) zeroAt(i, j, k);
+        }
+
+    outU8->Modified();
+    out->Modified();
+    return true;
+}
+
 vtkSmartPointer<vtkPolyData> VolumeStlExporter::BuildFromBinaryVoxelsNew(
     vtkImageData* binImage, const VisibleExportOptions& opt)
 {
     if (!binImage) return nullptr;
+    TRACE_SCOPE("stl", "BuildFromBinaryVoxelsNew");
     if (opt.progress) opt.progress(5, tr("Init binary export"));
 
     qDebug() << "[STL] BuildFromBinaryVoxelsNew: start";
 
-    enum class Mode { FullSdf, ShrinkSdf, FastIso };
+    enum class Mode { FullSdf, NarrowBandSdf, ShrinkSdf, FastIso };
 
     auto extentToDims = [](const int e[6], int& nx, int& ny, int& nz)
         {
@@ -1169,7 +1352,8 @@ vtkSmartPointer<vtkPolyData> VolumeStlExporter::BuildFromBinaryVoxelsNew(
     qDebug() << "[STL] dims" << nx << ny << nz << "vox" << vox;
     qDebug() << "[STL] spacing" << spPad[0] << spPad[1] << spPad[2];
 
-    const double estGB = estimatePeakSdfGB(vox, 5.5);
+    // SDF float + результат сглаживания + u8-маски
+    const double estGB = estimatePeakSdfGB(vox, 2.5);
     qDebug() << "[STL] estimated peak SDF GB" << estGB;
 
     constexpr quint64 VOX_FORCE_SHRINK = 20ull * 1000ull * 1000ull; // 20M
@@ -1179,6 +1363,11 @@ vtkSmartPointer<vtkPolyData> VolumeStlExporter::BuildFromBinaryVoxelsNew(
     if (vox >= VOX_FORCE_SHRINK) mode = Mode::ShrinkSdf;
     else if (estGB > SDF_GB_LIMIT) mode = Mode::ShrinkSdf;
 
+    // Узкая полоса считает SDF только в кирпичах у границы, память не зависит
+    // от объёма целиком — прореживание (и потеря тонких стенок) не нужно.
+    if (mode == Mode::ShrinkSdf && opt.narrowBand)
+        mode = Mode::NarrowBandSdf;
+
     // На длинных стеках (много срезов по Z) shrink-SDF может давать
     // заметный ровный «срез» у верхней/нижней границы из-за редкой выборки.
     // Для таких наборов данных безопаснее сразу идти в FastIso по полной
@@ -1192,6 +1381,7 @@ vtkSmartPointer<vtkPolyData> VolumeStlExporter::BuildFromBinaryVoxelsNew(
 
     const char* modeStr =
         (mode == Mode::FullSdf) ? "FullSdf" :
+        (mode == Mode::NarrowBandSdf) ? "NarrowBandSdf" :
         (mode == Mode::ShrinkSdf) ? "ShrinkSdf" : "FastIso";
     qDebug() << "[STL] mode" << modeStr;
 
@@ -1208,7 +1398,10 @@ vtkSmartPointer<vtkPolyData> VolumeStlExporter::BuildFromBinaryVoxelsNew(
         fe->ComputeNormalsOff();
         fe->ComputeGradientsOff();
         fe->ComputeScalarsOff();
-        fe->Update();
+        {
+            TRACE_SCOPE("stl", "FlyingEdges (FastIso)");
+            fe->Update();
+        }
         if (opt.progress) opt.progress(70, tr("Extracting surface"));
 
         vtkNew<vtkTriangleFilter> tri;
@@ -1220,7 +1413,10 @@ vtkSmartPointer<vtkPolyData> VolumeStlExporter::BuildFromBinaryVoxelsNew(
         vtkNew<vtkCleanPolyData> clean;
         clean->PointMergingOn();
         clean->SetInputConnection(tri->GetOutputPort());
-        clean->Update();
+        {
+            TRACE_SCOPE("stl", "triangulate + clean");
+            clean->Update();
+        }
         if (opt.progress) opt.progress(85, tr("Cleaning"));
 
         vtkNew<vtkFeatureEdges> feEdges;
@@ -1253,7 +1449,11 @@ vtkSmartPointer<vtkPolyData> VolumeStlExporter::BuildFromBinaryVoxelsNew(
             qDebug() << "[STL] skip FillHoles in FastIso due to open boundary";
         }
 
-        auto keptRegions = KeepSignificantRegions(holesInput, 0.03, 500);
+        vtkSmartPointer<vtkPolyData> keptRegions;
+        {
+            TRACE_SCOPE("stl", "KeepSignificantRegions");
+            keptRegions = KeepSignificantRegions(holesInput, 0.03, 500);
+        }
         if (!keptRegions || keptRegions->GetNumberOfCells() == 0)
             keptRegions = holesInput;
 
@@ -1283,8 +1483,6 @@ vtkSmartPointer<vtkPolyData> VolumeStlExporter::BuildFromBinaryVoxelsNew(
     // SDF PATH
     // =========================================================
 
-    vtkAlgorithmOutput* sdfMaskU8 = padded0->GetOutputPort();
-
     vtkNew<vtkExtractVOI> shrinkVoi;
     int shrinkFactor = 1;
     bool usedShrink = false;
@@ -1302,7 +1500,6 @@ vtkSmartPointer<vtkPolyData> VolumeStlExporter::BuildFromBinaryVoxelsNew(
         shrinkVoi->SetSampleRate(shrinkFactor, shrinkFactor, shrinkFactor);
         shrinkVoi->Update();
 
-        sdfMaskU8 = shrinkVoi->GetOutputPort();
         usedShrink = true;
 
         int eS[6];
@@ -1315,51 +1512,102 @@ vtkSmartPointer<vtkPolyData> VolumeStlExporter::BuildFromBinaryVoxelsNew(
         qDebug() << "[STL] shrink spacing" << sps[0] << sps[1] << sps[2];
     }
 
-    // --- EDT считаем по u8 0/1 ---
-    vtkNew<vtkImageCast> binU8;
-    binU8->SetInputConnection(sdfMaskU8);
-    binU8->SetOutputScalarTypeToUnsignedChar();
-    binU8->Update();
-
-    vtkNew<vtkImageMathematics> invU8;
-    invU8->SetOperationToMultiplyByK();
-    invU8->SetInputConnection(0, binU8->GetOutputPort());
-    invU8->SetConstantK(-1.0);
-    invU8->Update();
-
-    vtkNew<vtkImageMathematics> invU8b;
-    invU8b->SetOperationToAddConstant();
-    invU8b->SetInputConnection(0, invU8->GetOutputPort());
-    invU8b->SetConstantC(1.0);
-    invU8b->Update();
-
-    vtkNew<vtkImageEuclideanDistance> distOut;
-    distOut->SetInputConnection(binU8->GetOutputPort());
-    distOut->SetConsiderAnisotropy(true);
-    distOut->Update();
-    if (opt.progress) opt.progress(40, tr("Distance (outside)"));
-    qDebug() << "[STL] EDT outside done";
-
-    vtkNew<vtkImageEuclideanDistance> distIn;
-    distIn->SetInputConnection(invU8b->GetOutputPort());
-    distIn->SetConsiderAnisotropy(true);
-    distIn->Update();
-    if (opt.progress) opt.progress(55, tr("Distance (inside)"));
-    qDebug() << "[STL] EDT inside done";
-
-    // SDF = distOut - distIn
-    vtkNew<vtkImageMathematics> sdf;
-    sdf->SetOperationToSubtract();
-    sdf->SetInputConnection(0, distOut->GetOutputPort());
-    sdf->SetInputConnection(1, distIn->GetOutputPort());
-    sdf->Update();
-
-    double rSdf[2];
-    sdf->GetOutput()->GetScalarRange(rSdf);
-    qDebug() << "[STL] SDF range" << rSdf[0] << rSdf[1];
-
-    const bool badSdfRange = (!std::isfinite(rSdf[0]) || !std::isfinite(rSdf[1]) || rSdf[0] <= -1.0e9);
-    if (badSdfRange)
+    // Сглаживание SDF: sigma в мм, в воксели переводится по spacing
+    const double sigmaXY = 0.9;     // было 0.8
+    const double sigmaZ = 1.4;     // усилить вдоль срезов
+
+    vtkNew<vtkImageGaussianSmooth> gs;
+    vtkNew<vtkFlyingEdges3D> fe;
+    vtkNew<vtkTriangleFilter> tri;
+    tri->PassLinesOff();
+    tri->PassVertsOff();
+
+    bool sdfOk = false;
+    if (mode == Mode::NarrowBandSdf)
+    {
+        NarrowBandSurface::Params nb;
+        nb.sigmaMm[0] = sigmaXY;
+        nb.sigmaMm[1] = sigmaXY;
+        nb.sigmaMm[2] = sigmaZ;
+        nb.radiusFactor = 3.0;
+        TRACE_SCOPE("stl", "narrow band surface");
+
+        auto bandSurface = NarrowBandSurface::Build(padded0->GetOutput(), nb,
+            [&opt](int done, int total)
+            {
+                if (opt.progress && total > 0)
+                    opt.progress(35 + 45 * done / total, tr("Extracting surface"));
+            });
+
+        sdfOk = bandSurface && bandSurface->GetNumberOfPolys() > 0;
+        if (sdfOk)
+        {
+            tri->SetInputData(bandSurface);
+            tri->Update();
+            qDebug() << "[STL] narrow band surface done";
+        }
+    }
+    else
+    {
+        // --- Знаковое расстояние одним ядром прямо по u8 0/1 ---
+        // Раньше: cast -> инверсия (2x ImageMathematics) -> 2x EuclideanDistance -> subtract,
+        // каждый шаг материализовал полный float-том. Теперь один раздельный EDT по линиям,
+        // внутри и снаружи за один проход: > 0 внутри, < 0 снаружи, в мм с учётом spacing.
+        vtkImageData* sdfMask = usedShrink ? shrinkVoi->GetOutput() : padded0->GetOutput();
+
+        double rSdf[2]{ 0.0, 0.0 };
+        vtkSmartPointer<vtkImageData> sdf;
+        {
+            TRACE_SCOPE("stl", "signed distance");
+            sdf = SignedDistanceField::Compute(sdfMask, rSdf);
+        }
+        if (opt.progress) opt.progress(55, tr("Signed distance"));
+        qDebug() << "[STL] fused SDF done";
+        qDebug() << "[STL] SDF range" << rSdf[0] << rSdf[1];
+
+        sdfOk = (sdf && std::isfinite(rSdf[0]) && std::isfinite(rSdf[1]) && rSdf[0] > -1.0e9);
+        if (sdfOk)
+        {
+            // Gaussian smooth SDF
+            gs->SetInputData(sdf);
+            gs->SetDimensionality(3);
+
+            double spS[3];
+            if (usedShrink) shrinkVoi->GetOutput()->GetSpacing(spS);
+            else           padded0->GetOutput()->GetSpacing(spS);
+
+            gs->SetStandardDeviations(
+                sigmaXY / std::max(1e-9, spS[0]),
+                sigmaXY / std::max(1e-9, spS[1]),
+                sigmaZ / std::max(1e-9, spS[2])
+            );
+            gs->SetRadiusFactors(3.0, 3.0, 3.0);
+            {
+                TRACE_SCOPE("stl", "smooth SDF");
+                gs->Update();
+            }
+
+            if (opt.progress) opt.progress(72, tr("Smooth SDF"));
+
+            // iso-surface at 0
+            fe->SetInputConnection(gs->GetOutputPort());
+            fe->SetValue(0, 0.0);
+            fe->ComputeNormalsOff();
+            fe->ComputeGradientsOff();
+            fe->ComputeScalarsOff();
+            {
+                TRACE_SCOPE("stl", "FlyingEdges iso=0");
+                fe->Update();
+            }
+            if (opt.progress) opt.progress(80, tr("Extracting surface"));
+            qDebug() << "[STL] FlyingEdges iso=0 done";
+
+            tri->SetInputConnection(fe->GetOutputPort());
+            tri->Update();
+        }
+    }
+
+    if (!sdfOk)
     {
         qDebug() << "[STL] suspicious SDF range, fallback to FastIso";
 
@@ -1398,74 +1646,9 @@ vtkSmartPointer<vtkPolyData> VolumeStlExporter::BuildFromBinaryVoxelsNew(
             qDebug() << "[STL] BuildFromBinaryVoxelsNew: done (FastIso fallback)";
             return out;
         }
-        qDebug() << "[STL] FastIso fallback failed, continue SDF path";
-    }
-
-    // Если знак вдруг перевёрнут
-    if (!(rSdf[0] <= 0.0 && rSdf[1] >= 0.0))
-    {
-        qDebug() << "[STL] SDF sign inverted, fixing";
-        vtkNew<vtkImageMathematics> neg;
-        neg->SetOperationToMultiplyByK();
-        neg->SetInputConnection(0, sdf->GetOutputPort());
-        neg->SetConstantK(-1.0);
-        neg->Update();
-
-        neg->GetOutput()->GetScalarRange(rSdf);
-        qDebug() << "[STL] SDF range after fix" << rSdf[0] << rSdf[1];
-
-        if (!(rSdf[0] <= 0.0 && rSdf[1] >= 0.0))
-        {
-            qDebug() << "[STL] SDF still wrong, abort";
-            return nullptr;
-        }
-
-        sdf->SetOperationToMultiplyByK();
-        sdf->SetInputConnection(0, neg->GetOutputPort());
-        sdf->SetConstantK(1.0);
-        sdf->Update();
+        qDebug() << "[STL] FastIso fallback failed";
+        return nullptr;
     }
-    if (opt.progress) opt.progress(62, tr("Signed distance"));
-
-    // Gaussian smooth SDF
-    vtkNew<vtkImageGaussianSmooth> gs;
-    gs->SetInputConnection(sdf->GetOutputPort());
-    gs->SetDimensionality(3);
-
-    double spS[3];
-    if (usedShrink) shrinkVoi->GetOutput()->GetSpacing(spS);
-    else           padded0->GetOutput()->GetSpacing(spS);
-
-    double sigmaXY = 0.9;     // было 0.8
-    double sigmaZ = 1.4;     // усилить вдоль срезов
-
-    gs->SetStandardDeviations(
-        sigmaXY / std::max(1e-9, spS[0]),
-        sigmaXY / std::max(1e-9, spS[1]),
-        sigmaZ / std::max(1e-9, spS[2])
-    );
-    gs->SetRadiusFactors(3.0, 3.0, 3.0);
-    gs->Update();
-
-    if (opt.progress) opt.progress(72, tr("Smooth SDF"));
-
-
-    // iso-surface at 0
-    vtkNew<vtkFlyingEdges3D> fe;
-    fe->SetInputConnection(gs->GetOutputPort());
-    fe->SetValue(0, 0.0);
-    fe->ComputeNormalsOff();
-    fe->ComputeGradientsOff();
-    fe->ComputeScalarsOff();
-    fe->Update();
-    if (opt.progress) opt.progress(80, tr("Extracting surface"));
-    qDebug() << "[STL] FlyingEdges iso=0 done";
-
-    vtkNew<vtkTriangleFilter> tri;
-    tri->SetInputConnection(fe->GetOutputPort());
-    tri->PassLinesOff();
-    tri->PassVertsOff();
-    tri->Update();
 
     // bounds/spacing берём с актуального объёма
     double b[6];
@@ -1540,7 +1723,10 @@ vtkSmartPointer<vtkPolyData> VolumeStlExporter::BuildFromBinaryVoxelsNew(
     vtkNew<vtkCleanPolyData> clean;
     clean->PointMergingOn();
     clean->SetInputConnection(geomPort);
-    clean->Update();
+    {
+        TRACE_SCOPE("stl", "clean");
+        clean->Update();
+    }
     if (opt.progress) opt.progress(88, tr("Cleaning"));
 
     vtkNew<vtkFeatureEdges> feEdges;
@@ -1571,7 +1757,11 @@ vtkSmartPointer<vtkPolyData> VolumeStlExporter::BuildFromBinaryVoxelsNew(
         qDebug() << "[STL] skip FillHoles in SDF due to open boundary";
     }
 
-    auto keptRegions = KeepSignificantRegions(holesInput, 0.03, 500);
+    vtkSmartPointer<vtkPolyData> keptRegions;
+    {
+        TRACE_SCOPE("stl", "KeepSignificantRegions");
+        keptRegions = KeepSignificantRegions(holesInput, 0.03, 500);
+    }
     if (!keptRegions || keptRegions->GetNumberOfCells() == 0)
         keptRegions = holesInput;
 
@@ -1620,23 +1810,287 @@ vtkSmartPointer<vtkPolyData> VolumeStlExporter::BuildFromBinaryVoxelsNew(
     return finalPd;
 }
 
-#include <vtkSmartPointer.h>
-#include <vtkSmoothPolyDataFilter.h>
+namespace
+{
+    // Постобработка сшитого кирпичного меша без VTK-фильтров (на миллионах треугольников
+    // connectivity/clean/normals занимают секунды): значимые компоненты по тем же правилам,
+    // что KeepSignificantRegions(0.03, 500), ориентация по знаку объёма, нормали точек.
+    // nullptr — формат не тот (причина в логе), вызывающий откатывается на полную пересборку.
+    vtkSmartPointer<vtkPolyData> FinalizeStitchedSurface(vtkPolyData* pd)
+    {
+        if (!pd || !pd->GetPoints() || pd->GetNumberOfPolys() == 0)
+        {
+            qDebug() << "[STL] stitched surface is empty";
+            return nullptr;
+        }
 
-vtkSmartPointer<vtkPolyData> VolumeStlExporter::SimplifySurface(
-    vtkPolyData* in,
-    double targetReduction,
-    int smoothIter,
-    double passBand)
+        auto* coords = vtkArrayDownCast<vtkFloatArray>(pd->GetPoints()->GetData());
+        vtkCellArray* polys = pd->GetPolys();
+        if (!coords)
+        {
+            qDebug() << "[STL] stitched points are not float, type" << pd->GetPoints()->GetDataType();
+            return nullptr;
+        }
+        if (!polys->IsStorage64Bit())
+        {
+            qDebug() << "[STL] stitched cell array is not 64-bit storage";
+            return nullptr;
+        }
+        if (polys->GetNumberOfConnectivityIds() != 3 * polys->GetNumberOfCells())
+        {
+            qDebug() << "[STL] stitched surface has non-triangle cells";
+            return nullptr;
+        }
+
+        const float* P = coords->GetPointer(0);
+        const vtkIdType* T = polys->GetConnectivityArray64()->GetPointer(0);
+        const vtkIdType nv = pd->GetNumberOfPoints();
+        const vtkIdType nt = polys->GetNumberOfCells();
+
+        // --- компоненты: union-find по вершинам ---
+        std::vector<vtkIdType> parent(static_cast<size_t>(nv));
+        for (vtkIdType v = 0; v < nv; ++v) parent[size_t(v)] = v;
+        auto find = [&](vtkIdType v)
+            {
+                while (parent[size_t(v)] != v)
+                {
+                    parent[size_t(v)] = parent[size_t(parent[size_t(v)])];
+                    v = parent[size_t(v)];
+                }
+                return v;
+            };
+        for (vtkIdType t = 0; t < nt; ++t)
+        {
+            const vtkIdType a = find(T[3 * t]);
+            for (int k = 1; k < 3; ++k)
+            {
+                const vtkIdType b = find(T[3 * t + k]);
+                if (a != b) parent[size_t(b)] = a;
+            }
+        }
+
+        std::vector<vtkIdType> regionTris(static_cast<size_t>(nv), 0);
+        for (vtkIdType t = 0; t < nt; ++t)
+            ++regionTris[size_t(find(T[3 * t]))];
+
+        vtkIdType largest = 0;
+        for (vtkIdType v = 0; v < nv; ++v)
+            largest = std::max(largest, regionTris[size_t(v)]);
+        const double minByFrac = double(largest) * 0.03;
+        constexpr vtkIdType kMinCells = 500;
+
+        auto keepRegion = [&](vtkIdType root)
+            {
+                const vtkIdType sz = regionTris[size_t(root)];
+                return (double(sz) >= minByFrac && sz >= kMinCells) || sz == largest;
+            };
+
+        // --- отбор треугольников, знак объёма ---
+        std::vector<vtkIdType> kept;
+        kept.reserve(size_t(nt));
+        double vol6 = 0.0;
+        for (vtkIdType t = 0; t < nt; ++t)
+        {
+            if (!keepRegion(find(T[3 * t])))
+                continue;
+            kept.push_back(t);
+            const float* a = P + 3 * T[3 * t];
+            const float* b = P + 3 * T[3 * t + 1];
+            const float* c = P + 3 * T[3 * t + 2];
+            vol6 += double(a[0]) * (double(b[1]) * c[2] - double(b[2]) * c[1])
+                - double(a[1]) * (double(b[0]) * c[2] - double(b[2]) * c[0])
+                + double(a[2]) * (double(b[0]) * c[1] - double(b[1]) * c[0]);
+        }
+        const bool reverse = std::isfinite(vol6) && vol6 < 0.0;
+        if (reverse)
+            qDebug() << "[STL] volume negative, reversing sense";
+
+        // --- компактный выход + нормали точек (взвешены площадью) ---
+        std::vector<vtkIdType> remap(static_cast<size_t>(nv), -1);
+        vtkIdType outPts = 0;
+        for (vtkIdType t : kept)
+            for (int k = 0; k < 3; ++k)
+            {
+                auto& r = remap[size_t(T[3 * t + k])];
+                if (r < 0) r = outPts++;
+            }
+
+        vtkNew<vtkFloatArray> outCoords;
+        outCoords->SetNumberOfComponents(3);
+        outCoords->SetNumberOfTuples(outPts);
+        float* OP = outCoords->GetPointer(0);
+        for (vtkIdType v = 0; v < nv; ++v)
+            if (remap[size_t(v)] >= 0)
+                std::memcpy(OP + 3 * remap[size_t(v)], P + 3 * v, 3 * sizeof(float));
+
+        const vtkIdType nk = vtkIdType(kept.size());
+        vtkNew<vtkIdTypeArray> offsets, conn;
+        offsets->SetNumberOfTuples(nk + 1);
+        conn->SetNumberOfTuples(3 * nk);
+        vtkIdType* off = offsets->GetPointer(0);
+        vtkIdType* con = conn->GetPointer(0);
+
+        std::vector<double> nacc(size_t(outPts) * 3, 0.0);
+        for (vtkIdType i = 0; i < nk; ++i)
+        {
+            const vtkIdType t = kept[size_t(i)];
+            vtkIdType ids[3] = { remap[size_t(T[3 * t])], remap[size_t(T[3 * t + 1])], remap[size_t(T[3 * t + 2])] };
+            if (reverse) std::swap(ids[1], ids[2]);
+
+            off[i] = 3 * i;
+            con[3 * i + 0] = ids[0];
+            con[3 * i + 1] = ids[1];
+            con[3 * i + 2] = ids[2];
+
+            const float* a = OP + 3 * ids[0];
+            const float* b = OP + 3 * ids[1];
+            const float* c = OP + 3 * ids[2];
+            double u[3]{ double(b[0]) - a[0], double(b[1]) - a[1], double(b[2]) - a[2] };
+            double w[3]{ double(c[0]) - a[0], double(c[1]) - a[1], double(c[2]) - a[2] };
+            double n[3];
+            vtkMath::Cross(u, w, n);
+            for (int k = 0; k < 3; ++k)
+            {
+                double* dst = nacc.data() + 3 * size_t(ids[k]);
+                dst[0] += n[0]; dst[1] += n[1]; dst[2] += n[2];
+            }
+        }
+        off[nk] = 3 * nk;
+
+        vtkNew<vtkFloatArray> normals;
+        normals->SetName("Normals");
+        normals->SetNumberOfComponents(3);
+        normals->SetNumberOfTuples(outPts);
+        float* NP = normals->GetPointer(0);
+        vtkSMPTools::For(0, outPts, [&](vtkIdType first, vtkIdType last)
+            {
+                for (vtkIdType v = first; v < last; ++v)
+                {
+                    double n[3]{ nacc[3 * size_t(v)], nacc[3 * size_t(v) + 1], nacc[3 * size_t(v) + 2] };
+                    vtkMath::Normalize(n);
+                    NP[3 * v + 0] = float(n[0]);
+                    NP[3 * v + 1] = float(n[1]);
+                    NP[3 * v + 2] = float(n[2]);
+                }
+            });
+
+        vtkNew<vtkPoints> points;
+        points->SetData(outCoords);
+        vtkNew<vtkCellArray> outPolys;
+        outPolys->SetData(offsets, conn);
+
+        auto out = vtkSmartPointer<vtkPolyData>::New();
+        out->SetPoints(points);
+        out->SetPolys(outPolys);
+        out->GetPointData()->SetNormals(normals);
+        return out;
+    }
+}
+
+vtkSmartPointer<vtkPolyData> VolumeStlExporter::RebuildFromBinaryVoxelsIncremental(
+    vtkImageData* binImage, SurfaceBrickCache& cache, const VisibleExportOptions& opt)
 {
-    if (!in || in->GetNumberOfCells() == 0)
-        return nullptr;
+    if (!binImage) return nullptr;
+    if (opt.progress) opt.progress(5, tr("Init binary export"));
 
-    targetReduction = std::clamp(targetReduction, 0.0, 0.99);
-    smoothIter = std::max(0, smoothIter);
-    passBand = std::clamp(passBand, 0.01, 0.5);
+    // Кэш живёт в системе индексов всего объёма (без ROI-обрезки и паддинга):
+    // иначе любая правка сдвигала бы сетку кирпичей. Края маски уже обнулены.
+    vtkSmartPointer<vtkImageData> u8 = binImage;
+    if (binImage->GetScalarType() != VTK_UNSIGNED_CHAR || binImage->GetNumberOfScalarComponents() != 1)
+    {
+        vtkNew<vtkImageCast> castU8;
+        castU8->SetInputData(binImage);
+        castU8->SetOutputScalarTypeToUnsignedChar();
+        castU8->Update();
+        u8 = castU8->GetOutput();
+    }
+
+    NarrowBandSurface::Params nb;
+    nb.sigmaMm[0] = 0.9;
+    nb.sigmaMm[1] = 0.9;
+    nb.sigmaMm[2] = 1.4;
+    nb.radiusFactor = 3.0;
+
+    auto stitched = NarrowBandSurface::BuildIncremental(u8, nb, cache,
+        [&opt](int done, int total)
+        {
+            if (opt.progress && total > 0)
+                opt.progress(10 + 75 * done / total, tr("Extracting surface"));
+        });
+
+    auto out = FinalizeStitchedSurface(stitched);
+    if (!out || out->GetNumberOfCells() == 0)
+    {
+        qDebug() << "[STL] incremental rebuild failed, full rebuild";
+        cache.clear();
+        return BuildFromBinaryVoxelsNew(binImage, opt);
+    }
+    if (opt.progress) opt.progress(90, tr("Components"));
+
+    // Дальше — как в BuildFromBinaryVoxelsNew: мелкие технологические дырки только на
+    // замкнутой поверхности и согласованная ориентация нормалей.
+    {
+        vtkNew<vtkFeatureEdges> feEdges;
+        feEdges->SetInputData(out);
+        feEdges->BoundaryEdgesOn();
+        feEdges->FeatureEdgesOff();
+        feEdges->ManifoldEdgesOff();
+        feEdges->NonManifoldEdgesOff();
+        feEdges->Update();
+
+        const vtkIdType boundaryEdges = feEdges->GetOutput()->GetNumberOfCells();
+        qDebug() << "[STL] incremental boundary edges" << boundaryEdges;
+
+        vtkSmartPointer<vtkPolyData> holesInput = out;
+        if (boundaryEdges == 0)
+        {
+            double sp[3]{ 1, 1, 1 };
+            binImage->GetSpacing(sp);
+            const double tinyHoleMm = 3.0 * std::max({ sp[0], sp[1], sp[2] });
+
+            vtkNew<vtkFillHolesFilter> fill;
+            fill->SetInputData(out);
+            fill->SetHoleSize(tinyHoleMm * tinyHoleMm);
+            fill->Update();
+            holesInput = fill->GetOutput();
+        }
+        else
+        {
+            qDebug() << "[STL] skip FillHoles in incremental rebuild due to open boundary";
+        }
+
+        vtkNew<vtkPolyDataNormals> nrm;
+        nrm->SetInputData(holesInput);
+        nrm->ComputePointNormalsOn();
+        nrm->ComputeCellNormalsOff();
+        nrm->SplittingOff();
+        nrm->ConsistencyOn();
+        nrm->AutoOrientNormalsOn();
+        {
+            TRACE_SCOPE("stl", "normals");
+            nrm->Update();
+        }
+
+        if (nrm->GetOutput()->GetNumberOfCells() > 0)
+        {
+            out = vtkSmartPointer<vtkPolyData>::New();
+            out->DeepCopy(nrm->GetOutput());
+        }
+    }
+
+    qDebug() << "[STL] output points" << out->GetNumberOfPoints();
+    qDebug() << "[STL] output polys" << out->GetNumberOfPolys();
+
+    if (opt.progress) opt.progress(100, tr("Done"));
+    return out;
+}
 
-    // 1) Треугольники + clean + largest
+#include <vtkSmartPointer.h>
+#include <vtkSmoothPolyDataFilter.h>
+
+// 1-2) Треугольники + clean + largest + лёгкое сглаживание ДО децимации
+static vtkSmartPointer<vtkPolyData> PrepareForSimplify(vtkPolyData* in, int smoothIter, double passBand)
+{
     vtkNew<vtkTriangleFilter> tri;
     tri->SetInputData(in);
     tri->PassLinesOff();
@@ -1653,18 +2107,15 @@ vtkSmartPointer<vtkPolyData> VolumeStlExporter::SimplifySurface(
     conn0->SetExtractionModeToLargestRegion();
     conn0->Update();
 
-    vtkAlgorithmOutput* cur = conn0->GetOutputPort();
-
-    // 2) Легкое сглаживание ДО децимации (убрать “шахматку/рябь”)
+    // Легкое сглаживание ДО децимации (убрать “шахматку/рябь”)
     // Важно: без normalize coordinates.
-    vtkAlgorithmOutput* pre = cur;
     vtkNew<vtkWindowedSincPolyDataFilter> preSmooth;
     {
         // preSmooth всегда небольшой, иначе начнет “мылить”
         const int preIter = (smoothIter > 0) ? std::min(12, std::max(6, smoothIter / 2)) : 8;
         const double preBand = std::clamp(passBand * 1.3, 0.08, 0.25);
 
-        preSmooth->SetInputConnection(cur);
+        preSmooth->SetInputConnection(conn0->GetOutputPort());
         preSmooth->SetNumberOfIterations(preIter);
         preSmooth->SetPassBand(preBand);
 
@@ -1675,53 +2126,25 @@ vtkSmartPointer<vtkPolyData> VolumeStlExporter::SimplifySurface(
         preSmooth->GenerateErrorScalarsOff();
         preSmooth->GenerateErrorVectorsOff();
         preSmooth->Update();
-
-        pre = preSmooth->GetOutputPort();
-    }
-
-    // 3) Децимация: QuadricDecimation обычно держит форму лучше, чем DecimatePro,
-    // особенно когда нужно сильно ужимать (как у тебя 9MB -> 3MB).
-    vtkAlgorithmOutput* decOut = pre;
-
-    vtkNew<vtkQuadricDecimation> qdec;
-    vtkNew<vtkCleanPolyData> postDecClean;
-    vtkNew<vtkTriangleFilter> postDecTri;
-
-    if (targetReduction > 0.0)
-    {
-        qdec->SetInputConnection(pre);
-        qdec->SetTargetReduction(targetReduction);
-
-        qdec->AttributeErrorMetricOff();
-        qdec->ScalarsAttributeOff();
-        qdec->VectorsAttributeOff();
-        qdec->NormalsAttributeOff();
-        qdec->TCoordsAttributeOff();
-        qdec->TensorsAttributeOff();
-        qdec->Update();
-
-        postDecClean->SetInputConnection(qdec->GetOutputPort());
-        postDecClean->PointMergingOn();
-        postDecClean->Update();
-
-        postDecTri->SetInputConnection(postDecClean->GetOutputPort());
-        postDecTri->PassLinesOff();
-        postDecTri->PassVertsOff();
-        postDecTri->Update();
-
-        decOut = postDecTri->GetOutputPort();
     }
 
+    vtkSmartPointer<vtkPolyData> out = vtkSmartPointer<vtkPolyData>::New();
+    out->DeepCopy(preSmooth->GetOutput());
+    return out;
+}
 
+// 4-7) После децимации: сглаживание, largest, нормали, финальный clean
+static vtkSmartPointer<vtkPolyData> FinishSimplified(vtkPolyData* decimated, int smoothIter, double passBand)
+{
     vtkNew<vtkSmoothPolyDataFilter> lap;
-    lap->SetInputConnection(decOut);
+    lap->SetInputData(decimated);
     lap->SetNumberOfIterations(std::min(60, std::max(10, smoothIter * 3)));
     lap->SetRelaxationFactor(0.01);        // маленький, чтобы не “усаживало”
     lap->FeatureEdgeSmoothingOff();
     lap->BoundarySmoothingOn();            // ключ для среза
     lap->Update();
 
-    // 4) Post-smooth: уже мягко, чтобы скрыть триангуляцию после децимации
+    // Post-smooth: уже мягко, чтобы скрыть триангуляцию после децимации
     vtkAlgorithmOutput* post = lap->GetOutputPort();
     vtkNew<vtkWindowedSincPolyDataFilter> postSmooth;
     if (smoothIter > 0)
@@ -1745,13 +2168,13 @@ vtkSmartPointer<vtkPolyData> VolumeStlExporter::SimplifySurface(
         post = postSmooth->GetOutputPort();
     }
 
-    // 5) Largest component еще раз (после decimation бывает мусор)
+    // Largest component еще раз (после decimation бывает мусор)
     vtkNew<vtkPolyDataConnectivityFilter> conn1;
     conn1->SetInputConnection(post);
     conn1->SetExtractionModeToLargestRegion();
     conn1->Update();
 
-    // 6) Нормали
+    // Нормали
     vtkNew<vtkPolyDataNormals> nrm;
     nrm->SetInputConnection(conn1->GetOutputPort());
     nrm->ComputePointNormalsOn();
@@ -1761,7 +2184,7 @@ vtkSmartPointer<vtkPolyData> VolumeStlExporter::SimplifySurface(
     nrm->AutoOrientNormalsOn();
     nrm->Update();
 
-    // 7) Финальный clean
+    // Финальный clean
     vtkNew<vtkCleanPolyData> clean1;
     clean1->SetInputConnection(nrm->GetOutputPort());
     clean1->PointMergingOn();
@@ -1771,3 +2194,112 @@ vtkSmartPointer<vtkPolyData> VolumeStlExporter::SimplifySurface(
     out->DeepCopy(clean1->GetOutput());
     return out;
 }
+
+vtkSmartPointer<vtkPolyData> VolumeStlExporter::SmoothSurface(vtkPolyData* in, int iterations, double passBand)
+{
+    if (!in || in->GetNumberOfCells() == 0 || iterations <= 0)
+        return in;
+
+    vtkNew<vtkWindowedSincPolyDataFilter> smooth;
+    smooth->SetInputData(in);
+    smooth->SetNumberOfIterations(iterations);
+    smooth->BoundarySmoothingOff();
+    smooth->FeatureEdgeSmoothingOff();
+    smooth->SetFeatureAngle(120.0);
+    smooth->SetPassBand(std::max(0.0, passBand));
+    smooth->NonManifoldSmoothingOn();
+    smooth->NormalizeCoordinatesOn();
+    smooth->Update();
+
+    vtkSmartPointer<vtkPolyData> out = vtkSmartPointer<vtkPolyData>::New();
+    out->ShallowCopy(smooth->GetOutput());
+    return out;
+}
+
+vtkSmartPointer<vtkPolyData> VolumeStlExporter::SimplifySurface(
+    vtkPolyData* in,
+    double targetReduction,
+    int smoothIter,
+    double passBand)
+{
+    if (!in || in->GetNumberOfCells() == 0)
+        return nullptr;
+
+    targetReduction = std::clamp(targetReduction, 0.0, 0.99);
+    smoothIter = std::max(0, smoothIter);
+    passBand = std::clamp(passBand, 0.01, 0.5);
+
+    auto pre = PrepareForSimplify(in, smoothIter, passBand);
+    if (!pre || pre->GetNumberOfCells() == 0)
+        return nullptr;
+
+    // 3) Децимация: QuadricDecimation обычно держит форму лучше, чем DecimatePro,
+    // особенно когда нужно сильно ужимать (как у тебя 9MB -> 3MB).
+    vtkPolyData* decOut = pre;
+
+    vtkNew<vtkQuadricDecimation> qdec;
+    vtkNew<vtkCleanPolyData> postDecClean;
+    vtkNew<vtkTriangleFilter> postDecTri;
+
+    if (targetReduction > 0.0)
+    {
+        qdec->SetInputData(pre);
+        qdec->SetTargetReduction(targetReduction);
+
+        qdec->AttributeErrorMetricOff();
+        qdec->ScalarsAttributeOff();
+        qdec->VectorsAttributeOff();
+        qdec->NormalsAttributeOff();
+        qdec->TCoordsAttributeOff();
+        qdec->TensorsAttributeOff();
+        qdec->Update();
+
+        postDecClean->SetInputConnection(qdec->GetOutputPort());
+        postDecClean->PointMergingOn();
+        postDecClean->Update();
+
+        postDecTri->SetInputConnection(postDecClean->GetOutputPort());
+        postDecTri->PassLinesOff();
+        postDecTri->PassVertsOff();
+        postDecTri->Update();
+
+        decOut = postDecTri->GetOutput();
+    }
+
+    return FinishSimplified(decOut, smoothIter, passBand);
+}
+
+std::shared_ptr<ProgressiveMesh> VolumeStlExporter::BuildProgressiveMesh(
+    vtkPolyData* in,
+    int smoothIter,
+    double passBand)
+{
+    if (!in || in->GetNumberOfCells() == 0)
+        return nullptr;
+
+    smoothIter = std::max(0, smoothIter);
+    passBand = std::clamp(passBand, 0.01, 0.5);
+
+    auto pre = PrepareForSimplify(in, smoothIter, passBand);
+    if (!pre || pre->GetNumberOfPolys() == 0)
+        return nullptr;
+
+    return ProgressiveMesh::Build(pre);
+}
+
+vtkSmartPointer<vtkPolyData> VolumeStlExporter::SimplifyToTargetBytes(
+    const ProgressiveMesh& pm,
+    std::int64_t targetBytes,
+    int smoothIter,
+    double passBand)
+{
+    // сглаживание и clean число треугольников не увеличивают — размер не выше цели
+    const vtkIdType targetTris = vtkIdType(std::max<std::int64_t>(1, (targetBytes - 84) / 50));
+    auto level = pm.Extract(targetTris);
+    if (!level || level->GetNumberOfCells() == 0)
+        return nullptr;
+
+    smoothIter = std::max(0, smoothIter);
+    passBand = std::clamp(passBand, 0.01, 0.5);
+    return FinishSimplified(level, smoothIter, passBand);
+}
@@ -2,10 +2,14 @@
 #include <QString>
 #include <vtkSmartPointer.h>
 #include <functional>
+#include <memory>
+#include <cstdint>
 
 class vtkImageData;
 class vtkVolume;
 class vtkPolyData;
+class ProgressiveMesh;
+class SurfaceBrickCache;
 
 struct VisibleExportOptions
 {
@@ -27,6 +31,9 @@ struct VisibleExportOptions
 
     bool   binaryStl = true;
 
+    // большие объёмы: узкополосный SDF по кирпичам на полном разрешении вместо shrink
+    bool   narrowBand = true;
+
     std::function<void(int, const QString&)> progress;
 };
 
@@ -34,11 +41,23 @@ class VolumeStlExporter
 {
 
 public:
+    // Маска 0/255 по диапазону значений (ноль не входит), по 2 слоя у граней обнулены —
+    // поверхность получается замкнутой. out принимает геометрию src.
+    static bool BuildBinaryMask(vtkImageData* src, double lo, double hi, vtkImageData* out);
+
     static vtkSmartPointer<vtkPolyData> BuildFromBinaryVoxelsNew(
         vtkImageData* binImage, const VisibleExportOptions& opt);
 
+    // Пересборка после правки вокселей: узкополосный SDF по кирпичам всего объёма,
+    // кирпичи без изменений (с ореолом) берутся из cache. Первый вызов строит всё.
+    static vtkSmartPointer<vtkPolyData> RebuildFromBinaryVoxelsIncremental(
+        vtkImageData* binImage, SurfaceBrickCache& cache, const VisibleExportOptions& opt);
+
     static vtkSmartPointer<vtkPolyData> SimplifySurface(
         vtkPolyData* in, double targetReduction = 0.25, int smoothIter = 10, double passBand = 0.15);
+
+    // Windowed-sinc без децимации (те же настройки, что у сглаживания экспорта); iterations <= 0 — вход как есть.
+    static vtkSmartPointer<vtkPolyData> SmoothSurface(vtkPolyData* in, int iterations, double passBand);
     
     static bool SaveStlMyBinary_NoCenter(vtkPolyData* pd, const QString& filePath, double VolumeOriginX, double VolumeOriginY, double VolumeOriginZ,
         double VolumeCenterX, double VolumeCenterY, double VolumeCenterZ, bool recomputeNormals /*= true*/,
@@ -46,6 +65,10 @@ public:
 
     static vtkSmartPointer<vtkPolyData> SimplifyToTargetBytes(vtkPolyData* in, std::int64_t targetBytes, int smoothIter, double passBand);
 
+    // Стягивания считаются один раз; любой размер потом — SimplifyToTargetBytes(pm, ...) без повторной децимации.
+    static std::shared_ptr<ProgressiveMesh> BuildProgressiveMesh(vtkPolyData* in, int smoothIter, double passBand);
+    static vtkSmartPointer<vtkPolyData> SimplifyToTargetBytes(const ProgressiveMesh& pm, std::int64_t targetBytes, int smoothIter, double passBand);
+
     static vtkSmartPointer<vtkPolyData> NormalizeSurface(vtkPolyData* in);
 
     static QString prettyBytes(quint64 bytes);